@@ -98,6 +98,18 @@ int cmd_status(void) {
 // ===================
 int cmd_monitor_stats(const char *device) {
     device_stats_t stats;
+    performance_sample_t sample;
+    
+    // Con el daemon en marcha la última muestra está en shm: sin socket ni /proc
+    if (ipc_samples_attach() == 0) {
+        int n = ipc_samples_read(device, &sample, 1);
+        ipc_samples_detach();
+        if (n == 1) {
+            printf("Device: %s (live sample from daemon)\n", device);
+            monitor_print_performance(&sample);
+            return 0;
+        }
+    }
     
     if (monitor_init() != 0) {
         return -1;
@@ -115,6 +127,45 @@ int cmd_monitor_stats(const char *device) {
     return 0;
 }
 
+int cmd_monitor_files(const char *mount_point) {
+    open_file_t *files = NULL;
+    int count = 0;
+    
+    if (monitor_list_open_files(mount_point, &files, &count) != 0) {
+        fprintf(stderr, "Failed to scan open files on %s\n", mount_point);
+        return -1;
+    }
+    
+    printf("%-8s %-16s %-5s %-4s %s\n", "PID", "COMMAND", "FD", "MODE", "PATH");
+    for (int i = 0; i < count; i++) {
+        printf("%-8d %-16s %-5d %-4s %s\n", files[i].pid, files[i].process_name,
+               files[i].fd, files[i].mode, files[i].path);
+    }
+    printf("%d open files on %s\n", count, mount_point);
+    
+    free(files);
+    return 0;
+}
+
+int cmd_monitor_report(const char *output_file, int hours) {
+    time_t end = time(NULL);
+    
+    if (monitor_init() != 0) {
+        return -1;
+    }
+    
+    int devices = monitor_generate_report(output_file, end - (time_t)hours * 3600, end);
+    monitor_cleanup();
+    
+    if (devices < 0) {
+        fprintf(stderr, "Failed to generate report %s\n", output_file);
+        return -1;
+    }
+    printf("Report for the last %d hours written to %s (%d devices)\n", hours,
+           output_file, devices);
+    return 0;
+}
+
 int cmd_monitor_start(int interval) {
     printf("Starting continuous monitoring (interval: %d seconds)\n", interval);
     // Placeholder: si quisieras delegarlo al daemon, usarías send_command con CMD_MONITOR_START
@@ -130,8 +181,10 @@ int cmd_monitor_stop(void) {
 // ===================
 // Comandos de backup
 // ===================
-int cmd_backup_create(const char *source, const char *dest, const char *type_str) {
+int cmd_backup_create(const char *source, const char *dest, const char *type_str,
+                      const char *format_str) {
     backup_type_t type = BACKUP_FULL;
+    backup_config_t config;
     
     if (strcmp(type_str, "incremental") == 0) {
         type = BACKUP_INCREMENTAL;
@@ -139,7 +192,12 @@ int cmd_backup_create(const char *source, const char *dest, const char *type_str
         type = BACKUP_DIFFERENTIAL;
     }
     
-    if (backup_init(NULL) != 0) {
+    backup_config_defaults(&config);
+    if (format_str && strcmp(format_str, "chunked") == 0) {
+        config.format = BACKUP_FORMAT_CHUNKED;
+    }
+    
+    if (backup_init_with_config(&config) != 0) {
         return -1;
     }
     
@@ -177,7 +235,14 @@ int cmd_backup_list(void) {
             printf("  Type:      %s\n", type_str);
             printf("  Date:      %s", ctime(&backups[i].timestamp));
             printf("  Source:    %s\n", backups[i].source_path);
-            printf("  Size:      %.2f MB\n", backups[i].size_bytes / (1024.0 * 1024.0));
+            printf("  Format:    %s\n",
+                   backups[i].format == BACKUP_FORMAT_CHUNKED ? "Chunked" : "Tree");
+            printf("  Size:      %.2f MB (%.2f MB stored)\n",
+                   backups[i].logical_bytes / (1024.0 * 1024.0),
+                   backups[i].stored_bytes / (1024.0 * 1024.0));
+            if (backups[i].checksum[0]) {
+                printf("  Checksum:  %s\n", backups[i].checksum);
+            }
             printf("  Success:   %s\n", backups[i].success ? "Yes" : "No");
             if (!backups[i].success && strlen(backups[i].error_msg) > 0) {
                 printf("  Error:     %s\n", backups[i].error_msg);
@@ -203,8 +268,19 @@ int cmd_backup_restore(const char *backup_id, const char *dest) {
     return result;
 }
 
-int cmd_backup_verify(const char *backup_id) {
-    if (backup_init(NULL) != 0) {
+int cmd_backup_verify(const char *backup_id, int argc, char *argv[]) {
+    backup_config_t config;
+    
+    backup_config_defaults(&config);
+    for (int i = 0; i < argc; i++) {
+        if (strncmp(argv[i], "--sample=", 9) == 0) {
+            config.verify_sample_percent = atoi(argv[i] + 9);
+        } else if (strncmp(argv[i], "--rate=", 7) == 0) {
+            config.verify_rate_limit_mb = atoi(argv[i] + 7);
+        }
+    }
+    
+    if (backup_init_with_config(&config) != 0) {
         return -1;
     }
     
@@ -377,14 +453,18 @@ void show_help(const char *prog_name) {
     
     printf("Monitor Commands:\n");
     printf("  monitor stats <device>       - Show device statistics\n");
+    printf("  monitor files <mount_point>  - List open files on a filesystem\n");
+    printf("  monitor report <file> [hours] - Report (.csv, .json or text), default 24 h\n");
     printf("  monitor start [interval]     - Start continuous monitoring\n");
     printf("  monitor stop                 - Stop continuous monitoring\n\n");
     
     printf("Backup Commands:\n");
-    printf("  backup create <src> <dest> <type>  - Create backup (full/incremental/differential)\n");
+    printf("  backup create <src> <dest> <type> [tree|chunked]\n");
+    printf("                                      - Create backup (full/incremental/differential)\n");
     printf("  backup list                         - List all backups\n");
     printf("  backup restore <id> <dest>          - Restore backup\n");
-    printf("  backup verify <id>                  - Verify backup integrity\n\n");
+    printf("  backup verify <id> [--sample=PCT] [--rate=MB/s]\n");
+    printf("                                      - Re-read and hash backup contents\n\n");
     
     printf("Performance Commands:\n");
     printf("  perf benchmark <device> <file>     - Run performance benchmark\n");
@@ -435,7 +515,7 @@ int main(int argc, char *argv[]) {
     // Monitor
     if (strcmp(command, "monitor") == 0) {
         if (argc < 3) {
-            fprintf(stderr, "Usage: %s monitor <stats|start|stop> [args]\n", argv[0]);
+            fprintf(stderr, "Usage: %s monitor <stats|files|report|start|stop> [args]\n", argv[0]);
             return 1;
         }
         
@@ -447,6 +527,19 @@ int main(int argc, char *argv[]) {
                 return 1;
             }
             return cmd_monitor_stats(argv[3]);
+        } else if (strcmp(subcmd, "files") == 0) {
+            if (argc < 4) {
+                fprintf(stderr, "Usage: %s monitor files <mount_point>\n", argv[0]);
+                return 1;
+            }
+            return cmd_monitor_files(argv[3]) == 0 ? 0 : 1;
+        } else if (strcmp(subcmd, "report") == 0) {
+            if (argc < 4) {
+                fprintf(stderr, "Usage: %s monitor report <file> [hours]\n", argv[0]);
+                return 1;
+            }
+            int hours = argc >= 5 ? atoi(argv[4]) : 24;
+            return cmd_monitor_report(argv[3], hours > 0 ? hours : 24) == 0 ? 0 : 1;
         } else if (strcmp(subcmd, "start") == 0) {
             int interval = argc >= 4 ? atoi(argv[3]) : 5;
             return cmd_monitor_start(interval);
@@ -466,11 +559,12 @@ int main(int argc, char *argv[]) {
         
         if (strcmp(subcmd, "create") == 0) {
             if (argc < 6) {
-                fprintf(stderr, "Usage: %s backup create <source> <dest> <type>\n", argv[0]);
+                fprintf(stderr, "Usage: %s backup create <source> <dest> <type> [format]\n", argv[0]);
                 fprintf(stderr, "Types: full, incremental, differential\n");
+                fprintf(stderr, "Formats: tree (default), chunked\n");
                 return 1;
             }
-            return cmd_backup_create(argv[3], argv[4], argv[5]);
+            return cmd_backup_create(argv[3], argv[4], argv[5], argc > 6 ? argv[6] : NULL);
         } else if (strcmp(subcmd, "list") == 0) {
             return cmd_backup_list();
         } else if (strcmp(subcmd, "restore") == 0) {
@@ -481,10 +575,10 @@ int main(int argc, char *argv[]) {
             return cmd_backup_restore(argv[3], argv[4]);
         } else if (strcmp(subcmd, "verify") == 0) {
             if (argc < 4) {
-                fprintf(stderr, "Usage: %s backup verify <backup_id>\n", argv[0]);
+                fprintf(stderr, "Usage: %s backup verify <backup_id> [--sample=PCT] [--rate=MB/s]\n", argv[0]);
                 return 1;
             }
-            return cmd_backup_verify(argv[3]);
+            return cmd_backup_verify(argv[3], argc - 4, argv + 4);
         }
     }
     
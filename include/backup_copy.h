@@ -0,0 +1,87 @@
+#ifndef BACKUP_COPY_H
+#define BACKUP_COPY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+/*
+ * Recorrido paralelo de árboles y copiador en proceso (sustituye a rsync
+ * en backups y restores).
+ *
+ * Cada worker del recorrido tiene una cola doble de tareas: los
+ * directorios que lee generan una tarea por entrada en su propia cola
+ * (LIFO, mantiene la localidad) y los workers sin trabajo roban por el
+ * otro extremo de la cola de otro (FIFO, se llevan los subárboles más
+ * grandes). El copiador es una visita sobre ese recorrido: los datos se
+ * mueven con copy_file_range(); si el sistema de ficheros no lo admite se
+ * usa sendfile() y como último recurso read/write con un buffer grande por
+ * worker. Se conservan modo, propietario, tiempos, enlaces simbólicos y
+ * enlaces duros. Los metadatos de los directorios se aplican al final,
+ * cuando ya no se van a crear más entradas dentro.
+ */
+
+#define BACKUP_COPY_MAX_THREADS 64
+#define BACKUP_COPY_BUFFER_SIZE (1024 * 1024)
+
+typedef struct {
+    int threads;               // workers (0 = automático según CPUs)
+    const char *link_dest;     // solo backup_manifest_copy: árbol del que se enlazan las entradas sin cambios
+} backup_copy_opts_t;
+
+typedef struct {
+    uint64_t files;            // ficheros regulares en el árbol
+    uint64_t dirs;
+    uint64_t symlinks;
+    uint64_t specials;         // fifos y dispositivos
+    uint64_t hardlinks;        // entradas recreadas como enlace duro de otra del árbol
+    uint64_t linked;           // ficheros enlazados desde link_dest sin copiar datos (manifiesto)
+    uint64_t bytes_total;      // tamaño lógico de los ficheros regulares
+    uint64_t bytes_copied;     // bytes escritos realmente
+    uint64_t errors;
+    double elapsed_s;
+    int threads;
+    char first_error[256];
+} backup_copy_stats_t;
+
+typedef struct backup_walk backup_walk_t;
+
+// Visita de una entrada desde el worker indicado (rel = "" es la raíz).
+// Las entradas de un directorio se encolan después de su visita; si
+// devuelve <0 no se desciende.
+typedef int (*backup_walk_fn)(backup_walk_t *walk, int worker, const char *rel,
+                              const struct stat *st, void *arg);
+
+typedef struct {
+    uint64_t entries;
+    uint64_t errors;
+    double elapsed_s;
+    int threads;
+    char first_error[256];
+} backup_walk_stats_t;
+
+// Número de workers para una petición (0 = 2 por CPU, tope BACKUP_COPY_MAX_THREADS).
+// Las visitas reciben worker en [0, backup_walk_threads(threads)).
+int backup_walk_threads(int requested);
+int backup_walk_tree(const char *root, int threads, backup_walk_fn fn, void *arg,
+                     backup_walk_stats_t *stats);
+// Cuenta el error en stats->errors y guarda el primero
+void backup_walk_error(backup_walk_t *walk, const char *path, const char *op, int err);
+// NULL si es la primera entrada vista con ese (dev, ino); si no, copia de su ruta
+char* backup_walk_claim_link(backup_walk_t *walk, const struct stat *st, const char *rel);
+
+// Propietario (sin privilegios se ignora EPERM), modo y tiempos, por fd o
+// por ruta si fd < 0. En error devuelve -1 con errno y la operación.
+int backup_apply_metadata(int fd, const char *path, const struct stat *st,
+                          const char **failed_op);
+// base/rel, o base si rel es ""; -1 si no cabe
+int backup_join_path(char *out, size_t size, const char *base, const char *rel);
+
+// Copia src en dst (que se crea si no existe), siempre completa: qué
+// cambió lo decide el manifiesto (backup_manifest_copy). Devuelve 0 si no hubo
+// errores, -1 si alguna entrada falló (ver stats->first_error) o
+// -EINVAL/-ENOMEM si no se pudo empezar.
+int backup_copy_tree(const char *src, const char *dst,
+                     const backup_copy_opts_t *opts, backup_copy_stats_t *stats);
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <time.h>
 #include <stdint.h>
+#include "backup_verify.h"
 
 // Tipos de backup
 typedef enum {
@@ -11,6 +12,12 @@ typedef enum {
     BACKUP_DIFFERENTIAL
 } backup_type_t;
 
+// Formato de almacenamiento
+typedef enum {
+    BACKUP_FORMAT_TREE,         // copia del árbol en <dest>/<backup_id>
+    BACKUP_FORMAT_CHUNKED       // repositorio deduplicado en <dest>/repository (backup_repo.h)
+} backup_format_t;
+
 // Información de backup
 typedef struct {
     char backup_id[64];
@@ -23,6 +30,9 @@ typedef struct {
     int success;
     char error_msg[256];
     char parent_backup_id[64];  // Para incrementales
+    backup_format_t format;
+    unsigned long long logical_bytes;   // tamaño de los ficheros respaldados
+    unsigned long long stored_bytes;    // bytes nuevos que ocupó en disco
 } backup_info_t;
 
 // Configuración de schedule
@@ -35,8 +45,19 @@ typedef struct {
     int keep_count;
 } backup_schedule_t;
 
+// Configuración del motor
+typedef struct {
+    char db_path[256];
+    int copy_threads;           // workers del copiador (0 = automático, ver backup_copy.h)
+    backup_format_t format;     // formato de los backups nuevos
+    int verify_sample_percent;  // % de ficheros releídos por verificación (100 = todos)
+    int verify_rate_limit_mb;   // MB/s máximos al verificar (0 = sin límite)
+} backup_config_t;
+
 // Inicialización
+void backup_config_defaults(backup_config_t *config);
 int backup_init(const char *db_path);
+int backup_init_with_config(const backup_config_t *config);
 void backup_cleanup(void);
 
 // Operaciones de backup
@@ -55,6 +76,9 @@ int backup_unmount_snapshot(const char *mount_point);
 
 // Verificación y restauración
 int backup_verify(const char *backup_id);
+// Como backup_verify, con las rutas que no coinciden (liberar con
+// backup_verify_report_free)
+int backup_verify_with_report(const char *backup_id, backup_verify_report_t *report);
 int backup_restore(const char *backup_id, const char *dest);
 int backup_restore_file(const char *backup_id, const char *file_path, 
                         const char *dest);
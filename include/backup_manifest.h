@@ -0,0 +1,124 @@
+#ifndef BACKUP_MANIFEST_H
+#define BACKUP_MANIFEST_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include "backup_copy.h"
+
+/*
+ * Manifiesto binario de un backup: una entrada por fichero, directorio,
+ * enlace o especial, ordenadas por ruta (un directorio va siempre antes
+ * que su contenido).
+ *
+ * Formato: cabecera fija, un registro de 88 bytes por entrada seguido de
+ * la ruta, el destino (symlink o enlace duro), el SHA-256 del contenido
+ * (desde la versión 2) y los hashes de sus chunks, y al final el SHA-256
+ * de todo lo anterior. Los enteros están en el orden de bytes de la
+ * máquina que lo escribió. La versión 3 añade el inodo y el ctime de cada
+ * entrada y el instante del recorrido (las anteriores usaban cabecera de
+ * 32 bytes y registros de 64).
+ *
+ * El checksum de un backup es la raíz Merkle de sus entradas: cada hoja
+ * resume ruta, tipo, tamaño y contenido (o destino) de una entrada, en
+ * orden de ruta, y los nodos se combinan como en RFC 6962.
+ *
+ * Detección de cambios: un incremental recorre el origen solo con lstat,
+ * ordena y cruza la lista con el manifiesto anterior en una pasada
+ * (merge-join por ruta). Un fichero con el mismo inodo, tamaño, mtime y
+ * ctime conserva el hash y los chunks anteriores sin abrirse; solo se
+ * leen los que cambiaron.
+ */
+
+#define BACKUP_MANIFEST_MAGIC   "SMGRMANI"
+#define BACKUP_MANIFEST_VERSION 3
+#define BACKUP_HASH_SIZE        32      // SHA-256
+#define BACKUP_HASH_BUFFER      (4 * 1024 * 1024)   // lecturas al calcular hashes
+
+// Opciones de backup_manifest_scan
+#define BACKUP_SCAN_HASH        0x1     // leer cada fichero y calcular su hash
+
+typedef uint8_t backup_hash_t[BACKUP_HASH_SIZE];
+
+typedef struct {
+    char *path;                 // relativa a la raíz ("" = la raíz)
+    char *target;               // destino del symlink, o entrada a la que enlaza (enlace duro)
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+    uint64_t size;
+    uint64_t rdev;
+    int64_t atime_sec;
+    int64_t mtime_sec;
+    uint32_t atime_nsec;
+    uint32_t mtime_nsec;
+    uint64_t ino;               // del origen (0 en manifiestos anteriores a la versión 3)
+    int64_t ctime_sec;
+    uint32_t ctime_nsec;
+    uint32_t nchunks;
+    int has_hash;               // hash calculado (ficheros regulares que no son enlaces)
+    int unchanged;              // en memoria: igual que en el manifiesto anterior
+    backup_hash_t hash;         // SHA-256 del contenido
+    backup_hash_t *chunks;
+} backup_manifest_entry_t;
+
+typedef struct {
+    backup_manifest_entry_t *entries;
+    size_t count;
+    size_t cap;
+    uint64_t logical_bytes;     // suma de size de los ficheros regulares
+    int64_t created_sec;        // inicio del recorrido (reloj del sistema de ficheros)
+    uint32_t created_nsec;
+} backup_manifest_t;
+
+// Rellena los metadatos de una entrada desde un stat (sin ruta ni chunks)
+void backup_manifest_entry_init(backup_manifest_entry_t *entry, const struct stat *st);
+// struct stat equivalente para restaurar metadatos
+void backup_manifest_entry_stat(const backup_manifest_entry_t *entry, struct stat *st);
+// Un enlace duro es un fichero regular con target
+int backup_manifest_is_hardlink(const backup_manifest_entry_t *entry);
+
+void backup_manifest_init(backup_manifest_t *manifest);
+// Añade la entrada; el manifiesto pasa a ser dueño de path, target y chunks
+int backup_manifest_append(backup_manifest_t *manifest, backup_manifest_entry_t *entry);
+// Mueve todas las entradas de src al final de dst
+int backup_manifest_merge(backup_manifest_t *dst, backup_manifest_t *src);
+// Ordena por ruta y hace primaria de cada grupo de enlaces duros la ruta
+// menor (0 o -ENOMEM)
+int backup_manifest_sort(backup_manifest_t *manifest);
+// Quita las entradas con drop[i] != 0 y recalcula logical_bytes
+void backup_manifest_drop(backup_manifest_t *manifest, const uint8_t *drop);
+// Cruza un manifiesto ordenado con el anterior (también ordenado): marca
+// unchanged los ficheros sin cambios y les pasa el hash y los chunks de
+// prev. Devuelve cuántos ficheros hay que leer.
+size_t backup_manifest_join(backup_manifest_t *manifest, backup_manifest_t *prev);
+void backup_manifest_free(backup_manifest_t *manifest);
+
+// Raíz Merkle de un manifiesto ordenado
+void backup_manifest_root(const backup_manifest_t *manifest, backup_hash_t root);
+// Recorre root con threads workers y construye su manifiesto ordenado.
+// Con BACKUP_SCAN_HASH calcula el SHA-256 de cada fichero regular; sin él
+// solo hace lstat (y readlink) y no abre ningún fichero.
+int backup_manifest_scan(const char *root, int threads, int flags,
+                         backup_manifest_t *manifest, backup_walk_stats_t *stats);
+// Copia src en dst siguiendo su manifiesto (backup_manifest_scan sin hash
+// y backup_manifest_join): los ficheros sin cambios se enlazan desde
+// opts->link_dest y el resto se copia calculando el hash, que queda en el
+// manifiesto. Las entradas que fallan se quitan del manifiesto. Devuelve
+// 0, -1 si alguna entrada falló o -EINVAL/-ENOMEM.
+int backup_manifest_copy(const char *src, const char *dst, backup_manifest_t *manifest,
+                         const backup_copy_opts_t *opts, backup_copy_stats_t *stats);
+
+// SHA-256 de lo que queda por leer de fd, en lecturas de buf_size bytes
+int backup_hash_fd(int fd, uint8_t *buf, size_t buf_size, backup_hash_t out);
+// Hash en hexadecimal (out de al menos 2 * BACKUP_HASH_SIZE + 1 bytes)
+void backup_hash_hex(const backup_hash_t hash, char *out);
+
+// Escritura atómica (fichero temporal, fsync y rename)
+int backup_manifest_write(const char *path, const backup_manifest_t *manifest);
+// Devuelve 0, -ENOENT, -EBADMSG si está truncado o el checksum no coincide,
+// o -ENOMEM. Lee también manifiestos de las versiones 1 (sin hashes de
+// fichero) y 2 (sin inodo ni ctime)
+int backup_manifest_load(const char *path, backup_manifest_t *manifest);
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef BACKUP_REPO_H
+#define BACKUP_REPO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "backup_manifest.h"
+#include "backup_verify.h"
+
+/*
+ * Repositorio de backups deduplicado por contenido.
+ *
+ *   <dest>/repository/index.db                índice de chunks: SHA-256 → pack, offset, longitud
+ *   <dest>/repository/packs/NNNNNNNN.pack      chunks concatenados, solo se añaden al final
+ *   <dest>/repository/manifests/<id>.manifest  un manifiesto por backup (backup_manifest.h)
+ *
+ * Los ficheros se cortan con FastCDC: gear hash rodante con máscara
+ * normalizada (más exigente antes del tamaño medio y más permisiva
+ * después), de modo que los cortes dependen del contenido y una inserción
+ * solo cambia los chunks de alrededor. Un chunk cuyo hash ya está en el
+ * índice no se escribe de nuevo, así que un full de datos casi sin cambios
+ * solo añade los chunks nuevos. Cada worker escribe en su propio pack; el
+ * índice se actualiza en una única transacción por backup, confirmada
+ * después de sincronizar los packs y el manifiesto. Con el manifiesto del
+ * backup anterior, los ficheros cuyos metadatos no cambiaron reutilizan
+ * sus chunks sin abrirse (backup_manifest_join).
+ */
+
+#define BACKUP_REPO_NAME      "repository"
+#define BACKUP_CDC_MIN_SIZE   (16 * 1024)
+#define BACKUP_CDC_AVG_SIZE   (64 * 1024)
+#define BACKUP_CDC_MAX_SIZE   (256 * 1024)
+#define BACKUP_PACK_MAX_SIZE  (512ULL * 1024 * 1024)
+
+typedef struct {
+    uint64_t files;
+    uint64_t dirs;
+    uint64_t symlinks;
+    uint64_t specials;
+    uint64_t hardlinks;
+    uint64_t unchanged;         // ficheros tomados del manifiesto anterior sin leerlos
+    uint64_t chunks;            // referencias a chunks en el manifiesto
+    uint64_t new_chunks;        // chunks escritos por esta operación
+    uint64_t logical_bytes;     // tamaño de los ficheros
+    uint64_t stored_bytes;      // bytes nuevos escritos en packs
+    uint64_t errors;
+    double elapsed_s;
+    int threads;
+    backup_hash_t root;         // raíz Merkle del manifiesto escrito
+    char first_error[256];
+} backup_repo_stats_t;
+
+// Longitud del siguiente chunk de data (len <= BACKUP_CDC_MAX_SIZE salvo
+// que se trate del final del fichero)
+size_t backup_cdc_cut(const uint8_t *data, size_t len);
+
+// Trocea src en el repositorio y escribe su manifiesto en manifest_path.
+// prev_manifest (NULL = ninguno) es un manifiesto anterior del mismo
+// repositorio: solo se leen los ficheros que cambiaron desde él.
+int backup_repo_store(const char *repo_dir, const char *src, const char *manifest_path,
+                      const char *prev_manifest, int threads, backup_repo_stats_t *stats);
+// Reconstruye en dst el árbol de un manifiesto (comprueba el hash de cada chunk)
+int backup_repo_restore(const char *repo_dir, const char *manifest_path, const char *dst,
+                        int threads, backup_repo_stats_t *stats);
+// Relee los chunks de cada fichero del manifiesto y comprueba sus hashes y
+// el del fichero completo (backup_verify.h)
+int backup_repo_verify(const char *repo_dir, const char *manifest_path,
+                       const backup_verify_opts_t *opts, backup_verify_report_t *report);
+// Chunks del manifiesto que no están en el índice (0 = completo, <0 en error)
+long backup_repo_missing(const char *repo_dir, const char *manifest_path);
+// Quita del índice los chunks que ningún manifiesto referencia y borra
+// los packs que se quedan sin chunks vivos (no compacta packs parciales)
+int backup_repo_gc(const char *repo_dir, uint64_t *freed_bytes);
+
+#endif
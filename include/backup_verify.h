@@ -0,0 +1,66 @@
+#ifndef BACKUP_VERIFY_H
+#define BACKUP_VERIFY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "backup_manifest.h"
+
+/*
+ * Verificación de backups contra su manifiesto.
+ *
+ * Un pool de lectores reparte las entradas del manifiesto (índice atómico),
+ * relee cada fichero, recalcula su SHA-256 y lo compara con el registrado.
+ * Cada discrepancia se informa con su ruta exacta dentro del backup. Con muestreo solo se
+ * leen los ficheros cuyo cubo (hash de la ruta mod 100) cae en la ventana
+ * [offset, offset + percent): avanzando offset entre ejecuciones se cubre
+ * todo el backup en 100 / percent pasadas. El límite de velocidad es un
+ * reloj virtual compartido: tras cada lectura el lector espera al final
+ * del hueco que le corresponde.
+ */
+
+#define BACKUP_VERIFY_MAX_REPORTED 64
+
+typedef struct {
+    int threads;                // lectores (0 = automático, ver backup_copy.h)
+    int sample_percent;         // 1-100 (100 = todo)
+    int sample_offset;          // inicio de la ventana de muestreo (0-99)
+    int rate_limit_mb;          // MB/s entre todos los lectores (0 = sin límite)
+} backup_verify_opts_t;
+
+typedef struct {
+    uint64_t entries;           // entradas del manifiesto
+    uint64_t checked;           // entradas comprobadas
+    uint64_t sampled_out;       // ficheros fuera de la muestra
+    uint64_t bytes_read;
+    uint64_t mismatches;
+    double elapsed_s;
+    int threads;
+    char *bad_paths[BACKUP_VERIFY_MAX_REPORTED];   // primeras rutas con discrepancias (relativas)
+    size_t reported;
+} backup_verify_report_t;
+
+typedef struct backup_verify backup_verify_t;
+
+// Comprobación de una entrada seleccionada. buf es del worker y tiene
+// BACKUP_HASH_BUFFER bytes. Las discrepancias se anotan con backup_verify_fail.
+typedef void (*backup_verify_fn)(backup_verify_t *verify, int worker, uint8_t *buf,
+                                 const backup_manifest_entry_t *entry, void *arg);
+
+void backup_verify_opts_defaults(backup_verify_opts_t *opts);
+// Cubo de muestreo de una ruta (0-99)
+int backup_verify_bucket(const char *path);
+
+// Reparte las entradas del manifiesto entre los lectores
+int backup_verify_manifest(const backup_manifest_t *manifest, const backup_verify_opts_t *opts,
+                           backup_verify_fn fn, void *arg, backup_verify_report_t *report);
+// Cuenta bytes leídos y espera lo que exija el límite de velocidad
+void backup_verify_throttle(backup_verify_t *verify, size_t bytes);
+// Anota una discrepancia (se imprime y se guarda la ruta en el informe)
+void backup_verify_fail(backup_verify_t *verify, const char *path, const char *reason);
+
+// Verifica un backup en árbol: root contra su manifiesto
+int backup_verify_tree(const char *manifest_path, const char *root,
+                       const backup_verify_opts_t *opts, backup_verify_report_t *report);
+void backup_verify_report_free(backup_verify_report_t *report);
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <sys/types.h>
+#include "monitor.h"
 
 #define IPC_SOCKET_PATH "/var/run/storage_mgr.sock"
 #define IPC_PROTOCOL_VERSION 1
@@ -37,6 +38,8 @@ typedef enum {
     CMD_SHUTDOWN
 } command_type_t;
 
+#define IPC_COMMAND_COUNT (CMD_SHUTDOWN + 1)
+
 // Códigos de estado
 typedef enum {
     STATUS_OK = 0,
@@ -95,8 +98,44 @@ typedef struct {
     char current_operation[256];
     double cpu_usage;
     double memory_usage_mb;
+    monitor_self_stats_t monitor;       // coste del monitor, lo actualiza el daemon
 } system_status_t;
 
+/*
+ * Últimas muestras de cada dispositivo en shm (IPC_SAMPLES_SHM_NAME).
+ * El daemon es el único escritor; cada anillo lleva su propio seqlock
+ * (seq impar mientras se escribe), así que cualquier proceso local puede
+ * leer una instantánea coherente sin llamadas al sistema tras el mmap.
+ */
+#define IPC_SAMPLES_SHM_NAME "/storage_mgr_samples"
+#define IPC_SAMPLES_MAGIC 0x534d5231    // "SMR1"
+#define IPC_SAMPLE_RING_SIZE 64
+#define IPC_SAMPLE_MAX_DEVICES MONITOR_MAX_DEVICES
+
+typedef struct {
+    uint32_t seq;
+    uint32_t reserved;
+    char device[64];
+    uint64_t head;                      // muestras publicadas desde el arranque
+    performance_sample_t samples[IPC_SAMPLE_RING_SIZE];   // posición head % tamaño
+} ipc_sample_ring_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t ring_size;
+    uint32_t max_devices;
+    uint32_t ndevices;                  // anillos con nombre (solo crece)
+    ipc_sample_ring_t rings[IPC_SAMPLE_MAX_DEVICES];
+} ipc_sample_shm_t;
+
+// Contadores de peticiones atendidas desde el arranque
+typedef struct {
+    uint64_t total_requests;
+    uint64_t failed_requests;
+    uint64_t by_command[IPC_COMMAND_COUNT];
+    int clients;
+} ipc_counters_t;
+
 // Message queue para operaciones asíncronas
 typedef struct {
     command_type_t command;
@@ -123,6 +162,8 @@ int ipc_handle_request(int client_fd, request_t *req, response_t *resp);
 int ipc_dispatch_command(command_type_t cmd, const char *payload, 
                         char *result, size_t result_size);
 
+int ipc_get_counters(ipc_counters_t *out);
+
 // Funciones de lectura/escritura
 int ipc_read_request(int client_fd, request_t *req);
 int ipc_send_response(int client_fd, const response_t *resp);
@@ -132,6 +173,17 @@ int ipc_shm_init(void);
 void ipc_shm_cleanup(void);
 int ipc_shm_update_status(const system_status_t *status);
 int ipc_shm_get_status(system_status_t *status);
+int ipc_shm_update_monitor(const monitor_self_stats_t *stats);
+
+// Anillos de muestras: el daemon publica (ipc_shm_init crea el segmento),
+// los clientes se adjuntan en solo lectura. ipc_samples_read copia las
+// últimas max muestras del dispositivo, de la más antigua a la más
+// reciente, y devuelve cuántas copió, -ENOENT si el dispositivo no tiene
+// anillo o -1 si el segmento no existe.
+int ipc_samples_publish(const char *device, const performance_sample_t *sample);
+int ipc_samples_attach(void);
+void ipc_samples_detach(void);
+int ipc_samples_read(const char *device, performance_sample_t *out, int max);
 
 // Message queue para jobs
 int ipc_mq_init(void);
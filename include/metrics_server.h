@@ -0,0 +1,27 @@
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+
+/*
+ * Exposición OpenMetrics/Prometheus del monitor y del daemon.
+ *
+ * El cuerpo (con la cabecera HTTP) se regenera una vez por tick del
+ * monitor en un buffer preasignado; hay dos buffers y el que se está
+ * sirviendo nunca se reescribe. Un scrape es un único write() del buffer
+ * publicado, sin cálculo por petición. Solo escucha en un socket UNIX o
+ * en 127.0.0.1.
+ */
+
+#define METRICS_SOCKET_PATH "/var/run/storage_mgr_metrics.sock"
+#define METRICS_DEFAULT_PORT 9464
+#define METRICS_BUFFER_SIZE (256 * 1024)
+
+// listen_addr: "unix:/ruta" o "/ruta" (socket UNIX), "puerto" o
+// "127.0.0.1:puerto" (loopback TCP). NULL usa METRICS_SOCKET_PATH.
+// Registra además metrics_render() como hook de tick del monitor.
+int metrics_server_start(const char *listen_addr);
+void metrics_server_stop(void);
+
+// Regenera el cuerpo en el buffer libre y lo publica
+int metrics_render(void);
+
+#endif
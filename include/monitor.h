@@ -3,6 +3,36 @@
 
 #include <time.h>
 #include <stdint.h>
+#include <sys/types.h>
+
+#define MONITOR_MAX_DEVICES 128
+
+#define DISKSTATS_MAX_FIELDS 17
+
+// Línea completa de /proc/diskstats (11, 15 o 17 contadores según el kernel)
+typedef struct {
+    unsigned int major;
+    unsigned int minor;
+    char name[64];
+    unsigned long long rd_ios;
+    unsigned long long rd_merges;
+    unsigned long long rd_sectors;
+    unsigned long long rd_ticks;        // ms
+    unsigned long long wr_ios;
+    unsigned long long wr_merges;
+    unsigned long long wr_sectors;
+    unsigned long long wr_ticks;        // ms
+    unsigned long long in_flight;
+    unsigned long long io_ticks;        // ms
+    unsigned long long time_in_queue;   // ms ponderados
+    unsigned long long dc_ios;          // 4.18+
+    unsigned long long dc_merges;
+    unsigned long long dc_sectors;
+    unsigned long long dc_ticks;
+    unsigned long long fl_ios;          // 5.5+
+    unsigned long long fl_ticks;
+    int nfields;                        // contadores presentes en la línea
+} diskstats_entry_t;
 
 // Estructura para estadísticas de dispositivo
 typedef struct {
@@ -15,6 +45,9 @@ typedef struct {
     double avg_write_latency_ms;
     int queue_depth;
     time_t last_update;
+    uint64_t mono_ns;           // CLOCK_MONOTONIC de la lectura (para deltas)
+    uint64_t wall_ns;           // CLOCK_REALTIME de la lectura
+    diskstats_entry_t raw;
 } device_stats_t;
 
 // Estructura para muestra de rendimiento
@@ -22,10 +55,53 @@ typedef struct {
     time_t timestamp;
     double iops;
     double throughput_mbs;
-    double latency_ms;
-    int active_requests;
+    double latency_ms;          // await medio (lecturas + escrituras)
+    int active_requests;        // peticiones en vuelo al muestrear
+    double read_latency_ms;     // r_await del intervalo
+    double write_latency_ms;    // w_await del intervalo
+    double util_percent;        // %util (io_ticks / tiempo transcurrido)
+    double avg_queue_size;      // aqu-sz (time_in_queue / tiempo transcurrido)
+    uint64_t timestamp_ns;      // marca de tiempo con resolución de ns
+    double interval_s;          // duración del intervalo medido
 } performance_sample_t;
 
+// Resumen de una métrica dentro de un bucket de rollup
+typedef struct {
+    double min;
+    double max;
+    double avg;
+    double p95;
+} metric_summary_t;
+
+// Fila agregada del histórico (crudo, 1 minuto o 1 hora)
+typedef struct {
+    time_t bucket;              // inicio del bucket
+    int resolution_s;           // 0 = muestras crudas, 60 o 3600
+    unsigned int samples;
+    metric_summary_t iops;
+    metric_summary_t throughput_mbs;
+    metric_summary_t latency_ms;
+    metric_summary_t util_percent;
+} performance_rollup_t;
+
+// Ventanas deslizantes de los histogramas de latencia
+#define MONITOR_LATENCY_WINDOW_1S 1
+#define MONITOR_LATENCY_WINDOW_1M 60
+#define MONITOR_LATENCY_WINDOW_5M 300
+
+// Percentiles de la latencia media por intervalo sobre una ventana o un rango:
+// con el muestreo de diskstats cada IO cuenta con el await medio de su tick,
+// no con su latencia propia (las colas dentro de un tick no se ven)
+typedef struct {
+    int window_s;
+    uint64_t count;             // IOs contabilizados
+    double p50_ms;
+    double p95_ms;
+    double p99_ms;
+    double p999_ms;
+    double max_ms;
+} latency_percentiles_t;
+
 // Estructura para uso de disco
 typedef struct {
     char mount_point[256];
@@ -48,8 +124,75 @@ typedef struct {
     char mode[8];
 } open_file_t;
 
+#define MONITOR_TOP_PROCESSES 10         // top por defecto de monitor_update_process_io
+#define MONITOR_MAX_TOP_PROCESSES 64
+
+// E/S de un proceso (contadores de /proc/<pid>/io)
+typedef struct {
+    pid_t pid;
+    char process_name[64];
+    unsigned long long read_bytes;      // acumulados, capa de bloque
+    unsigned long long write_bytes;
+    double read_bps;                    // tasas del último intervalo
+    double write_bps;
+} process_io_t;
+
+// Evento del detector de anomalías
+typedef struct {
+    time_t timestamp;
+    char device[64];
+    char metric[16];                    // "latency_ms" o "iops"
+    double value;
+    double expected;                    // media de la banda que se superó
+    double stddev;
+    double score;                       // desviaciones típicas respecto a expected
+    int seasonal;                       // comparado con la baseline de la misma hora
+} monitor_anomaly_t;
+
+// Coste del propio monitor (monitor_get_self_stats)
+typedef struct {
+    uint64_t ticks;                     // ticks del thread continuo
+    uint64_t missed_ticks;              // ticks perdidos por retraso
+    double cpu_ms;                      // CPU acumulada del sampler y del writer
+    double cpu_percent;                 // CPU / tiempo real en la última ventana
+    double tick_cpu_us;                 // CPU del último tick
+    double parse_us;                    // lectura y parseo de diskstats del último tick
+    double lateness_ms;                 // retraso del último tick sobre su expiración
+    double max_lateness_ms;
+    double db_write_ms;                 // duración del último lote escrito
+    double max_db_write_ms;
+    unsigned long long samples_dropped; // muestras descartadas con la cola llena
+    int interval_ms;                    // intervalo en vigor
+    int budget_floor_ms;                // intervalo mínimo impuesto por el presupuesto (0 = ninguno)
+} monitor_self_stats_t;
+
+// Almacenamiento de las muestras crudas
+typedef enum {
+    MONITOR_BACKEND_SQLITE = 0,  // tabla performance_history
+    MONITOR_BACKEND_TSDB         // segmentos comprimidos (monitor_tsdb.h)
+} monitor_backend_t;
+
+// Configuración del monitor
+typedef struct {
+    char db_path[256];
+    monitor_backend_t backend;
+    char tsdb_dir[256];      // directorio de segmentos para MONITOR_BACKEND_TSDB
+    int process_top_n;       // top de procesos del sampler (0 = desactivado, por defecto;
+                             // máximo MONITOR_MAX_TOP_PROCESSES)
+    double anomaly_threshold; // desviaciones típicas que marcan anomalía (0 = desactivado)
+    char psi_trigger[64];    // trigger de /proc/pressure/io ("" = sin muestreo adaptativo)
+    int psi_fast_interval_ms; // intervalo mientras hay presión de I/O
+    int psi_hold_ms;         // tiempo sin presión antes de volver al intervalo base
+    double overhead_budget_percent; // CPU máxima del monitor (0 = sin límite)
+    int flush_interval_ms;   // tiempo máximo que una muestra espera en cola
+    int flush_batch_size;    // muestras en cola que disparan un flush inmediato
+    int queue_capacity;      // tamaño del ring; si se llena se descartan muestras
+} monitor_config_t;
+
 // Inicialización del sistema de monitoreo
+void monitor_config_defaults(monitor_config_t *config);
 int monitor_init(void);
+int monitor_init_with_config(const monitor_config_t *config);
 void monitor_cleanup(void);
 
 // Funciones de estadísticas de dispositivos
@@ -68,21 +211,123 @@ int monitor_check_disk_space(const char *mount_point, double threshold);
 // Funciones de archivos abiertos
 int monitor_list_open_files(const char *mount_point, open_file_t **files, int *count);
 int monitor_get_process_io(pid_t pid, device_stats_t *stats);
+// Relee /proc/<pid>/io de todos los procesos (lo hace el thread continuo en
+// cada tick) y actualiza el top-N por bytes/s de lectura+escritura
+int monitor_update_process_io(void);
+// Copia el último top-N, de mayor a menor tasa. Devuelve cuántos copió.
+int monitor_get_top_process_io(process_io_t *top, int max);
 
 // Funciones de datos históricos
+// Las muestras se encolan y un writer las persiste por lotes en una transacción.
 int monitor_save_sample(const char *device, const performance_sample_t *sample);
+int monitor_flush(void);
 int monitor_get_history(const char *device, time_t start, time_t end, 
                         performance_sample_t **samples, int *count);
+
+// Lectura en streaming del histórico con memoria acotada: una sola pasada
+// sobre la consulta, entregando lotes de tamaño fijo.
+#define MONITOR_HISTORY_BATCH 256
+
+typedef struct monitor_history_cursor monitor_history_cursor_t;
+typedef int (*monitor_history_cb)(const char *device, const performance_sample_t *batch,
+                                  int count, void *user_data);
+
+int monitor_history_open(const char *device, time_t start, time_t end,
+                         monitor_history_cursor_t **cursor);
+// Devuelve las filas copiadas en batch (0 al final, <0 en error)
+int monitor_history_next(monitor_history_cursor_t *cursor, performance_sample_t *batch, int max);
+void monitor_history_close(monitor_history_cursor_t *cursor);
+// Llama a cb por cada lote; si cb devuelve distinto de 0 se detiene y lo devuelve
+int monitor_history_foreach(const char *device, time_t start, time_t end, int batch_size,
+                            monitor_history_cb cb, void *user_data);
 int monitor_cleanup_old_data(int keep_days);
 
+// Consulta agregada: usa el nivel más grueso (1 h, 1 min o crudo) cuya
+// resolución no supere resolution_s. El llamador libera *rows.
+int monitor_get_rollups(const char *device, time_t start, time_t end, int resolution_s,
+                        performance_rollup_t **rows, int *count);
+
+// Histogramas de latencia log-lineales por dispositivo. El thread continuo
+// registra cada tick el await medio de lecturas y escrituras ponderado por
+// el número de IOs, así que los percentiles son de la latencia media por
+// intervalo; monitor_record_latency() admite latencias por IO de otras
+// fuentes. Las ventanas son 1, 60 o 300 segundos.
+int monitor_record_latency(const char *device, double latency_ms, uint64_t count);
+int monitor_get_latency_percentiles(const char *device, int window_s,
+                                    latency_percentiles_t *out);
+// Histograma acumulado desde el arranque: buckets[i] = IOs con latencia
+// <= bounds_ms[i] (límites crecientes), más el total y la suma en ms
+int monitor_get_latency_histogram(const char *device, const double *bounds_ms, int nbounds,
+                                  uint64_t *buckets, uint64_t *count, double *sum_ms);
+// Percentiles sobre los snapshots por minuto persistidos en [start, end]
+int monitor_get_latency_range(const char *device, time_t start, time_t end,
+                              latency_percentiles_t *out);
+
+// Detección de anomalías: banda EWMA y baseline por hora de la semana para
+// latencia e IOPS, en O(1) por muestra. El thread continuo observa cada
+// muestra; los eventos se guardan en la tabla anomaly_events.
+// Devuelve cuántas anomalías nuevas marcó la muestra.
+int monitor_observe_sample(const char *device, const performance_sample_t *sample);
+// device NULL = todos. El llamador libera *events.
+int monitor_get_anomalies(const char *device, time_t start, time_t end,
+                          monitor_anomaly_t **events, int *count);
+
 // Funciones de reportes
+typedef enum {
+    MONITOR_REPORT_TEXT = 0,
+    MONITOR_REPORT_CSV,
+    MONITOR_REPORT_JSON
+} monitor_report_format_t;
+
+#define MONITOR_REPORT_TOP_INTERVALS 5
+#define MONITOR_REPORT_BUSY_UTIL 80.0   // %util a partir del cual un intervalo cuenta como ocupado
+
+// Recorre una sola vez el histórico de todos los dispositivos en [start, end]
+// con memoria acotada por dispositivo: min/avg/p50/p95/p99/max de IOPS,
+// throughput, latencia y %util, más los intervalos de mayor %util.
+// Devuelve el número de dispositivos del reporte o <0 en error.
+int monitor_generate_report_format(const char *output_file, time_t start, time_t end,
+                                   monitor_report_format_t format);
+// Igual, con el formato deducido de la extensión (.csv, .json; texto si no)
 int monitor_generate_report(const char *output_file, time_t start, time_t end);
 void monitor_print_stats(const device_stats_t *stats);
 void monitor_print_performance(const performance_sample_t *sample);
 
+// Conjunto de dispositivos muestreados por el thread continuo.
+// Con count == 0 se muestrean todos los dispositivos de /proc/diskstats,
+// que se vuelve a listar cuando aparecen o desaparecen discos.
+int monitor_set_devices(const char *const *devices, int count);
+int monitor_get_device_count(void);
+
+// Última lectura publicada por el thread continuo de cada dispositivo, sin E/S
+int monitor_get_cached_stats(device_stats_t *stats, int max);
+
+// Lee /proc/diskstats una sola vez y rellena stats[i] para devices[i].
+// Las entradas no encontradas quedan con last_update == 0.
+// Devuelve el número de dispositivos encontrados o -1 en error.
+int monitor_sample_devices(const char *const *devices, int count, device_stats_t *stats);
+
+// Parser sin reservas de memoria del texto de /proc/diskstats.
+// Devuelve el número de entradas escritas en entries (máximo max).
+int monitor_diskstats_parse(const char *buf, size_t len, diskstats_entry_t *entries, int max);
+
 // Thread de monitoreo continuo
 void* monitor_thread_func(void *arg);
 int monitor_start_continuous(int interval_seconds);
+// Modo de alta resolución (timerfd sobre CLOCK_MONOTONIC, sin deriva), 10 ms mínimo
+int monitor_start_continuous_ms(int interval_ms);
 int monitor_stop_continuous(void);
+// Intervalo de muestreo en vigor: el base o psi_fast_interval_ms mientras
+// /proc/pressure/io indica presión de I/O (0 si el thread no está activo)
+int monitor_get_interval_ms(void);
+// Coste medido del monitor desde monitor_init
+int monitor_get_self_stats(monitor_self_stats_t *stats);
+// Función llamada al final de cada tick del thread continuo (NULL la quita)
+typedef void (*monitor_tick_hook)(void *arg);
+void monitor_set_tick_hook(monitor_tick_hook hook, void *arg);
+// Función llamada con cada muestra calculada por el thread continuo
+typedef void (*monitor_sample_hook)(const char *device, const performance_sample_t *sample,
+                                    void *arg);
+void monitor_set_sample_hook(monitor_sample_hook hook, void *arg);
 
 #endif // MONITOR_H
\ No newline at end of file
@@ -0,0 +1,49 @@
+#ifndef MONITOR_TSDB_H
+#define MONITOR_TSDB_H
+
+#include <stdint.h>
+#include <time.h>
+#include "monitor.h"
+
+/*
+ * Almacén de series temporales para las muestras del monitor.
+ *
+ * Cada dispositivo tiene un directorio con segmentos de tamaño fijo
+ * (<dir>/<device>/NNNNNNNN.seg) mapeados con mmap y escritos solo al final.
+ * Dentro de un segmento las muestras se agrupan en bloques de
+ * TSDB_BLOCK_SAMPLES; cada bloque empieza con valores sin comprimir y el
+ * resto se codifica al estilo Gorilla: delta-of-delta para el timestamp
+ * (resolución de microsegundos) y XOR con el valor anterior para cada
+ * double. La cabecera del segmento guarda el índice temporal de bloques,
+ * así que un escaneo por rango salta segmentos y bloques fuera del rango
+ * y descomprime el resto secuencialmente.
+ */
+
+#define TSDB_SEGMENT_SIZE  (1024 * 1024)
+#define TSDB_HEADER_SIZE   4096
+#define TSDB_BLOCK_SAMPLES 256
+
+typedef struct tsdb_iter tsdb_iter_t;
+
+// Abre (y crea si hace falta) el almacén en dir
+int tsdb_open(const char *dir);
+void tsdb_close(void);
+
+// Añade una muestra al segmento activo del dispositivo
+int tsdb_append(const char *device, const performance_sample_t *sample);
+// msync asíncrono de los segmentos activos
+int tsdb_sync(void);
+// Borra los segmentos cuya última muestra es anterior a cutoff
+int tsdb_drop_before(time_t cutoff);
+// Bytes ocupados en disco y número de muestras almacenadas
+int tsdb_usage(uint64_t *disk_bytes, uint64_t *samples);
+// Dispositivos con al menos un directorio de segmentos
+int tsdb_list_devices(char (*names)[64], int max);
+
+// Escaneo por rango [start, end] en segundos, en orden de inserción
+int tsdb_iter_open(const char *device, time_t start, time_t end, tsdb_iter_t **iter);
+// Devuelve las muestras copiadas en out (0 al final, <0 en error)
+int tsdb_iter_next(tsdb_iter_t *iter, performance_sample_t *out, int max);
+void tsdb_iter_close(tsdb_iter_t *iter);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef MOUNT_CACHE_H
+#define MOUNT_CACHE_H
+
+#include <time.h>
+#include <sys/types.h>
+
+/*
+ * Caché de uso de todos los puntos de montaje.
+ *
+ * La tabla de montajes se lee de /proc/self/mountinfo y solo se vuelve a
+ * leer cuando poll() sobre ese fichero avisa de un cambio. El statvfs de
+ * cada montaje lo hace un pool de workers; si uno no responde dentro del
+ * timeout por montaje (p.ej. un FUSE colgado) se abandona, el montaje se
+ * marca stale con sus últimos valores y el resto del barrido sigue.
+ * Las consultas se sirven desde memoria.
+ */
+
+#define MOUNT_CACHE_SWEEP_MS   5000    // intervalo del barrido en segundo plano
+#define MOUNT_CACHE_TIMEOUT_MS 2000    // timeout de statvfs por montaje
+
+typedef struct {
+    char device[256];
+    char mount_point[256];
+    char fstype[32];
+    char options[256];
+    dev_t dev;                          // major:minor de mountinfo
+    unsigned long long total_bytes;
+    unsigned long long free_bytes;
+    unsigned long long available_bytes;
+    unsigned long long total_inodes;
+    unsigned long long free_inodes;
+    time_t updated;                     // último statvfs correcto (0 = nunca)
+    int stale;                          // el último statvfs falló o no respondió
+} mount_usage_t;
+
+// Intervalo del barrido y timeout por montaje (<= 0 deja el valor actual)
+void mount_cache_configure(int sweep_interval_ms, int probe_timeout_ms);
+
+// Barrido periódico en segundo plano. Sin él, las consultas barren de forma
+// síncrona cuando la caché es más antigua que el intervalo. Tras fork() el
+// hijo no tiene sweeper ni workers y vuelve a ese modo síncrono.
+int mount_cache_start(void);
+void mount_cache_stop(void);
+
+// Fuerza un barrido completo (releyendo la tabla si cambió)
+int mount_cache_refresh(void);
+
+// Uso del montaje cuyo punto de montaje es exactamente mount_point.
+// Devuelve 0, o -ENOENT si no es un punto de montaje.
+int mount_cache_get(const char *mount_point, mount_usage_t *out);
+
+// Copia hasta max montajes en el orden de mountinfo. Devuelve el total
+// de montajes (puede ser mayor que max) o <0 en error.
+int mount_cache_list(mount_usage_t *out, int max);
+
+#endif
@@ -0,0 +1,859 @@
+#define _GNU_SOURCE
+#include "backup_copy.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <limits.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <sys/sendfile.h>
+
+#define COPY_CHUNK       (64ULL * 1024 * 1024)   // bytes por llamada a copy_file_range/sendfile
+#define LINK_HASH_BITS   12
+#define LINK_BUCKETS     (1 << LINK_HASH_BITS)
+#define DEQUE_INITIAL    256
+
+// Métodos de copia, del más rápido al de último recurso
+enum { COPY_RANGE = 0, COPY_SENDFILE, COPY_BUFFER };
+
+typedef struct {
+    char *rel;                 // ruta relativa a la raíz ("" = raíz)
+} walk_task_t;
+
+// Cola doble de un worker: el dueño empuja y saca por el final, los
+// ladrones sacan por el principio
+typedef struct {
+    pthread_mutex_t lock;
+    walk_task_t *tasks;
+    size_t cap;
+    size_t head;
+    size_t count;
+} task_deque_t;
+
+typedef struct link_node {
+    dev_t dev;
+    ino_t ino;
+    char *rel;                 // primera entrada vista del grupo
+    struct link_node *next;
+} link_node_t;
+
+typedef struct {
+    backup_walk_t *walk;
+    int id;
+    pthread_t thread;
+    task_deque_t dq;
+} walk_worker_t;
+
+struct backup_walk {
+    const char *root;
+    backup_walk_fn fn;
+    void *arg;
+    int nworkers;
+    walk_worker_t *workers;
+
+    atomic_long pending;       // tareas encoladas o en curso
+    atomic_int idle;
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+
+    pthread_mutex_t link_lock;
+    link_node_t *links[LINK_BUCKETS];
+
+    atomic_ullong entries;
+    atomic_ullong errors;
+    pthread_mutex_t error_lock;
+    char first_error[256];
+};
+
+static double elapsed_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int backup_join_path(char *out, size_t size, const char *base, const char *rel) {
+    int n = rel[0] ? snprintf(out, size, "%s/%s", base, rel)
+                   : snprintf(out, size, "%s", base);
+    return (n < 0 || (size_t)n >= size) ? -1 : 0;
+}
+
+void backup_walk_error(backup_walk_t *walk, const char *path, const char *op, int err) {
+    atomic_fetch_add(&walk->errors, 1);
+    fprintf(stderr, "Backup: %s %s: %s\n", op, path, strerror(err));
+
+    pthread_mutex_lock(&walk->error_lock);
+    if (walk->first_error[0] == '\0') {
+        snprintf(walk->first_error, sizeof(walk->first_error), "%s %s: %s",
+                 op, path, strerror(err));
+    }
+    pthread_mutex_unlock(&walk->error_lock);
+}
+
+// ---------------------------------------------------------------------------
+// Colas con robo de trabajo
+// ---------------------------------------------------------------------------
+
+static int deque_init(task_deque_t *dq) {
+    pthread_mutex_init(&dq->lock, NULL);
+    dq->tasks = malloc(DEQUE_INITIAL * sizeof(walk_task_t));
+    dq->cap = DEQUE_INITIAL;
+    dq->head = 0;
+    dq->count = 0;
+    return dq->tasks ? 0 : -ENOMEM;
+}
+
+static void deque_destroy(task_deque_t *dq) {
+    for (size_t i = 0; i < dq->count; i++) {
+        free(dq->tasks[(dq->head + i) % dq->cap].rel);
+    }
+    free(dq->tasks);
+    pthread_mutex_destroy(&dq->lock);
+}
+
+static int deque_push(task_deque_t *dq, walk_task_t task) {
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count == dq->cap) {
+        walk_task_t *grown = malloc(dq->cap * 2 * sizeof(walk_task_t));
+        if (!grown) {
+            pthread_mutex_unlock(&dq->lock);
+            return -ENOMEM;
+        }
+        for (size_t i = 0; i < dq->count; i++) {
+            grown[i] = dq->tasks[(dq->head + i) % dq->cap];
+        }
+        free(dq->tasks);
+        dq->tasks = grown;
+        dq->cap *= 2;
+        dq->head = 0;
+    }
+    dq->tasks[(dq->head + dq->count) % dq->cap] = task;
+    dq->count++;
+    pthread_mutex_unlock(&dq->lock);
+    return 0;
+}
+
+static int deque_pop(task_deque_t *dq, walk_task_t *task) {
+    int found = 0;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count > 0) {
+        dq->count--;
+        *task = dq->tasks[(dq->head + dq->count) % dq->cap];
+        found = 1;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+static int deque_steal(task_deque_t *dq, walk_task_t *task) {
+    int found = 0;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count > 0) {
+        *task = dq->tasks[dq->head];
+        dq->head = (dq->head + 1) % dq->cap;
+        dq->count--;
+        found = 1;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+static int steal_task(walk_worker_t *w, walk_task_t *task) {
+    backup_walk_t *walk = w->walk;
+
+    for (int i = 1; i < walk->nworkers; i++) {
+        walk_worker_t *victim = &walk->workers[(w->id + i) % walk->nworkers];
+        if (deque_steal(&victim->dq, task)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int any_task(backup_walk_t *walk) {
+    for (int i = 0; i < walk->nworkers; i++) {
+        task_deque_t *dq = &walk->workers[i].dq;
+        pthread_mutex_lock(&dq->lock);
+        size_t count = dq->count;
+        pthread_mutex_unlock(&dq->lock);
+        if (count > 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int push_task(walk_worker_t *w, char *rel) {
+    backup_walk_t *walk = w->walk;
+    walk_task_t task = { rel };
+
+    // pending sube antes de publicar la tarea: nunca llega a 0 con trabajo en cola
+    atomic_fetch_add(&walk->pending, 1);
+    if (deque_push(&w->dq, task) != 0) {
+        atomic_fetch_sub(&walk->pending, 1);
+        return -ENOMEM;
+    }
+    if (atomic_load(&walk->idle) > 0) {
+        pthread_mutex_lock(&walk->idle_lock);
+        pthread_cond_signal(&walk->idle_cond);
+        pthread_mutex_unlock(&walk->idle_lock);
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Recorrido paralelo
+// ---------------------------------------------------------------------------
+
+char* backup_walk_claim_link(backup_walk_t *walk, const struct stat *st, const char *rel) {
+    // Hash multiplicativo: los bits altos son los bien mezclados
+    uint64_t h = ((uint64_t)st->st_ino ^ ((uint64_t)st->st_dev << 40)) * 0x9E3779B97F4A7C15ULL;
+    size_t bucket = h >> (64 - LINK_HASH_BITS);
+    char *first = NULL;
+
+    pthread_mutex_lock(&walk->link_lock);
+    link_node_t *node = walk->links[bucket];
+    while (node && !(node->dev == st->st_dev && node->ino == st->st_ino)) {
+        node = node->next;
+    }
+    if (node) {
+        first = strdup(node->rel);
+    } else {
+        node = malloc(sizeof(link_node_t));
+        if (node) {
+            node->dev = st->st_dev;
+            node->ino = st->st_ino;
+            node->rel = strdup(rel);
+            node->next = walk->links[bucket];
+            walk->links[bucket] = node;
+        }
+    }
+    pthread_mutex_unlock(&walk->link_lock);
+    return first;
+}
+
+static void walk_dir(walk_worker_t *w, const char *rel, const char *path) {
+    DIR *dir = opendir(path);
+    if (!dir) {
+        backup_walk_error(w->walk, path, "opendir", errno);
+        return;
+    }
+
+    struct dirent *entry;
+    size_t rel_len = strlen(rel);
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        size_t len = rel_len + strlen(entry->d_name) + 2;
+        char *child = malloc(len);
+        if (!child) {
+            backup_walk_error(w->walk, path, "readdir", ENOMEM);
+            break;
+        }
+        if (rel_len) {
+            snprintf(child, len, "%s/%s", rel, entry->d_name);
+        } else {
+            snprintf(child, len, "%s", entry->d_name);
+        }
+        if (push_task(w, child) != 0) {
+            backup_walk_error(w->walk, path, "readdir", ENOMEM);
+            free(child);
+            break;
+        }
+    }
+    closedir(dir);
+}
+
+static void walk_task(walk_worker_t *w, const char *rel) {
+    backup_walk_t *walk = w->walk;
+    char path[PATH_MAX];
+    struct stat st;
+
+    if (backup_join_path(path, sizeof(path), walk->root, rel) != 0) {
+        backup_walk_error(walk, rel, "path", ENAMETOOLONG);
+        return;
+    }
+    if (lstat(path, &st) != 0) {
+        // Borrado entre readdir y lstat: no es un error del recorrido
+        if (errno != ENOENT) {
+            backup_walk_error(walk, path, "lstat", errno);
+        }
+        return;
+    }
+
+    atomic_fetch_add(&walk->entries, 1);
+    if (walk->fn(walk, w->id, rel, &st, walk->arg) == 0 && S_ISDIR(st.st_mode)) {
+        walk_dir(w, rel, path);
+    }
+}
+
+static void* walk_worker_func(void *arg) {
+    walk_worker_t *w = arg;
+    backup_walk_t *walk = w->walk;
+    walk_task_t task;
+
+    for (;;) {
+        if (deque_pop(&w->dq, &task) || steal_task(w, &task)) {
+            walk_task(w, task.rel);
+            free(task.rel);
+            if (atomic_fetch_sub(&walk->pending, 1) == 1) {
+                pthread_mutex_lock(&walk->idle_lock);
+                pthread_cond_broadcast(&walk->idle_cond);
+                pthread_mutex_unlock(&walk->idle_lock);
+            }
+            continue;
+        }
+
+        // idle sube antes de mirar las colas: un push posterior lo verá y
+        // avisará, y uno anterior deja la tarea visible para any_task()
+        pthread_mutex_lock(&walk->idle_lock);
+        atomic_fetch_add(&walk->idle, 1);
+        while (atomic_load(&walk->pending) > 0 && !any_task(walk)) {
+            pthread_cond_wait(&walk->idle_cond, &walk->idle_lock);
+        }
+        atomic_fetch_sub(&walk->idle, 1);
+        int done = atomic_load(&walk->pending) == 0;
+        pthread_mutex_unlock(&walk->idle_lock);
+        if (done) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+int backup_walk_threads(int requested) {
+    int threads = requested;
+
+    // Trabajo dominado por I/O: más workers que CPUs mantiene la cola del
+    // dispositivo llena mientras otros esperan metadatos
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus * 2 : 4;
+    }
+    return threads > BACKUP_COPY_MAX_THREADS ? BACKUP_COPY_MAX_THREADS : threads;
+}
+
+int backup_walk_tree(const char *root, int threads, backup_walk_fn fn, void *arg,
+                     backup_walk_stats_t *stats) {
+    backup_walk_t walk;
+    struct timespec start;
+    int rc = 0;
+
+    if (!root || !fn || !stats) {
+        return -EINVAL;
+    }
+    memset(stats, 0, sizeof(*stats));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    memset(&walk, 0, sizeof(walk));
+    walk.root = root;
+    walk.fn = fn;
+    walk.arg = arg;
+    walk.nworkers = backup_walk_threads(threads);
+    walk.workers = calloc(walk.nworkers, sizeof(walk_worker_t));
+    if (!walk.workers) {
+        return -ENOMEM;
+    }
+    atomic_init(&walk.pending, 0);
+    atomic_init(&walk.idle, 0);
+    atomic_init(&walk.entries, 0);
+    atomic_init(&walk.errors, 0);
+    pthread_mutex_init(&walk.idle_lock, NULL);
+    pthread_cond_init(&walk.idle_cond, NULL);
+    pthread_mutex_init(&walk.link_lock, NULL);
+    pthread_mutex_init(&walk.error_lock, NULL);
+
+    int initialized = 0;
+    for (; initialized < walk.nworkers; initialized++) {
+        walk_worker_t *w = &walk.workers[initialized];
+        w->walk = &walk;
+        w->id = initialized;
+        if (deque_init(&w->dq) != 0) {
+            pthread_mutex_destroy(&w->dq.lock);
+            rc = -ENOMEM;
+            break;
+        }
+    }
+
+    if (rc == 0) {
+        char *rel = strdup("");
+        if (!rel || push_task(&walk.workers[0], rel) != 0) {
+            free(rel);
+            rc = -ENOMEM;
+        }
+    }
+
+    int started = 0;
+    if (rc == 0) {
+        // Los workers que no lleguen a arrancar no tienen tareas propias:
+        // todo cuelga de la raíz, que está en la cola del primero
+        for (; started < walk.nworkers; started++) {
+            if (pthread_create(&walk.workers[started].thread, NULL,
+                               walk_worker_func, &walk.workers[started]) != 0) {
+                break;
+            }
+        }
+        if (started == 0) {
+            rc = -EAGAIN;
+        }
+        for (int i = 0; i < started; i++) {
+            pthread_join(walk.workers[i].thread, NULL);
+        }
+    }
+
+    for (int i = 0; i < initialized; i++) {
+        deque_destroy(&walk.workers[i].dq);
+    }
+    for (int i = 0; i < LINK_BUCKETS; i++) {
+        link_node_t *node = walk.links[i];
+        while (node) {
+            link_node_t *next = node->next;
+            free(node->rel);
+            free(node);
+            node = next;
+        }
+    }
+
+    stats->entries = atomic_load(&walk.entries);
+    stats->errors = atomic_load(&walk.errors);
+    stats->threads = started;
+    stats->elapsed_s = elapsed_since(&start);
+    strncpy(stats->first_error, walk.first_error, sizeof(stats->first_error) - 1);
+
+    free(walk.workers);
+    pthread_mutex_destroy(&walk.idle_lock);
+    pthread_cond_destroy(&walk.idle_cond);
+    pthread_mutex_destroy(&walk.link_lock);
+    pthread_mutex_destroy(&walk.error_lock);
+    return rc;
+}
+
+// Propietario, modo y tiempos. Sin privilegios, un chown a otro usuario
+// falla con EPERM y se conserva el propietario actual, como rsync.
+int backup_apply_metadata(int fd, const char *path, const struct stat *st,
+                          const char **failed_op) {
+    struct timespec times[2] = { st->st_atim, st->st_mtim };
+    int rc = fd >= 0 ? fchown(fd, st->st_uid, st->st_gid)
+                     : lchown(path, st->st_uid, st->st_gid);
+
+    if (rc != 0 && !(errno == EPERM && geteuid() != 0)) {
+        *failed_op = "chown";
+        return -1;
+    }
+    if (!S_ISLNK(st->st_mode)) {
+        rc = fd >= 0 ? fchmod(fd, st->st_mode & 07777)
+                     : chmod(path, st->st_mode & 07777);
+        if (rc != 0) {
+            *failed_op = "chmod";
+            return -1;
+        }
+    }
+    rc = fd >= 0 ? futimens(fd, times)
+                 : utimensat(AT_FDCWD, path, times, AT_SYMLINK_NOFOLLOW);
+    if (rc != 0) {
+        *failed_op = "utimens";
+        return -1;
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Copiador
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    char *rel;
+    char *target;              // para enlaces duros pendientes
+    struct stat st;            // para metadatos de directorios
+} fixup_t;
+
+typedef struct {
+    fixup_t *items;
+    size_t count;
+    size_t cap;
+} fixup_list_t;
+
+typedef struct {
+    char *buf;
+    int method;                // método de copia que funciona en este worker
+    backup_copy_stats_t stats;
+} copy_worker_t;
+
+typedef struct {
+    const char *src;
+    const char *dst;
+    copy_worker_t *workers;
+
+    pthread_mutex_t fixup_lock;
+    fixup_list_t dirs;         // metadatos de directorios a aplicar al final
+    fixup_list_t hardlinks;    // enlaces duros a crear al final
+} copy_ctx_t;
+
+static int fixup_add(copy_ctx_t *ctx, fixup_list_t *list, const char *rel,
+                     char *target, const struct stat *st) {
+    int rc = 0;
+
+    pthread_mutex_lock(&ctx->fixup_lock);
+    if (list->count == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 256;
+        fixup_t *items = realloc(list->items, cap * sizeof(fixup_t));
+        if (!items) {
+            rc = -ENOMEM;
+            goto out;
+        }
+        list->items = items;
+        list->cap = cap;
+    }
+    fixup_t *item = &list->items[list->count];
+    item->rel = strdup(rel);
+    item->target = target;
+    if (st) {
+        item->st = *st;
+    }
+    if (!item->rel) {
+        rc = -ENOMEM;
+        goto out;
+    }
+    list->count++;
+out:
+    pthread_mutex_unlock(&ctx->fixup_lock);
+    return rc;
+}
+
+static void fixup_free(fixup_list_t *list) {
+    for (size_t i = 0; i < list->count; i++) {
+        free(list->items[i].rel);
+        free(list->items[i].target);
+    }
+    free(list->items);
+    memset(list, 0, sizeof(*list));
+}
+
+static int copy_metadata(backup_walk_t *walk, int fd, const char *path,
+                         const struct stat *st) {
+    const char *op = NULL;
+
+    if (backup_apply_metadata(fd, path, st, &op) != 0) {
+        backup_walk_error(walk, path, op, errno);
+        return -1;
+    }
+    return 0;
+}
+
+static int fallback_errno(int err) {
+    return err == EXDEV || err == ENOSYS || err == EOPNOTSUPP ||
+           err == EINVAL || err == EBADF;
+}
+
+// Copia hasta EOF (el fichero puede haber cambiado de tamaño desde el stat)
+static int copy_data(backup_walk_t *walk, copy_worker_t *w, int in, int out,
+                     const char *path) {
+    uint64_t copied = 0;
+    ssize_t n;
+
+    while (w->method == COPY_RANGE) {
+        n = copy_file_range(in, NULL, out, NULL, COPY_CHUNK, 0);
+        if (n > 0) {
+            copied += n;
+            continue;
+        }
+        if (n == 0) {
+            goto done;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (copied == 0 && fallback_errno(errno)) {
+            w->method = COPY_SENDFILE;
+            break;
+        }
+        backup_walk_error(walk, path, "copy_file_range", errno);
+        return -1;
+    }
+
+    while (w->method == COPY_SENDFILE) {
+        n = sendfile(out, in, NULL, COPY_CHUNK);
+        if (n > 0) {
+            copied += n;
+            continue;
+        }
+        if (n == 0) {
+            goto done;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (copied == 0 && fallback_errno(errno)) {
+            w->method = COPY_BUFFER;
+            break;
+        }
+        backup_walk_error(walk, path, "sendfile", errno);
+        return -1;
+    }
+
+    for (;;) {
+        n = read(in, w->buf, BACKUP_COPY_BUFFER_SIZE);
+        if (n == 0) {
+            break;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            backup_walk_error(walk, path, "read", errno);
+            return -1;
+        }
+        for (ssize_t off = 0; off < n; ) {
+            ssize_t m = write(out, w->buf + off, n - off);
+            if (m < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                backup_walk_error(walk, path, "write", errno);
+                return -1;
+            }
+            off += m;
+        }
+        copied += n;
+    }
+
+done:
+    w->stats.bytes_copied += copied;
+    return 0;
+}
+
+static int copy_regular(backup_walk_t *walk, copy_worker_t *w, const char *src,
+                        const char *dst, const struct stat *st) {
+    int in = open(src, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (in < 0) {
+        backup_walk_error(walk, src, "open", errno);
+        return -1;
+    }
+
+    // O_EXCL: un destino existente puede ser un enlace duro a otro backup y
+    // truncarlo lo corrompería; se sustituye la entrada en su lugar
+    int flags = O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC;
+    int out = open(dst, flags, 0600);
+    if (out < 0 && errno == EEXIST && unlink(dst) == 0) {
+        out = open(dst, flags, 0600);
+    }
+    if (out < 0) {
+        backup_walk_error(walk, dst, "create", errno);
+        close(in);
+        return -1;
+    }
+
+    int rc = copy_data(walk, w, in, out, src);
+    if (rc == 0) {
+        rc = copy_metadata(walk, out, dst, st);
+    }
+    close(in);
+    if (close(out) != 0 && rc == 0) {
+        backup_walk_error(walk, dst, "close", errno);
+        rc = -1;
+    }
+    return rc;
+}
+
+static int copy_visit(backup_walk_t *walk, int worker, const char *rel,
+                      const struct stat *st, void *arg) {
+    copy_ctx_t *ctx = arg;
+    copy_worker_t *w = &ctx->workers[worker];
+    char src[PATH_MAX];
+    char dst[PATH_MAX];
+    int rc;
+
+    if (backup_join_path(src, sizeof(src), ctx->src, rel) != 0 ||
+        backup_join_path(dst, sizeof(dst), ctx->dst, rel) != 0) {
+        backup_walk_error(walk, rel, "path", ENAMETOOLONG);
+        return -1;
+    }
+
+    if (S_ISDIR(st->st_mode)) {
+        // Permisos amplios mientras se llena; los reales se aplican al final
+        if (mkdir(dst, 0700) != 0 && errno != EEXIST) {
+            backup_walk_error(walk, dst, "mkdir", errno);
+            return -1;
+        }
+        w->stats.dirs++;
+        if (fixup_add(ctx, &ctx->dirs, rel, NULL, st) != 0) {
+            backup_walk_error(walk, dst, "track", ENOMEM);
+        }
+        return 0;
+    }
+
+    if (S_ISREG(st->st_mode)) {
+        w->stats.files++;
+        w->stats.bytes_total += st->st_size;
+
+        if (st->st_nlink > 1) {
+            char *first = backup_walk_claim_link(walk, st, rel);
+            if (first) {
+                w->stats.hardlinks++;
+                if (fixup_add(ctx, &ctx->hardlinks, rel, first, NULL) != 0) {
+                    free(first);
+                    backup_walk_error(walk, dst, "track", ENOMEM);
+                }
+                return 0;
+            }
+        }
+        copy_regular(walk, w, src, dst, st);
+        return 0;
+    }
+
+    if (S_ISLNK(st->st_mode)) {
+        char target[PATH_MAX];
+        ssize_t len = readlink(src, target, sizeof(target) - 1);
+        if (len < 0) {
+            backup_walk_error(walk, src, "readlink", errno);
+            return 0;
+        }
+        target[len] = '\0';
+        rc = symlink(target, dst);
+        if (rc != 0 && errno == EEXIST && unlink(dst) == 0) {
+            rc = symlink(target, dst);
+        }
+        if (rc != 0) {
+            backup_walk_error(walk, dst, "symlink", errno);
+            return 0;
+        }
+        w->stats.symlinks++;
+        copy_metadata(walk, -1, dst, st);
+        return 0;
+    }
+
+    // fifos, sockets y dispositivos
+    rc = mknod(dst, st->st_mode, st->st_rdev);
+    if (rc != 0 && errno == EEXIST && unlink(dst) == 0) {
+        rc = mknod(dst, st->st_mode, st->st_rdev);
+    }
+    if (rc != 0) {
+        backup_walk_error(walk, dst, "mknod", errno);
+        return 0;
+    }
+    w->stats.specials++;
+    copy_metadata(walk, -1, dst, st);
+    return 0;
+}
+
+static void fixup_error(backup_copy_stats_t *stats, const char *op, const char *path) {
+    fprintf(stderr, "Backup: %s %s: %s\n", op, path, strerror(errno));
+    if (!stats->first_error[0]) {
+        snprintf(stats->first_error, sizeof(stats->first_error),
+                 "%s %s: %s", op, path, strerror(errno));
+    }
+    stats->errors++;
+}
+
+// Enlaces duros (el destino ya está copiado) y después los metadatos de los
+// directorios, de los más profundos a la raíz
+static void apply_fixups(copy_ctx_t *ctx, backup_copy_stats_t *stats) {
+    char path[PATH_MAX];
+    char target[PATH_MAX];
+    const char *op = NULL;
+
+    for (size_t i = 0; i < ctx->hardlinks.count; i++) {
+        fixup_t *item = &ctx->hardlinks.items[i];
+        if (backup_join_path(path, sizeof(path), ctx->dst, item->rel) != 0 ||
+            backup_join_path(target, sizeof(target), ctx->dst, item->target) != 0) {
+            errno = ENAMETOOLONG;
+            fixup_error(stats, "link", item->rel);
+            continue;
+        }
+        int rc = link(target, path);
+        if (rc != 0 && errno == EEXIST && unlink(path) == 0) {
+            rc = link(target, path);
+        }
+        if (rc != 0) {
+            fixup_error(stats, "link", path);
+        }
+    }
+
+    for (size_t i = ctx->dirs.count; i-- > 0; ) {
+        fixup_t *item = &ctx->dirs.items[i];
+        if (backup_join_path(path, sizeof(path), ctx->dst, item->rel) == 0 &&
+            backup_apply_metadata(-1, path, &item->st, &op) != 0) {
+            fixup_error(stats, op, path);
+        }
+    }
+}
+
+int backup_copy_tree(const char *src, const char *dst,
+                     const backup_copy_opts_t *opts, backup_copy_stats_t *stats) {
+    copy_ctx_t ctx;
+    backup_walk_stats_t ws;
+    struct timespec start;
+    struct stat st;
+    int rc = 0;
+
+    if (!src || !dst || !stats) {
+        return -EINVAL;
+    }
+    memset(stats, 0, sizeof(*stats));
+    if (lstat(src, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        snprintf(stats->first_error, sizeof(stats->first_error),
+                 "source %s is not a directory", src);
+        return -EINVAL;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.src = src;
+    ctx.dst = dst;
+    pthread_mutex_init(&ctx.fixup_lock, NULL);
+
+    int threads = backup_walk_threads(opts ? opts->threads : 0);
+    ctx.workers = calloc(threads, sizeof(copy_worker_t));
+    if (!ctx.workers) {
+        pthread_mutex_destroy(&ctx.fixup_lock);
+        return -ENOMEM;
+    }
+    for (int i = 0; i < threads && rc == 0; i++) {
+        ctx.workers[i].method = COPY_RANGE;
+        ctx.workers[i].buf = malloc(BACKUP_COPY_BUFFER_SIZE);
+        if (!ctx.workers[i].buf) {
+            rc = -ENOMEM;
+        }
+    }
+
+    if (rc == 0) {
+        rc = backup_walk_tree(src, threads, copy_visit, &ctx, &ws);
+        strncpy(stats->first_error, ws.first_error, sizeof(stats->first_error) - 1);
+        stats->errors = ws.errors;
+        stats->threads = ws.threads;
+    }
+    if (rc == 0) {
+        apply_fixups(&ctx, stats);
+    }
+
+    for (int i = 0; i < threads; i++) {
+        copy_worker_t *w = &ctx.workers[i];
+        stats->files += w->stats.files;
+        stats->dirs += w->stats.dirs;
+        stats->symlinks += w->stats.symlinks;
+        stats->specials += w->stats.specials;
+        stats->hardlinks += w->stats.hardlinks;
+        stats->bytes_total += w->stats.bytes_total;
+        stats->bytes_copied += w->stats.bytes_copied;
+        free(w->buf);
+    }
+    stats->elapsed_s = elapsed_since(&start);
+
+    fixup_free(&ctx.dirs);
+    fixup_free(&ctx.hardlinks);
+    free(ctx.workers);
+    pthread_mutex_destroy(&ctx.fixup_lock);
+
+    if (rc != 0) {
+        return rc;
+    }
+    return stats->errors ? -1 : 0;
+}
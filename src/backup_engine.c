@@ -1,4 +1,7 @@
 #include "backup_engine.h"
+#include "backup_copy.h"
+#include "backup_manifest.h"
+#include "backup_repo.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,12 +13,8 @@
 #include <dirent.h>
 #include <pthread.h>
 #include <sqlite3.h>
-#include <openssl/sha.h>
-#include <openssl/evp.h>
-
-// Silenciar warnings de deprecación
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+#include <fcntl.h>
+#include <limits.h>
 
 #define BACKUP_DB_PATH "/var/lib/storage_mgr/backups.db"
 #define BACKUP_BASE_DIR "/backup"
@@ -24,6 +23,7 @@ static sqlite3 *backup_db = NULL;
 static pthread_t scheduler_thread = 0;
 static int scheduler_active = 0;
 static pthread_mutex_t backup_mutex = PTHREAD_MUTEX_INITIALIZER;
+static backup_config_t backup_config;
 
 // Generar ID único para backup
 char* backup_generate_id(void) {
@@ -40,34 +40,25 @@ char* backup_generate_id(void) {
 
 // Calcular SHA256 checksum
 int backup_calculate_checksum(const char *path, char *checksum_out) {
-    FILE *fp = fopen(path, "rb");
-    if (!fp) {
-        perror("fopen");
-        return -1;
-    }
-    
-    unsigned char hash[SHA256_DIGEST_LENGTH];
-    SHA256_CTX sha256;
-    SHA256_Init(&sha256);
-    
-    unsigned char buffer[8192];
-    size_t bytes;
+    backup_hash_t hash;
     
-    while ((bytes = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
-        SHA256_Update(&sha256, buffer, bytes);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror("open");
+        return -1;
     }
     
-    SHA256_Final(hash, &sha256);
-    fclose(fp);
-    
-    // Convertir a hexadecimal
-    for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
-        sprintf(checksum_out + (i * 2), "%02x", hash[i]);
+    uint8_t *buffer = malloc(BACKUP_HASH_BUFFER);
+    int rc = buffer ? backup_hash_fd(fd, buffer, BACKUP_HASH_BUFFER, hash) : -ENOMEM;
+    free(buffer);
+    close(fd);
+    if (rc != 0) {
+        fprintf(stderr, "Cannot hash %s: %s\n", path, strerror(-rc));
+        return -1;
     }
-    checksum_out[64] = '\0';
     
+    backup_hash_hex(hash, checksum_out);
     return 0;
-    #pragma GCC diagnostic pop
 }
 
 // Calcular tamaño de directorio
@@ -87,8 +78,58 @@ unsigned long long backup_get_directory_size(const char *path) {
     return total_size;
 }
 
+void backup_config_defaults(backup_config_t *config) {
+    if (!config) {
+        return;
+    }
+
+    memset(config, 0, sizeof(backup_config_t));
+    strncpy(config->db_path, BACKUP_DB_PATH, sizeof(config->db_path) - 1);
+    config->copy_threads = 0;
+    config->format = BACKUP_FORMAT_TREE;
+    config->verify_sample_percent = 100;
+    config->verify_rate_limit_mb = 0;
+}
+
+// Añade una columna al catálogo si una versión anterior la creó sin ella
+static int ensure_column(const char *table, const char *column, const char *type) {
+    char sql[256];
+    sqlite3_stmt *stmt;
+    int exists = 0;
+
+    snprintf(sql, sizeof(sql), "PRAGMA table_info(%s);", table);
+    if (sqlite3_prepare_v2(backup_db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        return -1;
+    }
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        const char *name = (const char*)sqlite3_column_text(stmt, 1);
+        if (name && strcmp(name, column) == 0) {
+            exists = 1;
+            break;
+        }
+    }
+    sqlite3_finalize(stmt);
+
+    if (exists) {
+        return 0;
+    }
+
+    snprintf(sql, sizeof(sql), "ALTER TABLE %s ADD COLUMN %s %s;", table, column, type);
+    return sqlite3_exec(backup_db, sql, NULL, NULL, NULL) == SQLITE_OK ? 0 : -1;
+}
+
 // Inicialización
 int backup_init(const char *db_path) {
+    backup_config_t config;
+
+    backup_config_defaults(&config);
+    if (db_path) {
+        strncpy(config.db_path, db_path, sizeof(config.db_path) - 1);
+    }
+    return backup_init_with_config(&config);
+}
+
+int backup_init_with_config(const backup_config_t *config) {
     int rc;
     const char *sql_create =
         "CREATE TABLE IF NOT EXISTS backups ("
@@ -117,8 +158,19 @@ int backup_init(const char *db_path) {
     system("mkdir -p /var/lib/storage_mgr");
     system("mkdir -p " BACKUP_BASE_DIR);
     
-    const char *path = db_path ? db_path : BACKUP_DB_PATH;
-    rc = sqlite3_open(path, &backup_db);
+    if (config) {
+        backup_config = *config;
+    } else {
+        backup_config_defaults(&backup_config);
+    }
+    if (backup_config.db_path[0] == '\0') {
+        strncpy(backup_config.db_path, BACKUP_DB_PATH, sizeof(backup_config.db_path) - 1);
+    }
+    if (backup_config.verify_sample_percent <= 0 || backup_config.verify_sample_percent > 100) {
+        backup_config.verify_sample_percent = 100;
+    }
+
+    rc = sqlite3_open(backup_config.db_path, &backup_db);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Cannot open backup database: %s\n", sqlite3_errmsg(backup_db));
         return -1;
@@ -133,6 +185,11 @@ int backup_init(const char *db_path) {
         return -1;
     }
     
+    ensure_column("backups", "format", "INTEGER DEFAULT 0");
+    ensure_column("backups", "logical_bytes", "INTEGER");
+    ensure_column("backups", "stored_bytes", "INTEGER");
+    ensure_column("backups", "verify_offset", "INTEGER DEFAULT 0");
+    
     printf("Backup: Initialized successfully\n");
     return 0;
 }
@@ -241,22 +298,217 @@ int backup_unmount_snapshot(const char *mount_point) {
     return 0;
 }
 
-// Crear backup (full o incremental)
+// Backup de referencia para incrementales (el último correcto de la misma
+// fuente) y diferenciales (el último full correcto)
+static int backup_find_parent(const char *source, backup_type_t type,
+                              backup_info_t *parent) {
+    backup_info_t *backups = NULL;
+    int count = 0;
+    int found = 0;
+
+    if (backup_list(&backups, &count) != 0) {
+        return 0;
+    }
+    for (int i = 0; i < count && !found; i++) {
+        if (!backups[i].success || strcmp(backups[i].source_path, source) != 0) {
+            continue;
+        }
+        if (type == BACKUP_DIFFERENTIAL && backups[i].type != BACKUP_FULL) {
+            continue;
+        }
+        if (backups[i].format != backup_config.format) {
+            continue;
+        }
+        *parent = backups[i];
+        found = 1;
+    }
+    free(backups);
+    return found;
+}
+
+static void backup_print_copy_stats(const backup_copy_stats_t *cs) {
+    double mb = cs->bytes_copied / (1024.0 * 1024.0);
+
+    printf("Files:    %llu (%llu dirs, %llu symlinks, %llu hardlinks)\n",
+           (unsigned long long)cs->files, (unsigned long long)cs->dirs,
+           (unsigned long long)cs->symlinks, (unsigned long long)cs->hardlinks);
+    if (cs->linked) {
+        printf("Unchanged: %llu files linked from previous backup\n",
+               (unsigned long long)cs->linked);
+    }
+    printf("Copied:   %.2f MB in %.2f s (%.1f MB/s, %d threads)\n",
+           mb, cs->elapsed_s, cs->elapsed_s > 0 ? mb / cs->elapsed_s : 0.0,
+           cs->threads);
+    if (cs->errors) {
+        printf("Errors:   %llu (first: %s)\n",
+               (unsigned long long)cs->errors, cs->first_error);
+    }
+}
+
+static void backup_print_repo_stats(const backup_repo_stats_t *rs, const char *verb) {
+    double mb = rs->logical_bytes / (1024.0 * 1024.0);
+
+    printf("Files:    %llu (%llu dirs, %llu symlinks, %llu hardlinks)\n",
+           (unsigned long long)rs->files, (unsigned long long)rs->dirs,
+           (unsigned long long)rs->symlinks, (unsigned long long)rs->hardlinks);
+    if (rs->unchanged) {
+        printf("Unchanged: %llu files reused from previous manifest\n",
+               (unsigned long long)rs->unchanged);
+    }
+    printf("Chunks:   %llu (%llu new, %.2f MB stored)\n",
+           (unsigned long long)rs->chunks, (unsigned long long)rs->new_chunks,
+           rs->stored_bytes / (1024.0 * 1024.0));
+    printf("%s %.2f MB in %.2f s (%.1f MB/s, %d threads)\n",
+           verb, mb, rs->elapsed_s, rs->elapsed_s > 0 ? mb / rs->elapsed_s : 0.0,
+           rs->threads);
+    if (rs->errors) {
+        printf("Errors:   %llu (first: %s)\n",
+               (unsigned long long)rs->errors, rs->first_error);
+    }
+}
+
+// El manifiesto de un backup chunked está en <repo>/manifests/<id>.manifest
+static void backup_repo_dir(const backup_info_t *info, char *out, size_t size) {
+    strncpy(out, info->dest_path, size - 1);
+    out[size - 1] = '\0';
+    for (int i = 0; i < 2; i++) {
+        char *slash = strrchr(out, '/');
+        if (slash) {
+            *slash = '\0';
+        }
+    }
+}
+
+// Backup en árbol: recorrido solo de metadatos, cruce con el manifiesto del
+// backup anterior y copia de lo que cambió (con su hash); lo demás se enlaza
+// desde link_dest. La raíz Merkle del manifiesto es el checksum del backup
+// y el manifiesto se guarda junto al directorio.
+static int backup_store_tree(backup_info_t *info, const char *source,
+                             const char *prev_manifest, const backup_copy_opts_t *opts,
+                             backup_copy_stats_t *cs) {
+    backup_manifest_t manifest;
+    backup_manifest_t prev;
+    backup_walk_stats_t ws;
+    backup_hash_t root;
+    char manifest_path[PATH_MAX];
+    size_t changed;
+    
+    memset(cs, 0, sizeof(*cs));
+    int rc = backup_manifest_scan(source, opts->threads, 0, &manifest, &ws);
+    if (rc != 0) {
+        snprintf(info->error_msg, sizeof(info->error_msg), "scan failed: %.200s",
+                 ws.first_error[0] ? ws.first_error : strerror(rc < 0 ? -rc : EIO));
+        backup_manifest_free(&manifest);
+        return rc;
+    }
+    if (prev_manifest && backup_manifest_load(prev_manifest, &prev) == 0) {
+        changed = backup_manifest_join(&manifest, &prev);
+        backup_manifest_free(&prev);
+    } else {
+        changed = backup_manifest_join(&manifest, NULL);
+    }
+    printf("Scanned:  %llu entries in %.2f s, %llu files to read\n",
+           (unsigned long long)ws.entries, ws.elapsed_s, (unsigned long long)changed);
+    
+    rc = backup_manifest_copy(source, info->dest_path, &manifest, opts, cs);
+    cs->errors += ws.errors;
+    if (ws.errors && ws.first_error[0]) {
+        strncpy(cs->first_error, ws.first_error, sizeof(cs->first_error) - 1);
+    }
+    backup_print_copy_stats(cs);
+    if (rc == 0 && ws.errors) {
+        rc = -1;
+    }
+    if (rc == 0) {
+        backup_manifest_root(&manifest, root);
+        backup_hash_hex(root, info->checksum);
+        snprintf(manifest_path, sizeof(manifest_path), "%s.manifest", info->dest_path);
+        rc = backup_manifest_write(manifest_path, &manifest);
+        if (rc != 0) {
+            // La ruta ya está en dest_path; el mensaje solo lleva la causa
+            snprintf(info->error_msg, sizeof(info->error_msg),
+                     "cannot write manifest: %s", strerror(-rc));
+        }
+    } else {
+        snprintf(info->error_msg, sizeof(info->error_msg), "%s",
+                 cs->first_error[0] ? cs->first_error : "copy failed");
+    }
+    backup_manifest_free(&manifest);
+    return rc;
+}
+
+// Ventana de muestreo de la próxima verificación
+static int backup_get_verify_offset(const char *backup_id) {
+    sqlite3_stmt *stmt;
+    int offset = 0;
+    
+    if (sqlite3_prepare_v2(backup_db, "SELECT verify_offset FROM backups WHERE backup_id = ?;",
+                           -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, backup_id, -1, SQLITE_STATIC);
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            offset = sqlite3_column_int(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+    return offset;
+}
+
+static void backup_set_verify_offset(const char *backup_id, int offset) {
+    sqlite3_stmt *stmt;
+    
+    if (sqlite3_prepare_v2(backup_db, "UPDATE backups SET verify_offset = ? WHERE backup_id = ?;",
+                           -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_int(stmt, 1, offset);
+        sqlite3_bind_text(stmt, 2, backup_id, -1, SQLITE_STATIC);
+        sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+    }
+}
+
+// Crear backup (full, incremental o diferencial)
 int backup_create(const char *source, const char *dest, backup_type_t type) {
     backup_info_t info;
-    char cmd[2048];
-    char dest_path[512];
+    backup_info_t parent;
+    backup_copy_opts_t opts;
+    backup_copy_stats_t cs;
+    backup_repo_stats_t rs;
+    char cmd[PATH_MAX + 16];
+    char dest_path[PATH_MAX];
+    char repo_dir[PATH_MAX] = "";
+    char prev_manifest[PATH_MAX] = "";
     time_t now = time(NULL);
+    int len;
+    int rc;
     
     memset(&info, 0, sizeof(info));
     strcpy(info.backup_id, backup_generate_id());
+    // Dos backups en el mismo segundo tendrían el mismo ID
+    for (int n = 2; backup_get_info(info.backup_id, &parent) == 0; n++) {
+        snprintf(info.backup_id, sizeof(info.backup_id), "%s-%d", backup_generate_id(), n);
+    }
     info.timestamp = now;
     info.type = type;
+    info.format = backup_config.format;
     strncpy(info.source_path, source, sizeof(info.source_path) - 1);
     
+    // El destino se guarda en el catálogo (dest_path): sin truncar
+    if (info.format == BACKUP_FORMAT_CHUNKED) {
+        len = snprintf(repo_dir, sizeof(repo_dir), "%s/" BACKUP_REPO_NAME, dest);
+        if (len >= 0 && len < (int)sizeof(repo_dir)) {
+            len = snprintf(dest_path, sizeof(dest_path), "%s/manifests/%s.manifest",
+                           repo_dir, info.backup_id);
+        }
+    } else {
+        len = snprintf(dest_path, sizeof(dest_path), "%s/%s", dest, info.backup_id);
+    }
+    if (len < 0 || len >= (int)sizeof(info.dest_path)) {
+        fprintf(stderr, "Backup destination path too long: %s\n", dest);
+        return -1;
+    }
+    
     // Crear directorio de destino
-    snprintf(dest_path, sizeof(dest_path), "%s/%s", dest, info.backup_id);
-    snprintf(cmd, sizeof(cmd), "mkdir -p \"%s\"", dest_path);
+    snprintf(cmd, sizeof(cmd), "mkdir -p \"%s\"",
+             info.format == BACKUP_FORMAT_CHUNKED ? dest : dest_path);
     system(cmd);
     
     strncpy(info.dest_path, dest_path, sizeof(info.dest_path) - 1);
@@ -265,75 +517,78 @@ int backup_create(const char *source, const char *dest, backup_type_t type) {
     printf("ID:     %s\n", info.backup_id);
     printf("Type:   %s\n", type == BACKUP_FULL ? "FULL" : 
            type == BACKUP_INCREMENTAL ? "INCREMENTAL" : "DIFFERENTIAL");
+    printf("Format: %s\n", info.format == BACKUP_FORMAT_CHUNKED ? "CHUNKED" : "TREE");
     printf("Source: %s\n", source);
     printf("Dest:   %s\n", dest_path);
     
-    // Construir comando rsync según el tipo
-    if (type == BACKUP_FULL) {
-        snprintf(cmd, sizeof(cmd),
-                 "rsync -av --stats \"%s/\" \"%s/\" 2>&1",
-                 source, dest_path);
-    } else if (type == BACKUP_INCREMENTAL) {
-        // Buscar último backup para link-dest
-        backup_info_t *backups = NULL;
-        int count = 0;
-        
-        if (backup_list(&backups, &count) == 0 && count > 0) {
-            // Usar el backup más reciente como referencia
-            strncpy(info.parent_backup_id, backups[0].backup_id,
+    memset(&opts, 0, sizeof(opts));
+    opts.threads = backup_config.copy_threads;
+    
+    // Incremental y diferencial: el manifiesto del backup de referencia
+    // dice qué ficheros no cambiaron, y esos no se abren. En árbol se
+    // enlazan desde su directorio; en el repositorio se reutilizan sus
+    // chunks (solo si el padre está en el mismo repositorio).
+    if (type != BACKUP_FULL) {
+        if (backup_find_parent(source, type, &parent)) {
+            strncpy(info.parent_backup_id, parent.backup_id,
                    sizeof(info.parent_backup_id) - 1);
-            
-            snprintf(cmd, sizeof(cmd),
-                     "rsync -av --stats --link-dest=\"%s\" \"%s/\" \"%s/\" 2>&1",
-                     backups[0].dest_path, source, dest_path);
-            
-            free(backups);
+            if (info.format == BACKUP_FORMAT_CHUNKED) {
+                char parent_repo[PATH_MAX];
+                backup_repo_dir(&parent, parent_repo, sizeof(parent_repo));
+                if (strcmp(parent_repo, repo_dir) == 0) {
+                    snprintf(prev_manifest, sizeof(prev_manifest), "%s", parent.dest_path);
+                }
+            } else {
+                opts.link_dest = parent.dest_path;
+                snprintf(prev_manifest, sizeof(prev_manifest), "%s.manifest", parent.dest_path);
+            }
+            printf("Parent: %s\n", parent.backup_id);
         } else {
             // Si no hay backup previo, hacer full
             printf("No previous backup found, performing full backup\n");
-            snprintf(cmd, sizeof(cmd),
-                     "rsync -av --stats \"%s/\" \"%s/\" 2>&1",
-                     source, dest_path);
         }
     }
-    
-    printf("\nExecuting: %s\n\n", cmd);
-    
-    FILE *fp = popen(cmd, "r");
-    if (!fp) {
-        perror("popen");
-        info.success = 0;
-        snprintf(info.error_msg, sizeof(info.error_msg), "Failed to execute rsync");
-        goto save_info;
-    }
-    
-    char line[512];
-    while (fgets(line, sizeof(line), fp)) {
-        printf("%s", line);
+    printf("\n");
+    
+    if (info.format == BACKUP_FORMAT_CHUNKED) {
+        rc = backup_repo_store(repo_dir, source, dest_path, prev_manifest, opts.threads, &rs);
+        backup_print_repo_stats(&rs, "Read:    ");
+        info.logical_bytes = rs.logical_bytes;
+        info.stored_bytes = rs.stored_bytes;
+        if (rc == 0) {
+            backup_hash_hex(rs.root, info.checksum);
+        } else {
+            snprintf(info.error_msg, sizeof(info.error_msg), "%s",
+                     rs.first_error[0] ? rs.first_error : "store failed");
+        }
+    } else {
+        rc = backup_store_tree(&info, source, prev_manifest[0] ? prev_manifest : NULL,
+                               &opts, &cs);
+        // Los ficheros enlazados cuentan en el tamaño lógico pero no ocupan
+        info.logical_bytes = cs.bytes_total;
+        info.stored_bytes = cs.bytes_copied;
     }
     
-    int status = pclose(fp);
-    if (status == 0) {
+    if (rc == 0) {
         info.success = 1;
+        printf("Checksum: %s\n", info.checksum);
         printf("\nBackup completed successfully!\n");
     } else {
         info.success = 0;
-        snprintf(info.error_msg, sizeof(info.error_msg), 
-                 "rsync failed with exit code %d", status);
         fprintf(stderr, "\nBackup failed!\n");
     }
     
-    // Calcular tamaño y checksum
-    info.size_bytes = backup_get_directory_size(dest_path);
-    printf("Backup size: %.2f MB\n", info.size_bytes / (1024.0 * 1024.0));
+    info.size_bytes = info.logical_bytes;
+    printf("Backup size: %.2f MB (%.2f MB stored)\n",
+           info.logical_bytes / (1024.0 * 1024.0), info.stored_bytes / (1024.0 * 1024.0));
     
-save_info:
     // Guardar info en base de datos
     if (backup_db) {
         const char *sql = "INSERT INTO backups "
                          "(backup_id, timestamp, type, source_path, dest_path, "
-                         "size_bytes, checksum, success, error_msg, parent_backup_id) "
-                         "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
+                         "size_bytes, checksum, success, error_msg, parent_backup_id, "
+                         "format, logical_bytes, stored_bytes) "
+                         "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
         
         sqlite3_stmt *stmt;
         if (sqlite3_prepare_v2(backup_db, sql, -1, &stmt, NULL) == SQLITE_OK) {
@@ -347,6 +602,9 @@ save_info:
             sqlite3_bind_int(stmt, 8, info.success);
             sqlite3_bind_text(stmt, 9, info.error_msg, -1, SQLITE_STATIC);
             sqlite3_bind_text(stmt, 10, info.parent_backup_id, -1, SQLITE_STATIC);
+            sqlite3_bind_int(stmt, 11, info.format);
+            sqlite3_bind_int64(stmt, 12, info.logical_bytes);
+            sqlite3_bind_int64(stmt, 13, info.stored_bytes);
             
             sqlite3_step(stmt);
             sqlite3_finalize(stmt);
@@ -401,8 +659,9 @@ int backup_list(backup_info_t **backups, int *count) {
     }
     
     const char *sql = "SELECT backup_id, timestamp, type, source_path, dest_path, "
-                     "size_bytes, checksum, success, error_msg, parent_backup_id "
-                     "FROM backups ORDER BY timestamp DESC;";
+                     "size_bytes, checksum, success, error_msg, parent_backup_id, "
+                     "format, logical_bytes, stored_bytes "
+                     "FROM backups ORDER BY timestamp DESC, rowid DESC;";
     
     sqlite3_stmt *stmt;
     if (sqlite3_prepare_v2(backup_db, sql, -1, &stmt, NULL) != SQLITE_OK) {
@@ -429,6 +688,7 @@ int backup_list(backup_info_t **backups, int *count) {
         return -ENOMEM;
     }
     
+    memset(*backups, 0, *count * sizeof(backup_info_t));
     int i = 0;
     while (sqlite3_step(stmt) == SQLITE_ROW && i < *count) {
         const char *text;
@@ -462,6 +722,16 @@ int backup_list(backup_info_t **backups, int *count) {
             strncpy((*backups)[i].parent_backup_id, text, 
                    sizeof((*backups)[i].parent_backup_id) - 1);
         
+        (*backups)[i].format = sqlite3_column_int(stmt, 10);
+        // Filas anteriores a estas columnas: todo lo respaldado se copió
+        if (sqlite3_column_type(stmt, 11) == SQLITE_NULL) {
+            (*backups)[i].logical_bytes = (*backups)[i].size_bytes;
+            (*backups)[i].stored_bytes = (*backups)[i].size_bytes;
+        } else {
+            (*backups)[i].logical_bytes = sqlite3_column_int64(stmt, 11);
+            (*backups)[i].stored_bytes = sqlite3_column_int64(stmt, 12);
+        }
+        
         i++;
     }
     
@@ -476,7 +746,8 @@ int backup_get_info(const char *backup_id, backup_info_t *info) {
     }
     
     const char *sql = "SELECT timestamp, type, source_path, dest_path, "
-                     "size_bytes, checksum, success, error_msg, parent_backup_id "
+                     "size_bytes, checksum, success, error_msg, parent_backup_id, "
+                     "format, logical_bytes, stored_bytes "
                      "FROM backups WHERE backup_id = ?;";
     
     sqlite3_stmt *stmt;
@@ -514,14 +785,34 @@ int backup_get_info(const char *backup_id, backup_info_t *info) {
     if (text)
         strncpy(info->error_msg, text, sizeof(info->error_msg) - 1);
     
+    text = (const char*)sqlite3_column_text(stmt, 8);
+    if (text)
+        strncpy(info->parent_backup_id, text, sizeof(info->parent_backup_id) - 1);
+    
+    info->format = sqlite3_column_int(stmt, 9);
+    if (sqlite3_column_type(stmt, 10) == SQLITE_NULL) {
+        info->logical_bytes = info->size_bytes;
+        info->stored_bytes = info->size_bytes;
+    } else {
+        info->logical_bytes = sqlite3_column_int64(stmt, 10);
+        info->stored_bytes = sqlite3_column_int64(stmt, 11);
+    }
+    
     sqlite3_finalize(stmt);
     return 0;
 }
 
-// Verificar backup
-int backup_verify(const char *backup_id) {
+// Verificar backup: relee los datos contra el manifiesto
+int backup_verify_with_report(const char *backup_id, backup_verify_report_t *report) {
     backup_info_t info;
+    backup_verify_opts_t opts;
+    backup_manifest_t manifest;
+    backup_hash_t root;
+    char manifest_path[512];
+    char hex[65];
+    int rc;
     
+    memset(report, 0, sizeof(*report));
     if (backup_get_info(backup_id, &info) != 0) {
         fprintf(stderr, "Backup not found: %s\n", backup_id);
         return -1;
@@ -530,30 +821,100 @@ int backup_verify(const char *backup_id) {
     printf("Verifying backup: %s\n", backup_id);
     printf("Path: %s\n", info.dest_path);
     
-    // Verificar que el directorio existe
-    struct stat st;
-    if (stat(info.dest_path, &st) != 0) {
-        fprintf(stderr, "Backup directory not found!\n");
-        return -1;
+    if (info.format == BACKUP_FORMAT_CHUNKED) {
+        snprintf(manifest_path, sizeof(manifest_path), "%s", info.dest_path);
+    } else {
+        snprintf(manifest_path, sizeof(manifest_path), "%s.manifest", info.dest_path);
     }
     
-    // Verificar tamaño
-    unsigned long long current_size = backup_get_directory_size(info.dest_path);
-    printf("Recorded size: %.2f MB\n", info.size_bytes / (1024.0 * 1024.0));
-    printf("Current size:  %.2f MB\n", current_size / (1024.0 * 1024.0));
+    // Backups en árbol anteriores a los manifiestos: solo se puede
+    // comprobar que existen y no están vacíos
+    if (info.format == BACKUP_FORMAT_TREE && access(manifest_path, F_OK) != 0) {
+        struct stat st;
+        if (stat(info.dest_path, &st) != 0) {
+            fprintf(stderr, "Backup directory not found!\n");
+            return -1;
+        }
+        unsigned long long current_size = backup_get_directory_size(info.dest_path);
+        printf("No manifest, checking size only\n");
+        printf("Recorded size: %.2f MB\n", info.size_bytes / (1024.0 * 1024.0));
+        printf("Current size:  %.2f MB\n", current_size / (1024.0 * 1024.0));
+        if (current_size == 0) {
+            fprintf(stderr, "Warning: Backup appears to be empty!\n");
+            return -1;
+        }
+        printf("Backup verification passed!\n");
+        return 0;
+    }
     
-    if (current_size == 0) {
-        fprintf(stderr, "Warning: Backup appears to be empty!\n");
+    // El manifiesto debe ser el que se registró al crear el backup
+    rc = backup_manifest_load(manifest_path, &manifest);
+    if (rc != 0) {
+        fprintf(stderr, "Cannot read manifest %s: %s\n", manifest_path, strerror(-rc));
         return -1;
     }
+    backup_manifest_root(&manifest, root);
+    backup_manifest_free(&manifest);
+    backup_hash_hex(root, hex);
+    if (info.checksum[0] && strcmp(hex, info.checksum) != 0) {
+        fprintf(stderr, "Manifest root %s does not match recorded checksum %s\n",
+               hex, info.checksum);
+        return -1;
+    }
+    
+    backup_verify_opts_defaults(&opts);
+    opts.threads = backup_config.copy_threads;
+    opts.sample_percent = backup_config.verify_sample_percent;
+    opts.rate_limit_mb = backup_config.verify_rate_limit_mb;
+    opts.sample_offset = backup_get_verify_offset(backup_id);
+    if (opts.sample_percent < 100) {
+        printf("Sampling %d%% of files (window starts at %d)\n",
+               opts.sample_percent, opts.sample_offset);
+    }
     
+    if (info.format == BACKUP_FORMAT_CHUNKED) {
+        char repo_dir[PATH_MAX];
+        backup_repo_dir(&info, repo_dir, sizeof(repo_dir));
+        rc = backup_repo_verify(repo_dir, manifest_path, &opts, report);
+    } else {
+        rc = backup_verify_tree(manifest_path, info.dest_path, &opts, report);
+    }
+    
+    double mb = report->bytes_read / (1024.0 * 1024.0);
+    printf("Checked:  %llu of %llu entries (%llu outside sample)\n",
+           (unsigned long long)report->checked, (unsigned long long)report->entries,
+           (unsigned long long)report->sampled_out);
+    printf("Read:     %.2f MB in %.2f s (%.1f MB/s, %d threads)\n",
+           mb, report->elapsed_s, report->elapsed_s > 0 ? mb / report->elapsed_s : 0.0,
+           report->threads);
+    
+    // La próxima pasada muestrea la ventana siguiente
+    if (opts.sample_percent < 100) {
+        backup_set_verify_offset(backup_id, (opts.sample_offset + opts.sample_percent) % 100);
+    }
+    
+    if (rc != 0) {
+        fprintf(stderr, "Backup verification FAILED: %llu mismatches\n",
+                (unsigned long long)report->mismatches);
+        return -1;
+    }
     printf("Backup verification passed!\n");
     return 0;
 }
 
+int backup_verify(const char *backup_id) {
+    backup_verify_report_t report;
+    
+    int rc = backup_verify_with_report(backup_id, &report);
+    backup_verify_report_free(&report);
+    return rc;
+}
+
 // Restaurar backup
 int backup_restore(const char *backup_id, const char *dest) {
     backup_info_t info;
+    backup_copy_opts_t opts;
+    backup_copy_stats_t cs;
     char cmd[2048];
     
     if (backup_get_info(backup_id, &info) != 0) {
@@ -570,26 +931,23 @@ int backup_restore(const char *backup_id, const char *dest) {
     snprintf(cmd, sizeof(cmd), "mkdir -p \"%s\"", dest);
     system(cmd);
     
-    // Usar rsync para restaurar
-    snprintf(cmd, sizeof(cmd),
-             "rsync -av --stats \"%s/\" \"%s/\" 2>&1",
-             info.dest_path, dest);
-    
-    printf("\nExecuting: %s\n\n", cmd);
+    memset(&opts, 0, sizeof(opts));
+    opts.threads = backup_config.copy_threads;
     
-    FILE *fp = popen(cmd, "r");
-    if (!fp) {
-        perror("popen");
-        return -1;
-    }
-    
-    char line[512];
-    while (fgets(line, sizeof(line), fp)) {
-        printf("%s", line);
+    printf("\n");
+    int rc;
+    if (info.format == BACKUP_FORMAT_CHUNKED) {
+        backup_repo_stats_t rs;
+        char repo_dir[PATH_MAX];
+        backup_repo_dir(&info, repo_dir, sizeof(repo_dir));
+        rc = backup_repo_restore(repo_dir, info.dest_path, dest, opts.threads, &rs);
+        backup_print_repo_stats(&rs, "Restored:");
+    } else {
+        rc = backup_copy_tree(info.dest_path, dest, &opts, &cs);
+        backup_print_copy_stats(&cs);
     }
     
-    int status = pclose(fp);
-    if (status != 0) {
+    if (rc != 0) {
         fprintf(stderr, "\nRestore failed!\n");
         return -1;
     }
@@ -619,10 +977,17 @@ int backup_cleanup_old(int keep_count) {
     for (int i = keep_count; i < count; i++) {
         printf("Removing backup: %s\n", backups[i].backup_id);
         
-        // Eliminar directorio
-        char cmd[512];
-        snprintf(cmd, sizeof(cmd), "rm -rf \"%s\"", backups[i].dest_path);
-        system(cmd);
+        // Eliminar directorio, o el manifiesto si está en un repositorio
+        if (backups[i].format == BACKUP_FORMAT_CHUNKED) {
+            unlink(backups[i].dest_path);
+        } else {
+            char cmd[512];
+            char manifest_path[PATH_MAX];
+            snprintf(cmd, sizeof(cmd), "rm -rf \"%s\"", backups[i].dest_path);
+            system(cmd);
+            snprintf(manifest_path, sizeof(manifest_path), "%s.manifest", backups[i].dest_path);
+            unlink(manifest_path);
+        }
         
         // Eliminar de DB
         if (backup_db) {
@@ -636,6 +1001,29 @@ int backup_cleanup_old(int keep_count) {
         }
     }
     
+    // Los chunks que ya no referencia ningún manifiesto se liberan una vez
+    // por repositorio
+    for (int i = keep_count; i < count; i++) {
+        char repo_dir[PATH_MAX];
+        int seen = 0;
+        uint64_t freed = 0;
+        
+        if (backups[i].format != BACKUP_FORMAT_CHUNKED) {
+            continue;
+        }
+        backup_repo_dir(&backups[i], repo_dir, sizeof(repo_dir));
+        for (int j = keep_count; j < i && !seen; j++) {
+            char other[PATH_MAX];
+            if (backups[j].format == BACKUP_FORMAT_CHUNKED) {
+                backup_repo_dir(&backups[j], other, sizeof(other));
+                seen = strcmp(other, repo_dir) == 0;
+            }
+        }
+        if (!seen && backup_repo_gc(repo_dir, &freed) == 0) {
+            printf("Repository %s: %.2f MB freed\n", repo_dir, freed / (1024.0 * 1024.0));
+        }
+    }
+    
     free(backups);
     printf("Cleanup completed\n");
     return 0;
@@ -0,0 +1,1066 @@
+#include "backup_manifest.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <openssl/evp.h>
+
+#define MANIFEST_IO_BUFFER (1024 * 1024)
+#define MANIFEST_HAS_HASH  0x1      // el registro va seguido del hash del contenido
+#define MERKLE_MAX_DEPTH   64
+#define MANIFEST_V2_HEADER 32       // tamaños de cabecera y registro antes de la versión 3
+#define MANIFEST_V2_RECORD 64
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t logical_bytes;
+    int64_t created_sec;        // desde la versión 3
+    uint32_t created_nsec;
+    uint32_t reserved2;
+} manifest_header_t;
+
+typedef struct {
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t nchunks;
+    uint64_t size;
+    uint64_t rdev;
+    int64_t atime_sec;
+    int64_t mtime_sec;
+    uint32_t atime_nsec;
+    uint32_t mtime_nsec;
+    uint16_t path_len;
+    uint16_t target_len;
+    uint32_t flags;             // reservado (0) en la versión 1
+    uint64_t ino;               // desde la versión 3
+    int64_t ctime_sec;
+    uint32_t ctime_nsec;
+    uint32_t reserved;
+} manifest_record_t;
+
+_Static_assert(sizeof(manifest_header_t) == 48, "cabecera de manifiesto");
+_Static_assert(sizeof(manifest_record_t) == 88, "registro de manifiesto");
+
+void backup_manifest_entry_init(backup_manifest_entry_t *entry, const struct stat *st) {
+    memset(entry, 0, sizeof(*entry));
+    entry->mode = st->st_mode;
+    entry->uid = st->st_uid;
+    entry->gid = st->st_gid;
+    entry->size = S_ISREG(st->st_mode) ? (uint64_t)st->st_size : 0;
+    entry->rdev = st->st_rdev;
+    entry->atime_sec = st->st_atim.tv_sec;
+    entry->atime_nsec = st->st_atim.tv_nsec;
+    entry->mtime_sec = st->st_mtim.tv_sec;
+    entry->mtime_nsec = st->st_mtim.tv_nsec;
+    entry->ino = st->st_ino;
+    entry->ctime_sec = st->st_ctim.tv_sec;
+    entry->ctime_nsec = st->st_ctim.tv_nsec;
+}
+
+void backup_manifest_entry_stat(const backup_manifest_entry_t *entry, struct stat *st) {
+    memset(st, 0, sizeof(*st));
+    st->st_mode = entry->mode;
+    st->st_uid = entry->uid;
+    st->st_gid = entry->gid;
+    st->st_size = entry->size;
+    st->st_rdev = entry->rdev;
+    st->st_atim.tv_sec = entry->atime_sec;
+    st->st_atim.tv_nsec = entry->atime_nsec;
+    st->st_mtim.tv_sec = entry->mtime_sec;
+    st->st_mtim.tv_nsec = entry->mtime_nsec;
+}
+
+int backup_manifest_is_hardlink(const backup_manifest_entry_t *entry) {
+    return S_ISREG(entry->mode) && entry->target != NULL;
+}
+
+void backup_manifest_init(backup_manifest_t *manifest) {
+    memset(manifest, 0, sizeof(*manifest));
+}
+
+static void entry_free(backup_manifest_entry_t *entry) {
+    free(entry->path);
+    free(entry->target);
+    free(entry->chunks);
+}
+
+static int manifest_reserve(backup_manifest_t *manifest, size_t count) {
+    if (count <= manifest->cap) {
+        return 0;
+    }
+    size_t cap = manifest->cap ? manifest->cap : 1024;
+    while (cap < count) {
+        cap *= 2;
+    }
+    backup_manifest_entry_t *entries = realloc(manifest->entries,
+                                               cap * sizeof(backup_manifest_entry_t));
+    if (!entries) {
+        return -ENOMEM;
+    }
+    manifest->entries = entries;
+    manifest->cap = cap;
+    return 0;
+}
+
+int backup_manifest_append(backup_manifest_t *manifest, backup_manifest_entry_t *entry) {
+    if (manifest_reserve(manifest, manifest->count + 1) != 0) {
+        entry_free(entry);
+        return -ENOMEM;
+    }
+    manifest->entries[manifest->count++] = *entry;
+    if (S_ISREG(entry->mode) && !entry->target) {
+        manifest->logical_bytes += entry->size;
+    }
+    return 0;
+}
+
+int backup_manifest_merge(backup_manifest_t *dst, backup_manifest_t *src) {
+    if (src->count == 0) {
+        backup_manifest_free(src);
+        return 0;
+    }
+    if (manifest_reserve(dst, dst->count + src->count) != 0) {
+        return -ENOMEM;
+    }
+    memcpy(dst->entries + dst->count, src->entries,
+           src->count * sizeof(backup_manifest_entry_t));
+    dst->count += src->count;
+    dst->logical_bytes += src->logical_bytes;
+    free(src->entries);
+    backup_manifest_init(src);
+    return 0;
+}
+
+static int entry_compare(const void *a, const void *b) {
+    return strcmp(((const backup_manifest_entry_t*)a)->path,
+                  ((const backup_manifest_entry_t*)b)->path);
+}
+
+static backup_manifest_entry_t* manifest_find(backup_manifest_t *manifest, const char *path) {
+    backup_manifest_entry_t key;
+
+    key.path = (char*)path;
+    return bsearch(&key, manifest->entries, manifest->count,
+                   sizeof(backup_manifest_entry_t), entry_compare);
+}
+
+int backup_manifest_sort(backup_manifest_t *manifest) {
+    if (manifest->count > 1) {
+        qsort(manifest->entries, manifest->count, sizeof(backup_manifest_entry_t),
+              entry_compare);
+    }
+
+    // El primer enlace de un grupo que encontraron los workers depende del
+    // orden del recorrido: el contenido pasa a la ruta menor del grupo y el
+    // resto apunta a ella, así el manifiesto (y su raíz) es determinista
+    for (size_t i = 0; i < manifest->count; i++) {
+        backup_manifest_entry_t *e = &manifest->entries[i];
+        if (!backup_manifest_is_hardlink(e)) {
+            continue;
+        }
+        backup_manifest_entry_t *primary = manifest_find(manifest, e->target);
+        if (!primary) {
+            continue;
+        }
+        if (backup_manifest_is_hardlink(primary)) {
+            // Grupo ya reordenado: apuntar directamente a la nueva primaria
+            char *target = strdup(primary->target);
+            if (!target) {
+                return -ENOMEM;
+            }
+            free(e->target);
+            e->target = target;
+        } else if (primary > e) {
+            char *target = strdup(e->path);
+            if (!target) {
+                return -ENOMEM;
+            }
+            free(e->target);
+            e->target = NULL;
+            e->has_hash = primary->has_hash;
+            memcpy(e->hash, primary->hash, BACKUP_HASH_SIZE);
+            e->nchunks = primary->nchunks;
+            e->chunks = primary->chunks;
+            primary->target = target;
+            primary->has_hash = 0;
+            primary->nchunks = 0;
+            primary->chunks = NULL;
+        }
+    }
+    return 0;
+}
+
+void backup_manifest_drop(backup_manifest_t *manifest, const uint8_t *drop) {
+    size_t out = 0;
+
+    manifest->logical_bytes = 0;
+    for (size_t i = 0; i < manifest->count; i++) {
+        backup_manifest_entry_t *e = &manifest->entries[i];
+        if (drop[i]) {
+            entry_free(e);
+            continue;
+        }
+        if (S_ISREG(e->mode) && !e->target) {
+            manifest->logical_bytes += e->size;
+        }
+        manifest->entries[out++] = *e;
+    }
+    manifest->count = out;
+}
+
+// Un fichero se da por igual si conserva inodo, tamaño, mtime y ctime (un
+// chmod, chown o reescritura con el mtime restaurado cambian el ctime). Si
+// el ctime no es anterior al recorrido de prev pudo cambiar otra vez en el
+// mismo tick del reloj sin que se note: se vuelve a leer.
+static int entry_unchanged(const backup_manifest_entry_t *e, const backup_manifest_entry_t *old,
+                           const backup_manifest_t *prev) {
+    if (old->target || !old->has_hash || old->ino == 0 ||
+        e->mode != old->mode || e->ino != old->ino || e->size != old->size ||
+        e->mtime_sec != old->mtime_sec || e->mtime_nsec != old->mtime_nsec ||
+        e->ctime_sec != old->ctime_sec || e->ctime_nsec != old->ctime_nsec) {
+        return 0;
+    }
+    return e->ctime_sec < prev->created_sec ||
+           (e->ctime_sec == prev->created_sec && e->ctime_nsec < prev->created_nsec);
+}
+
+size_t backup_manifest_join(backup_manifest_t *manifest, backup_manifest_t *prev) {
+    size_t changed = 0;
+    size_t j = 0;
+
+    for (size_t i = 0; i < manifest->count; i++) {
+        backup_manifest_entry_t *e = &manifest->entries[i];
+        e->unchanged = 0;
+        if (!S_ISREG(e->mode) || e->target) {
+            continue;
+        }
+        // Ambas listas van por ruta: prev avanza hasta alcanzar la actual
+        while (prev && j < prev->count && strcmp(prev->entries[j].path, e->path) < 0) {
+            j++;
+        }
+        if (!prev || j == prev->count || strcmp(prev->entries[j].path, e->path) != 0 ||
+            !entry_unchanged(e, &prev->entries[j], prev)) {
+            changed++;
+            continue;
+        }
+        backup_manifest_entry_t *old = &prev->entries[j];
+        e->unchanged = 1;
+        e->has_hash = 1;
+        memcpy(e->hash, old->hash, BACKUP_HASH_SIZE);
+        free(e->chunks);
+        e->nchunks = old->nchunks;
+        e->chunks = old->chunks;
+        old->nchunks = 0;
+        old->chunks = NULL;
+    }
+    return changed;
+}
+
+void backup_manifest_free(backup_manifest_t *manifest) {
+    for (size_t i = 0; i < manifest->count; i++) {
+        entry_free(&manifest->entries[i]);
+    }
+    free(manifest->entries);
+    backup_manifest_init(manifest);
+}
+
+static int manifest_put(FILE *fp, EVP_MD_CTX *md, const void *data, size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    EVP_DigestUpdate(md, data, len);
+    return fwrite(data, 1, len, fp) == len ? 0 : -1;
+}
+
+int backup_manifest_write(const char *path, const backup_manifest_t *manifest) {
+    char tmp_path[4096];
+    manifest_header_t header;
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_len = 0;
+    int rc = 0;
+
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path)) {
+        return -ENAMETOOLONG;
+    }
+    FILE *fp = fopen(tmp_path, "w");
+    if (!fp) {
+        return -errno;
+    }
+    char *iobuf = malloc(MANIFEST_IO_BUFFER);
+    if (iobuf) {
+        setvbuf(fp, iobuf, _IOFBF, MANIFEST_IO_BUFFER);
+    }
+    EVP_MD_CTX *md = EVP_MD_CTX_new();
+    if (!md || EVP_DigestInit_ex(md, EVP_sha256(), NULL) != 1) {
+        rc = -ENOMEM;
+        goto out;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BACKUP_MANIFEST_MAGIC, sizeof(header.magic));
+    header.version = BACKUP_MANIFEST_VERSION;
+    header.count = manifest->count;
+    header.logical_bytes = manifest->logical_bytes;
+    header.created_sec = manifest->created_sec;
+    header.created_nsec = manifest->created_nsec;
+    rc = manifest_put(fp, md, &header, sizeof(header));
+
+    for (size_t i = 0; i < manifest->count && rc == 0; i++) {
+        const backup_manifest_entry_t *e = &manifest->entries[i];
+        manifest_record_t rec;
+        size_t path_len = strlen(e->path);
+        size_t target_len = e->target ? strlen(e->target) : 0;
+
+        if (path_len > UINT16_MAX || target_len > UINT16_MAX) {
+            rc = -ENAMETOOLONG;
+            break;
+        }
+        // Un enlace duro sin bytes de destino sería indistinguible de un
+        // fichero normal: target, si existe, no puede estar vacío
+        if (e->target && target_len == 0) {
+            rc = -EINVAL;
+            break;
+        }
+        memset(&rec, 0, sizeof(rec));
+        rec.mode = e->mode;
+        rec.uid = e->uid;
+        rec.gid = e->gid;
+        rec.nchunks = e->nchunks;
+        rec.size = e->size;
+        rec.rdev = e->rdev;
+        rec.atime_sec = e->atime_sec;
+        rec.mtime_sec = e->mtime_sec;
+        rec.atime_nsec = e->atime_nsec;
+        rec.mtime_nsec = e->mtime_nsec;
+        rec.path_len = path_len;
+        rec.target_len = target_len;
+        rec.flags = e->has_hash ? MANIFEST_HAS_HASH : 0;
+        rec.ino = e->ino;
+        rec.ctime_sec = e->ctime_sec;
+        rec.ctime_nsec = e->ctime_nsec;
+
+        if (manifest_put(fp, md, &rec, sizeof(rec)) != 0 ||
+            manifest_put(fp, md, e->path, path_len) != 0 ||
+            manifest_put(fp, md, e->target, target_len) != 0 ||
+            manifest_put(fp, md, e->hash, e->has_hash ? BACKUP_HASH_SIZE : 0) != 0 ||
+            manifest_put(fp, md, e->chunks, (size_t)e->nchunks * BACKUP_HASH_SIZE) != 0) {
+            rc = -EIO;
+        }
+    }
+
+    if (rc == 0) {
+        EVP_DigestFinal_ex(md, digest, &digest_len);
+        if (fwrite(digest, 1, digest_len, fp) != digest_len ||
+            fflush(fp) != 0 || fsync(fileno(fp)) != 0) {
+            rc = -EIO;
+        }
+    }
+
+out:
+    EVP_MD_CTX_free(md);
+    if (fclose(fp) != 0 && rc == 0) {
+        rc = -EIO;
+    }
+    free(iobuf);
+    if (rc == 0 && rename(tmp_path, path) != 0) {
+        rc = -errno;
+    }
+    if (rc != 0) {
+        unlink(tmp_path);
+    }
+    return rc;
+}
+
+static char* dup_bytes(const uint8_t *data, size_t len) {
+    char *s = malloc(len + 1);
+    if (s) {
+        memcpy(s, data, len);
+        s[len] = '\0';
+    }
+    return s;
+}
+
+int backup_manifest_load(const char *path, backup_manifest_t *manifest) {
+    struct stat st;
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_len = 0;
+    int rc = 0;
+
+    backup_manifest_init(manifest);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -errno;
+    }
+    if (fstat(fd, &st) != 0) {
+        rc = -errno;
+        close(fd);
+        return rc;
+    }
+    size_t size = st.st_size;
+    if (size < MANIFEST_V2_HEADER + BACKUP_HASH_SIZE) {
+        close(fd);
+        return -EBADMSG;
+    }
+    const uint8_t *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -errno;
+    }
+    madvise((void*)map, size, MADV_SEQUENTIAL);
+
+    size_t body = size - BACKUP_HASH_SIZE;
+    EVP_Digest(map, body, digest, &digest_len, EVP_sha256(), NULL);
+    if (digest_len != BACKUP_HASH_SIZE || memcmp(digest, map + body, BACKUP_HASH_SIZE) != 0) {
+        rc = -EBADMSG;
+        goto out;
+    }
+
+    // Los campos nuevos quedan a cero al leer versiones anteriores
+    manifest_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(&header, map, MANIFEST_V2_HEADER);
+    size_t header_size = header.version >= 3 ? sizeof(manifest_header_t) : MANIFEST_V2_HEADER;
+    size_t record_size = header.version >= 3 ? sizeof(manifest_record_t) : MANIFEST_V2_RECORD;
+    if (memcmp(header.magic, BACKUP_MANIFEST_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version < 1 || header.version > BACKUP_MANIFEST_VERSION ||
+        body < header_size || header.count > body / record_size) {
+        rc = -EBADMSG;
+        goto out;
+    }
+    memcpy(&header, map, header_size);
+    manifest->created_sec = header.created_sec;
+    manifest->created_nsec = header.created_nsec;
+    if (manifest_reserve(manifest, header.count) != 0) {
+        rc = -ENOMEM;
+        goto out;
+    }
+
+    size_t off = header_size;
+    for (uint64_t i = 0; i < header.count; i++) {
+        manifest_record_t rec;
+        backup_manifest_entry_t entry;
+
+        if (body - off < record_size) {
+            rc = -EBADMSG;
+            break;
+        }
+        memset(&rec, 0, sizeof(rec));
+        memcpy(&rec, map + off, record_size);
+        off += record_size;
+
+        size_t chunk_bytes = (size_t)rec.nchunks * BACKUP_HASH_SIZE;
+        size_t hash_bytes = rec.flags & MANIFEST_HAS_HASH ? BACKUP_HASH_SIZE : 0;
+        if ((header.version < 2 && rec.flags != 0) ||
+            body - off < (size_t)rec.path_len + rec.target_len + hash_bytes + chunk_bytes) {
+            rc = -EBADMSG;
+            break;
+        }
+
+        memset(&entry, 0, sizeof(entry));
+        entry.mode = rec.mode;
+        entry.uid = rec.uid;
+        entry.gid = rec.gid;
+        entry.size = rec.size;
+        entry.rdev = rec.rdev;
+        entry.atime_sec = rec.atime_sec;
+        entry.mtime_sec = rec.mtime_sec;
+        entry.atime_nsec = rec.atime_nsec;
+        entry.mtime_nsec = rec.mtime_nsec;
+        entry.ino = rec.ino;
+        entry.ctime_sec = rec.ctime_sec;
+        entry.ctime_nsec = rec.ctime_nsec;
+        entry.nchunks = rec.nchunks;
+        entry.path = dup_bytes(map + off, rec.path_len);
+        off += rec.path_len;
+        if (rec.target_len) {
+            entry.target = dup_bytes(map + off, rec.target_len);
+            off += rec.target_len;
+        }
+        if (hash_bytes) {
+            memcpy(entry.hash, map + off, hash_bytes);
+            entry.has_hash = 1;
+            off += hash_bytes;
+        }
+        if (chunk_bytes) {
+            entry.chunks = malloc(chunk_bytes);
+            if (entry.chunks) {
+                memcpy(entry.chunks, map + off, chunk_bytes);
+            }
+            off += chunk_bytes;
+        }
+        if (!entry.path || (rec.target_len && !entry.target) ||
+            (chunk_bytes && !entry.chunks)) {
+            entry_free(&entry);
+            rc = -ENOMEM;
+            break;
+        }
+        backup_manifest_append(manifest, &entry);
+    }
+    if (rc == 0 && off != body) {
+        rc = -EBADMSG;
+    }
+    if (rc == 0 && manifest->logical_bytes != header.logical_bytes) {
+        rc = -EBADMSG;
+    }
+
+out:
+    munmap((void*)map, size);
+    if (rc != 0) {
+        backup_manifest_free(manifest);
+    }
+    return rc;
+}
+
+void backup_hash_hex(const backup_hash_t hash, char *out) {
+    for (int i = 0; i < BACKUP_HASH_SIZE; i++) {
+        sprintf(out + i * 2, "%02x", hash[i]);
+    }
+    out[BACKUP_HASH_SIZE * 2] = '\0';
+}
+
+int backup_hash_fd(int fd, uint8_t *buf, size_t buf_size, backup_hash_t out) {
+    unsigned int out_len = 0;
+    int rc = 0;
+
+    EVP_MD_CTX *md = EVP_MD_CTX_new();
+    if (!md || EVP_DigestInit_ex(md, EVP_sha256(), NULL) != 1) {
+        EVP_MD_CTX_free(md);
+        return -ENOMEM;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    for (;;) {
+        ssize_t n = read(fd, buf, buf_size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            rc = -errno;
+            break;
+        }
+        if (n == 0) {
+            break;
+        }
+        EVP_DigestUpdate(md, buf, n);
+    }
+    if (rc == 0) {
+        EVP_DigestFinal_ex(md, out, &out_len);
+    }
+    EVP_MD_CTX_free(md);
+    return rc;
+}
+
+// ---------------------------------------------------------------------------
+// Raíz Merkle
+// ---------------------------------------------------------------------------
+
+static void put_le(uint8_t *out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        out[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+// Hoja: 0x00 || ruta || 0x00 || modo (LE32) || tamaño (LE64) || contenido,
+// donde contenido es el hash del fichero, el destino de un enlace o el
+// dispositivo de un especial
+static void merkle_leaf(const backup_manifest_entry_t *e, backup_hash_t out) {
+    uint8_t prefix = 0x00;
+    uint8_t fixed[1 + 4 + 8];
+    unsigned int out_len = 0;
+    EVP_MD_CTX *md = EVP_MD_CTX_new();
+
+    fixed[0] = 0x00;
+    put_le(fixed + 1, e->mode, 4);
+    put_le(fixed + 5, e->size, 8);
+
+    EVP_DigestInit_ex(md, EVP_sha256(), NULL);
+    EVP_DigestUpdate(md, &prefix, 1);
+    EVP_DigestUpdate(md, e->path, strlen(e->path));
+    EVP_DigestUpdate(md, fixed, sizeof(fixed));
+    if (e->target) {
+        EVP_DigestUpdate(md, e->target, strlen(e->target));
+    } else if (S_ISREG(e->mode)) {
+        EVP_DigestUpdate(md, e->hash, BACKUP_HASH_SIZE);
+    } else if (S_ISCHR(e->mode) || S_ISBLK(e->mode)) {
+        uint8_t rdev[8];
+        put_le(rdev, e->rdev, 8);
+        EVP_DigestUpdate(md, rdev, sizeof(rdev));
+    }
+    EVP_DigestFinal_ex(md, out, &out_len);
+    EVP_MD_CTX_free(md);
+}
+
+static void merkle_node(const backup_hash_t left, const backup_hash_t right, backup_hash_t out) {
+    uint8_t data[1 + 2 * BACKUP_HASH_SIZE];
+    unsigned int out_len = 0;
+
+    data[0] = 0x01;
+    memcpy(data + 1, left, BACKUP_HASH_SIZE);
+    memcpy(data + 1 + BACKUP_HASH_SIZE, right, BACKUP_HASH_SIZE);
+    EVP_Digest(data, sizeof(data), out, &out_len, EVP_sha256(), NULL);
+}
+
+void backup_manifest_root(const backup_manifest_t *manifest, backup_hash_t root) {
+    // Pila de subárboles completos de tamaño decreciente (como un contador
+    // binario): memoria O(log n) para cualquier número de entradas
+    backup_hash_t stack[MERKLE_MAX_DEPTH];
+    uint64_t sizes[MERKLE_MAX_DEPTH];
+    int top = 0;
+    unsigned int out_len = 0;
+
+    if (manifest->count == 0) {
+        EVP_Digest("", 0, root, &out_len, EVP_sha256(), NULL);
+        return;
+    }
+    for (size_t i = 0; i < manifest->count; i++) {
+        merkle_leaf(&manifest->entries[i], stack[top]);
+        sizes[top++] = 1;
+        while (top >= 2 && sizes[top - 1] == sizes[top - 2]) {
+            merkle_node(stack[top - 2], stack[top - 1], stack[top - 2]);
+            sizes[top - 2] *= 2;
+            top--;
+        }
+    }
+    // Los subárboles restantes se unen de derecha a izquierda
+    while (top >= 2) {
+        merkle_node(stack[top - 2], stack[top - 1], stack[top - 2]);
+        top--;
+    }
+    memcpy(root, stack[0], BACKUP_HASH_SIZE);
+}
+
+// ---------------------------------------------------------------------------
+// Manifiesto de un árbol en disco
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    uint8_t *buf;
+    backup_manifest_t manifest;
+} scan_worker_t;
+
+typedef struct {
+    const char *root;
+    int flags;
+    scan_worker_t *workers;
+} scan_ctx_t;
+
+static int scan_visit(backup_walk_t *walk, int worker, const char *rel,
+                      const struct stat *st, void *arg) {
+    scan_ctx_t *ctx = arg;
+    scan_worker_t *w = &ctx->workers[worker];
+    backup_manifest_entry_t entry;
+    char path[PATH_MAX];
+
+    if (backup_join_path(path, sizeof(path), ctx->root, rel) != 0) {
+        backup_walk_error(walk, rel, "path", ENAMETOOLONG);
+        return -1;
+    }
+    backup_manifest_entry_init(&entry, st);
+    entry.path = strdup(rel);
+    if (!entry.path) {
+        backup_walk_error(walk, path, "manifest", ENOMEM);
+        return -1;
+    }
+
+    if (S_ISREG(st->st_mode)) {
+        entry.target = st->st_nlink > 1 ? backup_walk_claim_link(walk, st, rel) : NULL;
+        if (!entry.target && (ctx->flags & BACKUP_SCAN_HASH)) {
+            int fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+            int rc = fd < 0 ? -errno : backup_hash_fd(fd, w->buf, BACKUP_HASH_BUFFER, entry.hash);
+            if (fd >= 0) {
+                close(fd);
+            }
+            if (rc != 0) {
+                backup_walk_error(walk, path, fd < 0 ? "open" : "read", -rc);
+                free(entry.path);
+                return 0;
+            }
+            entry.has_hash = 1;
+        }
+    } else if (S_ISLNK(st->st_mode)) {
+        char target[PATH_MAX];
+        ssize_t len = readlink(path, target, sizeof(target) - 1);
+        if (len <= 0) {
+            backup_walk_error(walk, path, "readlink", len < 0 ? errno : EINVAL);
+            free(entry.path);
+            return 0;
+        }
+        target[len] = '\0';
+        entry.target = strdup(target);
+    }
+
+    if (backup_manifest_append(&w->manifest, &entry) != 0) {
+        backup_walk_error(walk, path, "manifest", ENOMEM);
+        return -1;
+    }
+    return 0;
+}
+
+int backup_manifest_scan(const char *root, int threads, int flags,
+                         backup_manifest_t *manifest, backup_walk_stats_t *stats) {
+    scan_ctx_t ctx;
+    struct timespec now;
+    int rc = 0;
+
+    // Los tiempos de los ficheros salen del reloj grueso del kernel o son
+    // posteriores: lo que cambie desde aquí tendrá un ctime igual o mayor
+    backup_manifest_init(manifest);
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+    manifest->created_sec = now.tv_sec;
+    manifest->created_nsec = now.tv_nsec;
+
+    threads = backup_walk_threads(threads);
+    ctx.root = root;
+    ctx.flags = flags;
+    ctx.workers = calloc(threads, sizeof(scan_worker_t));
+    if (!ctx.workers) {
+        return -ENOMEM;
+    }
+    for (int i = 0; i < threads && rc == 0; i++) {
+        backup_manifest_init(&ctx.workers[i].manifest);
+        if (flags & BACKUP_SCAN_HASH) {
+            ctx.workers[i].buf = malloc(BACKUP_HASH_BUFFER);
+            if (!ctx.workers[i].buf) {
+                rc = -ENOMEM;
+            }
+        }
+    }
+    if (rc == 0) {
+        rc = backup_walk_tree(root, threads, scan_visit, &ctx, stats);
+    }
+    for (int i = 0; i < threads; i++) {
+        if (backup_manifest_merge(manifest, &ctx.workers[i].manifest) != 0) {
+            backup_manifest_free(&ctx.workers[i].manifest);
+            rc = -ENOMEM;
+        }
+        free(ctx.workers[i].buf);
+    }
+    free(ctx.workers);
+
+    if (rc != -ENOMEM && backup_manifest_sort(manifest) != 0) {
+        rc = -ENOMEM;
+    }
+    if (rc == -ENOMEM) {
+        backup_manifest_free(manifest);
+    }
+    return rc;
+}
+
+// ---------------------------------------------------------------------------
+// Copia guiada por el manifiesto
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    const char *src;
+    const char *dst;
+    const char *link_dest;
+    backup_manifest_t *manifest;
+    uint8_t *drop;              // entradas que no llegaron al destino
+    atomic_size_t next;
+    pthread_mutex_t lock;       // errores en stats
+    backup_copy_stats_t *stats;
+} mcopy_ctx_t;
+
+typedef struct {
+    mcopy_ctx_t *ctx;
+    pthread_t thread;
+    uint8_t *buf;
+    EVP_MD_CTX *md;
+    backup_copy_stats_t stats;
+} mcopy_worker_t;
+
+static void mcopy_error(mcopy_ctx_t *ctx, const char *path, const char *op, int err) {
+    fprintf(stderr, "Backup: %s %s: %s\n", op, path, strerror(err));
+    pthread_mutex_lock(&ctx->lock);
+    if (!ctx->stats->first_error[0]) {
+        snprintf(ctx->stats->first_error, sizeof(ctx->stats->first_error),
+                 "%s %s: %s", op, path, strerror(err));
+    }
+    ctx->stats->errors++;
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+// Copia con read/write calculando el hash en la misma pasada: el fichero
+// se lee una sola vez. El tamaño y el hash guardados son los de lo leído.
+static int mcopy_file(mcopy_worker_t *w, const char *src, const char *dst,
+                      backup_manifest_entry_t *e) {
+    mcopy_ctx_t *ctx = w->ctx;
+    struct stat st;
+    const char *op = NULL;
+    uint64_t total = 0;
+    int rc = 0;
+
+    int in = open(src, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (in < 0) {
+        mcopy_error(ctx, src, "open", errno);
+        return -1;
+    }
+    // O_EXCL como en backup_copy_tree: nunca se trunca un enlace a otro backup
+    int flags = O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC;
+    int out = open(dst, flags, 0600);
+    if (out < 0 && errno == EEXIST && unlink(dst) == 0) {
+        out = open(dst, flags, 0600);
+    }
+    if (out < 0) {
+        mcopy_error(ctx, dst, "create", errno);
+        close(in);
+        return -1;
+    }
+    posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+    EVP_DigestInit_ex(w->md, EVP_sha256(), NULL);
+
+    for (;;) {
+        ssize_t n = read(in, w->buf, BACKUP_HASH_BUFFER);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            mcopy_error(ctx, src, "read", errno);
+            rc = -1;
+            goto out;
+        }
+        if (n == 0) {
+            break;
+        }
+        EVP_DigestUpdate(w->md, w->buf, n);
+        for (ssize_t off = 0; off < n; ) {
+            ssize_t m = write(out, w->buf + off, n - off);
+            if (m < 0 && errno == EINTR) {
+                continue;
+            }
+            if (m < 0) {
+                mcopy_error(ctx, dst, "write", errno);
+                rc = -1;
+                goto out;
+            }
+            off += m;
+        }
+        total += n;
+    }
+    EVP_DigestFinal_ex(w->md, e->hash, NULL);
+    e->has_hash = 1;
+    e->size = total;
+    w->stats.bytes_copied += total;
+
+    backup_manifest_entry_stat(e, &st);
+    if (backup_apply_metadata(out, dst, &st, &op) != 0) {
+        mcopy_error(ctx, dst, op, errno);
+        rc = -1;
+    }
+
+out:
+    close(in);
+    if (close(out) != 0 && rc == 0) {
+        mcopy_error(ctx, dst, "close", errno);
+        rc = -1;
+    }
+    return rc;
+}
+
+static int mcopy_entry(mcopy_worker_t *w, backup_manifest_entry_t *e) {
+    mcopy_ctx_t *ctx = w->ctx;
+    char src[PATH_MAX];
+    char dst[PATH_MAX];
+    char prev[PATH_MAX];
+    struct stat st;
+    const char *op = NULL;
+    int rc;
+
+    if (backup_join_path(src, sizeof(src), ctx->src, e->path) != 0 ||
+        backup_join_path(dst, sizeof(dst), ctx->dst, e->path) != 0) {
+        mcopy_error(ctx, e->path, "path", ENAMETOOLONG);
+        return -1;
+    }
+
+    if (S_ISREG(e->mode)) {
+        w->stats.files++;
+        // EMLINK, EXDEV o backup anterior borrado: se copia
+        if (e->unchanged && ctx->link_dest &&
+            backup_join_path(prev, sizeof(prev), ctx->link_dest, e->path) == 0 &&
+            link(prev, dst) == 0) {
+            w->stats.linked++;
+            return 0;
+        }
+        return mcopy_file(w, src, dst, e);
+    }
+
+    if (S_ISLNK(e->mode)) {
+        rc = symlink(e->target ? e->target : "", dst);
+        if (rc != 0 && errno == EEXIST && unlink(dst) == 0) {
+            rc = symlink(e->target ? e->target : "", dst);
+        }
+    } else {
+        rc = mknod(dst, e->mode, e->rdev);
+        if (rc != 0 && errno == EEXIST && unlink(dst) == 0) {
+            rc = mknod(dst, e->mode, e->rdev);
+        }
+    }
+    if (rc != 0) {
+        mcopy_error(ctx, dst, S_ISLNK(e->mode) ? "symlink" : "mknod", errno);
+        return -1;
+    }
+    if (S_ISLNK(e->mode)) {
+        w->stats.symlinks++;
+    } else {
+        w->stats.specials++;
+    }
+    backup_manifest_entry_stat(e, &st);
+    if (backup_apply_metadata(-1, dst, &st, &op) != 0) {
+        mcopy_error(ctx, dst, op, errno);
+        return -1;
+    }
+    return 0;
+}
+
+static void* mcopy_worker_func(void *arg) {
+    mcopy_worker_t *w = arg;
+    mcopy_ctx_t *ctx = w->ctx;
+
+    for (;;) {
+        size_t i = atomic_fetch_add(&ctx->next, 1);
+        if (i >= ctx->manifest->count) {
+            break;
+        }
+        backup_manifest_entry_t *e = &ctx->manifest->entries[i];
+        if (S_ISDIR(e->mode) || backup_manifest_is_hardlink(e)) {
+            continue;
+        }
+        if (mcopy_entry(w, e) != 0) {
+            ctx->drop[i] = 1;
+        }
+    }
+    return NULL;
+}
+
+int backup_manifest_copy(const char *src, const char *dst, backup_manifest_t *manifest,
+                         const backup_copy_opts_t *opts, backup_copy_stats_t *stats) {
+    mcopy_ctx_t ctx;
+    struct timespec start, end;
+    char path[PATH_MAX];
+    char target[PATH_MAX];
+    struct stat st;
+    const char *op = NULL;
+
+    if (!src || !dst || !manifest || !stats) {
+        return -EINVAL;
+    }
+    memset(stats, 0, sizeof(*stats));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.src = src;
+    ctx.dst = dst;
+    ctx.link_dest = opts && opts->link_dest && opts->link_dest[0] ? opts->link_dest : NULL;
+    ctx.manifest = manifest;
+    ctx.stats = stats;
+    ctx.drop = calloc(manifest->count ? manifest->count : 1, 1);
+    if (!ctx.drop) {
+        return -ENOMEM;
+    }
+    atomic_init(&ctx.next, 0);
+    pthread_mutex_init(&ctx.lock, NULL);
+
+    // Directorios primero (cada padre va antes que sus hijos), con
+    // permisos amplios hasta el final
+    for (size_t i = 0; i < manifest->count; i++) {
+        const backup_manifest_entry_t *e = &manifest->entries[i];
+        if (!S_ISDIR(e->mode)) {
+            continue;
+        }
+        if (backup_join_path(path, sizeof(path), dst, e->path) != 0) {
+            mcopy_error(&ctx, e->path, "path", ENAMETOOLONG);
+            ctx.drop[i] = 1;
+        } else if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+            mcopy_error(&ctx, path, "mkdir", errno);
+            ctx.drop[i] = 1;
+        }
+        stats->dirs++;
+    }
+
+    int threads = backup_walk_threads(opts ? opts->threads : 0);
+    mcopy_worker_t *workers = calloc(threads, sizeof(mcopy_worker_t));
+    int started = 0;
+    for (int i = 0; workers && i < threads; i++) {
+        workers[i].ctx = &ctx;
+        workers[i].buf = malloc(BACKUP_HASH_BUFFER);
+        workers[i].md = EVP_MD_CTX_new();
+        if (!workers[i].buf || !workers[i].md ||
+            pthread_create(&workers[i].thread, NULL, mcopy_worker_func, &workers[i]) != 0) {
+            free(workers[i].buf);
+            EVP_MD_CTX_free(workers[i].md);
+            break;
+        }
+        started++;
+    }
+    if (started == 0) {
+        mcopy_error(&ctx, dst, "start workers", ENOMEM);
+    }
+    for (int i = 0; i < started; i++) {
+        mcopy_worker_t *w = &workers[i];
+        pthread_join(w->thread, NULL);
+        stats->files += w->stats.files;
+        stats->symlinks += w->stats.symlinks;
+        stats->specials += w->stats.specials;
+        stats->linked += w->stats.linked;
+        stats->bytes_copied += w->stats.bytes_copied;
+        free(w->buf);
+        EVP_MD_CTX_free(w->md);
+    }
+    free(workers);
+    stats->threads = started;
+
+    // Enlaces duros (la primaria ya está copiada) y metadatos de
+    // directorios, de dentro a fuera
+    for (size_t i = 0; i < manifest->count; i++) {
+        const backup_manifest_entry_t *e = &manifest->entries[i];
+        if (!backup_manifest_is_hardlink(e)) {
+            continue;
+        }
+        stats->hardlinks++;
+        if (backup_join_path(path, sizeof(path), dst, e->path) != 0 ||
+            backup_join_path(target, sizeof(target), dst, e->target) != 0) {
+            mcopy_error(&ctx, e->path, "path", ENAMETOOLONG);
+            ctx.drop[i] = 1;
+            continue;
+        }
+        int rc = link(target, path);
+        if (rc != 0 && errno == EEXIST && unlink(path) == 0) {
+            rc = link(target, path);
+        }
+        if (rc != 0) {
+            mcopy_error(&ctx, path, "link", errno);
+            ctx.drop[i] = 1;
+        }
+    }
+    for (size_t i = manifest->count; i-- > 0; ) {
+        const backup_manifest_entry_t *e = &manifest->entries[i];
+        if (!S_ISDIR(e->mode) || ctx.drop[i] ||
+            backup_join_path(path, sizeof(path), dst, e->path) != 0) {
+            continue;
+        }
+        backup_manifest_entry_stat(e, &st);
+        if (backup_apply_metadata(-1, path, &st, &op) != 0) {
+            mcopy_error(&ctx, path, op, errno);
+        }
+    }
+
+    backup_manifest_drop(manifest, ctx.drop);
+    stats->bytes_total = manifest->logical_bytes;
+    free(ctx.drop);
+    pthread_mutex_destroy(&ctx.lock);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    stats->elapsed_s = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    return stats->errors ? -1 : 0;
+}
@@ -0,0 +1,1335 @@
+#include "backup_repo.h"
+#include "backup_copy.h"
+#include "backup_verify.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sqlite3.h>
+#include <openssl/evp.h>
+
+#define REPO_INDEX_NAME     "index.db"
+#define REPO_LOCK_NAME      "repo.lock"
+#define REPO_BUSY_TIMEOUT_MS 5000
+#define REPO_READ_BUFFER    (4 * 1024 * 1024)
+
+// Máscaras normalizadas (nivel 2) para un tamaño medio de 64 KB = 2^16:
+// antes del medio hacen falta 18 bits a cero y después solo 14. Se usan
+// los bits altos del gear hash, que dependen de los últimos 64 bytes.
+#define CDC_MASK_SMALL      (~0ULL << (64 - 18))
+#define CDC_MASK_LARGE      (~0ULL << (64 - 14))
+
+// Semilla de la tabla gear. No se puede cambiar: movería todos los cortes
+// y ningún chunk nuevo coincidiría con los ya guardados.
+#define CDC_GEAR_SEED       0x53746f72614d6772ULL
+
+static uint64_t gear[256];
+static pthread_once_t gear_once = PTHREAD_ONCE_INIT;
+
+typedef struct {
+    char dir[PATH_MAX];
+    sqlite3 *db;
+    pthread_mutex_t lock;
+    sqlite3_stmt *lookup;      // hash → pack, offset, length
+    sqlite3_stmt *insert;
+    uint32_t next_pack;
+    int lock_fd;               // flock exclusivo de store y gc, -1 sin tomar
+} repo_t;
+
+typedef struct {
+    int fd;
+    uint32_t id;
+    uint64_t off;
+} pack_writer_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    atomic_ullong count;
+    char first[256];
+} repo_errors_t;
+
+static double elapsed_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void errors_init(repo_errors_t *errors) {
+    pthread_mutex_init(&errors->lock, NULL);
+    atomic_init(&errors->count, 0);
+    errors->first[0] = '\0';
+}
+
+static void errors_add(repo_errors_t *errors, const char *path, const char *op, int err) {
+    atomic_fetch_add(&errors->count, 1);
+    fprintf(stderr, "Backup: %s %s: %s\n", op, path, strerror(err));
+
+    pthread_mutex_lock(&errors->lock);
+    if (errors->first[0] == '\0') {
+        snprintf(errors->first, sizeof(errors->first), "%s %s: %s",
+                 op, path, strerror(err));
+    }
+    pthread_mutex_unlock(&errors->lock);
+}
+
+static void chunk_hash(const uint8_t *data, size_t len, backup_hash_t out) {
+    unsigned int out_len = 0;
+    EVP_Digest(data, len, out, &out_len, EVP_sha256(), NULL);
+}
+
+// ---------------------------------------------------------------------------
+// FastCDC
+// ---------------------------------------------------------------------------
+
+static void gear_init(void) {
+    uint64_t x = CDC_GEAR_SEED;
+
+    // splitmix64: determinista y bien distribuido
+    for (int i = 0; i < 256; i++) {
+        uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        gear[i] = z ^ (z >> 31);
+    }
+}
+
+size_t backup_cdc_cut(const uint8_t *data, size_t len) {
+    uint64_t fp = 0;
+    size_t i = BACKUP_CDC_MIN_SIZE;
+    size_t normal = BACKUP_CDC_AVG_SIZE;
+
+    pthread_once(&gear_once, gear_init);
+
+    if (len <= BACKUP_CDC_MIN_SIZE) {
+        return len;
+    }
+    if (len > BACKUP_CDC_MAX_SIZE) {
+        len = BACKUP_CDC_MAX_SIZE;
+    }
+    if (normal > len) {
+        normal = len;
+    }
+    for (; i < normal; i++) {
+        fp = (fp << 1) + gear[data[i]];
+        if (!(fp & CDC_MASK_SMALL)) {
+            return i + 1;
+        }
+    }
+    for (; i < len; i++) {
+        fp = (fp << 1) + gear[data[i]];
+        if (!(fp & CDC_MASK_LARGE)) {
+            return i + 1;
+        }
+    }
+    return len;
+}
+
+// ---------------------------------------------------------------------------
+// Índice y packs
+// ---------------------------------------------------------------------------
+
+static void repo_close(repo_t *repo) {
+    if (repo->lookup) {
+        sqlite3_finalize(repo->lookup);
+    }
+    if (repo->insert) {
+        sqlite3_finalize(repo->insert);
+    }
+    if (repo->db) {
+        sqlite3_close(repo->db);
+    }
+    if (repo->lock_fd >= 0) {
+        close(repo->lock_fd);
+    }
+    pthread_mutex_destroy(&repo->lock);
+    memset(repo, 0, sizeof(*repo));
+}
+
+static int repo_open(repo_t *repo, const char *dir, int create) {
+    char path[PATH_MAX];
+    sqlite3_stmt *stmt;
+    const char *schema =
+        "PRAGMA journal_mode=WAL;"
+        "PRAGMA synchronous=NORMAL;"
+        "CREATE TABLE IF NOT EXISTS chunks ("
+        "hash BLOB PRIMARY KEY,"
+        "pack INTEGER NOT NULL,"
+        "offset INTEGER NOT NULL,"
+        "length INTEGER NOT NULL"
+        ") WITHOUT ROWID;";
+
+    memset(repo, 0, sizeof(*repo));
+    repo->lock_fd = -1;
+    pthread_mutex_init(&repo->lock, NULL);
+    strncpy(repo->dir, dir, sizeof(repo->dir) - 1);
+
+    if (create) {
+        const char *subdirs[] = { "", "/packs", "/manifests" };
+        for (int i = 0; i < 3; i++) {
+            snprintf(path, sizeof(path), "%s%s", dir, subdirs[i]);
+            if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+                int err = errno;
+                repo_close(repo);
+                return -err;
+            }
+        }
+    }
+
+    snprintf(path, sizeof(path), "%s/" REPO_INDEX_NAME, dir);
+    if (!create && access(path, F_OK) != 0) {
+        repo_close(repo);
+        return -ENOENT;
+    }
+    if (sqlite3_open(path, &repo->db) != SQLITE_OK ||
+        sqlite3_busy_timeout(repo->db, REPO_BUSY_TIMEOUT_MS) != SQLITE_OK ||
+        sqlite3_exec(repo->db, schema, NULL, NULL, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(repo->db,
+                           "SELECT pack, offset, length FROM chunks WHERE hash = ?;",
+                           -1, &repo->lookup, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(repo->db,
+                           "INSERT INTO chunks (hash, pack, offset, length) VALUES (?, ?, ?, ?);",
+                           -1, &repo->insert, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Cannot open chunk index %s: %s\n", path,
+                repo->db ? sqlite3_errmsg(repo->db) : "out of memory");
+        repo_close(repo);
+        return -1;
+    }
+
+    repo->next_pack = 1;
+    if (sqlite3_prepare_v2(repo->db, "SELECT MAX(pack) FROM chunks;", -1, &stmt, NULL) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            repo->next_pack = (uint32_t)sqlite3_column_int64(stmt, 0) + 1;
+        }
+        sqlite3_finalize(stmt);
+    }
+    return 0;
+}
+
+// Excluye entre sí a store y gc mientras dura la operación completa: gc
+// borraría los packs que un store aún está llenando y que el índice todavía
+// no referencia. Los lectores (restore, verify) no lo toman.
+static int repo_lock(repo_t *repo) {
+    char path[PATH_MAX];
+
+    if (snprintf(path, sizeof(path), "%s/" REPO_LOCK_NAME, repo->dir) >= (int)sizeof(path)) {
+        return -ENAMETOOLONG;
+    }
+    repo->lock_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (repo->lock_fd < 0) {
+        return -errno;
+    }
+    if (flock(repo->lock_fd, LOCK_EX | LOCK_NB) != 0) {
+        return errno == EWOULDBLOCK ? -EBUSY : -errno;
+    }
+    return 0;
+}
+
+// Busca un chunk; con el lock del repositorio tomado
+static int repo_lookup_locked(repo_t *repo, const backup_hash_t hash,
+                              uint32_t *pack, uint64_t *offset, uint32_t *length) {
+    int found = 0;
+
+    sqlite3_bind_blob(repo->lookup, 1, hash, BACKUP_HASH_SIZE, SQLITE_STATIC);
+    if (sqlite3_step(repo->lookup) == SQLITE_ROW) {
+        if (pack) {
+            *pack = (uint32_t)sqlite3_column_int64(repo->lookup, 0);
+            *offset = (uint64_t)sqlite3_column_int64(repo->lookup, 1);
+            *length = (uint32_t)sqlite3_column_int64(repo->lookup, 2);
+        }
+        found = 1;
+    }
+    sqlite3_reset(repo->lookup);
+    return found;
+}
+
+static int repo_lookup(repo_t *repo, const backup_hash_t hash,
+                       uint32_t *pack, uint64_t *offset, uint32_t *length) {
+    pthread_mutex_lock(&repo->lock);
+    int found = repo_lookup_locked(repo, hash, pack, offset, length);
+    pthread_mutex_unlock(&repo->lock);
+    return found;
+}
+
+static void pack_path(const repo_t *repo, uint32_t id, char *out, size_t size) {
+    snprintf(out, size, "%s/packs/%08u.pack", repo->dir, id);
+}
+
+// Cierra el pack actual y abre uno nuevo; con el lock tomado
+static int pack_rotate_locked(repo_t *repo, pack_writer_t *pw) {
+    char path[PATH_MAX];
+
+    if (pw->fd >= 0) {
+        fdatasync(pw->fd);
+        close(pw->fd);
+        pw->fd = -1;
+    }
+    // Un pack huérfano de un backup interrumpido conserva su número
+    for (;;) {
+        pw->id = repo->next_pack++;
+        pack_path(repo, pw->id, path, sizeof(path));
+        pw->fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (pw->fd >= 0) {
+            pw->off = 0;
+            return 0;
+        }
+        if (errno != EEXIST) {
+            return -errno;
+        }
+    }
+}
+
+static int pack_finish(pack_writer_t *pw) {
+    int rc = 0;
+
+    if (pw->fd >= 0) {
+        if (fdatasync(pw->fd) != 0) {
+            rc = -errno;
+        }
+        close(pw->fd);
+        pw->fd = -1;
+    }
+    return rc;
+}
+
+// Guarda el chunk si no está en el índice. Devuelve 1 si se escribió, 0 si
+// ya existía, <0 en error. La fila se inserta antes de escribir los datos:
+// si la escritura falla, la transacción del backup se deshace entera.
+static int repo_put_chunk(repo_t *repo, pack_writer_t *pw, const uint8_t *data,
+                          size_t len, const backup_hash_t hash) {
+    uint64_t offset;
+    int rc = 0;
+
+    pthread_mutex_lock(&repo->lock);
+    if (repo_lookup_locked(repo, hash, NULL, NULL, NULL)) {
+        pthread_mutex_unlock(&repo->lock);
+        return 0;
+    }
+    if (pw->fd < 0 || pw->off + len > BACKUP_PACK_MAX_SIZE) {
+        rc = pack_rotate_locked(repo, pw);
+    }
+    if (rc == 0) {
+        offset = pw->off;
+        pw->off += len;
+        sqlite3_bind_blob(repo->insert, 1, hash, BACKUP_HASH_SIZE, SQLITE_STATIC);
+        sqlite3_bind_int64(repo->insert, 2, pw->id);
+        sqlite3_bind_int64(repo->insert, 3, offset);
+        sqlite3_bind_int64(repo->insert, 4, len);
+        if (sqlite3_step(repo->insert) != SQLITE_DONE) {
+            rc = -EIO;
+        }
+        sqlite3_reset(repo->insert);
+    }
+    pthread_mutex_unlock(&repo->lock);
+    if (rc != 0) {
+        return rc;
+    }
+
+    for (size_t done = 0; done < len; ) {
+        ssize_t n = pwrite(pw->fd, data + done, len - done, offset + done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        done += n;
+    }
+    return 1;
+}
+
+// ---------------------------------------------------------------------------
+// Backup
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    repo_t *repo;
+    const char *src;
+    backup_manifest_t *manifest;
+    uint8_t *drop;             // ficheros que no se pudieron leer
+    atomic_size_t next;
+    repo_errors_t errors;
+    atomic_int fatal;          // fallo escribiendo el repositorio: se aborta
+} store_ctx_t;
+
+typedef struct {
+    store_ctx_t *ctx;
+    pthread_t thread;
+    pack_writer_t pack;
+    uint8_t *buf;
+    EVP_MD_CTX *file_md;       // SHA-256 del fichero completo
+    uint64_t new_chunks;
+    uint64_t stored_bytes;
+} store_worker_t;
+
+static int store_file(store_ctx_t *ctx, store_worker_t *w, const char *path,
+                      backup_manifest_entry_t *entry) {
+    size_t start = 0, end = 0, cap = 0;
+    uint64_t total = 0;
+    int eof = 0;
+    int rc = 0;
+
+    int fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        errors_add(&ctx->errors, path, "open", errno);
+        return -1;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    EVP_DigestInit_ex(w->file_md, EVP_sha256(), NULL);
+
+    for (;;) {
+        // Siempre hay al menos un chunk máximo en el buffer hasta el EOF,
+        // así los cortes no dependen de dónde cayó cada read()
+        if (!eof && end - start < BACKUP_CDC_MAX_SIZE) {
+            memmove(w->buf, w->buf + start, end - start);
+            end -= start;
+            start = 0;
+            while (!eof && end < REPO_READ_BUFFER) {
+                ssize_t n = read(fd, w->buf + end, REPO_READ_BUFFER - end);
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    errors_add(&ctx->errors, path, "read", errno);
+                    rc = -1;
+                    goto out;
+                }
+                if (n == 0) {
+                    eof = 1;
+                } else {
+                    end += n;
+                }
+            }
+        }
+        if (start == end) {
+            break;
+        }
+
+        size_t cut = backup_cdc_cut(w->buf + start, end - start);
+        if (entry->nchunks == cap) {
+            cap = cap ? cap * 2 : 16;
+            backup_hash_t *chunks = realloc(entry->chunks, cap * sizeof(backup_hash_t));
+            if (!chunks) {
+                errors_add(&ctx->errors, path, "chunk list", ENOMEM);
+                rc = -1;
+                goto out;
+            }
+            entry->chunks = chunks;
+        }
+        chunk_hash(w->buf + start, cut, entry->chunks[entry->nchunks]);
+        EVP_DigestUpdate(w->file_md, w->buf + start, cut);
+
+        int stored = repo_put_chunk(ctx->repo, &w->pack, w->buf + start, cut,
+                                    entry->chunks[entry->nchunks]);
+        if (stored < 0) {
+            errors_add(&ctx->errors, path, "store chunk", -stored);
+            atomic_store(&ctx->fatal, 1);
+            rc = -1;
+            goto out;
+        }
+        if (stored) {
+            w->new_chunks++;
+            w->stored_bytes += cut;
+        }
+        entry->nchunks++;
+        total += cut;
+        start += cut;
+    }
+    // El tamaño guardado es el leído (el fichero pudo cambiar tras el stat)
+    entry->size = total;
+    EVP_DigestFinal_ex(w->file_md, entry->hash, NULL);
+    entry->has_hash = 1;
+
+out:
+    close(fd);
+    return rc;
+}
+
+static void* store_worker_func(void *arg) {
+    store_worker_t *w = arg;
+    store_ctx_t *ctx = w->ctx;
+    char path[PATH_MAX];
+
+    for (;;) {
+        size_t i = atomic_fetch_add(&ctx->next, 1);
+        if (i >= ctx->manifest->count || atomic_load(&ctx->fatal)) {
+            break;
+        }
+        backup_manifest_entry_t *e = &ctx->manifest->entries[i];
+        if (!S_ISREG(e->mode) || e->target || e->unchanged) {
+            continue;
+        }
+        if (backup_join_path(path, sizeof(path), ctx->src, e->path) != 0) {
+            errors_add(&ctx->errors, e->path, "path", ENAMETOOLONG);
+            ctx->drop[i] = 1;
+        } else if (store_file(ctx, w, path, e) != 0) {
+            ctx->drop[i] = 1;
+        }
+    }
+    return NULL;
+}
+
+// Manifiesto del backup anterior para no releer lo que no cambió. Un
+// fichero no vacío sin chunks no se puede reutilizar.
+static void store_join_previous(backup_manifest_t *manifest, const char *prev_manifest) {
+    backup_manifest_t prev;
+
+    if (!prev_manifest || !prev_manifest[0] ||
+        backup_manifest_load(prev_manifest, &prev) != 0) {
+        return;
+    }
+    backup_manifest_join(manifest, &prev);
+    backup_manifest_free(&prev);
+    for (size_t i = 0; i < manifest->count; i++) {
+        backup_manifest_entry_t *e = &manifest->entries[i];
+        if (e->unchanged && e->size > 0 && e->nchunks == 0) {
+            e->unchanged = 0;
+        }
+    }
+}
+
+int backup_repo_store(const char *repo_dir, const char *src, const char *manifest_path,
+                      const char *prev_manifest, int threads, backup_repo_stats_t *stats) {
+    repo_t repo;
+    store_ctx_t ctx;
+    backup_walk_stats_t ws;
+    backup_manifest_t manifest;
+    struct timespec start;
+    struct stat st;
+    int rc;
+
+    if (!repo_dir || !src || !manifest_path || !stats) {
+        return -EINVAL;
+    }
+    memset(stats, 0, sizeof(*stats));
+    if (lstat(src, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        snprintf(stats->first_error, sizeof(stats->first_error),
+                 "source %s is not a directory", src);
+        return -EINVAL;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Recorrido solo de metadatos y cruce con el manifiesto anterior
+    threads = backup_walk_threads(threads);
+    rc = backup_manifest_scan(src, threads, 0, &manifest, &ws);
+    stats->errors = ws.errors;
+    strncpy(stats->first_error, ws.first_error, sizeof(stats->first_error) - 1);
+    if (rc != 0) {
+        backup_manifest_free(&manifest);
+        return rc;
+    }
+    store_join_previous(&manifest, prev_manifest);
+
+    rc = repo_open(&repo, repo_dir, 1);
+    if (rc != 0) {
+        snprintf(stats->first_error, sizeof(stats->first_error),
+                 "cannot open repository %s", repo_dir);
+        backup_manifest_free(&manifest);
+        return rc;
+    }
+    rc = repo_lock(&repo);
+    if (rc != 0) {
+        snprintf(stats->first_error, sizeof(stats->first_error),
+                 "repository locked: %s", strerror(-rc));
+        backup_manifest_free(&manifest);
+        repo_close(&repo);
+        return rc;
+    }
+    if (sqlite3_exec(repo.db, "BEGIN IMMEDIATE;", NULL, NULL, NULL) != SQLITE_OK) {
+        snprintf(stats->first_error, sizeof(stats->first_error),
+                 "repository locked: %s", sqlite3_errmsg(repo.db));
+        backup_manifest_free(&manifest);
+        repo_close(&repo);
+        return -EBUSY;
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.repo = &repo;
+    ctx.src = src;
+    ctx.manifest = &manifest;
+    atomic_init(&ctx.next, 0);
+    atomic_init(&ctx.fatal, 0);
+    errors_init(&ctx.errors);
+    ctx.drop = calloc(manifest.count ? manifest.count : 1, 1);
+
+    store_worker_t *workers = ctx.drop ? calloc(threads, sizeof(store_worker_t)) : NULL;
+    int started = 0;
+    for (int i = 0; workers && i < threads; i++) {
+        store_worker_t *w = &workers[i];
+        w->ctx = &ctx;
+        w->pack.fd = -1;
+        w->buf = malloc(REPO_READ_BUFFER);
+        w->file_md = EVP_MD_CTX_new();
+        if (!w->buf || !w->file_md ||
+            pthread_create(&w->thread, NULL, store_worker_func, w) != 0) {
+            free(w->buf);
+            EVP_MD_CTX_free(w->file_md);
+            break;
+        }
+        started++;
+    }
+    rc = started ? 0 : -ENOMEM;
+    stats->threads = started;
+
+    // Los packs se sincronizan antes que el manifiesto y este antes del
+    // commit: el índice nunca apunta a datos que no están en disco
+    for (int i = 0; i < started; i++) {
+        store_worker_t *w = &workers[i];
+        pthread_join(w->thread, NULL);
+        if (pack_finish(&w->pack) != 0) {
+            atomic_store(&ctx.fatal, 1);
+        }
+        stats->new_chunks += w->new_chunks;
+        stats->stored_bytes += w->stored_bytes;
+        EVP_MD_CTX_free(w->file_md);
+        free(w->buf);
+    }
+    free(workers);
+    stats->errors += atomic_load(&ctx.errors.count);
+    if (!stats->first_error[0]) {
+        strncpy(stats->first_error, ctx.errors.first, sizeof(stats->first_error) - 1);
+    }
+    pthread_mutex_destroy(&ctx.errors.lock);
+
+    if (rc == 0 && atomic_load(&ctx.fatal)) {
+        rc = -EIO;
+    }
+    if (rc == 0) {
+        backup_manifest_drop(&manifest, ctx.drop);
+        for (size_t i = 0; i < manifest.count; i++) {
+            const backup_manifest_entry_t *e = &manifest.entries[i];
+            if (S_ISDIR(e->mode)) {
+                stats->dirs++;
+            } else if (backup_manifest_is_hardlink(e)) {
+                stats->hardlinks++;
+            } else if (S_ISREG(e->mode)) {
+                stats->files++;
+                stats->unchanged += e->unchanged;
+                stats->chunks += e->nchunks;
+            } else if (S_ISLNK(e->mode)) {
+                stats->symlinks++;
+            } else {
+                stats->specials++;
+            }
+        }
+        backup_manifest_root(&manifest, stats->root);
+        stats->logical_bytes = manifest.logical_bytes;
+        rc = backup_manifest_write(manifest_path, &manifest);
+        if (rc != 0) {
+            snprintf(stats->first_error, sizeof(stats->first_error),
+                     "cannot write manifest %s: %s", manifest_path, strerror(-rc));
+        }
+    }
+    free(ctx.drop);
+    backup_manifest_free(&manifest);
+
+    if (rc == 0 && sqlite3_exec(repo.db, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK) {
+        snprintf(stats->first_error, sizeof(stats->first_error),
+                 "index commit failed: %s", sqlite3_errmsg(repo.db));
+        unlink(manifest_path);
+        rc = -EIO;
+    }
+    if (rc != 0) {
+        sqlite3_exec(repo.db, "ROLLBACK;", NULL, NULL, NULL);
+        stats->stored_bytes = 0;
+        stats->new_chunks = 0;
+        if (!stats->first_error[0]) {
+            snprintf(stats->first_error, sizeof(stats->first_error),
+                     "repository write failed: %s", strerror(rc < 0 ? -rc : EIO));
+        }
+    }
+    repo_close(&repo);
+    stats->elapsed_s = elapsed_since(&start);
+
+    if (rc != 0) {
+        return rc;
+    }
+    return stats->errors ? -1 : 0;
+}
+
+// ---------------------------------------------------------------------------
+// Restauración
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    repo_t *repo;
+    const char *dst;
+    const backup_manifest_t *manifest;
+    atomic_size_t next;
+    repo_errors_t errors;
+    atomic_ullong bytes;
+} restore_ctx_t;
+
+typedef struct {
+    restore_ctx_t *ctx;
+    pthread_t thread;
+    uint8_t *buf;
+    int pack_fd;
+    uint32_t pack_id;
+} restore_worker_t;
+
+static int restore_chunk(restore_worker_t *w, const backup_hash_t hash, int out,
+                         const char *path) {
+    restore_ctx_t *ctx = w->ctx;
+    uint32_t pack, length;
+    uint64_t offset;
+    backup_hash_t check;
+    char hex[BACKUP_HASH_SIZE * 2 + 1];
+
+    if (!repo_lookup(ctx->repo, hash, &pack, &offset, &length) ||
+        length > BACKUP_CDC_MAX_SIZE) {
+        backup_hash_hex(hash, hex);
+        errors_add(&ctx->errors, path, hex, ENOENT);
+        return -1;
+    }
+    if (w->pack_fd < 0 || w->pack_id != pack) {
+        char pack_file[PATH_MAX];
+        if (w->pack_fd >= 0) {
+            close(w->pack_fd);
+        }
+        pack_path(ctx->repo, pack, pack_file, sizeof(pack_file));
+        w->pack_fd = open(pack_file, O_RDONLY | O_CLOEXEC);
+        w->pack_id = pack;
+        if (w->pack_fd < 0) {
+            errors_add(&ctx->errors, pack_file, "open", errno);
+            return -1;
+        }
+    }
+    ssize_t n = pread(w->pack_fd, w->buf, length, offset);
+    if (n != (ssize_t)length) {
+        errors_add(&ctx->errors, path, "read chunk", n < 0 ? errno : EIO);
+        return -1;
+    }
+    chunk_hash(w->buf, length, check);
+    if (memcmp(check, hash, BACKUP_HASH_SIZE) != 0) {
+        backup_hash_hex(hash, hex);
+        errors_add(&ctx->errors, path, hex, EBADMSG);
+        return -1;
+    }
+    for (size_t done = 0; done < length; ) {
+        ssize_t m = write(out, w->buf + done, length - done);
+        if (m < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            errors_add(&ctx->errors, path, "write", errno);
+            return -1;
+        }
+        done += m;
+    }
+    atomic_fetch_add(&ctx->bytes, length);
+    return 0;
+}
+
+static void restore_entry(restore_worker_t *w, const backup_manifest_entry_t *e) {
+    restore_ctx_t *ctx = w->ctx;
+    char path[PATH_MAX];
+    struct stat st;
+    const char *op = NULL;
+    int rc;
+
+    if (backup_join_path(path, sizeof(path), ctx->dst, e->path) != 0) {
+        errors_add(&ctx->errors, e->path, "path", ENAMETOOLONG);
+        return;
+    }
+    backup_manifest_entry_stat(e, &st);
+
+    if (S_ISREG(e->mode)) {
+        int flags = O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC;
+        int out = open(path, flags, 0600);
+        if (out < 0 && errno == EEXIST && unlink(path) == 0) {
+            out = open(path, flags, 0600);
+        }
+        if (out < 0) {
+            errors_add(&ctx->errors, path, "create", errno);
+            return;
+        }
+        for (uint32_t i = 0; i < e->nchunks; i++) {
+            if (restore_chunk(w, e->chunks[i], out, path) != 0) {
+                close(out);
+                return;
+            }
+        }
+        if (backup_apply_metadata(out, path, &st, &op) != 0) {
+            errors_add(&ctx->errors, path, op, errno);
+        }
+        if (close(out) != 0) {
+            errors_add(&ctx->errors, path, "close", errno);
+        }
+        return;
+    }
+
+    if (S_ISLNK(e->mode)) {
+        rc = symlink(e->target ? e->target : "", path);
+        if (rc != 0 && errno == EEXIST && unlink(path) == 0) {
+            rc = symlink(e->target ? e->target : "", path);
+        }
+    } else {
+        rc = mknod(path, e->mode, e->rdev);
+        if (rc != 0 && errno == EEXIST && unlink(path) == 0) {
+            rc = mknod(path, e->mode, e->rdev);
+        }
+    }
+    if (rc != 0) {
+        errors_add(&ctx->errors, path, S_ISLNK(e->mode) ? "symlink" : "mknod", errno);
+        return;
+    }
+    if (backup_apply_metadata(-1, path, &st, &op) != 0) {
+        errors_add(&ctx->errors, path, op, errno);
+    }
+}
+
+static void* restore_worker_func(void *arg) {
+    restore_worker_t *w = arg;
+    restore_ctx_t *ctx = w->ctx;
+
+    for (;;) {
+        size_t i = atomic_fetch_add(&ctx->next, 1);
+        if (i >= ctx->manifest->count) {
+            break;
+        }
+        const backup_manifest_entry_t *e = &ctx->manifest->entries[i];
+        if (S_ISDIR(e->mode) || backup_manifest_is_hardlink(e)) {
+            continue;
+        }
+        restore_entry(w, e);
+    }
+    return NULL;
+}
+
+int backup_repo_restore(const char *repo_dir, const char *manifest_path, const char *dst,
+                        int threads, backup_repo_stats_t *stats) {
+    repo_t repo;
+    restore_ctx_t ctx;
+    backup_manifest_t manifest;
+    struct timespec start;
+    char path[PATH_MAX];
+    char target[PATH_MAX];
+    struct stat st;
+    const char *op = NULL;
+    int rc;
+
+    if (!repo_dir || !manifest_path || !dst || !stats) {
+        return -EINVAL;
+    }
+    memset(stats, 0, sizeof(*stats));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    rc = backup_manifest_load(manifest_path, &manifest);
+    if (rc != 0) {
+        snprintf(stats->first_error, sizeof(stats->first_error),
+                 "cannot load manifest %s: %s", manifest_path, strerror(-rc));
+        return rc;
+    }
+    rc = repo_open(&repo, repo_dir, 0);
+    if (rc != 0) {
+        snprintf(stats->first_error, sizeof(stats->first_error),
+                 "cannot open repository %s", repo_dir);
+        backup_manifest_free(&manifest);
+        return rc;
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.repo = &repo;
+    ctx.dst = dst;
+    ctx.manifest = &manifest;
+    atomic_init(&ctx.next, 0);
+    atomic_init(&ctx.bytes, 0);
+    errors_init(&ctx.errors);
+
+    // Directorios primero (el orden por ruta pone cada padre antes que sus
+    // hijos), con permisos amplios hasta el final
+    for (size_t i = 0; i < manifest.count; i++) {
+        const backup_manifest_entry_t *e = &manifest.entries[i];
+        if (!S_ISDIR(e->mode)) {
+            continue;
+        }
+        if (backup_join_path(path, sizeof(path), dst, e->path) != 0) {
+            errors_add(&ctx.errors, e->path, "path", ENAMETOOLONG);
+        } else if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+            errors_add(&ctx.errors, path, "mkdir", errno);
+        }
+        stats->dirs++;
+    }
+
+    threads = backup_walk_threads(threads);
+    restore_worker_t *workers = calloc(threads, sizeof(restore_worker_t));
+    int started = 0;
+    for (int i = 0; workers && i < threads; i++) {
+        workers[i].ctx = &ctx;
+        workers[i].pack_fd = -1;
+        workers[i].buf = malloc(BACKUP_CDC_MAX_SIZE);
+        if (!workers[i].buf ||
+            pthread_create(&workers[i].thread, NULL, restore_worker_func, &workers[i]) != 0) {
+            free(workers[i].buf);
+            break;
+        }
+        started++;
+    }
+    if (started == 0) {
+        errors_add(&ctx.errors, dst, "start workers", ENOMEM);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        if (workers[i].pack_fd >= 0) {
+            close(workers[i].pack_fd);
+        }
+        free(workers[i].buf);
+    }
+    free(workers);
+    stats->threads = started;
+
+    // Enlaces duros y después metadatos de directorios, de dentro a fuera
+    for (size_t i = 0; i < manifest.count; i++) {
+        const backup_manifest_entry_t *e = &manifest.entries[i];
+        if (S_ISREG(e->mode)) {
+            if (backup_manifest_is_hardlink(e)) {
+                stats->hardlinks++;
+                if (backup_join_path(path, sizeof(path), dst, e->path) != 0 ||
+                    backup_join_path(target, sizeof(target), dst, e->target) != 0) {
+                    errors_add(&ctx.errors, e->path, "path", ENAMETOOLONG);
+                    continue;
+                }
+                int lrc = link(target, path);
+                if (lrc != 0 && errno == EEXIST && unlink(path) == 0) {
+                    lrc = link(target, path);
+                }
+                if (lrc != 0) {
+                    errors_add(&ctx.errors, path, "link", errno);
+                }
+            } else {
+                stats->files++;
+                stats->chunks += e->nchunks;
+            }
+        } else if (S_ISLNK(e->mode)) {
+            stats->symlinks++;
+        } else if (!S_ISDIR(e->mode)) {
+            stats->specials++;
+        }
+    }
+    for (size_t i = manifest.count; i-- > 0; ) {
+        const backup_manifest_entry_t *e = &manifest.entries[i];
+        if (!S_ISDIR(e->mode) || backup_join_path(path, sizeof(path), dst, e->path) != 0) {
+            continue;
+        }
+        backup_manifest_entry_stat(e, &st);
+        if (backup_apply_metadata(-1, path, &st, &op) != 0) {
+            errors_add(&ctx.errors, path, op, errno);
+        }
+    }
+
+    stats->logical_bytes = atomic_load(&ctx.bytes);
+    stats->errors = atomic_load(&ctx.errors.count);
+    strncpy(stats->first_error, ctx.errors.first, sizeof(stats->first_error) - 1);
+    stats->elapsed_s = elapsed_since(&start);
+
+    pthread_mutex_destroy(&ctx.errors.lock);
+    backup_manifest_free(&manifest);
+    repo_close(&repo);
+    return stats->errors ? -1 : 0;
+}
+
+long backup_repo_missing(const char *repo_dir, const char *manifest_path) {
+    repo_t repo;
+    backup_manifest_t manifest;
+    long missing = 0;
+    int rc;
+
+    rc = backup_manifest_load(manifest_path, &manifest);
+    if (rc != 0) {
+        return rc;
+    }
+    rc = repo_open(&repo, repo_dir, 0);
+    if (rc != 0) {
+        backup_manifest_free(&manifest);
+        return rc;
+    }
+    for (size_t i = 0; i < manifest.count; i++) {
+        const backup_manifest_entry_t *e = &manifest.entries[i];
+        for (uint32_t c = 0; c < e->nchunks; c++) {
+            if (!repo_lookup(&repo, e->chunks[c], NULL, NULL, NULL)) {
+                missing++;
+            }
+        }
+    }
+    backup_manifest_free(&manifest);
+    repo_close(&repo);
+    return missing;
+}
+
+// ---------------------------------------------------------------------------
+// Verificación
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    int fd;
+    uint32_t id;
+} pack_reader_t;
+
+typedef struct {
+    repo_t *repo;
+    pack_reader_t *readers;     // pack abierto por cada lector
+} repo_verify_ctx_t;
+
+static void verify_repo_entry(backup_verify_t *verify, int worker, uint8_t *buf,
+                              const backup_manifest_entry_t *e, void *arg) {
+    repo_verify_ctx_t *ctx = arg;
+    pack_reader_t *reader = &ctx->readers[worker];
+    char reason[128];
+    char hex[BACKUP_HASH_SIZE * 2 + 1];
+    backup_hash_t check;
+    uint64_t total = 0;
+
+    // Sin datos propios: basta con que el manifiesto sea legible
+    if (!S_ISREG(e->mode) || backup_manifest_is_hardlink(e)) {
+        return;
+    }
+    EVP_MD_CTX *md = EVP_MD_CTX_new();
+    if (!md || EVP_DigestInit_ex(md, EVP_sha256(), NULL) != 1) {
+        EVP_MD_CTX_free(md);
+        backup_verify_fail(verify, e->path, strerror(ENOMEM));
+        return;
+    }
+
+    for (uint32_t i = 0; i < e->nchunks; i++) {
+        uint32_t pack, length;
+        uint64_t offset;
+
+        backup_hash_hex(e->chunks[i], hex);
+        if (!repo_lookup(ctx->repo, e->chunks[i], &pack, &offset, &length) ||
+            length > BACKUP_CDC_MAX_SIZE) {
+            snprintf(reason, sizeof(reason), "chunk %.16s missing", hex);
+            backup_verify_fail(verify, e->path, reason);
+            goto out;
+        }
+        if (reader->fd < 0 || reader->id != pack) {
+            char pack_file[PATH_MAX];
+            if (reader->fd >= 0) {
+                close(reader->fd);
+            }
+            pack_path(ctx->repo, pack, pack_file, sizeof(pack_file));
+            reader->fd = open(pack_file, O_RDONLY | O_CLOEXEC);
+            reader->id = pack;
+            if (reader->fd < 0) {
+                snprintf(reason, sizeof(reason), "pack %08u: %s", pack, strerror(errno));
+                backup_verify_fail(verify, e->path, reason);
+                goto out;
+            }
+        }
+        ssize_t n = pread(reader->fd, buf, length, offset);
+        if (n != (ssize_t)length) {
+            snprintf(reason, sizeof(reason), "chunk %.16s unreadable", hex);
+            backup_verify_fail(verify, e->path, reason);
+            goto out;
+        }
+        backup_verify_throttle(verify, length);
+        chunk_hash(buf, length, check);
+        if (memcmp(check, e->chunks[i], BACKUP_HASH_SIZE) != 0) {
+            snprintf(reason, sizeof(reason), "chunk %.16s corrupted", hex);
+            backup_verify_fail(verify, e->path, reason);
+            goto out;
+        }
+        EVP_DigestUpdate(md, buf, length);
+        total += length;
+    }
+    EVP_DigestFinal_ex(md, check, NULL);
+
+    if (total != e->size) {
+        snprintf(reason, sizeof(reason), "size %llu, expected %llu",
+                 (unsigned long long)total, (unsigned long long)e->size);
+        backup_verify_fail(verify, e->path, reason);
+    } else if (e->has_hash && memcmp(check, e->hash, BACKUP_HASH_SIZE) != 0) {
+        backup_verify_fail(verify, e->path, "content hash differs");
+    }
+
+out:
+    EVP_MD_CTX_free(md);
+}
+
+int backup_repo_verify(const char *repo_dir, const char *manifest_path,
+                       const backup_verify_opts_t *opts, backup_verify_report_t *report) {
+    repo_t repo;
+    backup_manifest_t manifest;
+    repo_verify_ctx_t ctx;
+    int threads = backup_walk_threads(opts->threads);
+
+    memset(report, 0, sizeof(*report));
+    int rc = backup_manifest_load(manifest_path, &manifest);
+    if (rc != 0) {
+        return rc;
+    }
+    rc = repo_open(&repo, repo_dir, 0);
+    if (rc != 0) {
+        backup_manifest_free(&manifest);
+        return rc;
+    }
+    ctx.repo = &repo;
+    ctx.readers = malloc(threads * sizeof(pack_reader_t));
+    if (!ctx.readers) {
+        rc = -ENOMEM;
+    } else {
+        for (int i = 0; i < threads; i++) {
+            ctx.readers[i].fd = -1;
+        }
+        rc = backup_verify_manifest(&manifest, opts, verify_repo_entry, &ctx, report);
+        for (int i = 0; i < threads; i++) {
+            if (ctx.readers[i].fd >= 0) {
+                close(ctx.readers[i].fd);
+            }
+        }
+        free(ctx.readers);
+    }
+    backup_manifest_free(&manifest);
+    repo_close(&repo);
+    return rc;
+}
+
+// ---------------------------------------------------------------------------
+// Recolección de chunks sin referencias
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    backup_hash_t *slots;
+    uint8_t *used;
+    size_t cap;
+    size_t count;
+} hash_set_t;
+
+static size_t hash_slot(const hash_set_t *set, const uint8_t *hash) {
+    uint64_t h;
+    memcpy(&h, hash, sizeof(h));
+    return h & (set->cap - 1);
+}
+
+static int hash_set_has(const hash_set_t *set, const uint8_t *hash) {
+    if (set->cap == 0) {
+        return 0;
+    }
+    for (size_t i = hash_slot(set, hash); set->used[i]; i = (i + 1) & (set->cap - 1)) {
+        if (memcmp(set->slots[i], hash, BACKUP_HASH_SIZE) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int hash_set_add(hash_set_t *set, const uint8_t *hash) {
+    if ((set->count + 1) * 2 > set->cap) {
+        hash_set_t grown;
+        grown.cap = set->cap ? set->cap * 2 : 4096;
+        grown.count = 0;
+        grown.slots = malloc(grown.cap * sizeof(backup_hash_t));
+        grown.used = calloc(grown.cap, 1);
+        if (!grown.slots || !grown.used) {
+            free(grown.slots);
+            free(grown.used);
+            return -ENOMEM;
+        }
+        for (size_t i = 0; i < set->cap; i++) {
+            if (set->used[i]) {
+                size_t j = hash_slot(&grown, set->slots[i]);
+                while (grown.used[j]) {
+                    j = (j + 1) & (grown.cap - 1);
+                }
+                memcpy(grown.slots[j], set->slots[i], BACKUP_HASH_SIZE);
+                grown.used[j] = 1;
+                grown.count++;
+            }
+        }
+        free(set->slots);
+        free(set->used);
+        *set = grown;
+    }
+
+    size_t i = hash_slot(set, hash);
+    while (set->used[i]) {
+        if (memcmp(set->slots[i], hash, BACKUP_HASH_SIZE) == 0) {
+            return 0;
+        }
+        i = (i + 1) & (set->cap - 1);
+    }
+    memcpy(set->slots[i], hash, BACKUP_HASH_SIZE);
+    set->used[i] = 1;
+    set->count++;
+    return 0;
+}
+
+static void hash_set_free(hash_set_t *set) {
+    free(set->slots);
+    free(set->used);
+    memset(set, 0, sizeof(*set));
+}
+
+// Marca en el conjunto todos los chunks de todos los manifiestos. Un
+// manifiesto ilegible aborta la recolección: sus chunks podrían estar vivos.
+static int gc_mark(const char *repo_dir, hash_set_t *live) {
+    char path[PATH_MAX];
+    struct dirent *de;
+    int rc = 0;
+
+    snprintf(path, sizeof(path), "%s/manifests", repo_dir);
+    DIR *dir = opendir(path);
+    if (!dir) {
+        return errno == ENOENT ? 0 : -errno;
+    }
+    while (rc == 0 && (de = readdir(dir)) != NULL) {
+        size_t len = strlen(de->d_name);
+        if (len < 9 || strcmp(de->d_name + len - 9, ".manifest") != 0) {
+            continue;
+        }
+        backup_manifest_t manifest;
+        snprintf(path, sizeof(path), "%s/manifests/%s", repo_dir, de->d_name);
+        rc = backup_manifest_load(path, &manifest);
+        if (rc != 0) {
+            fprintf(stderr, "Repository GC: cannot read %s: %s\n", path, strerror(-rc));
+            break;
+        }
+        for (size_t i = 0; i < manifest.count && rc == 0; i++) {
+            for (uint32_t c = 0; c < manifest.entries[i].nchunks && rc == 0; c++) {
+                rc = hash_set_add(live, manifest.entries[i].chunks[c]);
+            }
+        }
+        backup_manifest_free(&manifest);
+    }
+    closedir(dir);
+    return rc;
+}
+
+int backup_repo_gc(const char *repo_dir, uint64_t *freed_bytes) {
+    repo_t repo;
+    hash_set_t live;
+    hash_set_t dead;
+    sqlite3_stmt *stmt;
+    uint8_t *live_packs = NULL;
+    size_t npacks = 0;
+    char path[PATH_MAX];
+    struct dirent *de;
+    int rc;
+
+    if (freed_bytes) {
+        *freed_bytes = 0;
+    }
+    rc = repo_open(&repo, repo_dir, 0);
+    if (rc == -ENOENT) {
+        return 0;
+    }
+    if (rc != 0) {
+        return rc;
+    }
+    // Lock del repositorio durante marcado, borrado y limpieza de packs
+    rc = repo_lock(&repo);
+    if (rc == 0 && sqlite3_exec(repo.db, "BEGIN IMMEDIATE;", NULL, NULL, NULL) != SQLITE_OK) {
+        rc = -EBUSY;
+    }
+    if (rc != 0) {
+        fprintf(stderr, "Repository GC: %s is locked: %s\n", repo_dir, strerror(-rc));
+        repo_close(&repo);
+        return rc;
+    }
+
+    memset(&live, 0, sizeof(live));
+    memset(&dead, 0, sizeof(dead));
+    rc = gc_mark(repo_dir, &live);
+
+    // Chunks sin referencias y packs que conservan alguno vivo. Un recorrido
+    // incompleto dejaría packs vivos sin marcar: cualquier fallo aborta.
+    if (rc == 0 && sqlite3_prepare_v2(repo.db, "SELECT hash, pack FROM chunks;",
+                                      -1, &stmt, NULL) != SQLITE_OK) {
+        rc = -EIO;
+    } else if (rc == 0) {
+        int step = SQLITE_DONE;
+        while (rc == 0 && (step = sqlite3_step(stmt)) == SQLITE_ROW) {
+            const uint8_t *hash = sqlite3_column_blob(stmt, 0);
+            uint32_t pack = (uint32_t)sqlite3_column_int64(stmt, 1);
+            if (!hash || sqlite3_column_bytes(stmt, 0) != BACKUP_HASH_SIZE) {
+                continue;
+            }
+            if (!hash_set_has(&live, hash)) {
+                rc = hash_set_add(&dead, hash);
+                continue;
+            }
+            if (pack >= npacks) {
+                size_t grown = npacks ? npacks : 64;
+                while (grown <= pack) {
+                    grown *= 2;
+                }
+                uint8_t *tmp = realloc(live_packs, grown);
+                if (!tmp) {
+                    rc = -ENOMEM;
+                    break;
+                }
+                memset(tmp + npacks, 0, grown - npacks);
+                live_packs = tmp;
+                npacks = grown;
+            }
+            live_packs[pack] = 1;
+        }
+        if (rc == 0 && step != SQLITE_DONE) {
+            rc = -EIO;
+        }
+        sqlite3_finalize(stmt);
+    }
+
+    if (rc == 0 && dead.count > 0) {
+        if (sqlite3_prepare_v2(repo.db, "DELETE FROM chunks WHERE hash = ?;",
+                               -1, &stmt, NULL) != SQLITE_OK) {
+            rc = -EIO;
+        }
+        for (size_t i = 0; rc == 0 && i < dead.cap; i++) {
+            if (!dead.used[i]) {
+                continue;
+            }
+            sqlite3_bind_blob(stmt, 1, dead.slots[i], BACKUP_HASH_SIZE, SQLITE_STATIC);
+            if (sqlite3_step(stmt) != SQLITE_DONE) {
+                rc = -EIO;
+            }
+            sqlite3_reset(stmt);
+        }
+        sqlite3_finalize(stmt);
+    }
+    if (rc == 0 && sqlite3_exec(repo.db, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK) {
+        rc = -EIO;
+    }
+    if (rc != 0) {
+        sqlite3_exec(repo.db, "ROLLBACK;", NULL, NULL, NULL);
+    }
+
+    // Packs sin chunks vivos (incluidos los huérfanos de backups fallidos).
+    // El flock sigue tomado: ningún store puede estar creando packs.
+    snprintf(path, sizeof(path), "%s/packs", repo_dir);
+    DIR *dir = rc == 0 ? opendir(path) : NULL;
+    while (dir && (de = readdir(dir)) != NULL) {
+        unsigned int id;
+        char suffix[8];
+        if (sscanf(de->d_name, "%08u.%7s", &id, suffix) != 2 || strcmp(suffix, "pack") != 0) {
+            continue;
+        }
+        if (id < npacks && live_packs[id]) {
+            continue;
+        }
+        struct stat st;
+        pack_path(&repo, id, path, sizeof(path));
+        if (stat(path, &st) == 0 && unlink(path) == 0 && freed_bytes) {
+            *freed_bytes += st.st_size;
+        }
+    }
+    if (dir) {
+        closedir(dir);
+    }
+
+    if (rc == 0) {
+        printf("Repository GC: %zu unreferenced chunks removed\n", dead.count);
+    }
+    free(live_packs);
+    hash_set_free(&live);
+    hash_set_free(&dead);
+    repo_close(&repo);
+    return rc;
+}
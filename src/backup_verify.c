@@ -0,0 +1,299 @@
+#include "backup_verify.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <openssl/evp.h>
+
+struct backup_verify {
+    const backup_manifest_t *manifest;
+    const backup_verify_opts_t *opts;
+    backup_verify_fn fn;
+    void *arg;
+    backup_verify_report_t *report;
+    atomic_size_t next;
+    atomic_ullong checked;
+    atomic_ullong sampled_out;
+    atomic_ullong bytes_read;
+    pthread_mutex_t lock;       // informe y reloj del límite de velocidad
+    double rate;                // bytes por segundo (0 = sin límite)
+    double next_slot;           // instante en que queda libre el siguiente hueco
+};
+
+typedef struct {
+    backup_verify_t *verify;
+    pthread_t thread;
+    int id;
+    uint8_t *buf;
+} verify_worker_t;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void backup_verify_opts_defaults(backup_verify_opts_t *opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->sample_percent = 100;
+}
+
+int backup_verify_bucket(const char *path) {
+    // FNV-1a: estable entre ejecuciones y versiones
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (const unsigned char *p = (const unsigned char*)path; *p; p++) {
+        h ^= *p;
+        h *= 0x100000001b3ULL;
+    }
+    return (int)(h % 100);
+}
+
+static int verify_selected(const backup_verify_t *verify, const backup_manifest_entry_t *e) {
+    int percent = verify->opts->sample_percent;
+
+    // Solo se muestrean los datos; el resto de entradas no cuesta lecturas
+    if (percent >= 100 || !S_ISREG(e->mode) || backup_manifest_is_hardlink(e)) {
+        return 1;
+    }
+    int offset = ((verify->opts->sample_offset % 100) + 100) % 100;
+    return (backup_verify_bucket(e->path) - offset + 100) % 100 < percent;
+}
+
+void backup_verify_throttle(backup_verify_t *verify, size_t bytes) {
+    atomic_fetch_add(&verify->bytes_read, bytes);
+    if (verify->rate <= 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&verify->lock);
+    double now = now_seconds();
+    if (verify->next_slot < now) {
+        verify->next_slot = now;
+    }
+    verify->next_slot += bytes / verify->rate;
+    double end = verify->next_slot;
+    pthread_mutex_unlock(&verify->lock);
+
+    if (end > now) {
+        double wait = end - now;
+        struct timespec ts = { (time_t)wait, (long)((wait - (time_t)wait) * 1e9) };
+        while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+        }
+    }
+}
+
+void backup_verify_fail(backup_verify_t *verify, const char *path, const char *reason) {
+    backup_verify_report_t *report = verify->report;
+
+    if (path[0] == '\0') {
+        path = ".";
+    }
+    fprintf(stderr, "MISMATCH %s: %s\n", path, reason);
+    pthread_mutex_lock(&verify->lock);
+    report->mismatches++;
+    if (report->reported < BACKUP_VERIFY_MAX_REPORTED) {
+        char *copy = strdup(path);
+        if (copy) {
+            report->bad_paths[report->reported++] = copy;
+        }
+    }
+    pthread_mutex_unlock(&verify->lock);
+}
+
+static void* verify_worker_func(void *arg) {
+    verify_worker_t *w = arg;
+    backup_verify_t *verify = w->verify;
+
+    for (;;) {
+        size_t i = atomic_fetch_add(&verify->next, 1);
+        if (i >= verify->manifest->count) {
+            break;
+        }
+        const backup_manifest_entry_t *e = &verify->manifest->entries[i];
+        if (!verify_selected(verify, e)) {
+            atomic_fetch_add(&verify->sampled_out, 1);
+            continue;
+        }
+        verify->fn(verify, w->id, w->buf, e, verify->arg);
+        atomic_fetch_add(&verify->checked, 1);
+    }
+    return NULL;
+}
+
+int backup_verify_manifest(const backup_manifest_t *manifest, const backup_verify_opts_t *opts,
+                           backup_verify_fn fn, void *arg, backup_verify_report_t *report) {
+    backup_verify_t verify;
+    double start = now_seconds();
+    int threads = backup_walk_threads(opts->threads);
+    int started = 0;
+
+    memset(report, 0, sizeof(*report));
+    memset(&verify, 0, sizeof(verify));
+    verify.manifest = manifest;
+    verify.opts = opts;
+    verify.fn = fn;
+    verify.arg = arg;
+    verify.report = report;
+    verify.rate = opts->rate_limit_mb > 0 ? opts->rate_limit_mb * 1024.0 * 1024.0 : 0;
+    atomic_init(&verify.next, 0);
+    atomic_init(&verify.checked, 0);
+    atomic_init(&verify.sampled_out, 0);
+    atomic_init(&verify.bytes_read, 0);
+    pthread_mutex_init(&verify.lock, NULL);
+
+    verify_worker_t *workers = calloc(threads, sizeof(verify_worker_t));
+    for (int i = 0; workers && i < threads; i++) {
+        workers[i].verify = &verify;
+        workers[i].id = i;
+        workers[i].buf = malloc(BACKUP_HASH_BUFFER);
+        if (!workers[i].buf ||
+            pthread_create(&workers[i].thread, NULL, verify_worker_func, &workers[i]) != 0) {
+            free(workers[i].buf);
+            break;
+        }
+        started++;
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        free(workers[i].buf);
+    }
+    free(workers);
+    pthread_mutex_destroy(&verify.lock);
+
+    report->entries = manifest->count;
+    report->checked = atomic_load(&verify.checked);
+    report->sampled_out = atomic_load(&verify.sampled_out);
+    report->bytes_read = atomic_load(&verify.bytes_read);
+    report->threads = started;
+    report->elapsed_s = now_seconds() - start;
+
+    if (started == 0) {
+        return -ENOMEM;
+    }
+    return report->mismatches ? -1 : 0;
+}
+
+void backup_verify_report_free(backup_verify_report_t *report) {
+    for (size_t i = 0; i < report->reported; i++) {
+        free(report->bad_paths[i]);
+    }
+    report->reported = 0;
+}
+
+// ---------------------------------------------------------------------------
+// Backups en árbol
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    const char *root;
+} tree_ctx_t;
+
+static void verify_tree_file(backup_verify_t *verify, uint8_t *buf, const char *path,
+                             const backup_manifest_entry_t *e) {
+    backup_hash_t hash;
+    unsigned int hash_len = 0;
+    uint64_t total = 0;
+    char reason[64];
+
+    int fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        backup_verify_fail(verify, e->path, strerror(errno));
+        return;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    EVP_MD_CTX *md = EVP_MD_CTX_new();
+    if (!md || EVP_DigestInit_ex(md, EVP_sha256(), NULL) != 1) {
+        EVP_MD_CTX_free(md);
+        close(fd);
+        backup_verify_fail(verify, e->path, strerror(ENOMEM));
+        return;
+    }
+    for (;;) {
+        ssize_t n = read(fd, buf, BACKUP_HASH_BUFFER);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            snprintf(reason, sizeof(reason), "read: %s", strerror(errno));
+            backup_verify_fail(verify, e->path, reason);
+            goto out;
+        }
+        if (n == 0) {
+            break;
+        }
+        backup_verify_throttle(verify, n);
+        EVP_DigestUpdate(md, buf, n);
+        total += n;
+    }
+    EVP_DigestFinal_ex(md, hash, &hash_len);
+
+    if (total != e->size) {
+        snprintf(reason, sizeof(reason), "size %llu, expected %llu",
+                 (unsigned long long)total, (unsigned long long)e->size);
+        backup_verify_fail(verify, e->path, reason);
+    } else if (e->has_hash && memcmp(hash, e->hash, BACKUP_HASH_SIZE) != 0) {
+        backup_verify_fail(verify, e->path, "content hash differs");
+    }
+
+out:
+    EVP_MD_CTX_free(md);
+    close(fd);
+}
+
+static void verify_tree_entry(backup_verify_t *verify, int worker, uint8_t *buf,
+                              const backup_manifest_entry_t *e, void *arg) {
+    tree_ctx_t *ctx = arg;
+    char path[PATH_MAX];
+    char target[PATH_MAX];
+    struct stat st, st2;
+    (void)worker;
+
+    if (backup_join_path(path, sizeof(path), ctx->root, e->path) != 0) {
+        backup_verify_fail(verify, e->path, "path too long");
+        return;
+    }
+    if (lstat(path, &st) != 0) {
+        backup_verify_fail(verify, e->path, errno == ENOENT ? "missing" : strerror(errno));
+        return;
+    }
+    if ((st.st_mode & S_IFMT) != (e->mode & S_IFMT)) {
+        backup_verify_fail(verify, e->path, "file type changed");
+        return;
+    }
+
+    if (backup_manifest_is_hardlink(e)) {
+        if (backup_join_path(target, sizeof(target), ctx->root, e->target) != 0 ||
+            stat(target, &st2) != 0 || st2.st_ino != st.st_ino || st2.st_dev != st.st_dev) {
+            backup_verify_fail(verify, e->path, "hardlink broken");
+        }
+    } else if (S_ISREG(e->mode)) {
+        verify_tree_file(verify, buf, path, e);
+    } else if (S_ISLNK(e->mode)) {
+        ssize_t len = readlink(path, target, sizeof(target) - 1);
+        if (len < 0 || (target[len] = '\0', !e->target) || strcmp(target, e->target) != 0) {
+            backup_verify_fail(verify, e->path, "symlink target differs");
+        }
+    }
+}
+
+int backup_verify_tree(const char *manifest_path, const char *root,
+                       const backup_verify_opts_t *opts, backup_verify_report_t *report) {
+    backup_manifest_t manifest;
+    tree_ctx_t ctx = { root };
+
+    memset(report, 0, sizeof(*report));
+    int rc = backup_manifest_load(manifest_path, &manifest);
+    if (rc != 0) {
+        return rc;
+    }
+    rc = backup_verify_manifest(&manifest, opts, verify_tree_entry, &ctx, report);
+    backup_manifest_free(&manifest);
+    return rc;
+}
@@ -12,6 +12,7 @@
 #include "backup_engine.h"
 #include "performance_tuner.h"
 #include "ipc_server.h"
+#include "metrics_server.h"
 #include "daemon.h"
 
 /* Constantes y variables externas del daemon framework */
@@ -41,12 +42,27 @@ void test_worker(void *arg) {
 }
 
 /* Uso/ayuda */
+static double monitor_default_budget(void) {
+    monitor_config_t cfg;
+    monitor_config_defaults(&cfg);
+    return cfg.overhead_budget_percent;
+}
+
 void print_usage(const char *program_name) {
     printf("Usage: %s [OPTIONS]\n", program_name);
     printf("Storage Manager Daemon\n\n");
     printf("Options:\n");
     printf("  -f, --foreground    Run in foreground (don't daemonize)\n");
     printf("  -p, --pidfile PATH  Specify PID file path\n");
+    printf("  -d, --devices LIST  Comma-separated devices to monitor (default: all)\n");
+    printf("  -i, --interval MS   Monitor sampling interval in ms (default: 5000, min: 10)\n");
+    printf("  -b, --backend NAME  Sample storage: sqlite (default) or tsdb\n");
+    printf("  -m, --metrics ADDR  OpenMetrics endpoint: UNIX socket path or loopback port\n");
+    printf("                      (default: %s, 'none' disables)\n", METRICS_SOCKET_PATH);
+    printf("  -c, --cpu-budget P  Max monitor CPU %%; the interval grows to stay under it\n");
+    printf("                      (default: %.1f, 0 disables)\n", monitor_default_budget());
+    printf("  -t, --top-processes N  Rank the N busiest processes by I/O each second\n");
+    printf("                      (default: 0 = off, max: %d)\n", MONITOR_MAX_TOP_PROCESSES);
     printf("  -h, --help          Show this help message\n");
     printf("  -v, --version       Show version information\n");
     printf("\n");
@@ -60,6 +76,7 @@ void print_usage(const char *program_name) {
 /* Limpieza específica */
 void cleanup(void)
 {
+    metrics_server_stop();
     ipc_server_cleanup();
     fflush(stdout);
 }
@@ -72,6 +89,30 @@ static void handle_signal_simple(int sig)
     exit(0);
 }
 
+/* Configura los dispositivos monitorizados a partir de "sda,md0,dm-1" */
+static int configure_monitor_devices(char *list)
+{
+    const char *devices[MONITOR_MAX_DEVICES];
+    int count = 0;
+    char *saveptr = NULL;
+
+    for (char *tok = strtok_r(list, ",", &saveptr);
+         tok && count < MONITOR_MAX_DEVICES;
+         tok = strtok_r(NULL, ",", &saveptr)) {
+        if (*tok) {
+            devices[count++] = tok;
+        }
+    }
+
+    return monitor_set_devices(devices, count);
+}
+
+/* Cada muestra del monitor se publica en los anillos de shm */
+static void publish_sample(const char *device, const performance_sample_t *sample, void *arg) {
+    (void)arg;
+    ipc_samples_publish(device, sample);
+}
+
 /* Hilo que corre el servidor IPC */
 static void* ipc_server_thread(void *arg) {
     (void)arg;
@@ -85,17 +126,29 @@ int main(int argc, char *argv[])
 {
     int foreground = 0;
     const char *pidfile = NULL;
+    char *device_list = NULL;
+    int interval_ms = 5000;
+    const char *metrics_addr = METRICS_SOCKET_PATH;
+    monitor_config_t monitor_cfg;
     int opt;
 
+    monitor_config_defaults(&monitor_cfg);
+
     static struct option long_options[] = {
         {"foreground", no_argument, 0, 'f'},
         {"pidfile", required_argument, 0, 'p'},
+        {"devices", required_argument, 0, 'd'},
+        {"interval", required_argument, 0, 'i'},
+        {"backend", required_argument, 0, 'b'},
+        {"metrics", required_argument, 0, 'm'},
+        {"cpu-budget", required_argument, 0, 'c'},
+        {"top-processes", required_argument, 0, 't'},
         {"help", no_argument, 0, 'h'},
         {"version", no_argument, 0, 'v'},
         {0, 0, 0, 0}
     };
 
-    while ((opt = getopt_long(argc, argv, "fp:hv", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "fp:d:i:b:m:c:t:hv", long_options, NULL)) != -1) {
         switch (opt) {
             case 'f':
                 foreground = 1;
@@ -103,6 +156,31 @@ int main(int argc, char *argv[])
             case 'p':
                 pidfile = optarg;
                 break;
+            case 'd':
+                device_list = optarg;
+                break;
+            case 'i':
+                interval_ms = atoi(optarg);
+                break;
+            case 'b':
+                if (strcmp(optarg, "tsdb") == 0) {
+                    monitor_cfg.backend = MONITOR_BACKEND_TSDB;
+                } else if (strcmp(optarg, "sqlite") == 0) {
+                    monitor_cfg.backend = MONITOR_BACKEND_SQLITE;
+                } else {
+                    fprintf(stderr, "Unknown backend: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'm':
+                metrics_addr = strcmp(optarg, "none") == 0 ? NULL : optarg;
+                break;
+            case 'c':
+                monitor_cfg.overhead_budget_percent = atof(optarg);
+                break;
+            case 't':
+                monitor_cfg.process_top_n = atoi(optarg);
+                break;
             case 'h':
                 print_usage(argv[0]);
                 return 0;
@@ -116,34 +194,34 @@ int main(int argc, char *argv[])
         }
     }
 
-    if (geteuid() != 0) {
-        fprintf(stderr, "Error: this daemon must be run as root\n");
+    if (interval_ms < 10) {
+        fprintf(stderr, "Invalid interval: %d ms (min: 10)\n", interval_ms);
         return 1;
     }
 
-    printf("Starting Storage Manager Daemon...\n");
-
-    /* Inicialización de IPC y monitor antes de daemonizar */
-    if (ipc_server_init(socket_path) != 0) {
-        fprintf(stderr, "ipc_server_init failed (socket=%s)\n", socket_path);
+    if (monitor_cfg.process_top_n < 0 || monitor_cfg.process_top_n > MONITOR_MAX_TOP_PROCESSES) {
+        fprintf(stderr, "Invalid process count: %d (max: %d)\n",
+                monitor_cfg.process_top_n, MONITOR_MAX_TOP_PROCESSES);
         return 1;
     }
 
-    if (monitor_init() != 0) {
-        fprintf(stderr, "monitor_init failed\n");
-        ipc_server_cleanup();
+    if (geteuid() != 0) {
+        fprintf(stderr, "Error: this daemon must be run as root\n");
         return 1;
     }
 
-    if (monitor_start_continuous(5) != 0) {
-        fprintf(stderr, "monitor_start_continuous failed\n");
-        ipc_server_cleanup();
+    printf("Starting Storage Manager Daemon...\n");
+
+    /* El socket IPC se abre antes de daemonizar para informar del error en la terminal */
+    if (ipc_server_init(socket_path) != 0) {
+        fprintf(stderr, "ipc_server_init failed (socket=%s)\n", socket_path);
         return 1;
     }
 
-    /* Daemonización */
+    /* Daemonización antes de crear hilos: fork() solo conserva el que lo llama */
     if (!foreground) {
         printf("Daemonizing process...\n");
+        fflush(stdout);
         if (daemon_init() < 0) {
             fprintf(stderr, "Error: Failed to daemonize\n");
             cleanup();
@@ -154,6 +232,31 @@ int main(int argc, char *argv[])
         openlog(DAEMON_NAME, LOG_PID | LOG_PERROR, LOG_DAEMON);
     }
 
+    /* Monitor (escritor, barrido de montajes y muestreo) y endpoint de métricas */
+    if (monitor_init_with_config(&monitor_cfg) != 0) {
+        syslog(LOG_ERR, "monitor_init failed");
+        ipc_server_cleanup();
+        return 1;
+    }
+
+    if (device_list && configure_monitor_devices(device_list) != 0) {
+        syslog(LOG_ERR, "Invalid device list");
+        ipc_server_cleanup();
+        return 1;
+    }
+
+    monitor_set_sample_hook(publish_sample, NULL);
+    if (monitor_start_continuous_ms(interval_ms) != 0) {
+        syslog(LOG_ERR, "monitor_start_continuous failed");
+        ipc_server_cleanup();
+        return 1;
+    }
+
+    /* El cuerpo OpenMetrics se regenera en cada tick del monitor */
+    if (metrics_addr && metrics_server_start(metrics_addr) != 0) {
+        syslog(LOG_WARNING, "metrics endpoint not available on %s", metrics_addr);
+    }
+
     /* PID file */
     if (daemon_create_pidfile(pidfile) < 0) {
         syslog(LOG_ERR, "Error creating PID file");
@@ -195,6 +298,12 @@ int main(int argc, char *argv[])
         worker_t worker_list[MAX_WORKERS];
         int active = daemon_monitor_workers(worker_list, MAX_WORKERS);
 
+        /* Coste del monitor visible por CMD_STATUS y en shm */
+        monitor_self_stats_t self;
+        if (monitor_get_self_stats(&self) == 0) {
+            ipc_shm_update_monitor(&self);
+        }
+
         if (loop_count % 30 == 0 && active < 3) {
             syslog(LOG_INFO, "Spawning test worker");
             int *task_id = malloc(sizeof(int));
@@ -1,4 +1,5 @@
 #include "../include/filesystem_ops.h"
+#include "../include/mount_cache.h"
 #include <sys/statvfs.h>
 #include <mntent.h>
 
@@ -532,32 +533,42 @@ int fs_get_info(const char *device_or_mount, fs_info_t *info) {
 
 /**
  * Lista filesystems montados
+ * El uso sale de la caché de montajes (statvfs en paralelo con timeout),
+ * así que un montaje colgado no bloquea el listado.
  */
 int fs_list_mounted(fs_info_t *fs_list, int max_fs, int *count) {
-    FILE *fp = setmntent("/proc/mounts", "r");
-    if (fp == NULL) {
-        return ERROR_SYSTEM_CALL;
+    if (fs_list == NULL || count == NULL || max_fs < 0) {
+        return ERROR_INVALID_PARAM;
     }
     
-    *count = 0;
-    struct mntent *mnt;
+    mount_usage_t *mounts = malloc((max_fs > 0 ? max_fs : 1) * sizeof(mount_usage_t));
+    if (mounts == NULL) {
+        return ERROR_GENERIC;
+    }
     
-    while ((mnt = getmntent(fp)) != NULL && *count < max_fs) {
-        fs_info_t *info = &fs_list[*count];
+    int total = mount_cache_list(mounts, max_fs);
+    if (total < 0) {
+        free(mounts);
+        return ERROR_SYSTEM_CALL;
+    }
+    
+    *count = MIN(total, max_fs);
+    for (int i = 0; i < *count; i++) {
+        fs_info_t *info = &fs_list[i];
+        mount_usage_t *m = &mounts[i];
         
-        strncpy(info->device, mnt->mnt_fsname, MAX_PATH - 1);
-        strncpy(info->mount_point, mnt->mnt_dir, MAX_PATH - 1);
-        strncpy(info->type_str, mnt->mnt_type, 15);
-        strncpy(info->options, mnt->mnt_opts, 255);
-        info->type = fs_string_to_type(mnt->mnt_type);
+        memset(info, 0, sizeof(fs_info_t));
+        strncpy(info->device, m->device, MAX_PATH - 1);
+        strncpy(info->mount_point, m->mount_point, MAX_PATH - 1);
+        strncpy(info->type_str, m->fstype, 15);
+        strncpy(info->options, m->options, 255);
+        info->type = fs_string_to_type(m->fstype);
         info->is_mounted = 1;
-        
-        fs_get_usage(info->mount_point, &info->total_bytes,
-                    &info->used_bytes, &info->available_bytes);
-        
-        (*count)++;
+        info->total_bytes = m->total_bytes;
+        info->used_bytes = m->total_bytes - m->free_bytes;
+        info->available_bytes = m->available_bytes;
     }
     
-    endmntent(fp);
+    free(mounts);
     return SUCCESS;
 }
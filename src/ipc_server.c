@@ -9,6 +9,7 @@
 #include <sys/select.h>
 #include <sys/shm.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/msg.h>
 #include <semaphore.h>
 #include <fcntl.h>
@@ -18,14 +19,24 @@
 
 #define SHM_NAME "/storage_mgr_shm"
 #define SEM_NAME "/storage_mgr_sem"
+#define SAMPLES_READ_RETRIES 1000
 
 static ipc_server_state_t server_state;
 static system_status_t *shared_status = NULL;
+static ipc_sample_shm_t *sample_shm = NULL;
+static int sample_shm_writer = 0;
+static uint32_t sample_hint = 0;        // anillo de la última publicación
 static sem_t *status_sem = NULL;
 static int msg_queue_id = -1;
 
 static struct sockaddr_un addr;
 
+static int ipc_samples_create(void);
+
+// Contadores de peticiones (exportados por ipc_get_counters)
+static ipc_counters_t counters;
+static pthread_mutex_t counters_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 int ipc_server_init(const char *socket_path) {
     signal(SIGPIPE, SIG_IGN);
 
@@ -169,12 +180,27 @@ int ipc_dispatch_command(command_type_t cmd, const char *payload,
     (void)payload;
 
     switch (cmd) {
-        case CMD_STATUS:
+        case CMD_STATUS: {
+            monitor_self_stats_t mon;
+            memset(&mon, 0, sizeof(mon));
+            pthread_mutex_lock(&counters_mutex);
+            if (shared_status) {
+                mon = shared_status->monitor;
+            }
+            pthread_mutex_unlock(&counters_mutex);
             snprintf(result, result_size,
-                     "Running:1 Clients:%d Uptime:%ld",
+                     "Running:1 Clients:%d Uptime:%ld "
+                     "MonitorCPU:%.2f%% Interval:%dms BudgetFloor:%dms Ticks:%llu "
+                     "MissedTicks:%llu TickCPU:%.1fus Parse:%.1fus Late:%.2fms MaxLate:%.2fms "
+                     "DBWrite:%.2fms MaxDBWrite:%.2fms Dropped:%llu",
                      server_state.num_clients,
-                     time(NULL) - (shared_status ? shared_status->started_at : 0));
+                     time(NULL) - (shared_status ? shared_status->started_at : 0),
+                     mon.cpu_percent, mon.interval_ms, mon.budget_floor_ms,
+                     (unsigned long long)mon.ticks, (unsigned long long)mon.missed_ticks,
+                     mon.tick_cpu_us, mon.parse_us, mon.lateness_ms, mon.max_lateness_ms,
+                     mon.db_write_ms, mon.max_db_write_ms, mon.samples_dropped);
             return STATUS_OK;
+        }
 
         case CMD_SHUTDOWN:
             server_state.running = 0;
@@ -201,6 +227,20 @@ int ipc_handle_request(int client_fd, request_t *req, response_t *resp) {
                                       sizeof(result));
     resp->status = status;
 
+    pthread_mutex_lock(&counters_mutex);
+    counters.total_requests++;
+    if (req->command >= 0 && req->command < IPC_COMMAND_COUNT) {
+        counters.by_command[req->command]++;
+    }
+    if (status != STATUS_OK) {
+        counters.failed_requests++;
+    }
+    if (shared_status) {
+        shared_status->total_requests = counters.total_requests;
+        shared_status->failed_requests = counters.failed_requests;
+    }
+    pthread_mutex_unlock(&counters_mutex);
+
     if (status == STATUS_OK) {
         resp->data_size = strlen(result) + 1;
         if (resp->data_size > IPC_MAX_PAYLOAD_SIZE)
@@ -214,6 +254,16 @@ int ipc_handle_request(int client_fd, request_t *req, response_t *resp) {
     return 0;
 }
 
+int ipc_get_counters(ipc_counters_t *out) {
+    if (!out) return -1;
+
+    pthread_mutex_lock(&counters_mutex);
+    *out = counters;
+    pthread_mutex_unlock(&counters_mutex);
+    out->clients = server_state.num_clients;
+    return 0;
+}
+
 int ipc_shm_init(void) {
     int shm_fd = shm_open(SHM_NAME, O_CREAT | O_RDWR, 0666);
     if (shm_fd < 0) {
@@ -238,6 +288,10 @@ int ipc_shm_init(void) {
     shared_status->daemon_running = 1;
     shared_status->started_at = time(NULL);
 
+    if (ipc_samples_create() != 0) {
+        fprintf(stderr, "Sample ring shm init failed\n");
+    }
+
     return 0;
 }
 
@@ -247,6 +301,151 @@ void ipc_shm_cleanup(void) {
         shared_status = NULL;
     }
     shm_unlink(SHM_NAME);
+
+    if (sample_shm) {
+        int writer = sample_shm_writer;
+        ipc_samples_detach();
+        if (writer) {
+            shm_unlink(IPC_SAMPLES_SHM_NAME);
+        }
+    }
+}
+
+// Segmento nuevo (vacío) para los anillos; lo hereda un daemon reiniciado
+static int ipc_samples_create(void) {
+    shm_unlink(IPC_SAMPLES_SHM_NAME);
+    int shm_fd = shm_open(IPC_SAMPLES_SHM_NAME, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (shm_fd < 0) {
+        return -1;
+    }
+    if (ftruncate(shm_fd, sizeof(ipc_sample_shm_t)) != 0) {
+        close(shm_fd);
+        shm_unlink(IPC_SAMPLES_SHM_NAME);
+        return -1;
+    }
+
+    void *map = mmap(NULL, sizeof(ipc_sample_shm_t), PROT_READ | PROT_WRITE,
+                     MAP_SHARED, shm_fd, 0);
+    close(shm_fd);
+    if (map == MAP_FAILED) {
+        shm_unlink(IPC_SAMPLES_SHM_NAME);
+        return -1;
+    }
+
+    sample_shm = map;
+    sample_shm_writer = 1;
+    sample_hint = 0;
+    sample_shm->ring_size = IPC_SAMPLE_RING_SIZE;
+    sample_shm->max_devices = IPC_SAMPLE_MAX_DEVICES;
+    __atomic_store_n(&sample_shm->magic, IPC_SAMPLES_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static ipc_sample_ring_t *samples_find(const char *device, uint32_t hint) {
+    uint32_t n = __atomic_load_n(&sample_shm->ndevices, __ATOMIC_ACQUIRE);
+    if (hint < n && strcmp(sample_shm->rings[hint].device, device) == 0) {
+        return &sample_shm->rings[hint];
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        if (strcmp(sample_shm->rings[i].device, device) == 0) {
+            return &sample_shm->rings[i];
+        }
+    }
+    return NULL;
+}
+
+// Solo lo llama el thread del monitor (un único escritor)
+int ipc_samples_publish(const char *device, const performance_sample_t *sample) {
+    if (!sample_shm || !sample_shm_writer || !device || !sample) return -1;
+
+    const char *slash = strrchr(device, '/');
+    const char *name = slash ? slash + 1 : device;
+
+    // Las muestras llegan en el mismo orden cada tick: probar el siguiente anillo
+    ipc_sample_ring_t *ring = samples_find(name, sample_hint + 1);
+    if (!ring) {
+        uint32_t n = sample_shm->ndevices;
+        if (n >= IPC_SAMPLE_MAX_DEVICES) return -ENOSPC;
+        ring = &sample_shm->rings[n];
+        strncpy(ring->device, name, sizeof(ring->device) - 1);
+        __atomic_store_n(&sample_shm->ndevices, n + 1, __ATOMIC_RELEASE);
+    }
+    sample_hint = (uint32_t)(ring - sample_shm->rings);
+
+    uint32_t seq = ring->seq;
+    __atomic_store_n(&ring->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    ring->samples[ring->head % IPC_SAMPLE_RING_SIZE] = *sample;
+    ring->head++;
+    __atomic_store_n(&ring->seq, seq + 2, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int ipc_samples_attach(void) {
+    if (sample_shm) return 0;
+
+    int shm_fd = shm_open(IPC_SAMPLES_SHM_NAME, O_RDONLY, 0);
+    if (shm_fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(shm_fd, &st) != 0 || (size_t)st.st_size < sizeof(ipc_sample_shm_t)) {
+        close(shm_fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, sizeof(ipc_sample_shm_t), PROT_READ, MAP_SHARED, shm_fd, 0);
+    close(shm_fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    ipc_sample_shm_t *shm = map;
+    if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != IPC_SAMPLES_MAGIC ||
+        shm->ring_size != IPC_SAMPLE_RING_SIZE || shm->max_devices != IPC_SAMPLE_MAX_DEVICES) {
+        munmap(map, sizeof(ipc_sample_shm_t));
+        return -1;
+    }
+    sample_shm = shm;
+    sample_shm_writer = 0;
+    return 0;
+}
+
+void ipc_samples_detach(void) {
+    if (sample_shm) {
+        munmap(sample_shm, sizeof(ipc_sample_shm_t));
+        sample_shm = NULL;
+        sample_shm_writer = 0;
+    }
+}
+
+int ipc_samples_read(const char *device, performance_sample_t *out, int max) {
+    if (!sample_shm) return -1;
+    if (!device || !out || max <= 0) return -EINVAL;
+
+    const char *slash = strrchr(device, '/');
+    ipc_sample_ring_t *ring = samples_find(slash ? slash + 1 : device, 0);
+    if (!ring) return -ENOENT;
+    if (max > IPC_SAMPLE_RING_SIZE) max = IPC_SAMPLE_RING_SIZE;
+
+    for (int attempt = 0; attempt < SAMPLES_READ_RETRIES; attempt++) {
+        uint32_t seq = __atomic_load_n(&ring->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;
+        }
+
+        uint64_t head = ring->head;
+        int n = head < (uint64_t)max ? (int)head : max;
+        for (int i = 0; i < n; i++) {
+            out[i] = ring->samples[(head - n + i) % IPC_SAMPLE_RING_SIZE];
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&ring->seq, __ATOMIC_RELAXED) == seq) {
+            return n;
+        }
+    }
+    return -EAGAIN;
 }
 
 int ipc_shm_update_status(const system_status_t *status) {
@@ -255,6 +454,15 @@ int ipc_shm_update_status(const system_status_t *status) {
     return 0;
 }
 
+int ipc_shm_update_monitor(const monitor_self_stats_t *stats) {
+    if (!shared_status || !stats) return -1;
+    pthread_mutex_lock(&counters_mutex);
+    shared_status->monitor = *stats;
+    shared_status->cpu_usage = stats->cpu_percent;
+    pthread_mutex_unlock(&counters_mutex);
+    return 0;
+}
+
 int ipc_shm_get_status(system_status_t *status) {
     if (!shared_status || !status) return -1;
     *status = *shared_status;
@@ -408,6 +616,28 @@ int ipc_server_stop(void) {
 const char* ipc_command_to_string(command_type_t cmd) {
     switch (cmd) {
         case CMD_STATUS: return "STATUS";
+        case CMD_RAID_CREATE: return "RAID_CREATE";
+        case CMD_RAID_STATUS: return "RAID_STATUS";
+        case CMD_RAID_ADD_DISK: return "RAID_ADD_DISK";
+        case CMD_RAID_REMOVE_DISK: return "RAID_REMOVE_DISK";
+        case CMD_RAID_FAIL_DISK: return "RAID_FAIL_DISK";
+        case CMD_LVM_PV_CREATE: return "LVM_PV_CREATE";
+        case CMD_LVM_VG_CREATE: return "LVM_VG_CREATE";
+        case CMD_LVM_LV_CREATE: return "LVM_LV_CREATE";
+        case CMD_LVM_LV_EXTEND: return "LVM_LV_EXTEND";
+        case CMD_LVM_SNAPSHOT: return "LVM_SNAPSHOT";
+        case CMD_FS_CREATE: return "FS_CREATE";
+        case CMD_FS_MOUNT: return "FS_MOUNT";
+        case CMD_FS_UNMOUNT: return "FS_UNMOUNT";
+        case CMD_FS_CHECK: return "FS_CHECK";
+        case CMD_BACKUP_CREATE: return "BACKUP_CREATE";
+        case CMD_BACKUP_LIST: return "BACKUP_LIST";
+        case CMD_BACKUP_RESTORE: return "BACKUP_RESTORE";
+        case CMD_MONITOR_STATS: return "MONITOR_STATS";
+        case CMD_MONITOR_START: return "MONITOR_START";
+        case CMD_MONITOR_STOP: return "MONITOR_STOP";
+        case CMD_PERF_BENCHMARK: return "PERF_BENCHMARK";
+        case CMD_PERF_TUNE: return "PERF_TUNE";
         case CMD_SHUTDOWN: return "SHUTDOWN";
         default: return "OTHER";
     }
@@ -0,0 +1,437 @@
+#include "metrics_server.h"
+#include "monitor.h"
+#include "ipc_server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define METRICS_HEADER_RESERVE 256
+#define METRICS_LATENCY_BOUNDS 15
+
+static const double latency_bounds_ms[METRICS_LATENCY_BOUNDS] = {
+    0.1, 0.25, 0.5, 1, 2.5, 5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000
+};
+
+// Respuesta HTTP completa: cabecera justo antes del cuerpo, en data[start..start+len)
+typedef struct {
+    char *data;
+    size_t cap;
+    size_t start;
+    size_t len;
+    int overflow;
+} metrics_buf_t;
+
+static metrics_buf_t bufs[2];
+static int front = -1;                  // buffer publicado
+static int in_use = -1;                 // buffer que se está enviando
+static pthread_mutex_t publish_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t render_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int listen_fd = -1;
+static int wake_fd = -1;
+static char unix_path[108];
+static pthread_t server_thread;
+static int server_running = 0;
+
+static void mb_printf(metrics_buf_t *b, const char *fmt, ...) {
+    if (b->overflow) {
+        return;
+    }
+
+    size_t room = b->cap - b->start - b->len;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(b->data + b->start + b->len, room, fmt, ap);
+    va_end(ap);
+
+    if (n < 0 || (size_t)n >= room) {
+        b->overflow = 1;
+        return;
+    }
+    b->len += (size_t)n;
+}
+
+static const char *basename_of(const char *device) {
+    const char *slash = strrchr(device, '/');
+    return slash ? slash + 1 : device;
+}
+
+static void render_body(metrics_buf_t *b) {
+    device_stats_t stats[MONITOR_MAX_DEVICES];
+    int n = monitor_get_cached_stats(stats, MONITOR_MAX_DEVICES);
+    if (n < 0) {
+        n = 0;
+    }
+
+    static const struct {
+        const char *name;
+        const char *type;
+        const char *help;
+    } families[] = {
+        { "storage_device_reads_completed", "counter", "Reads completed" },
+        { "storage_device_writes_completed", "counter", "Writes completed" },
+        { "storage_device_read_bytes", "counter", "Bytes read" },
+        { "storage_device_written_bytes", "counter", "Bytes written" },
+        { "storage_device_io_time_seconds", "counter", "Time spent doing I/O" },
+        { "storage_device_weighted_io_time_seconds", "counter", "Weighted time spent doing I/O" },
+        { "storage_device_in_flight", "gauge", "I/Os currently in progress" },
+    };
+
+    for (size_t f = 0; f < sizeof(families) / sizeof(families[0]); f++) {
+        mb_printf(b, "# TYPE %s %s\n# HELP %s %s.\n", families[f].name, families[f].type,
+                  families[f].name, families[f].help);
+        for (int i = 0; i < n; i++) {
+            const diskstats_entry_t *r = &stats[i].raw;
+            const char *dev = basename_of(stats[i].device);
+            switch (f) {
+            case 0: mb_printf(b, "%s_total{device=\"%s\"} %llu\n", families[f].name, dev, r->rd_ios); break;
+            case 1: mb_printf(b, "%s_total{device=\"%s\"} %llu\n", families[f].name, dev, r->wr_ios); break;
+            case 2: mb_printf(b, "%s_total{device=\"%s\"} %llu\n", families[f].name, dev, stats[i].read_bytes); break;
+            case 3: mb_printf(b, "%s_total{device=\"%s\"} %llu\n", families[f].name, dev, stats[i].write_bytes); break;
+            case 4: mb_printf(b, "%s_total{device=\"%s\"} %.3f\n", families[f].name, dev, r->io_ticks / 1000.0); break;
+            case 5: mb_printf(b, "%s_total{device=\"%s\"} %.3f\n", families[f].name, dev, r->time_in_queue / 1000.0); break;
+            default: mb_printf(b, "%s{device=\"%s\"} %llu\n", families[f].name, dev, r->in_flight); break;
+            }
+        }
+    }
+
+    mb_printf(b, "# TYPE storage_device_latency_seconds histogram\n"
+                 "# HELP storage_device_latency_seconds I/O completion latency, each I/O at its sampling interval's mean await.\n");
+    for (int i = 0; i < n; i++) {
+        uint64_t buckets[METRICS_LATENCY_BOUNDS];
+        uint64_t count;
+        double sum_ms;
+        const char *dev = basename_of(stats[i].device);
+
+        if (monitor_get_latency_histogram(dev, latency_bounds_ms, METRICS_LATENCY_BOUNDS,
+                                          buckets, &count, &sum_ms) != 0) {
+            continue;
+        }
+        for (int k = 0; k < METRICS_LATENCY_BOUNDS; k++) {
+            mb_printf(b, "storage_device_latency_seconds_bucket{device=\"%s\",le=\"%g\"} %llu\n",
+                      dev, latency_bounds_ms[k] / 1000.0, (unsigned long long)buckets[k]);
+        }
+        mb_printf(b, "storage_device_latency_seconds_bucket{device=\"%s\",le=\"+Inf\"} %llu\n"
+                     "storage_device_latency_seconds_count{device=\"%s\"} %llu\n"
+                     "storage_device_latency_seconds_sum{device=\"%s\"} %.6f\n",
+                  dev, (unsigned long long)count, dev, (unsigned long long)count,
+                  dev, sum_ms / 1000.0);
+    }
+
+    monitor_self_stats_t self;
+    if (monitor_get_self_stats(&self) == 0) {
+        mb_printf(b, "# TYPE storage_monitor_cpu_seconds counter\n"
+                     "# HELP storage_monitor_cpu_seconds CPU used by the sampler and writer threads.\n"
+                     "storage_monitor_cpu_seconds_total %.6f\n"
+                     "# TYPE storage_monitor_ticks counter\n"
+                     "# HELP storage_monitor_ticks Sampling ticks run.\n"
+                     "storage_monitor_ticks_total %llu\n"
+                     "# TYPE storage_monitor_missed_ticks counter\n"
+                     "# HELP storage_monitor_missed_ticks Ticks skipped because the sampler ran late.\n"
+                     "storage_monitor_missed_ticks_total %llu\n"
+                     "# TYPE storage_monitor_samples_dropped counter\n"
+                     "# HELP storage_monitor_samples_dropped Samples dropped with the write queue full.\n"
+                     "storage_monitor_samples_dropped_total %llu\n"
+                     "# TYPE storage_monitor_interval_seconds gauge\n"
+                     "# HELP storage_monitor_interval_seconds Sampling interval in effect.\n"
+                     "storage_monitor_interval_seconds %.3f\n"
+                     "# TYPE storage_monitor_tick_lateness_seconds gauge\n"
+                     "# HELP storage_monitor_tick_lateness_seconds Delay of the last tick past its deadline.\n"
+                     "storage_monitor_tick_lateness_seconds %.6f\n"
+                     "# TYPE storage_monitor_db_write_seconds gauge\n"
+                     "# HELP storage_monitor_db_write_seconds Duration of the last write batch.\n"
+                     "storage_monitor_db_write_seconds %.6f\n",
+                  self.cpu_ms / 1000.0, (unsigned long long)self.ticks,
+                  (unsigned long long)self.missed_ticks, self.samples_dropped,
+                  self.interval_ms / 1000.0, self.lateness_ms / 1000.0,
+                  self.db_write_ms / 1000.0);
+    }
+
+    ipc_counters_t ipc;
+    if (ipc_get_counters(&ipc) == 0) {
+        mb_printf(b, "# TYPE storage_daemon_requests counter\n"
+                     "# HELP storage_daemon_requests IPC requests handled.\n");
+        for (int c = 0; c < IPC_COMMAND_COUNT; c++) {
+            if (ipc.by_command[c] > 0) {
+                mb_printf(b, "storage_daemon_requests_total{command=\"%s\"} %llu\n",
+                          ipc_command_to_string((command_type_t)c),
+                          (unsigned long long)ipc.by_command[c]);
+            }
+        }
+        mb_printf(b, "# TYPE storage_daemon_requests_failed counter\n"
+                     "# HELP storage_daemon_requests_failed IPC requests that failed.\n"
+                     "storage_daemon_requests_failed_total %llu\n"
+                     "# TYPE storage_daemon_clients gauge\n"
+                     "# HELP storage_daemon_clients Connected IPC clients.\n"
+                     "storage_daemon_clients %d\n",
+                  (unsigned long long)ipc.failed_requests, ipc.clients);
+    }
+
+    mb_printf(b, "# EOF\n");
+}
+
+int metrics_render(void) {
+    pthread_mutex_lock(&render_mutex);
+
+    pthread_mutex_lock(&publish_mutex);
+    int target = front < 0 ? 0 : 1 - front;
+    int busy = target == in_use;
+    pthread_mutex_unlock(&publish_mutex);
+
+    // Un scrape lento todavía envía ese buffer: se publica en el próximo tick
+    if (busy) {
+        pthread_mutex_unlock(&render_mutex);
+        return 0;
+    }
+
+    metrics_buf_t *b = &bufs[target];
+    for (;;) {
+        if (!b->data) {
+            b->cap = METRICS_BUFFER_SIZE;
+            b->data = malloc(b->cap);
+            if (!b->data) {
+                b->cap = 0;
+                pthread_mutex_unlock(&render_mutex);
+                return -ENOMEM;
+            }
+        }
+        b->start = METRICS_HEADER_RESERVE;
+        b->len = 0;
+        b->overflow = 0;
+        render_body(b);
+        if (!b->overflow) {
+            break;
+        }
+        // Solo crece si el número de series supera el buffer
+        char *bigger = realloc(b->data, b->cap * 2);
+        if (!bigger) {
+            pthread_mutex_unlock(&render_mutex);
+            return -ENOMEM;
+        }
+        b->data = bigger;
+        b->cap *= 2;
+    }
+
+    char header[METRICS_HEADER_RESERVE];
+    int hlen = snprintf(header, sizeof(header),
+                        "HTTP/1.1 200 OK\r\n"
+                        "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+                        "Content-Length: %zu\r\n"
+                        "Connection: close\r\n\r\n", b->len);
+    b->start = METRICS_HEADER_RESERVE - (size_t)hlen;
+    memcpy(b->data + b->start, header, (size_t)hlen);
+    b->len += (size_t)hlen;
+
+    pthread_mutex_lock(&publish_mutex);
+    front = target;
+    pthread_mutex_unlock(&publish_mutex);
+
+    pthread_mutex_unlock(&render_mutex);
+    return 0;
+}
+
+static void serve_client(int fd) {
+    char req[2048];
+    struct timeval tv = { 1, 0 };
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    // Solo se mira que sea un GET; la ruta da igual
+    ssize_t n = read(fd, req, sizeof(req) - 1);
+    if (n < 4 || memcmp(req, "GET ", 4) != 0) {
+        static const char bad[] = "HTTP/1.1 405 Method Not Allowed\r\nContent-Length: 0\r\n"
+                                  "Connection: close\r\n\r\n";
+        if (write(fd, bad, sizeof(bad) - 1) < 0) {
+            // el cliente ya se fue
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&publish_mutex);
+    int idx = front;
+    in_use = idx;
+    pthread_mutex_unlock(&publish_mutex);
+
+    if (idx >= 0) {
+        const char *p = bufs[idx].data + bufs[idx].start;
+        size_t left = bufs[idx].len;
+        while (left > 0) {
+            ssize_t w = write(fd, p, left);
+            if (w <= 0) {
+                break;
+            }
+            p += w;
+            left -= (size_t)w;
+        }
+    }
+
+    pthread_mutex_lock(&publish_mutex);
+    in_use = -1;
+    pthread_mutex_unlock(&publish_mutex);
+}
+
+static void *metrics_server_func(void *arg) {
+    (void)arg;
+
+    while (server_running) {
+        struct pollfd pfds[2] = {
+            { .fd = listen_fd, .events = POLLIN },
+            { .fd = wake_fd, .events = POLLIN },
+        };
+        if (poll(pfds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (pfds[1].revents & POLLIN) {
+            break;
+        }
+        if (pfds[0].revents & POLLIN) {
+            int fd = accept(listen_fd, NULL, NULL);
+            if (fd >= 0) {
+                // serve_client puede tardar hasta sus timeouts: que los hijos
+                // de system()/popen() no hereden la conexión
+                fcntl(fd, F_SETFD, FD_CLOEXEC);
+                serve_client(fd);
+                close(fd);
+            }
+        }
+    }
+    return NULL;
+}
+
+static int open_listener(const char *listen_addr) {
+    const char *spec = listen_addr ? listen_addr : METRICS_SOCKET_PATH;
+    int fd;
+
+    if (strncmp(spec, "unix:", 5) == 0) {
+        spec += 5;
+    }
+
+    if (spec[0] == '/') {
+        struct sockaddr_un sun;
+
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        strncpy(sun.sun_path, spec, sizeof(sun.sun_path) - 1);
+        strncpy(unix_path, spec, sizeof(unix_path) - 1);
+        unlink(spec);
+        if (bind(fd, (struct sockaddr*)&sun, sizeof(sun)) < 0) {
+            close(fd);
+            unix_path[0] = '\0';
+            return -1;
+        }
+    } else {
+        // Solo loopback: el endpoint no se publica fuera de la máquina
+        struct sockaddr_in sin;
+        const char *colon = strrchr(spec, ':');
+        int port = atoi(colon ? colon + 1 : spec);
+        int one = 1;
+
+        if (port <= 0 || port > 65535 ||
+            (colon && strncmp(spec, "127.0.0.1:", 10) != 0 && strncmp(spec, "localhost:", 10) != 0)) {
+            errno = EINVAL;
+            return -1;
+        }
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_port = htons((uint16_t)port);
+        sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(fd, (struct sockaddr*)&sin, sizeof(sin)) < 0) {
+            close(fd);
+            return -1;
+        }
+    }
+
+    if (listen(fd, 16) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void metrics_tick(void *arg) {
+    (void)arg;
+    metrics_render();
+}
+
+int metrics_server_start(const char *listen_addr) {
+    if (server_running) {
+        return -1;
+    }
+
+    listen_fd = open_listener(listen_addr);
+    if (listen_fd < 0) {
+        return -1;
+    }
+    wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wake_fd < 0 || metrics_render() != 0) {
+        metrics_server_stop();
+        return -1;
+    }
+
+    server_running = 1;
+    if (pthread_create(&server_thread, NULL, metrics_server_func, NULL) != 0) {
+        server_running = 0;
+        metrics_server_stop();
+        return -1;
+    }
+
+    monitor_set_tick_hook(metrics_tick, NULL);
+    return 0;
+}
+
+void metrics_server_stop(void) {
+    monitor_set_tick_hook(NULL, NULL);
+
+    if (server_running) {
+        uint64_t one = 1;
+        server_running = 0;
+        if (write(wake_fd, &one, sizeof(one)) < 0) {
+            // el thread sale al siguiente accept
+        }
+        pthread_join(server_thread, NULL);
+    }
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        listen_fd = -1;
+    }
+    if (wake_fd >= 0) {
+        close(wake_fd);
+        wake_fd = -1;
+    }
+    if (unix_path[0]) {
+        unlink(unix_path);
+        unix_path[0] = '\0';
+    }
+
+    pthread_mutex_lock(&render_mutex);
+    for (int i = 0; i < 2; i++) {
+        free(bufs[i].data);
+        memset(&bufs[i], 0, sizeof(metrics_buf_t));
+    }
+    front = -1;
+    pthread_mutex_unlock(&render_mutex);
+}
@@ -1,204 +1,434 @@
 #include "monitor.h"
+#include "monitor_tsdb.h"
+#include "mount_cache.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <sys/stat.h>
 #include <sys/statvfs.h>
+#include <sys/syscall.h>
 #include <dirent.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <sqlite3.h>
 #include <time.h>
+#include <math.h>
+#include "common.h"
 
 #define DB_PATH "/var/lib/storage_mgr/monitoring.db"
+#define TSDB_PATH "/var/lib/storage_mgr/tsdb"
 #define DISKSTATS_PATH "/proc/diskstats"
 #define PROC_PATH "/proc"
 
+#define DEFAULT_FLUSH_INTERVAL_MS 5000
+#define DEFAULT_FLUSH_BATCH_SIZE 256
+#define DEFAULT_QUEUE_CAPACITY 8192
+#define MIN_INTERVAL_MS 10
+#define DEVICE_RELIST_TICKS 60          // relistado periódico en modo "todos"
+#define PSI_PATH "/proc/pressure/io"
+#define DEFAULT_PSI_TRIGGER "some 50000 1000000"
+#define DEFAULT_PSI_FAST_INTERVAL_MS 100
+#define DEFAULT_PSI_HOLD_MS 10000
+#define PSI_DECAY_STEP_MS 1000
+#define DEFAULT_OVERHEAD_BUDGET 1.0
+#define BUDGET_WINDOW_MS 2000
+#define BUDGET_MAX_INTERVAL_MS 60000
+
 static sqlite3 *db = NULL;
+static monitor_config_t monitor_config;
 static pthread_t monitor_thread = 0;
 static int monitoring_active = 0;
-static int monitor_interval = 1;
+static int monitor_interval_ms = 1000;
+static atomic_int monitor_effective_ms = 0;
+static int tick_floor_ms = 0;           // mínimo del presupuesto (solo el thread)
+static int monitor_wake_fd = -1;
 static pthread_mutex_t monitor_mutex = PTHREAD_MUTEX_INITIALIZER;
+static monitor_tick_hook tick_hook = NULL;
+static void *tick_hook_arg = NULL;
+static monitor_sample_hook sample_hook = NULL;
+static void *sample_hook_arg = NULL;
 
-int monitor_init(void) {
-    int rc;
-    char *err_msg = NULL;
-    const char *sql_create_table =
-        "CREATE TABLE IF NOT EXISTS performance_history ("
-        "id INTEGER PRIMARY KEY AUTOINCREMENT,"
-        "device TEXT NOT NULL,"
-        "timestamp INTEGER NOT NULL,"
-        "iops REAL,"
-        "throughput_mbs REAL,"
-        "latency_ms REAL,"
-        "active_requests INTEGER"
-        ");";
+// Conjunto de dispositivos del thread continuo (protegido por monitor_mutex)
+static char sample_devices[MONITOR_MAX_DEVICES][64];
+static int sample_device_count = 0;
+static unsigned int sample_devices_gen = 0;
 
-    system("mkdir -p /var/lib/storage_mgr");
+typedef struct {
+    const char *name;
+    int index;
+} device_index_t;
 
-    rc = sqlite3_open(DB_PATH, &db);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Cannot open database: %s\n", sqlite3_errmsg(db));
-        return -1;
-    }
+static void diskstats_close(void);
 
-    rc = sqlite3_exec(db, sql_create_table, NULL, NULL, &err_msg);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "SQL error: %s\n", err_msg);
-        sqlite3_free(err_msg);
-        sqlite3_close(db);
-        return -1;
-    }
+// Cola write-behind de muestras pendientes de persistir
+typedef struct {
+    char device[64];
+    performance_sample_t sample;
+} queued_sample_t;
 
-    printf("Monitor: Initialized successfully\n");
-    return 0;
-}
+static queued_sample_t *sample_queue = NULL;
+static queued_sample_t *flush_batch = NULL;
+static int queue_head = 0;
+static int queue_count = 0;
+static unsigned long long samples_dropped = 0;
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
 
-void monitor_cleanup(void) {
-    if (monitoring_active) {
-        monitor_stop_continuous();
-    }
+// Coste propio del monitor (monitor_get_self_stats)
+static monitor_self_stats_t self_stats;
+static pthread_mutex_t self_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-    if (db) {
-        sqlite3_close(db);
-        db = NULL;
-    }
-}
+// Writer: única conexión que inserta, con sentencia preparada cacheada
+static pthread_mutex_t db_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t writer_thread = 0;
+static pid_t writer_pid = 0;        // proceso que creó el hilo (0: sin arrancar)
+static int writer_active = 0;
 
-static int parse_diskstats(const char *device, unsigned long long *reads,
-                          unsigned long long *writes,
-                          unsigned long long *read_sectors,
-                          unsigned long long *write_sectors) {
-    FILE *fp = fopen(DISKSTATS_PATH, "r");
-    if (!fp) {
-        return -1;
-    }
+static void *monitor_writer_func(void *arg);
 
-    char line[512];
-    char dev_name[64];
+/*
+ * Rollups de 1 minuto y 1 hora con min/max/avg/p95 por bucket. Los mantiene
+ * el writer de forma incremental dentro de la misma transacción que inserta
+ * las muestras crudas; el p95 se estima con un histograma logarítmico de
+ * 20 bins por década (error relativo < 6%).
+ */
+#define ROLLUP_TIERS 2
+#define ROLLUP_METRICS 4
+#define ROLLUP_BINS 201
+#define ROLLUP_BINS_PER_DECADE 20
+#define ROLLUP_MIN_DECADE (-3)
 
-    const char *base_name = strrchr(device, '/');
-    if (base_name)
-        base_name++;
-    else
-        base_name = device;
-
-    while (fgets(line, sizeof(line), fp)) {
-        unsigned long long rd, wr, rd_sec, wr_sec;
-        int major, minor;
-        unsigned long long dummy;
-
-        int n = sscanf(line, "%d %d %s %llu %llu %llu %llu %llu %llu %llu",
-                      &major, &minor, dev_name,
-                      &rd, &dummy, &rd_sec, &dummy,
-                      &wr, &dummy, &wr_sec);
-
-        if (n >= 10 && strcmp(dev_name, base_name) == 0) {
-            *reads = rd;
-            *writes = wr;
-            *read_sectors = rd_sec;
-            *write_sectors = wr_sec;
-            fclose(fp);
-            return 0;
-        }
+static const int rollup_resolution[ROLLUP_TIERS] = { 60, 3600 };
+static const char *const rollup_table[ROLLUP_TIERS] = {
+    "performance_rollup_1m", "performance_rollup_1h"
+};
+static const char *const rollup_metric[ROLLUP_METRICS] = {
+    "iops", "throughput", "latency", "util"
+};
+
+typedef struct {
+    double min;
+    double max;
+    double sum;
+    uint32_t bins[ROLLUP_BINS];
+} metric_acc_t;
+
+typedef struct {
+    time_t bucket;
+    unsigned int count;
+    int dirty;
+    metric_acc_t metrics[ROLLUP_METRICS];
+} rollup_acc_t;
+
+typedef struct {
+    char name[64];
+    rollup_acc_t tiers[ROLLUP_TIERS];
+} rollup_state_t;
+
+// Estado privado del writer (solo se toca con db_mutex)
+static rollup_state_t *rollup_states[MONITOR_MAX_DEVICES * 2];
+static sqlite3_stmt *rollup_stmt[ROLLUP_TIERS];
+
+/*
+ * Histogramas de latencia log-lineales (estilo HDR) por dispositivo, en µs.
+ * Los valores menores que 2^LAT_SUB_BITS ocupan bins lineales; por encima,
+ * cada potencia de dos se divide en LAT_HALF sub-bins (error relativo
+ * < 3.2%) hasta 2^32 µs. Las ventanas deslizantes usan dos anillos: 60
+ * slots de 1 s (ventanas de 1 s y 1 min) y 5 slots de 1 min (ventana de
+ * 5 min con granularidad de minuto). Además se acumula el minuto de reloj
+ * en curso, que el writer persiste como snapshot compacto.
+ */
+#define LAT_SUB_BITS 5
+#define LAT_HALF (1 << (LAT_SUB_BITS - 1))
+#define LAT_MAX_BITS 32
+#define LAT_BINS ((LAT_MAX_BITS - LAT_SUB_BITS + 2) * LAT_HALF)
+#define LAT_SEC_SLOTS 60
+#define LAT_MIN_SLOTS 5
+
+typedef struct {
+    int64_t epoch;              // segundo o minuto del slot
+    int merged;                 // snapshot ya combinado con la fila existente
+    uint64_t total;
+    uint32_t bins[LAT_BINS];
+} lat_slot_t;
+
+typedef struct {
+    char name[64];
+    lat_slot_t sec[LAT_SEC_SLOTS];
+    lat_slot_t min[LAT_MIN_SLOTS];
+    lat_slot_t snap;            // minuto de reloj en curso (epoch = inicio)
+    lat_slot_t closed;          // minuto cerrado pendiente de persistir
+    int snap_dirty;
+    int closed_dirty;
+    uint64_t cumulative[LAT_BINS];  // desde el arranque (exportación OpenMetrics)
+    uint64_t cumulative_count;
+    double cumulative_sum_ms;
+} lat_state_t;
+
+static lat_state_t *lat_states[MONITOR_MAX_DEVICES * 2];
+static pthread_mutex_t lat_mutex = PTHREAD_MUTEX_INITIALIZER;
+static sqlite3_stmt *lat_stmt = NULL;
+
+/*
+ * Detección de anomalías online. Por dispositivo y métrica (latencia e
+ * IOPS) se mantiene una banda EWMA de media y varianza y una baseline
+ * estacional por hora de la semana; ambas se actualizan en O(1) por
+ * muestra. La baseline estacional pliega la media y varianza de cada hora
+ * cerrada en su slot, así que compara con la misma hora de semanas
+ * anteriores. Los eventos se encolan y el writer los persiste en
+ * anomaly_events.
+ */
+#define ANOMALY_METRICS 2
+#define ANOMALY_ALPHA 0.05              // banda rápida (~20 muestras)
+#define ANOMALY_SEASON_ALPHA 0.3        // peso de la última semana
+#define ANOMALY_SEASON_SLOTS 168
+#define ANOMALY_WARMUP 30               // muestras antes de poder marcar
+#define ANOMALY_SEASON_WARMUP 2         // semanas antes de usar la baseline
+#define ANOMALY_QUEUE 256
+#define DEFAULT_ANOMALY_THRESHOLD 4.0
+
+typedef struct {
+    double mean;
+    double var;
+    uint32_t n;
+} ewma_t;
+
+typedef struct {
+    char name[64];
+    ewma_t fast[ANOMALY_METRICS];
+    ewma_t season[ANOMALY_METRICS][ANOMALY_SEASON_SLOTS];
+    int64_t hour;                               // hora en curso (desde epoch)
+    double hour_sum[ANOMALY_METRICS];
+    double hour_sumsq[ANOMALY_METRICS];
+    uint32_t hour_n[ANOMALY_METRICS];
+    int active[ANOMALY_METRICS];                // anomalía abierta (histéresis)
+} anomaly_state_t;
+
+static anomaly_state_t *anomaly_states[MONITOR_MAX_DEVICES * 2];
+static monitor_anomaly_t anomaly_queue[ANOMALY_QUEUE];
+static int anomaly_queued = 0;
+static unsigned long long anomalies_dropped = 0;
+static pthread_mutex_t anomaly_mutex = PTHREAD_MUTEX_INITIALIZER;
+static sqlite3_stmt *anomaly_stmt = NULL;
+
+static int rollup_init_db(void);
+static int lat_init_db(void);
+static int anomaly_init_db(void);
+static int flush_pending(void);
+static void proc_io_cleanup(void);
+
+void monitor_config_defaults(monitor_config_t *config) {
+    if (!config) {
+        return;
     }
 
-    fclose(fp);
-    return -1;
+    memset(config, 0, sizeof(monitor_config_t));
+    strncpy(config->db_path, DB_PATH, sizeof(config->db_path) - 1);
+    config->backend = MONITOR_BACKEND_SQLITE;
+    strncpy(config->tsdb_dir, TSDB_PATH, sizeof(config->tsdb_dir) - 1);
+    config->flush_interval_ms = DEFAULT_FLUSH_INTERVAL_MS;
+    config->flush_batch_size = DEFAULT_FLUSH_BATCH_SIZE;
+    config->queue_capacity = DEFAULT_QUEUE_CAPACITY;
+    config->process_top_n = 0;
+    config->anomaly_threshold = DEFAULT_ANOMALY_THRESHOLD;
+    strncpy(config->psi_trigger, DEFAULT_PSI_TRIGGER, sizeof(config->psi_trigger) - 1);
+    config->psi_fast_interval_ms = DEFAULT_PSI_FAST_INTERVAL_MS;
+    config->psi_hold_ms = DEFAULT_PSI_HOLD_MS;
+    config->overhead_budget_percent = DEFAULT_OVERHEAD_BUDGET;
 }
 
-int monitor_get_device_stats(const char *device, device_stats_t *stats) {
-    if (!device || !stats) {
-        return -EINVAL;
-    }
+int monitor_init(void) {
+    return monitor_init_with_config(NULL);
+}
 
-    memset(stats, 0, sizeof(device_stats_t));
-    strncpy(stats->device, device, sizeof(stats->device) - 1);
+// Añade una columna a una tabla existente si todavía no la tiene
+static int ensure_column(const char *table, const char *column, const char *type) {
+    char sql[256];
+    sqlite3_stmt *stmt;
+    int exists = 0;
 
-    unsigned long long reads, writes, read_sectors, write_sectors;
-    if (parse_diskstats(device, &reads, &writes, &read_sectors, &write_sectors) != 0) {
+    snprintf(sql, sizeof(sql), "PRAGMA table_info(%s);", table);
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
         return -1;
     }
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        const char *name = (const char*)sqlite3_column_text(stmt, 1);
+        if (name && strcmp(name, column) == 0) {
+            exists = 1;
+            break;
+        }
+    }
+    sqlite3_finalize(stmt);
 
-    stats->reads = reads;
-    stats->writes = writes;
-    stats->read_bytes = read_sectors * 512;
-    stats->write_bytes = write_sectors * 512;
-    stats->last_update = time(NULL);
-
-    stats->avg_read_latency_ms = 0.0;
-    stats->avg_write_latency_ms = 0.0;
-    stats->queue_depth = 0;
+    if (exists) {
+        return 0;
+    }
 
-    return 0;
+    snprintf(sql, sizeof(sql), "ALTER TABLE %s ADD COLUMN %s %s;", table, column, type);
+    return sqlite3_exec(db, sql, NULL, NULL, NULL) == SQLITE_OK ? 0 : -1;
 }
 
-int monitor_get_io_stats(const char *device, device_stats_t *stats) {
-    return monitor_get_device_stats(device, stats);
+/*
+ * Histórico crudo particionado por día UTC: una tabla
+ * performance_history_AAAAMMDD por día, con índice (device, timestamp,
+ * timestamp_ns). Las consultas solo abren las particiones del rango y la
+ * retención borra particiones enteras con DROP TABLE, sin DELETE fila a
+ * fila. La lista de particiones y la sentencia de inserción cacheada se
+ * protegen con db_mutex.
+ */
+#define HISTORY_PREFIX "performance_history_"
+#define HISTORY_COLUMNS "timestamp, iops, throughput_mbs, latency_ms, active_requests, " \
+                        "read_latency_ms, write_latency_ms, util_percent, avg_queue_size, " \
+                        "timestamp_ns"
+#define SECONDS_PER_DAY 86400
+
+static sqlite3_stmt *insert_stmt = NULL;    // INSERT en la partición insert_day
+static long insert_day = -1;
+static long *history_days = NULL;           // días con partición, ordenados
+static int history_ndays = 0;
+static int history_capacity = 0;
+
+static long history_day(time_t t) {
+    return t >= 0 ? (long)(t / SECONDS_PER_DAY) : -(long)((-t + SECONDS_PER_DAY - 1) / SECONDS_PER_DAY);
 }
 
-int monitor_reset_stats(const char *device) {
-    printf("Monitor: Reset stats for %s\n", device);
-    return 0;
+static void history_table_name(long day, char *name, size_t size) {
+    time_t t = (time_t)day * SECONDS_PER_DAY;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    snprintf(name, size, HISTORY_PREFIX "%04d%02d%02d",
+             tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
 }
 
-int monitor_get_current_performance(const char *device, performance_sample_t *sample) {
-    static device_stats_t prev_stats = {0};
-    static time_t prev_time = 0;
-    device_stats_t curr_stats;
-    time_t curr_time;
+// Días desde 1970-01-01 de una fecha del calendario gregoriano
+static long days_from_civil(int y, int m, int d) {
+    y -= m <= 2;
+    long era = (y >= 0 ? y : y - 399) / 400;
+    long yoe = y - era * 400;
+    long doy = (153L * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
 
-    if (!device || !sample) {
-        return -EINVAL;
+static int history_find_day(long day, int *pos) {
+    int lo = 0, hi = history_ndays;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (history_days[mid] < day) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
     }
+    *pos = lo;
+    return lo < history_ndays && history_days[lo] == day;
+}
 
-    if (monitor_get_device_stats(device, &curr_stats) != 0) {
-        return -1;
+static int history_add_day(long day) {
+    int pos;
+    if (history_find_day(day, &pos)) {
+        return 0;
     }
+    if (history_ndays == history_capacity) {
+        int capacity = history_capacity ? history_capacity * 2 : 64;
+        long *bigger = realloc(history_days, capacity * sizeof(long));
+        if (!bigger) {
+            return -ENOMEM;
+        }
+        history_days = bigger;
+        history_capacity = capacity;
+    }
+    memmove(&history_days[pos + 1], &history_days[pos],
+            (history_ndays - pos) * sizeof(long));
+    history_days[pos] = day;
+    history_ndays++;
+    return 0;
+}
 
-    curr_time = time(NULL);
-    sample->timestamp = curr_time;
-
-    if (prev_time > 0 && strcmp(prev_stats.device, device) == 0) {
-        time_t time_diff = curr_time - prev_time;
-        if (time_diff > 0) {
-            unsigned long long read_diff = curr_stats.read_bytes - prev_stats.read_bytes;
-            unsigned long long write_diff = curr_stats.write_bytes - prev_stats.write_bytes;
-            unsigned long long ops_diff =
-                (curr_stats.reads + curr_stats.writes) -
-                (prev_stats.reads + prev_stats.writes);
+static int history_load_partitions(void) {
+    const char *sql = "SELECT name FROM sqlite_master WHERE type = 'table' "
+                      "AND name GLOB '" HISTORY_PREFIX "[0-9]*';";
+    sqlite3_stmt *stmt;
+    int rc = 0;
 
-            sample->iops = (double)ops_diff / time_diff;
-            sample->throughput_mbs = (double)(read_diff + write_diff) / (time_diff * 1024 * 1024);
-            sample->latency_ms = curr_stats.avg_read_latency_ms;
-            sample->active_requests = curr_stats.queue_depth;
+    history_ndays = 0;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        return -1;
+    }
+    while (rc == 0 && sqlite3_step(stmt) == SQLITE_ROW) {
+        const char *name = (const char*)sqlite3_column_text(stmt, 0);
+        int y, m, d;
+        if (name && sscanf(name + strlen(HISTORY_PREFIX), "%4d%2d%2d", &y, &m, &d) == 3) {
+            rc = history_add_day(days_from_civil(y, m, d));
         }
-    } else {
-        sample->iops = 0.0;
-        sample->throughput_mbs = 0.0;
-        sample->latency_ms = 0.0;
-        sample->active_requests = 0;
     }
+    sqlite3_finalize(stmt);
+    return rc;
+}
 
-    memcpy(&prev_stats, &curr_stats, sizeof(device_stats_t));
-    prev_time = curr_time;
-
-    return 0;
+static void history_reset_insert(void) {
+    if (insert_stmt) {
+        sqlite3_finalize(insert_stmt);
+        insert_stmt = NULL;
+    }
+    insert_day = -1;
 }
 
-int monitor_track_performance(const char *device, performance_sample_t *sample) {
-    if (!db) {
-        return -1;
+// Sentencia de inserción de la partición del día, creándola si no existe
+static sqlite3_stmt *history_insert_stmt(long day) {
+    char name[64];
+    char sql[1024];
+    int pos;
+
+    if (insert_stmt && insert_day == day) {
+        return insert_stmt;
     }
+    history_reset_insert();
 
-    const char *sql = "INSERT INTO performance_history "
-                     "(device, timestamp, iops, throughput_mbs, latency_ms, active_requests) "
-                     "VALUES (?, ?, ?, ?, ?, ?);";
+    history_table_name(day, name, sizeof(name));
+    if (!history_find_day(day, &pos)) {
+        snprintf(sql, sizeof(sql),
+                 "CREATE TABLE IF NOT EXISTS %s ("
+                 "device TEXT NOT NULL,"
+                 "timestamp INTEGER NOT NULL,"
+                 "iops REAL,"
+                 "throughput_mbs REAL,"
+                 "latency_ms REAL,"
+                 "active_requests INTEGER,"
+                 "read_latency_ms REAL,"
+                 "write_latency_ms REAL,"
+                 "util_percent REAL,"
+                 "avg_queue_size REAL,"
+                 "timestamp_ns INTEGER"
+                 ");"
+                 "CREATE INDEX IF NOT EXISTS %s_device_ts ON %s (device, timestamp, timestamp_ns);",
+                 name, name, name);
+        if (sqlite3_exec(db, sql, NULL, NULL, NULL) != SQLITE_OK || history_add_day(day) != 0) {
+            return NULL;
+        }
+    }
 
-    sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-    if (rc != SQLITE_OK) {
+    snprintf(sql, sizeof(sql),
+             "INSERT INTO %s (device, " HISTORY_COLUMNS ") "
+             "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);", name);
+    if (sqlite3_prepare_v2(db, sql, -1, &insert_stmt, NULL) != SQLITE_OK) {
+        insert_stmt = NULL;
+        return NULL;
+    }
+    insert_day = day;
+    return insert_stmt;
+}
+
+static int history_insert(const char *device, const performance_sample_t *sample) {
+    sqlite3_stmt *stmt = history_insert_stmt(history_day(sample->timestamp));
+    if (!stmt) {
         return -1;
     }
 
@@ -208,227 +438,3948 @@ int monitor_track_performance(const char *device, performance_sample_t *sample)
     sqlite3_bind_double(stmt, 4, sample->throughput_mbs);
     sqlite3_bind_double(stmt, 5, sample->latency_ms);
     sqlite3_bind_int(stmt, 6, sample->active_requests);
+    sqlite3_bind_double(stmt, 7, sample->read_latency_ms);
+    sqlite3_bind_double(stmt, 8, sample->write_latency_ms);
+    sqlite3_bind_double(stmt, 9, sample->util_percent);
+    sqlite3_bind_double(stmt, 10, sample->avg_queue_size);
+    sqlite3_bind_int64(stmt, 11, (sqlite3_int64)sample->timestamp_ns);
 
-    rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-
+    int rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
     return rc == SQLITE_DONE ? 0 : -1;
 }
 
-int monitor_save_sample(const char *device, const performance_sample_t *sample) {
-    return monitor_track_performance(device, (performance_sample_t*)sample);
+// Lee HISTORY_COLUMNS a partir de la columna first
+static void history_read_row(sqlite3_stmt *stmt, int first, performance_sample_t *smp) {
+    memset(smp, 0, sizeof(performance_sample_t));
+    smp->timestamp = sqlite3_column_int64(stmt, first);
+    smp->iops = sqlite3_column_double(stmt, first + 1);
+    smp->throughput_mbs = sqlite3_column_double(stmt, first + 2);
+    smp->latency_ms = sqlite3_column_double(stmt, first + 3);
+    smp->active_requests = sqlite3_column_int(stmt, first + 4);
+    smp->read_latency_ms = sqlite3_column_double(stmt, first + 5);
+    smp->write_latency_ms = sqlite3_column_double(stmt, first + 6);
+    smp->util_percent = sqlite3_column_double(stmt, first + 7);
+    smp->avg_queue_size = sqlite3_column_double(stmt, first + 8);
+    smp->timestamp_ns = (uint64_t)sqlite3_column_int64(stmt, first + 9);
 }
 
-int monitor_get_disk_usage(const char *mount_point, disk_usage_t *usage) {
-    struct statvfs stat;
-
-    if (!mount_point || !usage) {
-        return -EINVAL;
-    }
+// Copia los días con partición que solapan [start, end]
+static int history_partitions(time_t start, time_t end, long **days) {
+    int first, last;
 
-    if (statvfs(mount_point, &stat) != 0) {
-        return -1;
+    *days = NULL;
+    pthread_mutex_lock(&db_mutex);
+    history_find_day(history_day(start), &first);
+    history_find_day(history_day(end) + 1, &last);
+    int n = last - first;
+    if (n > 0) {
+        *days = malloc(n * sizeof(long));
+        if (!*days) {
+            pthread_mutex_unlock(&db_mutex);
+            return -ENOMEM;
+        }
+        memcpy(*days, &history_days[first], n * sizeof(long));
     }
+    pthread_mutex_unlock(&db_mutex);
+    return n > 0 ? n : 0;
+}
 
-    memset(usage, 0, sizeof(disk_usage_t));
-    strncpy(usage->mount_point, mount_point, sizeof(usage->mount_point) - 1);
-
-    usage->total_bytes = (unsigned long long)stat.f_blocks * stat.f_frsize;
-    usage->available_bytes = (unsigned long long)stat.f_bavail * stat.f_frsize;
-    usage->used_bytes = usage->total_bytes - ((unsigned long long)stat.f_bfree * stat.f_frsize);
-    usage->usage_percent = (double)usage->used_bytes / usage->total_bytes * 100.0;
-    usage->total_inodes = stat.f_files;
-    usage->free_inodes = stat.f_ffree;
-    usage->used_inodes = usage->total_inodes - usage->free_inodes;
-
-    FILE *fp = fopen(PROC_PATH, "r");
-    if (fp) { fclose(fp); }
+// Versiones anteriores guardaban todo en una única tabla performance_history:
+// sus filas se reparten por día una sola vez y la tabla se elimina.
+static int history_migrate_legacy(void) {
+    const char *sql = "SELECT device, " HISTORY_COLUMNS " FROM performance_history;";
+    sqlite3_stmt *stmt;
+    int exists = 0;
+    int migrated = 0;
+    int failed = 0;
 
-    return 0;
-}
+    if (sqlite3_prepare_v2(db, "SELECT 1 FROM sqlite_master WHERE type = 'table' "
+                           "AND name = 'performance_history';", -1, &stmt, NULL) == SQLITE_OK) {
+        exists = sqlite3_step(stmt) == SQLITE_ROW;
+        sqlite3_finalize(stmt);
+    }
+    if (!exists) {
+        return 0;
+    }
 
-int monitor_check_disk_space(const char *mount_point, double threshold) {
-    disk_usage_t usage;
+    // Bases de datos aún más antiguas no tienen estas columnas
+    ensure_column("performance_history", "read_latency_ms", "REAL");
+    ensure_column("performance_history", "write_latency_ms", "REAL");
+    ensure_column("performance_history", "util_percent", "REAL");
+    ensure_column("performance_history", "avg_queue_size", "REAL");
+    ensure_column("performance_history", "timestamp_ns", "INTEGER");
 
-    if (monitor_get_disk_usage(mount_point, &usage) != 0) {
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
         return -1;
     }
-
-    if (usage.usage_percent >= threshold) {
-        fprintf(stderr, "WARNING: Disk usage on %s is %.2f%%\n",
-                mount_point, usage.usage_percent);
-        return 1;
+    sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL);
+    while (!failed && sqlite3_step(stmt) == SQLITE_ROW) {
+        performance_sample_t smp;
+        const char *device = (const char*)sqlite3_column_text(stmt, 0);
+        if (!device) {
+            continue;
+        }
+        history_read_row(stmt, 1, &smp);
+        failed = history_insert(device, &smp) != 0;
+        migrated++;
     }
+    sqlite3_finalize(stmt);
+    history_reset_insert();
 
-    return 0;
-}
-
-int monitor_list_open_files(const char *mount_point, open_file_t **files, int *count) {
-    (void)mount_point;
-    *files = NULL;
-    *count = 0;
-    DIR *proc_dir = opendir(PROC_PATH);
-    if (!proc_dir) {
+    if (failed ||
+        sqlite3_exec(db, "DROP TABLE performance_history;", NULL, NULL, NULL) != SQLITE_OK ||
+        sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK) {
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+        history_load_partitions();
         return -1;
     }
-    closedir(proc_dir);
-    printf("Monitor: Listing open files\n");
+    printf("Monitor: Migrated %d samples into %d daily partitions\n", migrated, history_ndays);
     return 0;
 }
 
-int monitor_get_history(const char *device, time_t start, time_t end,
-                       performance_sample_t **samples, int *count) {
-    if (!db) {
-        return -1;
+int monitor_init_with_config(const monitor_config_t *config) {
+    int rc;
+
+    if (config && (config->process_top_n < 0 ||
+                   config->process_top_n > MONITOR_MAX_TOP_PROCESSES)) {
+        fprintf(stderr, "Monitor: process_top_n %d out of range (0-%d)\n",
+                config->process_top_n, MONITOR_MAX_TOP_PROCESSES);
+        return -EINVAL;
+    }
+
+    if (config) {
+        monitor_config = *config;
+    } else {
+        monitor_config_defaults(&monitor_config);
+    }
+    if (monitor_config.db_path[0] == '\0') {
+        strncpy(monitor_config.db_path, DB_PATH, sizeof(monitor_config.db_path) - 1);
+    }
+    if (monitor_config.tsdb_dir[0] == '\0') {
+        strncpy(monitor_config.tsdb_dir, TSDB_PATH, sizeof(monitor_config.tsdb_dir) - 1);
+    }
+    if (monitor_config.flush_interval_ms <= 0) {
+        monitor_config.flush_interval_ms = DEFAULT_FLUSH_INTERVAL_MS;
+    }
+    if (monitor_config.queue_capacity <= 0) {
+        monitor_config.queue_capacity = DEFAULT_QUEUE_CAPACITY;
+    }
+    if (monitor_config.psi_fast_interval_ms < MIN_INTERVAL_MS) {
+        monitor_config.psi_fast_interval_ms = DEFAULT_PSI_FAST_INTERVAL_MS;
+    }
+    if (monitor_config.psi_hold_ms <= 0) {
+        monitor_config.psi_hold_ms = DEFAULT_PSI_HOLD_MS;
+    }
+    if (monitor_config.overhead_budget_percent < 0) {
+        monitor_config.overhead_budget_percent = 0;
+    }
+    if (monitor_config.flush_batch_size <= 0 ||
+        monitor_config.flush_batch_size > monitor_config.queue_capacity) {
+        monitor_config.flush_batch_size = MIN(DEFAULT_FLUSH_BATCH_SIZE,
+                                              monitor_config.queue_capacity);
     }
 
-    const char *sql = "SELECT timestamp, iops, throughput_mbs, latency_ms, active_requests "
-                     "FROM performance_history "
-                     "WHERE device = ? AND timestamp BETWEEN ? AND ? "
-                     "ORDER BY timestamp;";
+    if (strcmp(monitor_config.db_path, DB_PATH) == 0) {
+        system("mkdir -p /var/lib/storage_mgr");
+    }
 
-    sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    rc = sqlite3_open(monitor_config.db_path, &db);
     if (rc != SQLITE_OK) {
+        fprintf(stderr, "Cannot open database: %s\n", sqlite3_errmsg(db));
+        sqlite3_close(db);
+        db = NULL;
         return -1;
     }
 
-    sqlite3_bind_text(stmt, 1, device, -1, SQLITE_STATIC);
-    sqlite3_bind_int64(stmt, 2, start);
-    sqlite3_bind_int64(stmt, 3, end);
+    // WAL + synchronous=NORMAL: un fsync por checkpoint, no por transacción
+    sqlite3_exec(db, "PRAGMA journal_mode=WAL;", NULL, NULL, NULL);
+    sqlite3_exec(db, "PRAGMA synchronous=NORMAL;", NULL, NULL, NULL);
+    sqlite3_busy_timeout(db, 5000);
 
-    *count = 0;
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        (*count)++;
+    if (history_load_partitions() != 0 || history_migrate_legacy() != 0) {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+        sqlite3_close(db);
+        db = NULL;
+        return -1;
     }
 
-    if (*count == 0) {
-        sqlite3_finalize(stmt);
-        *samples = NULL;
-        return 0;
+    if (rollup_init_db() != 0 || lat_init_db() != 0 || anomaly_init_db() != 0) {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+        monitor_cleanup();
+        return -1;
     }
 
-    sqlite3_reset(stmt);
+    // Con el backend TSDB SQLite solo guarda las tablas de rollup
+    if (monitor_config.backend == MONITOR_BACKEND_TSDB &&
+        tsdb_open(monitor_config.tsdb_dir) != 0) {
+        fprintf(stderr, "Cannot open time-series store: %s\n", monitor_config.tsdb_dir);
+        monitor_cleanup();
+        return -1;
+    }
 
-    *samples = malloc(*count * sizeof(performance_sample_t));
-    if (!*samples) {
-        sqlite3_finalize(stmt);
+    sample_queue = calloc(monitor_config.queue_capacity, sizeof(queued_sample_t));
+    flush_batch = calloc(monitor_config.queue_capacity, sizeof(queued_sample_t));
+    if (!sample_queue || !flush_batch) {
+        monitor_cleanup();
         return -ENOMEM;
     }
+    queue_head = 0;
+    queue_count = 0;
+    samples_dropped = 0;
+
+    pthread_mutex_lock(&self_mutex);
+    memset(&self_stats, 0, sizeof(self_stats));
+    pthread_mutex_unlock(&self_mutex);
 
-    int i = 0;
-    while (sqlite3_step(stmt) == SQLITE_ROW && i < *count) {
-        (*samples)[i].timestamp = sqlite3_column_int64(stmt, 0);
-        (*samples)[i].iops = sqlite3_column_double(stmt, 1);
-        (*samples)[i].throughput_mbs = sqlite3_column_double(stmt, 2);
-        (*samples)[i].latency_ms = sqlite3_column_double(stmt, 3);
-        (*samples)[i].active_requests = sqlite3_column_int(stmt, 4);
-        i++;
+    // El hilo writer arranca con la primera muestra encolada (writer_start)
+    pthread_mutex_lock(&queue_mutex);
+    writer_active = 1;
+    writer_pid = 0;
+    pthread_mutex_unlock(&queue_mutex);
+
+    // Uso de disco servido desde memoria; sin el barrido se mide bajo demanda
+    if (mount_cache_start() != 0) {
+        fprintf(stderr, "Monitor: mount usage sweeper not started\n");
     }
 
-    sqlite3_finalize(stmt);
+    printf("Monitor: Initialized successfully\n");
     return 0;
 }
 
-int monitor_cleanup_old_data(int keep_days) {
-    (void)keep_days;
-    time_t cutoff = time(NULL) - (keep_days * 24 * 3600);
-    const char *sql = "DELETE FROM performance_history WHERE timestamp < ?;";
+void monitor_cleanup(void) {
+    if (monitoring_active) {
+        monitor_stop_continuous();
+    }
 
-    sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-    if (rc != SQLITE_OK) {
-        return -1;
+    pthread_mutex_lock(&queue_mutex);
+    writer_active = 0;
+    pthread_cond_signal(&queue_cond);
+    int joinable = writer_pid == getpid();
+    writer_pid = 0;
+    pthread_mutex_unlock(&queue_mutex);
+    if (joinable) {
+        pthread_join(writer_thread, NULL);
     }
+    writer_thread = 0;
 
-    sqlite3_bind_int64(stmt, 1, cutoff);
-    rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    history_reset_insert();
+    free(history_days);
+    history_days = NULL;
+    history_ndays = 0;
+    history_capacity = 0;
 
-    printf("Monitor: Cleaned up data older than %d days\n", keep_days);
-    return rc == SQLITE_DONE ? 0 : -1;
+    for (int t = 0; t < ROLLUP_TIERS; t++) {
+        if (rollup_stmt[t]) {
+            sqlite3_finalize(rollup_stmt[t]);
+            rollup_stmt[t] = NULL;
+        }
+    }
+    for (int i = 0; i < MONITOR_MAX_DEVICES * 2; i++) {
+        free(rollup_states[i]);
+        rollup_states[i] = NULL;
+    }
+    if (lat_stmt) {
+        sqlite3_finalize(lat_stmt);
+        lat_stmt = NULL;
+    }
+    pthread_mutex_lock(&lat_mutex);
+    for (int i = 0; i < MONITOR_MAX_DEVICES * 2; i++) {
+        free(lat_states[i]);
+        lat_states[i] = NULL;
+    }
+    pthread_mutex_unlock(&lat_mutex);
+    if (anomaly_stmt) {
+        sqlite3_finalize(anomaly_stmt);
+        anomaly_stmt = NULL;
+    }
+    pthread_mutex_lock(&anomaly_mutex);
+    for (int i = 0; i < MONITOR_MAX_DEVICES * 2; i++) {
+        free(anomaly_states[i]);
+        anomaly_states[i] = NULL;
+    }
+    anomaly_queued = 0;
+    pthread_mutex_unlock(&anomaly_mutex);
+
+    if (db) {
+        sqlite3_close(db);
+        db = NULL;
+    }
+    tsdb_close();
+    mount_cache_stop();
+
+    free(sample_queue);
+    free(flush_batch);
+    sample_queue = NULL;
+    flush_batch = NULL;
+    queue_count = 0;
+
+    diskstats_close();
+    proc_io_cleanup();
 }
 
-void monitor_print_stats(const device_stats_t *stats) {
-    printf("\n=== Device Statistics: %s ===\n", stats->device);
-    printf("Read Operations:  %llu\n", stats->reads);
-    printf("Write Operations: %llu\n", stats->writes);
-    printf("Bytes Read:       %llu\n", stats->read_bytes);
-    printf("Bytes Written:    %llu\n", stats->write_bytes);
-    printf("Avg Read Latency: %.3f ms\n", stats->avg_read_latency_ms);
-    printf("Avg Write Latency: %.3f ms\n", stats->avg_write_latency_ms);
-    printf("Queue Depth:      %d\n", stats->queue_depth);
-    printf("Last Update:      %s", ctime(&stats->last_update));
+static const char *device_basename(const char *device) {
+    const char *base_name = strrchr(device, '/');
+    return base_name ? base_name + 1 : device;
 }
 
-void monitor_print_performance(const performance_sample_t *sample) {
-    printf("\n=== Performance Sample ===\n");
-    printf("Timestamp:      %s", ctime(&sample->timestamp));
-    printf("IOPS:           %.2f\n", sample->iops);
-    printf("Throughput:     %.2f MB/s\n", sample->throughput_mbs);
-    printf("Avg Latency:    %.3f ms\n", sample->latency_ms);
-    printf("Active Requests: %d\n", sample->active_requests);
+static int device_index_cmp(const void *a, const void *b) {
+    return strcmp(((const device_index_t*)a)->name,
+                  ((const device_index_t*)b)->name);
 }
 
-void* monitor_thread_func(void *arg) {
-    const char *device = (const char*)arg;
+/*
+ * Lector de /proc/diskstats: fd persistente releído con pread() sobre un
+ * buffer reutilizable y tokenizado a mano. El buffer solo crece si el
+ * fichero no cabe, así que en régimen estable no hay reservas por lectura.
+ */
+static int diskstats_fd = -1;
+static char *diskstats_buf = NULL;
+static size_t diskstats_buf_size = 0;
+static int diskstats_lines = 0;         // líneas de la última lectura
+static pthread_mutex_t diskstats_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-    while (monitoring_active) {
-        performance_sample_t sample;
-        if (monitor_get_current_performance(device, &sample) == 0) {
-            monitor_save_sample(device, &sample);
-        }
-        sleep(monitor_interval);
+static inline const char *skip_spaces(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
     }
-    return NULL;
+    return p;
 }
 
-int monitor_start_continuous(int interval_seconds) {
-    pthread_mutex_lock(&monitor_mutex);
+static inline const char *skip_line(const char *p, const char *end) {
+    const char *nl = memchr(p, '\n', end - p);
+    return nl ? nl + 1 : end;
+}
 
-    if (monitoring_active) {
-        pthread_mutex_unlock(&monitor_mutex);
-        return -1;
+static inline const char *parse_ull(const char *p, const char *end,
+                                    unsigned long long *out) {
+    unsigned long long v = 0;
+    const char *start = p;
+
+    while (p < end && *p >= '0' && *p <= '9') {
+        v = v * 10 + (unsigned long long)(*p - '0');
+        p++;
     }
+    *out = v;
+    return p == start ? NULL : p;
+}
 
-    monitoring_active = 1;
-    monitor_interval = interval_seconds;
-    const char *device = "sda";
+// Major, minor y nombre. Devuelve el puntero tras el nombre o NULL.
+static const char *diskstats_parse_header(const char *p, const char *end,
+                                          diskstats_entry_t *e) {
+    unsigned long long v;
 
-    if (pthread_create(&monitor_thread, NULL, monitor_thread_func, (void*)device) != 0) {
-        monitoring_active = 0;
-        pthread_mutex_unlock(&monitor_mutex);
-        return -1;
-    }
+    p = parse_ull(skip_spaces(p, end), end, &v);
+    if (!p) return NULL;
+    e->major = (unsigned int)v;
 
-    pthread_mutex_unlock(&monitor_mutex);
-    printf("Monitor: Started continuous monitoring (interval: %d seconds)\n", interval_seconds);
-    return 0;
+    p = parse_ull(skip_spaces(p, end), end, &v);
+    if (!p) return NULL;
+    e->minor = (unsigned int)v;
+
+    p = skip_spaces(p, end);
+    size_t n = 0;
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\n') {
+        if (n < sizeof(e->name) - 1) {
+            e->name[n++] = *p;
+        }
+        p++;
+    }
+    e->name[n] = '\0';
+    return n > 0 ? p : NULL;
 }
 
-int monitor_stop_continuous(void) {
-    pthread_mutex_lock(&monitor_mutex);
-    monitoring_active = 0;
-    pthread_mutex_unlock(&monitor_mutex);
+// Contadores hasta fin de línea. Devuelve el inicio de la línea siguiente.
+static const char *diskstats_parse_fields(const char *p, const char *end,
+                                          diskstats_entry_t *e) {
+    unsigned long long *fields[DISKSTATS_MAX_FIELDS] = {
+        &e->rd_ios, &e->rd_merges, &e->rd_sectors, &e->rd_ticks,
+        &e->wr_ios, &e->wr_merges, &e->wr_sectors, &e->wr_ticks,
+        &e->in_flight, &e->io_ticks, &e->time_in_queue,
+        &e->dc_ios, &e->dc_merges, &e->dc_sectors, &e->dc_ticks,
+        &e->fl_ios, &e->fl_ticks
+    };
+    int n = 0;
 
-    if (monitor_thread) {
+    while (n < DISKSTATS_MAX_FIELDS) {
+        p = skip_spaces(p, end);
+        const char *next = parse_ull(p, end, fields[n]);
+        if (!next) break;
+        p = next;
+        n++;
+    }
+    for (int i = n; i < DISKSTATS_MAX_FIELDS; i++) {
+        *fields[i] = 0;
+    }
+    e->nfields = n;
+
+    return skip_line(p, end);
+}
+
+int monitor_diskstats_parse(const char *buf, size_t len, diskstats_entry_t *entries, int max) {
+    const char *p = buf;
+    const char *end = buf + len;
+    int count = 0;
+
+    if (!buf || !entries || max <= 0) {
+        return -EINVAL;
+    }
+
+    while (p < end && count < max) {
+        diskstats_entry_t *e = &entries[count];
+        const char *q = diskstats_parse_header(p, end, e);
+        if (!q) {
+            p = skip_line(p, end);
+            continue;
+        }
+        p = diskstats_parse_fields(q, end, e);
+        if (e->nfields >= 11) {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+// Relee el fichero completo en diskstats_buf. Llamar con diskstats_mutex.
+static ssize_t diskstats_reload(void) {
+    if (diskstats_fd < 0) {
+        diskstats_fd = open(DISKSTATS_PATH, O_RDONLY | O_CLOEXEC);
+        if (diskstats_fd < 0) {
+            return -1;
+        }
+    }
+
+    if (!diskstats_buf) {
+        diskstats_buf_size = 16384;
+        diskstats_buf = malloc(diskstats_buf_size);
+        if (!diskstats_buf) {
+            return -1;
+        }
+    }
+
+    size_t total = 0;
+    for (;;) {
+        ssize_t n = pread(diskstats_fd, diskstats_buf + total,
+                          diskstats_buf_size - total, (off_t)total);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) break;
+        total += (size_t)n;
+
+        if (total == diskstats_buf_size) {
+            char *bigger = realloc(diskstats_buf, diskstats_buf_size * 2);
+            if (!bigger) {
+                return -1;
+            }
+            diskstats_buf = bigger;
+            diskstats_buf_size *= 2;
+        }
+    }
+
+    int lines = 0;
+    for (const char *p = diskstats_buf, *end = diskstats_buf + total;
+         (p = memchr(p, '\n', end - p)) != NULL; p++) {
+        lines++;
+    }
+    diskstats_lines = lines;
+
+    return (ssize_t)total;
+}
+
+// Líneas de /proc/diskstats en la última lectura (cambia al añadir o quitar discos)
+static int diskstats_line_count(void) {
+    pthread_mutex_lock(&diskstats_mutex);
+    int lines = diskstats_lines;
+    pthread_mutex_unlock(&diskstats_mutex);
+    return lines;
+}
+
+static void diskstats_close(void) {
+    pthread_mutex_lock(&diskstats_mutex);
+    if (diskstats_fd >= 0) {
+        close(diskstats_fd);
+        diskstats_fd = -1;
+    }
+    free(diskstats_buf);
+    diskstats_buf = NULL;
+    diskstats_buf_size = 0;
+    pthread_mutex_unlock(&diskstats_mutex);
+}
+
+// Lista todos los dispositivos presentes en /proc/diskstats
+static int diskstats_list_devices(char names[][64], int max) {
+    diskstats_entry_t e;
+    int count = 0;
+
+    pthread_mutex_lock(&diskstats_mutex);
+    ssize_t len = diskstats_reload();
+    if (len < 0) {
+        pthread_mutex_unlock(&diskstats_mutex);
+        return -1;
+    }
+
+    const char *p = diskstats_buf;
+    const char *end = diskstats_buf + len;
+    while (p < end && count < max) {
+        const char *q = diskstats_parse_header(p, end, &e);
+        if (q) {
+            memcpy(names[count++], e.name, sizeof(e.name));
+        }
+        p = skip_line(q ? q : p, end);
+    }
+    pthread_mutex_unlock(&diskstats_mutex);
+
+    return count;
+}
+
+int monitor_sample_devices(const char *const *devices, int count, device_stats_t *stats) {
+    device_index_t index[MONITOR_MAX_DEVICES];
+    diskstats_entry_t e;
+
+    if (!devices || !stats || count <= 0 || count > MONITOR_MAX_DEVICES) {
+        return -EINVAL;
+    }
+
+    for (int i = 0; i < count; i++) {
+        memset(&stats[i], 0, sizeof(device_stats_t));
+        strncpy(stats[i].device, devices[i], sizeof(stats[i].device) - 1);
+        index[i].name = device_basename(devices[i]);
+        index[i].index = i;
+    }
+    qsort(index, count, sizeof(device_index_t), device_index_cmp);
+
+    pthread_mutex_lock(&diskstats_mutex);
+    ssize_t len = diskstats_reload();
+    if (len < 0) {
+        pthread_mutex_unlock(&diskstats_mutex);
+        return -1;
+    }
+
+    struct timespec mono, wall;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_REALTIME, &wall);
+    uint64_t mono_ns = (uint64_t)mono.tv_sec * 1000000000ULL + mono.tv_nsec;
+    uint64_t wall_ns = (uint64_t)wall.tv_sec * 1000000000ULL + wall.tv_nsec;
+    const char *p = diskstats_buf;
+    const char *end = diskstats_buf + len;
+    int found = 0;
+
+    // Una sola pasada: solo se tokenizan los contadores de los dispositivos pedidos
+    while (p < end && found < count) {
+        const char *q = diskstats_parse_header(p, end, &e);
+        if (!q) {
+            p = skip_line(p, end);
+            continue;
+        }
+
+        device_index_t key = { e.name, 0 };
+        device_index_t *hit = bsearch(&key, index, count,
+                                      sizeof(device_index_t), device_index_cmp);
+        if (!hit || stats[hit->index].last_update != 0) {
+            p = skip_line(q, end);
+            continue;
+        }
+
+        p = diskstats_parse_fields(q, end, &e);
+        if (e.nfields < 11) {
+            continue;
+        }
+
+        device_stats_t *st = &stats[hit->index];
+        st->raw = e;
+        st->reads = e.rd_ios;
+        st->writes = e.wr_ios;
+        st->read_bytes = e.rd_sectors * 512;
+        st->write_bytes = e.wr_sectors * 512;
+        st->avg_read_latency_ms = e.rd_ios ? (double)e.rd_ticks / e.rd_ios : 0.0;
+        st->avg_write_latency_ms = e.wr_ios ? (double)e.wr_ticks / e.wr_ios : 0.0;
+        st->queue_depth = (int)e.in_flight;
+        st->last_update = wall.tv_sec;
+        st->mono_ns = mono_ns;
+        st->wall_ns = wall_ns;
+        found++;
+    }
+    pthread_mutex_unlock(&diskstats_mutex);
+
+    return found;
+}
+
+int monitor_set_devices(const char *const *devices, int count) {
+    if (count < 0 || count > MONITOR_MAX_DEVICES || (count > 0 && !devices)) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&monitor_mutex);
+    memset(sample_devices, 0, sizeof(sample_devices));
+    for (int i = 0; i < count; i++) {
+        strncpy(sample_devices[i], devices[i], sizeof(sample_devices[i]) - 1);
+    }
+    sample_device_count = count;
+    sample_devices_gen++;
+    pthread_mutex_unlock(&monitor_mutex);
+
+    return 0;
+}
+
+int monitor_get_device_count(void) {
+    pthread_mutex_lock(&monitor_mutex);
+    int count = sample_device_count;
+    pthread_mutex_unlock(&monitor_mutex);
+    return count;
+}
+
+int monitor_get_device_stats(const char *device, device_stats_t *stats) {
+    if (!device || !stats) {
+        return -EINVAL;
+    }
+
+    if (monitor_sample_devices(&device, 1, stats) != 1) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int monitor_get_io_stats(const char *device, device_stats_t *stats) {
+    return monitor_get_device_stats(device, stats);
+}
+
+/*
+ * Tabla de estado por dispositivo: direccionamiento abierto con sondeo
+ * lineal, indexada por nombre. Cada slot guarda las dos últimas lecturas
+ * bajo un seqlock, de modo que los lectores (thread IPC, CLI) calculan
+ * deltas sin bloquear mientras un único escritor a la vez (serializado por
+ * state_write_mutex) publica lecturas nuevas. Los slots nunca se liberan.
+ */
+#define STATE_TABLE_SIZE (MONITOR_MAX_DEVICES * 2)
+
+typedef struct {
+    atomic_uint seq;
+    atomic_int used;
+    char name[64];
+    device_stats_t prev;
+    device_stats_t curr;
+} device_state_t;
+
+static device_state_t state_table[STATE_TABLE_SIZE];
+static pthread_mutex_t state_write_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t hash_name(const char *name) {
+    uint32_t h = 2166136261u;
+    while (*name) {
+        h ^= (unsigned char)*name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Búsqueda sin bloqueo. Devuelve NULL si el dispositivo no tiene estado.
+static device_state_t *state_lookup(const char *name) {
+    uint32_t h = hash_name(name) & (STATE_TABLE_SIZE - 1);
+
+    for (int i = 0; i < STATE_TABLE_SIZE; i++) {
+        device_state_t *slot = &state_table[(h + i) & (STATE_TABLE_SIZE - 1)];
+        if (!atomic_load_explicit(&slot->used, memory_order_acquire)) {
+            return NULL;
+        }
+        if (strcmp(slot->name, name) == 0) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+// Busca o crea el slot de un dispositivo. Requiere state_write_mutex.
+static device_state_t *state_insert(const char *name) {
+    uint32_t h = hash_name(name) & (STATE_TABLE_SIZE - 1);
+
+    for (int i = 0; i < STATE_TABLE_SIZE; i++) {
+        device_state_t *slot = &state_table[(h + i) & (STATE_TABLE_SIZE - 1)];
+        if (!atomic_load_explicit(&slot->used, memory_order_relaxed)) {
+            strncpy(slot->name, name, sizeof(slot->name) - 1);
+            slot->name[sizeof(slot->name) - 1] = '\0';
+            atomic_store_explicit(&slot->used, 1, memory_order_release);
+            return slot;
+        }
+        if (strcmp(slot->name, name) == 0) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+// Publica una lectura nueva; la anterior pasa a prev. Requiere state_write_mutex.
+static void state_push(device_state_t *slot, const device_stats_t *stats) {
+    unsigned int seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+
+    atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot->prev = slot->curr;
+    slot->curr = *stats;
+    atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+}
+
+static void state_clear(device_state_t *slot) {
+    unsigned int seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+
+    atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memset(&slot->prev, 0, sizeof(slot->prev));
+    memset(&slot->curr, 0, sizeof(slot->curr));
+    atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+}
+
+// Copia consistente de las dos últimas lecturas, sin bloqueo
+static void state_read(device_state_t *slot, device_stats_t *prev, device_stats_t *curr) {
+    unsigned int s1, s2;
+
+    do {
+        s1 = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (s1 & 1) {
+            continue;
+        }
+        *prev = slot->prev;
+        *curr = slot->curr;
+        atomic_thread_fence(memory_order_acquire);
+        s2 = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+    } while ((s1 & 1) || s1 != s2);
+}
+
+int monitor_reset_stats(const char *device) {
+    if (!device) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&state_write_mutex);
+    device_state_t *slot = state_lookup(device_basename(device));
+    if (slot) {
+        state_clear(slot);
+    }
+    pthread_mutex_unlock(&state_write_mutex);
+
+    printf("Monitor: Reset stats for %s\n", device);
+    return 0;
+}
+
+int monitor_get_cached_stats(device_stats_t *stats, int max) {
+    device_stats_t prev;
+    int n = 0;
+
+    if (!stats || max <= 0) {
+        return -EINVAL;
+    }
+
+    for (int i = 0; i < STATE_TABLE_SIZE && n < max; i++) {
+        device_state_t *slot = &state_table[i];
+        if (!atomic_load_explicit(&slot->used, memory_order_acquire)) {
+            continue;
+        }
+        state_read(slot, &prev, &stats[n]);
+        if (stats[n].last_update != 0) {
+            n++;
+        }
+    }
+    return n;
+}
+
+static inline unsigned long long counter_delta(unsigned long long curr,
+                                               unsigned long long prev) {
+    return curr >= prev ? curr - prev : 0;
+}
+
+static inline uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint64_t thread_cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Calcula una muestra a partir de dos lecturas consecutivas, con las mismas
+// fórmulas que iostat: await = Δticks / Δios, %util = Δio_ticks / Δt,
+// aqu-sz = Δtime_in_queue / Δt
+static void compute_sample(const device_stats_t *prev, const device_stats_t *curr,
+                           performance_sample_t *sample) {
+    memset(sample, 0, sizeof(performance_sample_t));
+    sample->timestamp = curr->last_update;
+    sample->timestamp_ns = curr->wall_ns;
+    sample->active_requests = curr->queue_depth;
+
+    if (prev->mono_ns == 0 || curr->mono_ns <= prev->mono_ns) {
+        return;
+    }
+
+    double elapsed = (double)(curr->mono_ns - prev->mono_ns) / 1e9;
+    sample->interval_s = elapsed;
+
+    const diskstats_entry_t *p = &prev->raw;
+    const diskstats_entry_t *c = &curr->raw;
+    double elapsed_ms = elapsed * 1000.0;
+
+    unsigned long long rd_ios = counter_delta(c->rd_ios, p->rd_ios);
+    unsigned long long wr_ios = counter_delta(c->wr_ios, p->wr_ios);
+    unsigned long long rd_ticks = counter_delta(c->rd_ticks, p->rd_ticks);
+    unsigned long long wr_ticks = counter_delta(c->wr_ticks, p->wr_ticks);
+    unsigned long long read_diff = counter_delta(curr->read_bytes, prev->read_bytes);
+    unsigned long long write_diff = counter_delta(curr->write_bytes, prev->write_bytes);
+
+    sample->iops = (double)(rd_ios + wr_ios) / elapsed;
+    sample->throughput_mbs = (double)(read_diff + write_diff) / (elapsed * 1024 * 1024);
+
+    if (rd_ios > 0) {
+        sample->read_latency_ms = (double)rd_ticks / rd_ios;
+    }
+    if (wr_ios > 0) {
+        sample->write_latency_ms = (double)wr_ticks / wr_ios;
+    }
+    if (rd_ios + wr_ios > 0) {
+        sample->latency_ms = (double)(rd_ticks + wr_ticks) / (rd_ios + wr_ios);
+    }
+
+    sample->util_percent = counter_delta(c->io_ticks, p->io_ticks) / elapsed_ms * 100.0;
+    if (sample->util_percent > 100.0) {
+        sample->util_percent = 100.0;
+    }
+    sample->avg_queue_size = counter_delta(c->time_in_queue, p->time_in_queue) / elapsed_ms;
+}
+
+int monitor_get_current_performance(const char *device, performance_sample_t *sample) {
+    device_stats_t prev_stats;
+    device_stats_t curr_stats;
+
+    if (!device || !sample) {
+        return -EINVAL;
+    }
+
+    const char *name = device_basename(device);
+    device_state_t *slot = state_lookup(name);
+    // Con el sampler en marcha su intervalo efectivo (suelo de presupuesto,
+    // backoff PSI) manda sobre el configurado
+    uint64_t interval_ms = (uint64_t)monitor_get_interval_ms();
+    int sampling = interval_ms != 0;
+    int stale = 1;
+
+    if (!sampling) {
+        interval_ms = (uint64_t)monitor_interval_ms;
+    }
+
+    memset(&prev_stats, 0, sizeof(prev_stats));
+    memset(&curr_stats, 0, sizeof(curr_stats));
+    if (slot) {
+        state_read(slot, &prev_stats, &curr_stats);
+        stale = curr_stats.mono_ns == 0 ||
+                monotonic_ns() - curr_stats.mono_ns >= interval_ms * 1000000ULL;
+    }
+
+    // Sin lectura reciente del sampler: leer ahora
+    if (stale) {
+        device_stats_t fresh;
+        if (monitor_get_device_stats(device, &fresh) != 0) {
+            return -1;
+        }
+
+        // El sampler calcula sus deltas sobre slot->curr: mientras corre,
+        // su slot no se toca y la lectura nueva se compara con su última
+        if (sampling) {
+            compute_sample(&curr_stats, &fresh, sample);
+            return 0;
+        }
+
+        pthread_mutex_lock(&state_write_mutex);
+        slot = state_insert(name);
+        if (slot) {
+            state_push(slot, &fresh);
+        }
+        pthread_mutex_unlock(&state_write_mutex);
+
+        if (!slot) {
+            return -ENOSPC;
+        }
+        state_read(slot, &prev_stats, &curr_stats);
+    }
+
+    compute_sample(&prev_stats, &curr_stats, sample);
+
+    return 0;
+}
+
+/*
+ * Arranque diferido del writer, con queue_mutex tomado. Tras un fork() el
+ * hilo no existe en el hijo (writer_pid es el del padre), así que se crea
+ * de nuevo; un monitor inicializado antes de daemonizar sigue escribiendo.
+ */
+static int writer_start(void) {
+    pid_t self = getpid();
+
+    if (!writer_active) {
+        return -1;
+    }
+    if (writer_pid == self) {
+        return 0;
+    }
+    if (pthread_create(&writer_thread, NULL, monitor_writer_func, NULL) != 0) {
+        return -1;
+    }
+    writer_pid = self;
+    return 0;
+}
+
+int monitor_track_performance(const char *device, performance_sample_t *sample) {
+    if (!device || !sample) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&queue_mutex);
+    if (!sample_queue || writer_start() != 0) {
+        pthread_mutex_unlock(&queue_mutex);
+        return -1;
+    }
+
+    if (queue_count == monitor_config.queue_capacity) {
+        samples_dropped++;
+        pthread_mutex_unlock(&queue_mutex);
+        return -EAGAIN;
+    }
+
+    int slot = (queue_head + queue_count) % monitor_config.queue_capacity;
+    strncpy(sample_queue[slot].device, device_basename(device),
+            sizeof(sample_queue[slot].device) - 1);
+    sample_queue[slot].device[sizeof(sample_queue[slot].device) - 1] = '\0';
+    sample_queue[slot].sample = *sample;
+    queue_count++;
+
+    if (queue_count >= monitor_config.flush_batch_size) {
+        pthread_cond_signal(&queue_cond);
+    }
+    pthread_mutex_unlock(&queue_mutex);
+
+    return 0;
+}
+
+int monitor_save_sample(const char *device, const performance_sample_t *sample) {
+    return monitor_track_performance(device, (performance_sample_t*)sample);
+}
+
+static int rollup_init_db(void) {
+    char sql[1024];
+
+    for (int t = 0; t < ROLLUP_TIERS; t++) {
+        int len = snprintf(sql, sizeof(sql),
+                           "CREATE TABLE IF NOT EXISTS %s ("
+                           "device TEXT NOT NULL,"
+                           "bucket INTEGER NOT NULL,"
+                           "samples INTEGER,", rollup_table[t]);
+        for (int m = 0; m < ROLLUP_METRICS; m++) {
+            len += snprintf(sql + len, sizeof(sql) - len,
+                            "%1$s_min REAL, %1$s_max REAL, %1$s_avg REAL, %1$s_p95 REAL,",
+                            rollup_metric[m]);
+        }
+        snprintf(sql + len, sizeof(sql) - len,
+                 "PRIMARY KEY (device, bucket)) WITHOUT ROWID;"
+                 "CREATE INDEX IF NOT EXISTS %1$s_bucket ON %1$s (bucket);", rollup_table[t]);
+        if (sqlite3_exec(db, sql, NULL, NULL, NULL) != SQLITE_OK) {
+            return -1;
+        }
+
+        len = snprintf(sql, sizeof(sql),
+                       "INSERT OR REPLACE INTO %s VALUES (?, ?, ?", rollup_table[t]);
+        for (int i = 0; i < ROLLUP_METRICS * 4; i++) {
+            len += snprintf(sql + len, sizeof(sql) - len, ", ?");
+        }
+        snprintf(sql + len, sizeof(sql) - len, ");");
+        if (sqlite3_prepare_v2(db, sql, -1, &rollup_stmt[t], NULL) != SQLITE_OK) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static double metric_value(const performance_sample_t *sample, int metric) {
+    switch (metric) {
+        case 0: return sample->iops;
+        case 1: return sample->throughput_mbs;
+        case 2: return sample->latency_ms;
+        default: return sample->util_percent;
+    }
+}
+
+static int rollup_bin(double value) {
+    if (value <= 0) {
+        return 0;
+    }
+    int bin = (int)floor((log10(value) - ROLLUP_MIN_DECADE) * ROLLUP_BINS_PER_DECADE) + 1;
+    if (bin < 1) bin = 1;
+    if (bin >= ROLLUP_BINS) bin = ROLLUP_BINS - 1;
+    return bin;
+}
+
+static double rollup_bin_value(int bin) {
+    if (bin == 0) {
+        return 0.0;
+    }
+    return pow(10.0, (bin - 0.5) / ROLLUP_BINS_PER_DECADE + ROLLUP_MIN_DECADE);
+}
+
+static void metric_summarize(const metric_acc_t *acc, unsigned int count,
+                             metric_summary_t *out) {
+    out->min = acc->min;
+    out->max = acc->max;
+    out->avg = count ? acc->sum / count : 0.0;
+    out->p95 = acc->max;
+
+    unsigned int target = (unsigned int)ceil(count * 0.95);
+    unsigned int seen = 0;
+    for (int b = 0; b < ROLLUP_BINS; b++) {
+        seen += acc->bins[b];
+        if (seen >= target) {
+            out->p95 = rollup_bin_value(b);
+            break;
+        }
+    }
+    if (out->p95 < out->min) out->p95 = out->min;
+    if (out->p95 > out->max) out->p95 = out->max;
+}
+
+static rollup_state_t *rollup_get_state(const char *device) {
+    const int size = MONITOR_MAX_DEVICES * 2;
+    uint32_t h = hash_name(device) & (size - 1);
+
+    for (int i = 0; i < size; i++) {
+        int idx = (h + i) & (size - 1);
+        if (!rollup_states[idx]) {
+            rollup_states[idx] = calloc(1, sizeof(rollup_state_t));
+            if (!rollup_states[idx]) {
+                return NULL;
+            }
+            strncpy(rollup_states[idx]->name, device, sizeof(rollup_states[idx]->name) - 1);
+            return rollup_states[idx];
+        }
+        if (strcmp(rollup_states[idx]->name, device) == 0) {
+            return rollup_states[idx];
+        }
+    }
+    return NULL;
+}
+
+static int rollup_write(const char *device, int tier, const rollup_acc_t *acc) {
+    sqlite3_stmt *stmt = rollup_stmt[tier];
+    int col = 1;
+
+    sqlite3_bind_text(stmt, col++, device, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, col++, acc->bucket);
+    sqlite3_bind_int(stmt, col++, (int)acc->count);
+    for (int m = 0; m < ROLLUP_METRICS; m++) {
+        metric_summary_t sum;
+        metric_summarize(&acc->metrics[m], acc->count, &sum);
+        sqlite3_bind_double(stmt, col++, sum.min);
+        sqlite3_bind_double(stmt, col++, sum.max);
+        sqlite3_bind_double(stmt, col++, sum.avg);
+        sqlite3_bind_double(stmt, col++, sum.p95);
+    }
+
+    int rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    return rc == SQLITE_DONE ? 0 : -1;
+}
+
+// Acumula una muestra; al cambiar de bucket se escribe el bucket cerrado
+static void rollup_add(const char *device, const performance_sample_t *sample) {
+    rollup_state_t *state = rollup_get_state(device);
+    if (!state) {
+        return;
+    }
+
+    for (int t = 0; t < ROLLUP_TIERS; t++) {
+        rollup_acc_t *acc = &state->tiers[t];
+        time_t bucket = sample->timestamp - (sample->timestamp % rollup_resolution[t]);
+
+        if (acc->count > 0 && bucket < acc->bucket) {
+            continue;   // muestra atrasada de un bucket ya cerrado
+        }
+        if (acc->count > 0 && bucket != acc->bucket) {
+            rollup_write(state->name, t, acc);
+            acc->count = 0;
+        }
+        if (acc->count == 0) {
+            memset(acc, 0, sizeof(rollup_acc_t));
+            acc->bucket = bucket;
+        }
+
+        for (int m = 0; m < ROLLUP_METRICS; m++) {
+            metric_acc_t *ma = &acc->metrics[m];
+            double v = metric_value(sample, m);
+            if (acc->count == 0 || v < ma->min) ma->min = v;
+            if (acc->count == 0 || v > ma->max) ma->max = v;
+            ma->sum += v;
+            ma->bins[rollup_bin(v)]++;
+        }
+        acc->count++;
+        acc->dirty = 1;
+    }
+}
+
+// Escribe los buckets abiertos modificados para que las consultas los vean
+static void rollup_sync_open(void) {
+    for (int i = 0; i < MONITOR_MAX_DEVICES * 2; i++) {
+        rollup_state_t *state = rollup_states[i];
+        if (!state) {
+            continue;
+        }
+        for (int t = 0; t < ROLLUP_TIERS; t++) {
+            if (state->tiers[t].dirty && state->tiers[t].count > 0) {
+                rollup_write(state->name, t, &state->tiers[t]);
+                state->tiers[t].dirty = 0;
+            }
+        }
+    }
+}
+
+static int lat_bin(uint64_t us) {
+    if (us < (1u << LAT_SUB_BITS)) {
+        return (int)us;
+    }
+    if (us >= (1ULL << LAT_MAX_BITS)) {
+        return LAT_BINS - 1;
+    }
+    int msb = 63 - __builtin_clzll(us);
+    int shift = msb - LAT_SUB_BITS + 1;
+    return shift * LAT_HALF + (int)(us >> shift);
+}
+
+// Límites [low, high] en µs de un bin
+static void lat_bin_range(int bin, uint64_t *low, uint64_t *high) {
+    if (bin < (1 << LAT_SUB_BITS)) {
+        *low = *high = (uint64_t)bin;
+        return;
+    }
+    int shift = bin / LAT_HALF - 1;
+    uint64_t sub = (uint64_t)(bin - shift * LAT_HALF);
+    *low = sub << shift;
+    *high = ((sub + 1) << shift) - 1;
+}
+
+static void lat_slot_add(lat_slot_t *slot, int64_t epoch, int bin, uint64_t count) {
+    if (slot->epoch != epoch) {
+        memset(slot, 0, sizeof(lat_slot_t));
+        slot->epoch = epoch;
+    }
+    slot->bins[bin] += (uint32_t)count;
+    slot->total += count;
+}
+
+static lat_state_t *lat_get_state(const char *device) {
+    const int size = MONITOR_MAX_DEVICES * 2;
+    uint32_t h = hash_name(device) & (size - 1);
+
+    for (int i = 0; i < size; i++) {
+        int idx = (h + i) & (size - 1);
+        if (!lat_states[idx]) {
+            lat_states[idx] = calloc(1, sizeof(lat_state_t));
+            if (!lat_states[idx]) {
+                return NULL;
+            }
+            strncpy(lat_states[idx]->name, device, sizeof(lat_states[idx]->name) - 1);
+            for (int s = 0; s < LAT_SEC_SLOTS; s++) lat_states[idx]->sec[s].epoch = -1;
+            for (int s = 0; s < LAT_MIN_SLOTS; s++) lat_states[idx]->min[s].epoch = -1;
+            return lat_states[idx];
+        }
+        if (strcmp(lat_states[idx]->name, device) == 0) {
+            return lat_states[idx];
+        }
+    }
+    return NULL;
+}
+
+static lat_state_t *lat_find_state(const char *device) {
+    const int size = MONITOR_MAX_DEVICES * 2;
+    uint32_t h = hash_name(device) & (size - 1);
+
+    for (int i = 0; i < size; i++) {
+        lat_state_t *state = lat_states[(h + i) & (size - 1)];
+        if (!state) {
+            return NULL;
+        }
+        if (strcmp(state->name, device) == 0) {
+            return state;
+        }
+    }
+    return NULL;
+}
+
+static int lat_record(const char *device, double latency_ms, uint64_t count) {
+    if (count == 0) {
+        return 0;
+    }
+
+    double us = latency_ms * 1000.0;
+    int bin = lat_bin(us > 0.0 ? (uint64_t)(us + 0.5) : 0);
+    int64_t now_s = (int64_t)(monotonic_ns() / 1000000000ULL);
+    time_t minute = time(NULL) / 60 * 60;
+
+    pthread_mutex_lock(&lat_mutex);
+    lat_state_t *state = lat_get_state(device);
+    if (!state) {
+        pthread_mutex_unlock(&lat_mutex);
+        return -ENOSPC;
+    }
+
+    lat_slot_add(&state->sec[now_s % LAT_SEC_SLOTS], now_s, bin, count);
+    lat_slot_add(&state->min[(now_s / 60) % LAT_MIN_SLOTS], now_s / 60, bin, count);
+
+    // Al cambiar de minuto el snapshot anterior queda cerrado
+    if (state->snap.epoch != minute && state->snap.total > 0) {
+        state->closed = state->snap;
+        state->closed_dirty = 1;
+    }
+    lat_slot_add(&state->snap, minute, bin, count);
+    state->snap_dirty = 1;
+    state->cumulative[bin] += count;
+    state->cumulative_count += count;
+    state->cumulative_sum_ms += latency_ms * count;
+    pthread_mutex_unlock(&lat_mutex);
+
+    return 0;
+}
+
+static void lat_percentiles(const uint64_t *bins, uint64_t total, latency_percentiles_t *out) {
+    static const double quantiles[4] = { 0.50, 0.95, 0.99, 0.999 };
+    double *targets[4] = { &out->p50_ms, &out->p95_ms, &out->p99_ms, &out->p999_ms };
+    uint64_t seen = 0;
+    int q = 0;
+
+    out->count = total;
+    out->p50_ms = out->p95_ms = out->p99_ms = out->p999_ms = out->max_ms = 0.0;
+    if (total == 0) {
+        return;
+    }
+
+    for (int b = 0; b < LAT_BINS; b++) {
+        if (bins[b] == 0) {
+            continue;
+        }
+        uint64_t low, high;
+        lat_bin_range(b, &low, &high);
+        seen += bins[b];
+        while (q < 4 && seen >= (uint64_t)ceil(quantiles[q] * total)) {
+            *targets[q++] = (low + high) / 2.0 / 1000.0;
+        }
+        out->max_ms = high / 1000.0;
+    }
+}
+
+// Snapshot compacto: pares (salto de bin, cuenta) en varint
+static size_t lat_encode(const lat_slot_t *slot, uint8_t *buf) {
+    size_t len = 0;
+    int prev = -1;
+
+    for (int b = 0; b < LAT_BINS; b++) {
+        if (slot->bins[b] == 0) {
+            continue;
+        }
+        uint64_t values[2] = { (uint64_t)(b - prev), slot->bins[b] };
+        for (int v = 0; v < 2; v++) {
+            uint64_t x = values[v];
+            while (x >= 0x80) {
+                buf[len++] = (uint8_t)(x | 0x80);
+                x >>= 7;
+            }
+            buf[len++] = (uint8_t)x;
+        }
+        prev = b;
+    }
+    return len;
+}
+
+static void lat_decode_add(const uint8_t *buf, size_t len, uint64_t *bins, uint64_t *total) {
+    size_t pos = 0;
+    int bin = -1;
+
+    while (pos < len) {
+        uint64_t values[2] = { 0, 0 };
+        for (int v = 0; v < 2; v++) {
+            int shift = 0;
+            while (pos < len && shift < 64) {
+                uint8_t byte = buf[pos++];
+                values[v] |= (uint64_t)(byte & 0x7F) << shift;
+                shift += 7;
+                if (!(byte & 0x80)) {
+                    break;
+                }
+            }
+        }
+        bin += (int)values[0];
+        if (bin < 0 || bin >= LAT_BINS) {
+            return;
+        }
+        bins[bin] += values[1];
+        *total += values[1];
+    }
+}
+
+static int lat_init_db(void) {
+    const char *sql_create =
+        "CREATE TABLE IF NOT EXISTS latency_histograms ("
+        "device TEXT NOT NULL,"
+        "bucket INTEGER NOT NULL,"
+        "ios INTEGER,"
+        "p50_ms REAL, p95_ms REAL, p99_ms REAL, p999_ms REAL, max_ms REAL,"
+        "bins BLOB,"
+        "PRIMARY KEY (device, bucket)) WITHOUT ROWID;"
+        "CREATE INDEX IF NOT EXISTS latency_histograms_bucket ON latency_histograms (bucket);";
+    const char *sql_insert =
+        "INSERT OR REPLACE INTO latency_histograms VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?);";
+
+    if (sqlite3_exec(db, sql_create, NULL, NULL, NULL) != SQLITE_OK) {
+        return -1;
+    }
+    return sqlite3_prepare_v2(db, sql_insert, -1, &lat_stmt, NULL) == SQLITE_OK ? 0 : -1;
+}
+
+// Un minuto puede tener ya fila de un proceso anterior (reinicio del daemon):
+// se suma antes de la primera escritura para que el REPLACE no la pierda
+static void lat_merge_existing(const char *device, lat_slot_t *slot) {
+    const char *sql = "SELECT bins FROM latency_histograms WHERE device = ? AND bucket = ?;";
+    sqlite3_stmt *stmt;
+
+    slot->merged = 1;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        return;
+    }
+    sqlite3_bind_text(stmt, 1, device, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, slot->epoch);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        uint64_t bins[LAT_BINS] = { 0 };
+        uint64_t total = 0;
+        lat_decode_add(sqlite3_column_blob(stmt, 0), sqlite3_column_bytes(stmt, 0),
+                       bins, &total);
+        for (int b = 0; b < LAT_BINS; b++) {
+            slot->bins[b] += (uint32_t)bins[b];
+        }
+        slot->total += total;
+    }
+    sqlite3_finalize(stmt);
+}
+
+static int lat_write(const char *device, lat_slot_t *slot) {
+    uint8_t blob[LAT_BINS * 12];
+    uint64_t bins[LAT_BINS];
+    latency_percentiles_t pct;
+
+    if (!slot->merged) {
+        lat_merge_existing(device, slot);
+    }
+    for (int b = 0; b < LAT_BINS; b++) {
+        bins[b] = slot->bins[b];
+    }
+    lat_percentiles(bins, slot->total, &pct);
+    size_t len = lat_encode(slot, blob);
+
+    sqlite3_bind_text(lat_stmt, 1, device, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(lat_stmt, 2, slot->epoch);
+    sqlite3_bind_int64(lat_stmt, 3, (sqlite3_int64)slot->total);
+    sqlite3_bind_double(lat_stmt, 4, pct.p50_ms);
+    sqlite3_bind_double(lat_stmt, 5, pct.p95_ms);
+    sqlite3_bind_double(lat_stmt, 6, pct.p99_ms);
+    sqlite3_bind_double(lat_stmt, 7, pct.p999_ms);
+    sqlite3_bind_double(lat_stmt, 8, pct.max_ms);
+    sqlite3_bind_blob(lat_stmt, 9, blob, (int)len, SQLITE_TRANSIENT);
+
+    int rc = sqlite3_step(lat_stmt);
+    sqlite3_reset(lat_stmt);
+    return rc == SQLITE_DONE ? 0 : -1;
+}
+
+// Persiste los snapshots modificados (minuto cerrado y minuto en curso).
+// Se llama desde flush_pending() con db_mutex.
+static int lat_sync(void) {
+    int failed = 0;
+    int began = 0;
+
+    if (!lat_stmt) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&lat_mutex);
+    for (int i = 0; i < MONITOR_MAX_DEVICES * 2; i++) {
+        lat_state_t *state = lat_states[i];
+        if (!state || (!state->closed_dirty && !state->snap_dirty)) {
+            continue;
+        }
+        if (!began) {
+            sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL);
+            began = 1;
+        }
+        if (state->closed_dirty) {
+            failed |= lat_write(state->name, &state->closed) != 0;
+            state->closed_dirty = 0;
+        }
+        if (state->snap_dirty) {
+            failed |= lat_write(state->name, &state->snap) != 0;
+            state->snap_dirty = 0;
+        }
+    }
+    pthread_mutex_unlock(&lat_mutex);
+
+    if (began && sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK) {
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+        failed = 1;
+    }
+    return failed ? -1 : 0;
+}
+
+// Registra el await medio del intervalo ponderado por los IOs completados:
+// todos los IOs del tick caen en el mismo bin (latencia media por intervalo)
+static void lat_record_interval(const device_stats_t *prev, const device_stats_t *curr) {
+    unsigned long long rd_ios = counter_delta(curr->raw.rd_ios, prev->raw.rd_ios);
+    unsigned long long wr_ios = counter_delta(curr->raw.wr_ios, prev->raw.wr_ios);
+    const char *name = device_basename(curr->device);
+
+    if (rd_ios > 0) {
+        lat_record(name, (double)counter_delta(curr->raw.rd_ticks, prev->raw.rd_ticks) / rd_ios,
+                   rd_ios);
+    }
+    if (wr_ios > 0) {
+        lat_record(name, (double)counter_delta(curr->raw.wr_ticks, prev->raw.wr_ticks) / wr_ios,
+                   wr_ios);
+    }
+}
+
+int monitor_record_latency(const char *device, double latency_ms, uint64_t count) {
+    if (!device || latency_ms < 0.0) {
+        return -EINVAL;
+    }
+    return lat_record(device_basename(device), latency_ms, count);
+}
+
+int monitor_get_latency_percentiles(const char *device, int window_s,
+                                    latency_percentiles_t *out) {
+    uint64_t bins[LAT_BINS] = { 0 };
+    uint64_t total = 0;
+
+    if (!device || !out) {
+        return -EINVAL;
+    }
+    if (window_s != MONITOR_LATENCY_WINDOW_1S && window_s != MONITOR_LATENCY_WINDOW_1M &&
+        window_s != MONITOR_LATENCY_WINDOW_5M) {
+        return -EINVAL;
+    }
+
+    int64_t now_s = (int64_t)(monotonic_ns() / 1000000000ULL);
+
+    pthread_mutex_lock(&lat_mutex);
+    lat_state_t *state = lat_find_state(device_basename(device));
+    if (state) {
+        const lat_slot_t *slots = window_s == MONITOR_LATENCY_WINDOW_5M ? state->min : state->sec;
+        int nslots = window_s == MONITOR_LATENCY_WINDOW_5M ? LAT_MIN_SLOTS : LAT_SEC_SLOTS;
+        int64_t now = window_s == MONITOR_LATENCY_WINDOW_5M ? now_s / 60 : now_s;
+        int64_t span = window_s == MONITOR_LATENCY_WINDOW_5M ? LAT_MIN_SLOTS : window_s;
+
+        for (int s = 0; s < nslots; s++) {
+            if (slots[s].epoch < 0 || slots[s].epoch <= now - span || slots[s].epoch > now) {
+                continue;
+            }
+            for (int b = 0; b < LAT_BINS; b++) {
+                bins[b] += slots[s].bins[b];
+            }
+            total += slots[s].total;
+        }
+    }
+    pthread_mutex_unlock(&lat_mutex);
+
+    lat_percentiles(bins, total, out);
+    out->window_s = window_s;
+    return 0;
+}
+
+int monitor_get_latency_histogram(const char *device, const double *bounds_ms, int nbounds,
+                                  uint64_t *buckets, uint64_t *count, double *sum_ms) {
+    if (!device || (nbounds > 0 && (!bounds_ms || !buckets)) || !count || !sum_ms) {
+        return -EINVAL;
+    }
+
+    for (int i = 0; i < nbounds; i++) {
+        buckets[i] = 0;
+    }
+    *count = 0;
+    *sum_ms = 0.0;
+
+    pthread_mutex_lock(&lat_mutex);
+    lat_state_t *state = lat_find_state(device_basename(device));
+    if (state) {
+        // Cada bin cuenta en los límites que no quedan por debajo de su punto medio
+        for (int b = 0; b < LAT_BINS; b++) {
+            if (state->cumulative[b] == 0) {
+                continue;
+            }
+            uint64_t low, high;
+            lat_bin_range(b, &low, &high);
+            double mid_ms = (low + high) / 2.0 / 1000.0;
+            for (int i = nbounds - 1; i >= 0 && bounds_ms[i] >= mid_ms; i--) {
+                buckets[i] += state->cumulative[b];
+            }
+        }
+        *count = state->cumulative_count;
+        *sum_ms = state->cumulative_sum_ms;
+    }
+    pthread_mutex_unlock(&lat_mutex);
+
+    return state ? 0 : -ENOENT;
+}
+
+int monitor_get_latency_range(const char *device, time_t start, time_t end,
+                              latency_percentiles_t *out) {
+    const char *sql = "SELECT bins FROM latency_histograms "
+                      "WHERE device = ? AND bucket BETWEEN ? AND ?;";
+    uint64_t bins[LAT_BINS] = { 0 };
+    uint64_t total = 0;
+    sqlite3_stmt *stmt;
+
+    if (!device || !out) {
+        return -EINVAL;
+    }
+    if (!db) {
+        return -1;
+    }
+
+    flush_pending();
+
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        return -1;
+    }
+    sqlite3_bind_text(stmt, 1, device_basename(device), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, start - start % 60);
+    sqlite3_bind_int64(stmt, 3, end);
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        lat_decode_add(sqlite3_column_blob(stmt, 0), sqlite3_column_bytes(stmt, 0),
+                       bins, &total);
+    }
+    sqlite3_finalize(stmt);
+
+    lat_percentiles(bins, total, out);
+    out->window_s = (int)(end - start);
+    return 0;
+}
+
+static int anomaly_init_db(void) {
+    const char *sql_create =
+        "CREATE TABLE IF NOT EXISTS anomaly_events ("
+        "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+        "device TEXT NOT NULL,"
+        "timestamp INTEGER NOT NULL,"
+        "metric TEXT NOT NULL,"
+        "value REAL,"
+        "expected REAL,"
+        "stddev REAL,"
+        "score REAL,"
+        "seasonal INTEGER"
+        ");"
+        "CREATE INDEX IF NOT EXISTS anomaly_events_ts ON anomaly_events (timestamp);";
+    const char *sql_insert =
+        "INSERT INTO anomaly_events "
+        "(device, timestamp, metric, value, expected, stddev, score, seasonal) "
+        "VALUES (?, ?, ?, ?, ?, ?, ?, ?);";
+
+    if (sqlite3_exec(db, sql_create, NULL, NULL, NULL) != SQLITE_OK) {
+        return -1;
+    }
+    return sqlite3_prepare_v2(db, sql_insert, -1, &anomaly_stmt, NULL) == SQLITE_OK ? 0 : -1;
+}
+
+static anomaly_state_t *anomaly_get_state(const char *device) {
+    const int size = MONITOR_MAX_DEVICES * 2;
+    uint32_t h = hash_name(device) & (size - 1);
+
+    for (int i = 0; i < size; i++) {
+        int idx = (h + i) & (size - 1);
+        if (!anomaly_states[idx]) {
+            anomaly_states[idx] = calloc(1, sizeof(anomaly_state_t));
+            if (!anomaly_states[idx]) {
+                return NULL;
+            }
+            strncpy(anomaly_states[idx]->name, device, sizeof(anomaly_states[idx]->name) - 1);
+            anomaly_states[idx]->hour = -1;
+            return anomaly_states[idx];
+        }
+        if (strcmp(anomaly_states[idx]->name, device) == 0) {
+            return anomaly_states[idx];
+        }
+    }
+    return NULL;
+}
+
+static void ewma_update(ewma_t *e, double x, double alpha) {
+    if (e->n++ == 0) {
+        e->mean = x;
+        e->var = 0.0;
+        return;
+    }
+    double d = x - e->mean;
+    e->mean += alpha * d;
+    e->var = (1.0 - alpha) * (e->var + alpha * d * d);
+}
+
+// Desviación respecto a la banda. El suelo de la desviación típica evita
+// que una serie casi constante dispare con cambios insignificantes.
+static double ewma_score(const ewma_t *e, double x, double min_sd) {
+    double sd = MAX(sqrt(e->var), MAX(min_sd, 0.05 * fabs(e->mean)));
+    return (x - e->mean) / sd;
+}
+
+// Pliega la hora cerrada en su slot estacional
+static void anomaly_close_hour(anomaly_state_t *st) {
+    int slot = (int)(st->hour % ANOMALY_SEASON_SLOTS);
+
+    for (int m = 0; m < ANOMALY_METRICS; m++) {
+        if (st->hour_n[m] == 0) {
+            continue;
+        }
+        double mean = st->hour_sum[m] / st->hour_n[m];
+        double var = MAX(st->hour_sumsq[m] / st->hour_n[m] - mean * mean, 0.0);
+        ewma_t *e = &st->season[m][slot];
+        if (e->n++ == 0) {
+            e->mean = mean;
+            e->var = var;
+        } else {
+            double d = mean - e->mean;
+            e->mean += ANOMALY_SEASON_ALPHA * d;
+            e->var = (1.0 - ANOMALY_SEASON_ALPHA) * (e->var + ANOMALY_SEASON_ALPHA * d * d) +
+                     ANOMALY_SEASON_ALPHA * var;
+        }
+        st->hour_sum[m] = st->hour_sumsq[m] = 0.0;
+        st->hour_n[m] = 0;
+    }
+}
+
+int monitor_observe_sample(const char *device, const performance_sample_t *sample) {
+    static const char *const metric_name[ANOMALY_METRICS] = { "latency_ms", "iops" };
+    static const double metric_min_sd[ANOMALY_METRICS] = { 0.5, 10.0 };
+    double k = monitor_config.anomaly_threshold;
+    int flagged = 0;
+
+    if (!device || !sample) {
+        return -EINVAL;
+    }
+    if (k <= 0.0) {
+        return 0;
+    }
+
+    const char *name = device_basename(device);
+    time_t ts = sample->timestamp ? sample->timestamp : time(NULL);
+    int64_t hour = (int64_t)ts / 3600;
+
+    pthread_mutex_lock(&anomaly_mutex);
+    anomaly_state_t *st = anomaly_get_state(name);
+    if (!st) {
+        pthread_mutex_unlock(&anomaly_mutex);
+        return -ENOMEM;
+    }
+    if (st->hour >= 0 && hour != st->hour) {
+        anomaly_close_hour(st);
+    }
+    st->hour = hour;
+
+    double values[ANOMALY_METRICS] = { sample->latency_ms, sample->iops };
+    for (int m = 0; m < ANOMALY_METRICS; m++) {
+        double x = values[m];
+        ewma_t *fast = &st->fast[m];
+        const ewma_t *season = &st->season[m][hour % ANOMALY_SEASON_SLOTS];
+
+        // Sin IOs la latencia del intervalo no significa nada
+        if (m == 0 && sample->iops <= 0.0) {
+            continue;
+        }
+
+        double score = ewma_score(fast, x, metric_min_sd[m]);
+        int seasonal = season->n >= ANOMALY_SEASON_WARMUP;
+        double season_score = seasonal ? ewma_score(season, x, metric_min_sd[m]) : score;
+        // La latencia solo preocupa al subir; las IOPS en ambos sentidos
+        double s = m == 0 ? MIN(score, season_score)
+                          : (score > 0 ? MIN(score, season_score) : MAX(score, season_score));
+        int out = fast->n >= ANOMALY_WARMUP && (m == 0 ? s > k : fabs(s) > k);
+
+        if (out && !st->active[m]) {
+            if (anomaly_queued == ANOMALY_QUEUE) {
+                memmove(anomaly_queue, anomaly_queue + 1,
+                        (ANOMALY_QUEUE - 1) * sizeof(monitor_anomaly_t));
+                anomaly_queued--;
+                anomalies_dropped++;
+            }
+            monitor_anomaly_t *ev = &anomaly_queue[anomaly_queued++];
+            memset(ev, 0, sizeof(monitor_anomaly_t));
+            strncpy(ev->device, name, sizeof(ev->device) - 1);
+            strncpy(ev->metric, metric_name[m], sizeof(ev->metric) - 1);
+            ev->timestamp = ts;
+            ev->value = x;
+            ev->expected = seasonal ? season->mean : fast->mean;
+            ev->stddev = sqrt(seasonal ? season->var : fast->var);
+            ev->score = s;
+            ev->seasonal = seasonal;
+            st->active[m] = 1;
+            flagged++;
+            fprintf(stderr, "WARNING: %s %s anomaly: %.2f (expected %.2f, %.1f sigma)\n",
+                    name, metric_name[m], x, ev->expected, s);
+        } else if (st->active[m] && fabs(s) < k / 2) {
+            st->active[m] = 0;
+        }
+
+        // Durante una anomalía la banda se adapta despacio: un cambio de
+        // nivel sostenido acaba siendo la nueva normalidad
+        ewma_update(fast, x, st->active[m] ? ANOMALY_ALPHA / 10 : ANOMALY_ALPHA);
+        st->hour_sum[m] += x;
+        st->hour_sumsq[m] += x * x;
+        st->hour_n[m]++;
+    }
+    pthread_mutex_unlock(&anomaly_mutex);
+
+    return flagged;
+}
+
+// Persiste los eventos encolados. Se llama desde flush_pending() con db_mutex.
+static int anomaly_sync(void) {
+    monitor_anomaly_t events[ANOMALY_QUEUE];
+    int failed = 0;
+
+    if (!anomaly_stmt) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&anomaly_mutex);
+    int n = anomaly_queued;
+    memcpy(events, anomaly_queue, n * sizeof(monitor_anomaly_t));
+    anomaly_queued = 0;
+    pthread_mutex_unlock(&anomaly_mutex);
+
+    if (n == 0) {
+        return 0;
+    }
+
+    sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL);
+    for (int i = 0; i < n; i++) {
+        sqlite3_bind_text(anomaly_stmt, 1, events[i].device, -1, SQLITE_STATIC);
+        sqlite3_bind_int64(anomaly_stmt, 2, events[i].timestamp);
+        sqlite3_bind_text(anomaly_stmt, 3, events[i].metric, -1, SQLITE_STATIC);
+        sqlite3_bind_double(anomaly_stmt, 4, events[i].value);
+        sqlite3_bind_double(anomaly_stmt, 5, events[i].expected);
+        sqlite3_bind_double(anomaly_stmt, 6, events[i].stddev);
+        sqlite3_bind_double(anomaly_stmt, 7, events[i].score);
+        sqlite3_bind_int(anomaly_stmt, 8, events[i].seasonal);
+        if (sqlite3_step(anomaly_stmt) != SQLITE_DONE) {
+            failed = 1;
+        }
+        sqlite3_reset(anomaly_stmt);
+    }
+    sqlite3_clear_bindings(anomaly_stmt);
+    if (sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK) {
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+        failed = 1;
+    }
+    return failed ? -1 : 0;
+}
+
+int monitor_get_anomalies(const char *device, time_t start, time_t end,
+                          monitor_anomaly_t **events, int *count) {
+    const char *sql = "SELECT device, timestamp, metric, value, expected, stddev, score, seasonal "
+                     "FROM anomaly_events "
+                     "WHERE (?1 IS NULL OR device = ?1) AND timestamp BETWEEN ?2 AND ?3 "
+                     "ORDER BY timestamp, id;";
+    sqlite3_stmt *stmt;
+    int capacity = 0, n = 0, rc;
+
+    if (!events || !count) {
+        return -EINVAL;
+    }
+    if (!db) {
+        return -1;
+    }
+
+    flush_pending();
+
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        return -1;
+    }
+    if (device) {
+        sqlite3_bind_text(stmt, 1, device_basename(device), -1, SQLITE_TRANSIENT);
+    }
+    sqlite3_bind_int64(stmt, 2, start);
+    sqlite3_bind_int64(stmt, 3, end);
+
+    *events = NULL;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        if (n == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            monitor_anomaly_t *bigger = realloc(*events, capacity * sizeof(monitor_anomaly_t));
+            if (!bigger) {
+                free(*events);
+                *events = NULL;
+                sqlite3_finalize(stmt);
+                return -ENOMEM;
+            }
+            *events = bigger;
+        }
+
+        monitor_anomaly_t *ev = &(*events)[n++];
+        memset(ev, 0, sizeof(monitor_anomaly_t));
+        const char *dev = (const char*)sqlite3_column_text(stmt, 0);
+        const char *metric = (const char*)sqlite3_column_text(stmt, 2);
+        strncpy(ev->device, dev ? dev : "", sizeof(ev->device) - 1);
+        strncpy(ev->metric, metric ? metric : "", sizeof(ev->metric) - 1);
+        ev->timestamp = sqlite3_column_int64(stmt, 1);
+        ev->value = sqlite3_column_double(stmt, 3);
+        ev->expected = sqlite3_column_double(stmt, 4);
+        ev->stddev = sqlite3_column_double(stmt, 5);
+        ev->score = sqlite3_column_double(stmt, 6);
+        ev->seasonal = sqlite3_column_int(stmt, 7);
+    }
+    sqlite3_finalize(stmt);
+
+    if (rc != SQLITE_DONE) {
+        free(*events);
+        *events = NULL;
+        return -1;
+    }
+    *count = n;
+    return 0;
+}
+
+// Vacía la cola en lotes, cada uno dentro de una única transacción.
+// Devuelve el número de muestras escritas o -1 si falló algún lote.
+static int flush_pending(void) {
+    int written = 0;
+    int failed = 0;
+    uint64_t cpu_start = thread_cpu_ns();
+
+    pthread_mutex_lock(&db_mutex);
+    while (db) {
+        pthread_mutex_lock(&queue_mutex);
+        int n = queue_count;
+        for (int i = 0; i < n; i++) {
+            flush_batch[i] = sample_queue[(queue_head + i) % monitor_config.queue_capacity];
+        }
+        queue_head = (queue_head + n) % monitor_config.queue_capacity;
+        queue_count = 0;
+        pthread_mutex_unlock(&queue_mutex);
+
+        if (n == 0) {
+            break;
+        }
+
+        uint64_t batch_start = monotonic_ns();
+        sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL);
+        for (int i = 0; i < n; i++) {
+            const queued_sample_t *q = &flush_batch[i];
+
+            if (monitor_config.backend == MONITOR_BACKEND_TSDB) {
+                if (tsdb_append(q->device, &q->sample) != 0) {
+                    failed = 1;
+                }
+                rollup_add(q->device, &q->sample);
+                continue;
+            }
+
+            if (history_insert(q->device, &q->sample) != 0) {
+                failed = 1;
+            }
+            rollup_add(q->device, &q->sample);
+        }
+        rollup_sync_open();
+
+        if (sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK) {
+            // Las particiones creadas en el lote también se deshacen
+            sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+            history_reset_insert();
+            history_load_partitions();
+            failed = 1;
+        } else {
+            written += n;
+        }
+
+        double batch_ms = (monotonic_ns() - batch_start) / 1e6;
+        pthread_mutex_lock(&self_mutex);
+        self_stats.db_write_ms = batch_ms;
+        self_stats.max_db_write_ms = MAX(self_stats.max_db_write_ms, batch_ms);
+        pthread_mutex_unlock(&self_mutex);
+    }
+    if (written > 0 && monitor_config.backend == MONITOR_BACKEND_TSDB) {
+        tsdb_sync();
+    }
+    if (db && lat_sync() != 0) {
+        failed = 1;
+    }
+    if (db && anomaly_sync() != 0) {
+        failed = 1;
+    }
+    pthread_mutex_unlock(&db_mutex);
+
+    // La escritura cuenta en el coste del monitor aunque la pida una consulta
+    pthread_mutex_lock(&self_mutex);
+    self_stats.cpu_ms += (thread_cpu_ns() - cpu_start) / 1e6;
+    pthread_mutex_unlock(&self_mutex);
+
+    return failed ? -1 : written;
+}
+
+int monitor_flush(void) {
+    if (!db) {
+        return -1;
+    }
+    return flush_pending() < 0 ? -1 : 0;
+}
+
+static void *monitor_writer_func(void *arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&queue_mutex);
+    while (writer_active) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += monitor_config.flush_interval_ms / 1000;
+        deadline.tv_nsec += (long)(monitor_config.flush_interval_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        while (writer_active && queue_count < monitor_config.flush_batch_size) {
+            if (pthread_cond_timedwait(&queue_cond, &queue_mutex, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+
+        if (queue_count > 0) {
+            pthread_mutex_unlock(&queue_mutex);
+            flush_pending();
+            pthread_mutex_lock(&queue_mutex);
+        }
+    }
+    pthread_mutex_unlock(&queue_mutex);
+
+    // Último vaciado antes de cerrar la base de datos
+    flush_pending();
+    return NULL;
+}
+
+int monitor_get_disk_usage(const char *mount_point, disk_usage_t *usage) {
+    mount_usage_t m;
+
+    if (!mount_point || !usage) {
+        return -EINVAL;
+    }
+
+    memset(usage, 0, sizeof(disk_usage_t));
+    strncpy(usage->mount_point, mount_point, sizeof(usage->mount_point) - 1);
+
+    // Los puntos de montaje se sirven desde la caché, aunque estén stale;
+    // solo las rutas que no son puntos de montaje van a statvfs
+    if (mount_cache_get(mount_point, &m) == 0) {
+        if (m.updated == 0) {
+            // El primer statvfs colgó o falló: repetirlo aquí bloquearía
+            return -EAGAIN;
+        }
+        strncpy(usage->device, m.device, sizeof(usage->device) - 1);
+        usage->total_bytes = m.total_bytes;
+        usage->available_bytes = m.available_bytes;
+        usage->used_bytes = m.total_bytes - m.free_bytes;
+        usage->total_inodes = m.total_inodes;
+        usage->free_inodes = m.free_inodes;
+    } else {
+        struct statvfs stat;
+        if (statvfs(mount_point, &stat) != 0) {
+            return -1;
+        }
+        usage->total_bytes = (unsigned long long)stat.f_blocks * stat.f_frsize;
+        usage->available_bytes = (unsigned long long)stat.f_bavail * stat.f_frsize;
+        usage->used_bytes = usage->total_bytes - ((unsigned long long)stat.f_bfree * stat.f_frsize);
+        usage->total_inodes = stat.f_files;
+        usage->free_inodes = stat.f_ffree;
+    }
+
+    usage->usage_percent = usage->total_bytes ?
+        (double)usage->used_bytes / usage->total_bytes * 100.0 : 0.0;
+    usage->used_inodes = usage->total_inodes - usage->free_inodes;
+
+    return 0;
+}
+
+int monitor_check_disk_space(const char *mount_point, double threshold) {
+    disk_usage_t usage;
+
+    if (monitor_get_disk_usage(mount_point, &usage) != 0) {
+        return -1;
+    }
+
+    if (usage.usage_percent >= threshold) {
+        fprintf(stderr, "WARNING: Disk usage on %s is %.2f%%\n",
+                mount_point, usage.usage_percent);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Escaneo de descriptores abiertos: se enumeran los pids de /proc con
+ * getdents64 y un pool pequeño de threads reparte los pids por lotes. Cada
+ * thread abre /proc/<pid>/fd con openat() y compara el st_dev del destino
+ * de cada enlace (fstatat) con el del punto de montaje; solo para los que
+ * coinciden se resuelve la ruta y se lee el nombre del proceso.
+ */
+#define OPEN_FILES_MAX_THREADS 8
+#define OPEN_FILES_PID_BATCH 32
+#define DENTS_BUF_SIZE 32768
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+typedef struct {
+    int proc_fd;
+    dev_t dev;
+    const pid_t *pids;
+    int npids;
+    atomic_int next;
+} fd_scan_t;
+
+typedef struct {
+    fd_scan_t *scan;
+    open_file_t *files;
+    int count;
+    int capacity;
+    int failed;
+} fd_worker_t;
+
+static int parse_pid(const char *name, pid_t *pid) {
+    long v = 0;
+
+    if (*name == '\0') {
+        return 0;
+    }
+    for (const char *p = name; *p; p++) {
+        if (*p < '0' || *p > '9') {
+            return 0;
+        }
+        v = v * 10 + (*p - '0');
+    }
+    *pid = (pid_t)v;
+    return 1;
+}
+
+static int list_pids(int proc_fd, pid_t **pids) {
+    char buf[DENTS_BUF_SIZE];
+    int count = 0, capacity = 0;
+    long n;
+
+    *pids = NULL;
+    lseek(proc_fd, 0, SEEK_SET);
+    while ((n = syscall(SYS_getdents64, proc_fd, buf, sizeof(buf))) > 0) {
+        for (long off = 0; off < n; ) {
+            struct linux_dirent64 *d = (struct linux_dirent64*)(buf + off);
+            pid_t pid;
+            off += d->d_reclen;
+            if (d->d_type != DT_DIR || !parse_pid(d->d_name, &pid)) {
+                continue;
+            }
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 1024;
+                pid_t *bigger = realloc(*pids, capacity * sizeof(pid_t));
+                if (!bigger) {
+                    free(*pids);
+                    *pids = NULL;
+                    return -ENOMEM;
+                }
+                *pids = bigger;
+            }
+            (*pids)[count++] = pid;
+        }
+    }
+    return n < 0 ? -1 : count;
+}
+
+static void read_comm(int proc_fd, pid_t pid, char *name, size_t size) {
+    char path[32];
+    snprintf(path, sizeof(path), "%d/comm", (int)pid);
+
+    name[0] = '\0';
+    int fd = openat(proc_fd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    ssize_t n = read(fd, name, size - 1);
+    close(fd);
+    if (n > 0) {
+        name[n] = '\0';
+        char *nl = strchr(name, '\n');
+        if (nl) *nl = '\0';
+    } else {
+        name[0] = '\0';
+    }
+}
+
+static void scan_pid(fd_worker_t *w, pid_t pid) {
+    fd_scan_t *scan = w->scan;
+    char buf[DENTS_BUF_SIZE];
+    char path[32];
+    char comm[256];
+    long n;
+
+    snprintf(path, sizeof(path), "%d/fd", (int)pid);
+    int dir_fd = openat(scan->proc_fd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0) {
+        return;     // proceso terminado o sin permisos
+    }
+
+    comm[0] = '\0';
+    while ((n = syscall(SYS_getdents64, dir_fd, buf, sizeof(buf))) > 0) {
+        for (long off = 0; off < n; ) {
+            struct linux_dirent64 *d = (struct linux_dirent64*)(buf + off);
+            struct stat st;
+            pid_t fd_num;
+            off += d->d_reclen;
+
+            if (!parse_pid(d->d_name, &fd_num) ||
+                fstatat(dir_fd, d->d_name, &st, 0) != 0 || st.st_dev != scan->dev) {
+                continue;
+            }
+
+            if (w->count == w->capacity) {
+                int capacity = w->capacity ? w->capacity * 2 : 64;
+                open_file_t *bigger = realloc(w->files, capacity * sizeof(open_file_t));
+                if (!bigger) {
+                    w->failed = 1;
+                    close(dir_fd);
+                    return;
+                }
+                w->files = bigger;
+                w->capacity = capacity;
+            }
+
+            open_file_t *f = &w->files[w->count];
+            memset(f, 0, sizeof(open_file_t));
+            ssize_t len = readlinkat(dir_fd, d->d_name, f->path, sizeof(f->path) - 1);
+            if (len < 0) {
+                continue;
+            }
+            f->path[len] = '\0';
+            f->pid = pid;
+            f->fd = (int)fd_num;
+
+            // Los bits de permiso del enlace reflejan el modo de apertura
+            struct stat lst;
+            if (fstatat(dir_fd, d->d_name, &lst, AT_SYMLINK_NOFOLLOW) == 0) {
+                int m = 0;
+                if (lst.st_mode & S_IRUSR) f->mode[m++] = 'r';
+                if (lst.st_mode & S_IWUSR) f->mode[m++] = 'w';
+                f->mode[m] = '\0';
+            }
+
+            if (comm[0] == '\0') {
+                read_comm(scan->proc_fd, pid, comm, sizeof(comm));
+            }
+            strncpy(f->process_name, comm, sizeof(f->process_name) - 1);
+            w->count++;
+        }
+    }
+    close(dir_fd);
+}
+
+static void *fd_scan_worker(void *arg) {
+    fd_worker_t *w = arg;
+    fd_scan_t *scan = w->scan;
+
+    for (;;) {
+        int start = atomic_fetch_add(&scan->next, OPEN_FILES_PID_BATCH);
+        if (start >= scan->npids) {
+            break;
+        }
+        int end = MIN(start + OPEN_FILES_PID_BATCH, scan->npids);
+        for (int i = start; i < end && !w->failed; i++) {
+            scan_pid(w, scan->pids[i]);
+        }
+    }
+    return NULL;
+}
+
+int monitor_list_open_files(const char *mount_point, open_file_t **files, int *count) {
+    fd_worker_t workers[OPEN_FILES_MAX_THREADS];
+    pthread_t threads[OPEN_FILES_MAX_THREADS];
+    fd_scan_t scan;
+    struct stat st;
+
+    if (!mount_point || !files || !count) {
+        return -EINVAL;
+    }
+    *files = NULL;
+    *count = 0;
+
+    if (stat(mount_point, &st) != 0) {
+        return -errno;
+    }
+
+    memset(&scan, 0, sizeof(scan));
+    scan.dev = st.st_dev;
+    scan.proc_fd = open(PROC_PATH, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (scan.proc_fd < 0) {
+        return -1;
+    }
+
+    pid_t *pids;
+    scan.npids = list_pids(scan.proc_fd, &pids);
+    if (scan.npids < 0) {
+        close(scan.proc_fd);
+        return scan.npids;
+    }
+    scan.pids = pids;
+    atomic_init(&scan.next, 0);
+
+    // Al menos dos threads: el coste es de syscalls y algún stat puede bloquear
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int nthreads = (int)MIN(MAX(ncpu, 2), OPEN_FILES_MAX_THREADS);
+    nthreads = MIN(nthreads, (scan.npids + OPEN_FILES_PID_BATCH - 1) / OPEN_FILES_PID_BATCH);
+    if (nthreads < 1) {
+        nthreads = 1;
+    }
+
+    // El thread llamante actúa como worker 0
+    int created[OPEN_FILES_MAX_THREADS] = { 0 };
+    memset(workers, 0, sizeof(workers));
+    for (int t = 0; t < nthreads; t++) {
+        workers[t].scan = &scan;
+        if (t > 0) {
+            created[t] = pthread_create(&threads[t], NULL, fd_scan_worker, &workers[t]) == 0;
+        }
+    }
+    fd_scan_worker(&workers[0]);
+    for (int t = 1; t < nthreads; t++) {
+        if (created[t]) {
+            pthread_join(threads[t], NULL);
+        }
+    }
+
+    close(scan.proc_fd);
+    free(pids);
+
+    int total = 0, failed = 0;
+    for (int t = 0; t < nthreads; t++) {
+        total += workers[t].count;
+        failed |= workers[t].failed;
+    }
+
+    open_file_t *result = NULL;
+    if (!failed && total > 0) {
+        result = malloc(total * sizeof(open_file_t));
+        failed = !result;
+    }
+    int pos = 0;
+    for (int t = 0; t < nthreads; t++) {
+        if (result) {
+            memcpy(result + pos, workers[t].files, workers[t].count * sizeof(open_file_t));
+            pos += workers[t].count;
+        }
+        free(workers[t].files);
+    }
+
+    if (failed) {
+        free(result);
+        return -ENOMEM;
+    }
+
+    *files = result;
+    *count = total;
+    return 0;
+}
+
+/*
+ * E/S por proceso. Cada tick se enumeran los pids de /proc y se cruzan
+ * (merge-join por pid) con el estado del tick anterior, que conserva los
+ * contadores previos y, para los primeros PROC_IO_MAX_FDS procesos, un fd
+ * abierto sobre /proc/<pid>/io que se relee con pread() sin open/close.
+ * Un min-heap acotado a process_top_n elige los procesos con más bytes/s.
+ * Recorre todo /proc, así que el sampler solo lo hace si process_top_n > 0.
+ */
+#define PROC_IO_MAX_FDS 512
+#define PROC_IO_MIN_INTERVAL_MS 1000
+
+typedef struct {
+    pid_t pid;
+    int fd;                     // -1: sin fd persistente
+    uint64_t mono_ns;
+    unsigned long long read_bytes;
+    unsigned long long write_bytes;
+    double read_bps;
+    double write_bps;
+    char comm[64];              // se lee al entrar en el top ("" si el pid se reutilizó)
+} proc_io_state_t;
+
+static proc_io_state_t *proc_states = NULL;
+static int proc_state_count = 0;
+static int proc_fds_open = 0;
+static process_io_t proc_top[MONITOR_MAX_TOP_PROCESSES];
+static int proc_top_count = 0;
+static pthread_mutex_t proc_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int pid_cmp(const void *a, const void *b) {
+    pid_t x = *(const pid_t*)a;
+    pid_t y = *(const pid_t*)b;
+    return x < y ? -1 : (x > y);
+}
+
+// Extrae read_bytes y write_bytes del contenido de /proc/<pid>/io
+static int parse_proc_io(const char *buf, size_t len, unsigned long long *syscr,
+                         unsigned long long *syscw, unsigned long long *rd,
+                         unsigned long long *wr) {
+    const char *p = buf;
+    const char *end = buf + len;
+    int found = 0;
+
+    while (p < end) {
+        const char *colon = memchr(p, ':', end - p);
+        if (!colon) {
+            break;
+        }
+        size_t klen = colon - p;
+        unsigned long long v;
+        const char *q = parse_ull(skip_spaces(colon + 1, end), end, &v);
+        if (q) {
+            if (klen == 5 && memcmp(p, "syscr", 5) == 0 && syscr) { *syscr = v; found++; }
+            else if (klen == 5 && memcmp(p, "syscw", 5) == 0 && syscw) { *syscw = v; found++; }
+            else if (klen == 10 && memcmp(p, "read_bytes", 10) == 0) { *rd = v; found++; }
+            else if (klen == 11 && memcmp(p, "write_bytes", 11) == 0) { *wr = v; found++; }
+        }
+        p = skip_line(colon, end);
+    }
+    return found;
+}
+
+static int proc_io_read(int proc_fd, proc_io_state_t *st, int keep_fd) {
+    char buf[512];
+    ssize_t n = -1;
+
+    if (st->fd >= 0) {
+        n = pread(st->fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            return -1;      // el proceso terminó
+        }
+    } else {
+        char path[32];
+        snprintf(path, sizeof(path), "%d/io", (int)st->pid);
+        int fd = openat(proc_fd, path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return -1;
+        }
+        n = pread(fd, buf, sizeof(buf), 0);
+        if (n > 0 && keep_fd) {
+            st->fd = fd;
+            proc_fds_open++;
+        } else {
+            close(fd);
+        }
+        if (n <= 0) {
+            return -1;
+        }
+    }
+
+    unsigned long long rd = 0, wr = 0;
+    if (parse_proc_io(buf, (size_t)n, NULL, NULL, &rd, &wr) < 2) {
+        return -1;
+    }
+
+    // Contadores que retroceden sin fd persistente: el pid es otro proceso
+    if (rd < st->read_bytes || wr < st->write_bytes) {
+        st->comm[0] = '\0';
+    }
+
+    uint64_t now = monotonic_ns();
+    if (st->mono_ns != 0 && now > st->mono_ns && rd >= st->read_bytes && wr >= st->write_bytes) {
+        double elapsed = (double)(now - st->mono_ns) / 1e9;
+        st->read_bps = (double)(rd - st->read_bytes) / elapsed;
+        st->write_bps = (double)(wr - st->write_bytes) / elapsed;
+    } else {
+        st->read_bps = 0.0;
+        st->write_bps = 0.0;
+    }
+    st->read_bytes = rd;
+    st->write_bytes = wr;
+    st->mono_ns = now;
+    return 0;
+}
+
+static void proc_io_release(proc_io_state_t *st) {
+    if (st->fd >= 0) {
+        close(st->fd);
+        st->fd = -1;
+        proc_fds_open--;
+    }
+}
+
+static inline double proc_rate(const proc_io_state_t *st) {
+    return st->read_bps + st->write_bps;
+}
+
+static void heap_sift_down(proc_io_state_t **heap, int n, int i) {
+    for (;;) {
+        int l = 2 * i + 1, r = l + 1, m = i;
+        if (l < n && proc_rate(heap[l]) < proc_rate(heap[m])) m = l;
+        if (r < n && proc_rate(heap[r]) < proc_rate(heap[m])) m = r;
+        if (m == i) return;
+        proc_io_state_t *tmp = heap[i];
+        heap[i] = heap[m];
+        heap[m] = tmp;
+        i = m;
+    }
+}
+
+static void heap_sift_up(proc_io_state_t **heap, int i) {
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (proc_rate(heap[parent]) <= proc_rate(heap[i])) return;
+        proc_io_state_t *tmp = heap[i];
+        heap[i] = heap[parent];
+        heap[parent] = tmp;
+        i = parent;
+    }
+}
+
+int monitor_update_process_io(void) {
+    proc_io_state_t *heap[MONITOR_MAX_TOP_PROCESSES];
+    int top_n = monitor_config.process_top_n > 0 ? monitor_config.process_top_n
+                                                 : MONITOR_TOP_PROCESSES;
+    int heap_count = 0;
+    pid_t *pids;
+
+    top_n = MIN(top_n, MONITOR_MAX_TOP_PROCESSES);
+
+    int proc_fd = open(PROC_PATH, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (proc_fd < 0) {
+        return -1;
+    }
+    int npids = list_pids(proc_fd, &pids);
+    if (npids < 0) {
+        close(proc_fd);
+        return npids;
+    }
+    // getdents suele devolverlos ya ordenados
+    qsort(pids, npids, sizeof(pid_t), pid_cmp);
+
+    proc_io_state_t *next = malloc((npids ? npids : 1) * sizeof(proc_io_state_t));
+    if (!next) {
+        free(pids);
+        close(proc_fd);
+        return -ENOMEM;
+    }
+
+    pthread_mutex_lock(&proc_mutex);
+    int i = 0, n = 0;
+    for (int k = 0; k < npids; k++) {
+        // Procesos que ya no existen: liberar su estado
+        while (i < proc_state_count && proc_states[i].pid < pids[k]) {
+            proc_io_release(&proc_states[i++]);
+        }
+
+        proc_io_state_t *st = &next[n];
+        if (i < proc_state_count && proc_states[i].pid == pids[k]) {
+            *st = proc_states[i++];
+        } else {
+            memset(st, 0, sizeof(proc_io_state_t));
+            st->pid = pids[k];
+            st->fd = -1;
+        }
+
+        if (proc_io_read(proc_fd, st, proc_fds_open < PROC_IO_MAX_FDS) != 0) {
+            proc_io_release(st);
+            continue;
+        }
+        n++;
+    }
+    while (i < proc_state_count) {
+        proc_io_release(&proc_states[i++]);
+    }
+    free(proc_states);
+    proc_states = next;
+    proc_state_count = n;
+
+    // Min-heap de tamaño top_n: la raíz es el menor del top actual
+    for (int k = 0; k < n; k++) {
+        proc_io_state_t *st = &proc_states[k];
+        if (proc_rate(st) <= 0.0) {
+            continue;
+        }
+        if (heap_count < top_n) {
+            heap[heap_count] = st;
+            heap_sift_up(heap, heap_count++);
+        } else if (proc_rate(st) > proc_rate(heap[0])) {
+            heap[0] = st;
+            heap_sift_down(heap, heap_count, 0);
+        }
+    }
+
+    // Extraer de menor a mayor y guardar en orden descendente
+    proc_top_count = heap_count;
+    for (int k = heap_count - 1; k >= 0; k--) {
+        proc_io_state_t *st = heap[0];
+        heap[0] = heap[k];
+        heap_sift_down(heap, k, 0);
+
+        if (st->comm[0] == '\0') {
+            read_comm(proc_fd, st->pid, st->comm, sizeof(st->comm));
+        }
+        process_io_t *out = &proc_top[k];
+        out->pid = st->pid;
+        strncpy(out->process_name, st->comm, sizeof(out->process_name) - 1);
+        out->process_name[sizeof(out->process_name) - 1] = '\0';
+        out->read_bytes = st->read_bytes;
+        out->write_bytes = st->write_bytes;
+        out->read_bps = st->read_bps;
+        out->write_bps = st->write_bps;
+    }
+    pthread_mutex_unlock(&proc_mutex);
+
+    free(pids);
+    close(proc_fd);
+    return n;
+}
+
+int monitor_get_top_process_io(process_io_t *top, int max) {
+    if (!top || max <= 0) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&proc_mutex);
+    int n = MIN(max, proc_top_count);
+    memcpy(top, proc_top, n * sizeof(process_io_t));
+    pthread_mutex_unlock(&proc_mutex);
+
+    return n;
+}
+
+static void proc_io_cleanup(void) {
+    pthread_mutex_lock(&proc_mutex);
+    for (int i = 0; i < proc_state_count; i++) {
+        proc_io_release(&proc_states[i]);
+    }
+    free(proc_states);
+    proc_states = NULL;
+    proc_state_count = 0;
+    proc_top_count = 0;
+    pthread_mutex_unlock(&proc_mutex);
+}
+
+int monitor_get_process_io(pid_t pid, device_stats_t *stats) {
+    char path[64];
+    char buf[512];
+    char comm[64] = "";
+    ssize_t n = -1;
+
+    if (pid <= 0 || !stats) {
+        return -EINVAL;
+    }
+
+    // Un pid seguido por el barrido se relee por su fd persistente
+    pthread_mutex_lock(&proc_mutex);
+    proc_io_state_t key = { .pid = pid };
+    proc_io_state_t *st = proc_states ? bsearch(&key, proc_states, proc_state_count,
+                                                sizeof(proc_io_state_t), pid_cmp) : NULL;
+    if (st && st->fd >= 0) {
+        n = pread(st->fd, buf, sizeof(buf), 0);
+        memcpy(comm, st->comm, sizeof(comm));
+    }
+    pthread_mutex_unlock(&proc_mutex);
+
+    if (n <= 0) {
+        snprintf(path, sizeof(path), PROC_PATH "/%d/io", (int)pid);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return -errno;
+        }
+        n = pread(fd, buf, sizeof(buf), 0);
+        close(fd);
+        comm[0] = '\0';
+        if (n <= 0) {
+            return -1;
+        }
+    }
+
+    memset(stats, 0, sizeof(device_stats_t));
+    if (parse_proc_io(buf, (size_t)n, &stats->reads, &stats->writes,
+                      &stats->read_bytes, &stats->write_bytes) < 4) {
+        return -1;
+    }
+
+    // device = nombre del proceso
+    if (comm[0]) {
+        memcpy(stats->device, comm, MIN(sizeof(stats->device), sizeof(comm)));
+        stats->device[sizeof(stats->device) - 1] = '\0';
+    } else {
+        int proc_fd = open(PROC_PATH, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (proc_fd >= 0) {
+            read_comm(proc_fd, pid, stats->device, sizeof(stats->device));
+            close(proc_fd);
+        }
+    }
+    stats->last_update = time(NULL);
+    stats->mono_ns = monotonic_ns();
+    return 0;
+}
+
+struct monitor_history_cursor {
+    sqlite3_stmt *stmt;
+    tsdb_iter_t *iter;
+    char device[64];
+    time_t start;
+    time_t end;
+    long *days;                 // particiones del rango, en orden
+    int ndays;
+    int next_day;
+    int done;
+};
+
+// Abre la consulta sobre la siguiente partición del rango. Las que ya no
+// existen (la retención pudo borrarlas) se saltan.
+static void history_cursor_advance(monitor_history_cursor_t *c) {
+    char name[64];
+    char sql[512];
+
+    sqlite3_finalize(c->stmt);
+    c->stmt = NULL;
+    while (c->next_day < c->ndays) {
+        history_table_name(c->days[c->next_day++], name, sizeof(name));
+        snprintf(sql, sizeof(sql),
+                 "SELECT " HISTORY_COLUMNS " FROM %s "
+                 "WHERE device = ? AND timestamp BETWEEN ? AND ? "
+                 "ORDER BY timestamp, timestamp_ns;", name);
+        if (sqlite3_prepare_v2(db, sql, -1, &c->stmt, NULL) == SQLITE_OK) {
+            sqlite3_bind_text(c->stmt, 1, c->device, -1, SQLITE_STATIC);
+            sqlite3_bind_int64(c->stmt, 2, c->start);
+            sqlite3_bind_int64(c->stmt, 3, c->end);
+            return;
+        }
+        sqlite3_finalize(c->stmt);
+        c->stmt = NULL;
+    }
+    c->done = 1;
+}
+
+int monitor_history_open(const char *device, time_t start, time_t end,
+                         monitor_history_cursor_t **cursor) {
+    if (!device || !cursor) {
+        return -EINVAL;
+    }
+    if (!db) {
+        return -1;
+    }
+
+    // Las muestras aún en cola también deben aparecer en el histórico
+    flush_pending();
+
+    monitor_history_cursor_t *c = calloc(1, sizeof(monitor_history_cursor_t));
+    if (!c) {
+        return -ENOMEM;
+    }
+    strncpy(c->device, device_basename(device), sizeof(c->device) - 1);
+
+    if (monitor_config.backend == MONITOR_BACKEND_TSDB) {
+        int rc = tsdb_iter_open(c->device, start, end, &c->iter);
+        if (rc != 0) {
+            free(c);
+            return rc;
+        }
+        *cursor = c;
+        return 0;
+    }
+
+    c->start = start;
+    c->end = end;
+    c->ndays = history_partitions(start, end, &c->days);
+    if (c->ndays < 0) {
+        int rc = c->ndays;
+        free(c);
+        return rc;
+    }
+    history_cursor_advance(c);
+
+    *cursor = c;
+    return 0;
+}
+
+int monitor_history_next(monitor_history_cursor_t *cursor, performance_sample_t *batch, int max) {
+    int n = 0;
+
+    if (!cursor || !batch || max <= 0) {
+        return -EINVAL;
+    }
+
+    if (cursor->iter) {
+        return tsdb_iter_next(cursor->iter, batch, max);
+    }
+
+    while (!cursor->done && n < max) {
+        int rc = sqlite3_step(cursor->stmt);
+        if (rc == SQLITE_DONE) {
+            history_cursor_advance(cursor);
+            continue;
+        }
+        if (rc != SQLITE_ROW) {
+            cursor->done = 1;
+            return -1;
+        }
+        history_read_row(cursor->stmt, 0, &batch[n++]);
+    }
+
+    return n;
+}
+
+void monitor_history_close(monitor_history_cursor_t *cursor) {
+    if (!cursor) {
+        return;
+    }
+    if (cursor->iter) {
+        tsdb_iter_close(cursor->iter);
+    }
+    sqlite3_finalize(cursor->stmt);
+    free(cursor->days);
+    free(cursor);
+}
+
+int monitor_history_foreach(const char *device, time_t start, time_t end, int batch_size,
+                            monitor_history_cb cb, void *user_data) {
+    monitor_history_cursor_t *cursor;
+    performance_sample_t stack_batch[MONITOR_HISTORY_BATCH];
+    performance_sample_t *batch = stack_batch;
+    int rc;
+
+    if (!cb) {
+        return -EINVAL;
+    }
+    if (batch_size <= 0) {
+        batch_size = MONITOR_HISTORY_BATCH;
+    }
+    if (batch_size > MONITOR_HISTORY_BATCH) {
+        batch = malloc(batch_size * sizeof(performance_sample_t));
+        if (!batch) {
+            return -ENOMEM;
+        }
+    }
+
+    rc = monitor_history_open(device, start, end, &cursor);
+    if (rc == 0) {
+        int n;
+        while ((n = monitor_history_next(cursor, batch, batch_size)) > 0) {
+            rc = cb(cursor->device, batch, n, user_data);
+            if (rc != 0) {
+                break;
+            }
+        }
+        if (n < 0) {
+            rc = -1;
+        }
+        monitor_history_close(cursor);
+    }
+
+    if (batch != stack_batch) {
+        free(batch);
+    }
+    return rc;
+}
+
+// Array que crece por duplicación, para monitor_get_history()
+typedef struct {
+    performance_sample_t *items;
+    int count;
+    int capacity;
+} sample_array_t;
+
+static int sample_array_append(const char *device, const performance_sample_t *batch,
+                               int count, void *user_data) {
+    sample_array_t *array = user_data;
+    (void)device;
+
+    if (array->count + count > array->capacity) {
+        int capacity = array->capacity ? array->capacity : MONITOR_HISTORY_BATCH;
+        while (capacity < array->count + count) {
+            capacity *= 2;
+        }
+        performance_sample_t *bigger = realloc(array->items,
+                                               capacity * sizeof(performance_sample_t));
+        if (!bigger) {
+            return -ENOMEM;
+        }
+        array->items = bigger;
+        array->capacity = capacity;
+    }
+
+    memcpy(array->items + array->count, batch, count * sizeof(performance_sample_t));
+    array->count += count;
+    return 0;
+}
+
+int monitor_get_history(const char *device, time_t start, time_t end,
+                       performance_sample_t **samples, int *count) {
+    sample_array_t array = { NULL, 0, 0 };
+
+    if (!samples || !count) {
+        return -EINVAL;
+    }
+
+    int rc = monitor_history_foreach(device, start, end, MONITOR_HISTORY_BATCH,
+                                     sample_array_append, &array);
+    if (rc != 0) {
+        free(array.items);
+        *samples = NULL;
+        *count = 0;
+        return rc;
+    }
+
+    *samples = array.items;
+    *count = array.count;
+    return 0;
+}
+
+int monitor_get_rollups(const char *device, time_t start, time_t end, int resolution_s,
+                        performance_rollup_t **rows, int *count) {
+    char sql[512];
+    int tier = -1;
+
+    if (!device || !rows || !count) {
+        return -EINVAL;
+    }
+    if (!db) {
+        return -1;
+    }
+
+    *rows = NULL;
+    *count = 0;
+
+    for (int t = ROLLUP_TIERS - 1; t >= 0; t--) {
+        if (resolution_s >= rollup_resolution[t]) {
+            tier = t;
+            break;
+        }
+    }
+
+    // Sin nivel agregado adecuado: muestras crudas con min = max = avg = p95
+    if (tier < 0) {
+        performance_sample_t *samples = NULL;
+        int n = 0;
+        if (monitor_get_history(device, start, end, &samples, &n) != 0) {
+            return -1;
+        }
+        if (n == 0) {
+            return 0;
+        }
+        *rows = calloc(n, sizeof(performance_rollup_t));
+        if (!*rows) {
+            free(samples);
+            return -ENOMEM;
+        }
+        for (int i = 0; i < n; i++) {
+            performance_rollup_t *r = &(*rows)[i];
+            r->bucket = samples[i].timestamp;
+            r->resolution_s = 0;
+            r->samples = 1;
+            r->iops = (metric_summary_t){ samples[i].iops, samples[i].iops,
+                                          samples[i].iops, samples[i].iops };
+            r->throughput_mbs = (metric_summary_t){ samples[i].throughput_mbs,
+                                                    samples[i].throughput_mbs,
+                                                    samples[i].throughput_mbs,
+                                                    samples[i].throughput_mbs };
+            r->latency_ms = (metric_summary_t){ samples[i].latency_ms, samples[i].latency_ms,
+                                                samples[i].latency_ms, samples[i].latency_ms };
+            r->util_percent = (metric_summary_t){ samples[i].util_percent,
+                                                  samples[i].util_percent,
+                                                  samples[i].util_percent,
+                                                  samples[i].util_percent };
+        }
+        free(samples);
+        *count = n;
+        return 0;
+    }
+
+    flush_pending();
+
+    snprintf(sql, sizeof(sql),
+             "SELECT * FROM %s WHERE device = ? AND bucket BETWEEN ? AND ? "
+             "ORDER BY bucket;", rollup_table[tier]);
+
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        return -1;
+    }
+
+    sqlite3_bind_text(stmt, 1, device_basename(device), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, start - (start % rollup_resolution[tier]));
+    sqlite3_bind_int64(stmt, 3, end);
+
+    int capacity = 0;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            performance_rollup_t *bigger = realloc(*rows, capacity * sizeof(performance_rollup_t));
+            if (!bigger) {
+                sqlite3_finalize(stmt);
+                free(*rows);
+                *rows = NULL;
+                *count = 0;
+                return -ENOMEM;
+            }
+            *rows = bigger;
+        }
+
+        performance_rollup_t *r = &(*rows)[(*count)++];
+        metric_summary_t *metrics[ROLLUP_METRICS] = {
+            &r->iops, &r->throughput_mbs, &r->latency_ms, &r->util_percent
+        };
+        r->bucket = sqlite3_column_int64(stmt, 1);
+        r->resolution_s = rollup_resolution[tier];
+        r->samples = sqlite3_column_int(stmt, 2);
+        for (int m = 0; m < ROLLUP_METRICS; m++) {
+            metrics[m]->min = sqlite3_column_double(stmt, 3 + m * 4);
+            metrics[m]->max = sqlite3_column_double(stmt, 4 + m * 4);
+            metrics[m]->avg = sqlite3_column_double(stmt, 5 + m * 4);
+            metrics[m]->p95 = sqlite3_column_double(stmt, 6 + m * 4);
+        }
+    }
+
+    sqlite3_finalize(stmt);
+    return 0;
+}
+
+/*
+ * Retención de las tablas derivadas en múltiplos de keep_days: los rollups
+ * de 1 minuto sobreviven al crudo y los de 1 hora, igual que las anomalías
+ * (pocas filas), mucho más. Todas tienen índice sobre su columna de tiempo,
+ * así que cada DELETE recorre solo el rango que borra.
+ */
+#define ROLLUP_1M_RETENTION_FACTOR 7
+#define ROLLUP_1H_RETENTION_FACTOR 30
+#define ANOMALY_RETENTION_FACTOR 30
+
+static const struct {
+    const char *table;
+    const char *column;
+    int factor;
+} retention_tables[] = {
+    { "latency_histograms", "bucket", 1 },
+    { "performance_rollup_1m", "bucket", ROLLUP_1M_RETENTION_FACTOR },
+    { "performance_rollup_1h", "bucket", ROLLUP_1H_RETENTION_FACTOR },
+    { "anomaly_events", "timestamp", ANOMALY_RETENTION_FACTOR },
+};
+
+int monitor_cleanup_old_data(int keep_days) {
+    if (!db) {
+        return -1;
+    }
+
+    time_t now = time(NULL);
+    time_t cutoff = now - (time_t)keep_days * SECONDS_PER_DAY;
+    int rc = SQLITE_DONE;
+    int dropped = 0;
+
+    // Solo se borran días completos anteriores al corte: un DROP TABLE por día
+    pthread_mutex_lock(&db_mutex);
+    while (history_ndays > 0 && history_days[0] < history_day(cutoff)) {
+        char name[64];
+        char sql[128];
+
+        if (insert_day == history_days[0]) {
+            history_reset_insert();
+        }
+        history_table_name(history_days[0], name, sizeof(name));
+        snprintf(sql, sizeof(sql), "DROP TABLE IF EXISTS %s;", name);
+        if (sqlite3_exec(db, sql, NULL, NULL, NULL) != SQLITE_OK) {
+            rc = SQLITE_ERROR;
+            break;
+        }
+        memmove(&history_days[0], &history_days[1], (history_ndays - 1) * sizeof(long));
+        history_ndays--;
+        dropped++;
+    }
+
+    // Con db_mutex para no mezclarse con una transacción del writer
+    int tables = sizeof(retention_tables) / sizeof(retention_tables[0]);
+    for (int i = 0; i < tables && rc == SQLITE_DONE; i++) {
+        char sql[128];
+        sqlite3_stmt *stmt;
+
+        snprintf(sql, sizeof(sql), "DELETE FROM %s WHERE %s < ?;",
+                 retention_tables[i].table, retention_tables[i].column);
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+            rc = SQLITE_ERROR;
+            break;
+        }
+        sqlite3_bind_int64(stmt, 1, now - (time_t)keep_days * retention_tables[i].factor *
+                                    SECONDS_PER_DAY);
+        rc = sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+    }
+    pthread_mutex_unlock(&db_mutex);
+
+    // En el backend TSDB la retención borra segmentos completos
+    if (monitor_config.backend == MONITOR_BACKEND_TSDB && tsdb_drop_before(cutoff) < 0) {
+        rc = SQLITE_ERROR;
+    }
+
+    printf("Monitor: Cleaned up data older than %d days (%d daily partitions dropped)\n",
+           keep_days, dropped);
+    return rc == SQLITE_DONE ? 0 : -1;
+}
+
+void monitor_print_stats(const device_stats_t *stats) {
+    printf("\n=== Device Statistics: %s ===\n", stats->device);
+    printf("Read Operations:  %llu\n", stats->reads);
+    printf("Write Operations: %llu\n", stats->writes);
+    printf("Bytes Read:       %llu\n", stats->read_bytes);
+    printf("Bytes Written:    %llu\n", stats->write_bytes);
+    printf("Avg Read Latency: %.3f ms\n", stats->avg_read_latency_ms);
+    printf("Avg Write Latency: %.3f ms\n", stats->avg_write_latency_ms);
+    printf("Queue Depth:      %d\n", stats->queue_depth);
+    printf("Last Update:      %s", ctime(&stats->last_update));
+}
+
+void monitor_print_performance(const performance_sample_t *sample) {
+    printf("\n=== Performance Sample ===\n");
+    printf("Timestamp:      %s", ctime(&sample->timestamp));
+    printf("IOPS:           %.2f\n", sample->iops);
+    printf("Throughput:     %.2f MB/s\n", sample->throughput_mbs);
+    printf("Avg Latency:    %.3f ms\n", sample->latency_ms);
+    printf("Read Await:     %.3f ms\n", sample->read_latency_ms);
+    printf("Write Await:    %.3f ms\n", sample->write_latency_ms);
+    printf("Utilization:    %.2f%%\n", sample->util_percent);
+    printf("Avg Queue Size: %.2f\n", sample->avg_queue_size);
+    printf("Active Requests: %d\n", sample->active_requests);
+}
+
+/*
+ * Muestreo adaptativo por presión de I/O (PSI).
+ *
+ * Se registra un trigger en /proc/pressure/io ("some <stall us> <ventana us>")
+ * y su fd entra en el poll() del tick con POLLPRI: cuando el kernel avisa,
+ * el timerfd pasa a psi_fast_interval_ms. Tras psi_hold_ms sin avisos el
+ * intervalo se duplica cada PSI_DECAY_STEP_MS hasta volver al base. Si el
+ * kernel no acepta triggers (sin privilegios o sin soporte) se compara en
+ * cada tick el total=... acumulado con el mismo umbral.
+ */
+typedef struct {
+    int fd;
+    int trigger;                    // el kernel notifica con POLLPRI
+    int full;                       // línea "full" en vez de "some"
+    uint64_t threshold_us;
+    uint64_t window_us;
+    uint64_t last_total_us;         // modo sondeo
+    uint64_t last_total_ns;
+    uint64_t last_event_ns;         // último aviso de presión
+    uint64_t last_step_ns;          // último paso de vuelta al intervalo base
+    int interval_ms;                // intervalo programado en el timerfd
+} psi_state_t;
+
+// Programa el intervalo, nunca por debajo del mínimo del presupuesto de CPU
+static int set_tick_interval(int timer_fd, int interval_ms) {
+    interval_ms = MAX(interval_ms, tick_floor_ms);
+    if (timer_fd < 0) {
+        atomic_store_explicit(&monitor_effective_ms, interval_ms, memory_order_relaxed);
+        return 0;
+    }
+
+    struct itimerspec its;
+    its.it_interval.tv_sec = interval_ms / 1000;
+    its.it_interval.tv_nsec = (long)(interval_ms % 1000) * 1000000L;
+    its.it_value = its.it_interval;
+    if (timerfd_settime(timer_fd, 0, &its, NULL) != 0) {
+        return -1;
+    }
+    atomic_store_explicit(&monitor_effective_ms, interval_ms, memory_order_relaxed);
+    return 0;
+}
+
+// Stall acumulado (us) de la línea some/full de /proc/pressure/io
+static int psi_read_total(psi_state_t *psi, uint64_t *total_us) {
+    char buf[256];
+    ssize_t n = pread(psi->fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) {
+        return -1;
+    }
+    buf[n] = '\0';
+
+    const char *line = psi->full ? strstr(buf, "full ") : buf;
+    const char *total = line ? strstr(line, "total=") : NULL;
+    if (!total) {
+        return -1;
+    }
+    *total_us = strtoull(total + 6, NULL, 10);
+    return 0;
+}
+
+static void psi_open(psi_state_t *psi, int timer_fd) {
+    memset(psi, 0, sizeof(*psi));
+    psi->fd = -1;
+    psi->interval_ms = monitor_interval_ms;
+
+    const char *spec = monitor_config.psi_trigger;
+    char kind[8];
+    unsigned long long threshold, window;
+    if (timer_fd < 0 || spec[0] == '\0' ||
+        monitor_config.psi_fast_interval_ms >= monitor_interval_ms ||
+        sscanf(spec, "%7s %llu %llu", kind, &threshold, &window) != 3 ||
+        (strcmp(kind, "some") != 0 && strcmp(kind, "full") != 0) ||
+        threshold == 0 || threshold >= window) {
+        return;
+    }
+    psi->full = kind[0] == 'f';
+    psi->threshold_us = threshold;
+    psi->window_us = window;
+
+    psi->fd = open(PSI_PATH, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (psi->fd >= 0 && write(psi->fd, spec, strlen(spec) + 1) > 0) {
+        psi->trigger = 1;
+        return;
+    }
+    if (psi->fd >= 0) {
+        close(psi->fd);
+    }
+
+    psi->fd = open(PSI_PATH, O_RDONLY | O_CLOEXEC);
+    if (psi->fd >= 0 && psi_read_total(psi, &psi->last_total_us) == 0) {
+        psi->last_total_ns = monotonic_ns();
+        return;
+    }
+    if (psi->fd >= 0) {
+        close(psi->fd);
+        psi->fd = -1;
+    }
+}
+
+static void psi_close(psi_state_t *psi) {
+    if (psi->fd >= 0) {
+        close(psi->fd);
+        psi->fd = -1;
+    }
+}
+
+// Aviso de presión: intervalo rápido y reinicio del tiempo de espera
+static void psi_boost(psi_state_t *psi, int timer_fd, uint64_t now) {
+    psi->last_event_ns = now;
+    if (psi->interval_ms == monitor_config.psi_fast_interval_ms) {
+        return;
+    }
+    if (set_tick_interval(timer_fd, monitor_config.psi_fast_interval_ms) == 0) {
+        psi->interval_ms = monitor_config.psi_fast_interval_ms;
+        printf("Monitor: I/O pressure detected, sampling every %d ms\n",
+               monitor_get_interval_ms());
+    }
+}
+
+// Llamada una vez por tick: sondeo (si no hay trigger) y vuelta gradual
+static void psi_tick(psi_state_t *psi, int timer_fd) {
+    if (psi->fd < 0) {
+        return;
+    }
+    uint64_t now = monotonic_ns();
+
+    if (!psi->trigger) {
+        uint64_t total;
+        if (psi_read_total(psi, &total) == 0) {
+            uint64_t elapsed_us = (now - psi->last_total_ns) / 1000;
+            // Stall del último tick escalado a la ventana del trigger
+            if (elapsed_us > 0 && total > psi->last_total_us &&
+                (total - psi->last_total_us) * psi->window_us >= psi->threshold_us * elapsed_us) {
+                psi_boost(psi, timer_fd, now);
+            }
+            psi->last_total_us = total;
+            psi->last_total_ns = now;
+        }
+    }
+
+    if (psi->interval_ms >= monitor_interval_ms ||
+        now - psi->last_event_ns < (uint64_t)monitor_config.psi_hold_ms * 1000000ULL ||
+        now - psi->last_step_ns < PSI_DECAY_STEP_MS * 1000000ULL) {
+        return;
+    }
+    int interval = MIN(psi->interval_ms * 2, monitor_interval_ms);
+    if (set_tick_interval(timer_fd, interval) == 0) {
+        psi->interval_ms = interval;
+        psi->last_step_ns = now;
+        if (interval == monitor_interval_ms) {
+            printf("Monitor: I/O pressure cleared, sampling every %d ms\n", interval);
+        }
+    }
+}
+
+/*
+ * Presupuesto de CPU. Cada tick suma su CPU de thread (más la del writer,
+ * que flush_pending acumula) y cada BUDGET_WINDOW_MS se compara con el
+ * tiempo real. Si supera overhead_budget_percent se fija un intervalo
+ * mínimo proporcional al exceso; con menos de un cuarto del presupuesto
+ * ese mínimo se va relajando a la mitad.
+ */
+typedef struct {
+    uint64_t window_start_ns;
+    double window_cpu_ms;
+} overhead_state_t;
+
+static void overhead_tick(overhead_state_t *ov, int timer_fd, const psi_state_t *psi,
+                          uint64_t tick_cpu_ns, uint64_t parse_ns) {
+    uint64_t now = monotonic_ns();
+    double budget = monitor_config.overhead_budget_percent;
+    int changed = 0;
+
+    pthread_mutex_lock(&queue_mutex);
+    unsigned long long dropped = samples_dropped;
+    pthread_mutex_unlock(&queue_mutex);
+
+    pthread_mutex_lock(&self_mutex);
+    self_stats.ticks++;
+    self_stats.cpu_ms += tick_cpu_ns / 1e6;
+    self_stats.tick_cpu_us = tick_cpu_ns / 1e3;
+    self_stats.parse_us = parse_ns / 1e3;
+    self_stats.samples_dropped = dropped;
+
+    if (ov->window_start_ns == 0) {
+        ov->window_start_ns = now;
+        ov->window_cpu_ms = self_stats.cpu_ms;
+    } else if (now - ov->window_start_ns >= BUDGET_WINDOW_MS * 1000000ULL) {
+        double wall_ms = (now - ov->window_start_ns) / 1e6;
+        double pct = (self_stats.cpu_ms - ov->window_cpu_ms) / wall_ms * 100.0;
+        int current = monitor_get_interval_ms();
+
+        self_stats.cpu_percent = pct;
+        ov->window_start_ns = now;
+        ov->window_cpu_ms = self_stats.cpu_ms;
+
+        if (budget > 0 && pct > budget && current < BUDGET_MAX_INTERVAL_MS) {
+            // El coste escala con la frecuencia: margen del 20% bajo el presupuesto
+            tick_floor_ms = (int)MIN(ceil(current * pct / (budget * 0.8)),
+                                     (double)BUDGET_MAX_INTERVAL_MS);
+            changed = 1;
+        } else if (tick_floor_ms > 0 && (budget == 0 || pct < budget / 4)) {
+            tick_floor_ms /= 2;
+            if (budget == 0 || tick_floor_ms <= psi->interval_ms) {
+                tick_floor_ms = 0;
+            }
+            changed = 1;
+        }
+        self_stats.budget_floor_ms = tick_floor_ms;
+    }
+    pthread_mutex_unlock(&self_mutex);
+
+    if (changed) {
+        set_tick_interval(timer_fd, psi->interval_ms);
+        if (tick_floor_ms > 0) {
+            printf("Monitor: overhead above %.2f%% CPU budget, sampling every %d ms\n",
+                   budget, monitor_get_interval_ms());
+        } else {
+            printf("Monitor: overhead within budget, sampling every %d ms\n",
+                   monitor_get_interval_ms());
+        }
+    }
+}
+
+// Retraso del tick que acaba de vencer respecto a su expiración
+static void overhead_lateness(int timer_fd, uint64_t expirations, const struct timespec *next) {
+    double interval_ms = monitor_get_interval_ms();
+    double late_ms;
+
+    if (timer_fd >= 0) {
+        struct itimerspec cur;
+        if (timerfd_gettime(timer_fd, &cur) != 0) {
+            return;
+        }
+        double remaining_ms = cur.it_value.tv_sec * 1e3 + cur.it_value.tv_nsec / 1e6;
+        late_ms = (expirations - 1) * interval_ms + MAX(interval_ms - remaining_ms, 0.0);
+    } else {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        late_ms = (now.tv_sec - next->tv_sec) * 1e3 + (now.tv_nsec - next->tv_nsec) / 1e6;
+    }
+
+    pthread_mutex_lock(&self_mutex);
+    self_stats.missed_ticks += expirations - 1;
+    self_stats.lateness_ms = late_ms;
+    self_stats.max_lateness_ms = MAX(self_stats.max_lateness_ms, late_ms);
+    pthread_mutex_unlock(&self_mutex);
+}
+
+int monitor_get_self_stats(monitor_self_stats_t *stats) {
+    if (!stats) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&queue_mutex);
+    unsigned long long dropped = samples_dropped;
+    pthread_mutex_unlock(&queue_mutex);
+
+    pthread_mutex_lock(&self_mutex);
+    *stats = self_stats;
+    pthread_mutex_unlock(&self_mutex);
+    stats->samples_dropped = dropped;
+    stats->interval_ms = monitor_get_interval_ms();
+    return 0;
+}
+
+// Espera al siguiente tick o a una petición de parada. Con timerfd los
+// ticks son periódicos respecto a CLOCK_MONOTONIC, así que no hay deriva.
+// Los avisos del trigger PSI se atienden aquí sin interrumpir la espera.
+// Devuelve los ticks vencidos (>1 si el thread se retrasó) o 0 para parar.
+static uint64_t wait_tick(int timer_fd, struct timespec *next, psi_state_t *psi) {
+    if (timer_fd < 0) {
+        // Sin timerfd: sueño absoluto, igualmente sin deriva
+        int interval_ms = monitor_get_interval_ms();
+        next->tv_sec += interval_ms / 1000;
+        next->tv_nsec += (long)(interval_ms % 1000) * 1000000L;
+        if (next->tv_nsec >= 1000000000L) {
+            next->tv_sec++;
+            next->tv_nsec -= 1000000000L;
+        }
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, next, NULL) == EINTR) {
+        }
+        return monitoring_active ? 1 : 0;
+    }
+
+    struct pollfd fds[3] = {
+        { .fd = timer_fd, .events = POLLIN },
+        { .fd = monitor_wake_fd, .events = POLLIN },
+        { .fd = psi->trigger ? psi->fd : -1, .events = POLLPRI },
+    };
+
+    while (monitoring_active) {
+        if (poll(fds, 3, -1) < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        if (fds[1].revents & POLLIN) {
+            return 0;
+        }
+        if (fds[2].revents & POLLERR) {
+            // El trigger ya no es válido: seguir con el intervalo actual
+            psi_close(psi);
+            fds[2].fd = -1;
+        } else if (fds[2].revents & POLLPRI) {
+            psi_boost(psi, timer_fd, monotonic_ns());
+        }
+        if (fds[0].revents & POLLIN) {
+            uint64_t expirations = 0;
+            if (read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                return expirations;
+            }
+        }
+    }
+    return 0;
+}
+
+void* monitor_thread_func(void *arg) {
+    (void)arg;
+    struct timespec next;
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    tick_floor_ms = 0;
+    atomic_store_explicit(&monitor_effective_ms, monitor_interval_ms, memory_order_relaxed);
+    if (timer_fd >= 0 && set_tick_interval(timer_fd, monitor_interval_ms) != 0) {
+        close(timer_fd);
+        timer_fd = -1;
+    }
+
+    psi_state_t psi;
+    psi_open(&psi, timer_fd);
+    overhead_state_t overhead = { 0, 0 };
+
+    // Lista configurada y lista descubierta (modo "todos") por separado
+    char configured[MONITOR_MAX_DEVICES][64];
+    char discovered[MONITOR_MAX_DEVICES][64];
+    const char *names[MONITOR_MAX_DEVICES];
+    device_stats_t stats[MONITOR_MAX_DEVICES];
+    performance_sample_t samples[MONITOR_MAX_DEVICES];
+    int ready[MONITOR_MAX_DEVICES];
+    unsigned int gen = 0;
+    int loaded = 0;
+    int configured_count = 0;
+    int discovered_count = -1;          // -1: sin listar
+    int discovered_lines = 0;
+    unsigned int relist_ticks = 0;
+    uint64_t proc_io_last = 0;
+
+    while (monitoring_active) {
+        uint64_t tick_cpu = thread_cpu_ns();
+
+        // Recargar el conjunto de dispositivos si cambió
+        pthread_mutex_lock(&monitor_mutex);
+        if (!loaded || gen != sample_devices_gen) {
+            configured_count = sample_device_count;
+            memcpy(configured, sample_devices, sizeof(configured));
+            gen = sample_devices_gen;
+            loaded = 1;
+        }
+        pthread_mutex_unlock(&monitor_mutex);
+
+        // Sin lista configurada se relista al cambiar el número de líneas de
+        // /proc/diskstats y cada DEVICE_RELIST_TICKS (un disco sustituido)
+        int count = configured_count;
+        char (*names_buf)[64] = configured;
+        if (count == 0) {
+            if (discovered_count < 0 || ++relist_ticks >= DEVICE_RELIST_TICKS ||
+                diskstats_line_count() != discovered_lines) {
+                discovered_count = diskstats_list_devices(discovered, MONITOR_MAX_DEVICES);
+                discovered_lines = diskstats_line_count();
+                relist_ticks = 0;
+            }
+            count = discovered_count > 0 ? discovered_count : 0;
+            names_buf = discovered;
+        }
+        for (int i = 0; i < count; i++) {
+            names[i] = names_buf[i];
+        }
+
+        uint64_t parse_start = monotonic_ns();
+        int sampled = count > 0 ? monitor_sample_devices(names, count, stats) : 0;
+        uint64_t parse_ns = monotonic_ns() - parse_start;
+
+        if (sampled > 0) {
+            // Publicar todas las lecturas del tick con una sola toma del lock
+            pthread_mutex_lock(&state_write_mutex);
+            for (int i = 0; i < count; i++) {
+                ready[i] = 0;
+                if (stats[i].last_update == 0) {
+                    continue;
+                }
+
+                device_state_t *slot = state_insert(device_basename(names[i]));
+                if (!slot) {
+                    continue;
+                }
+
+                if (slot->curr.mono_ns != 0) {
+                    compute_sample(&slot->curr, &stats[i], &samples[i]);
+                    lat_record_interval(&slot->curr, &stats[i]);
+                    ready[i] = 1;
+                }
+                state_push(slot, &stats[i]);
+            }
+            pthread_mutex_unlock(&state_write_mutex);
+
+            pthread_mutex_lock(&monitor_mutex);
+            monitor_sample_hook on_sample = sample_hook;
+            void *on_sample_arg = sample_hook_arg;
+            pthread_mutex_unlock(&monitor_mutex);
+
+            for (int i = 0; i < count; i++) {
+                if (ready[i]) {
+                    monitor_observe_sample(stats[i].device, &samples[i]);
+                    monitor_save_sample(stats[i].device, &samples[i]);
+                    if (on_sample) {
+                        on_sample(stats[i].device, &samples[i], on_sample_arg);
+                    }
+                }
+            }
+        }
+
+        // El barrido de /proc es más caro que diskstats: como mucho uno por segundo
+        if (monitor_config.process_top_n > 0 &&
+            monotonic_ns() - proc_io_last >= PROC_IO_MIN_INTERVAL_MS * 1000000ULL) {
+            monitor_update_process_io();
+            proc_io_last = monotonic_ns();
+        }
+
+        pthread_mutex_lock(&monitor_mutex);
+        monitor_tick_hook hook = tick_hook;
+        void *hook_arg = tick_hook_arg;
+        pthread_mutex_unlock(&monitor_mutex);
+        if (hook) {
+            hook(hook_arg);
+        }
+
+        psi_tick(&psi, timer_fd);
+        overhead_tick(&overhead, timer_fd, &psi, thread_cpu_ns() - tick_cpu, parse_ns);
+
+        uint64_t expirations = wait_tick(timer_fd, &next, &psi);
+        if (expirations == 0) {
+            break;
+        }
+        overhead_lateness(timer_fd, expirations, &next);
+    }
+
+    psi_close(&psi);
+    if (timer_fd >= 0) {
+        close(timer_fd);
+    }
+    atomic_store_explicit(&monitor_effective_ms, 0, memory_order_relaxed);
+    return NULL;
+}
+
+void monitor_set_tick_hook(monitor_tick_hook hook, void *arg) {
+    pthread_mutex_lock(&monitor_mutex);
+    tick_hook = hook;
+    tick_hook_arg = arg;
+    pthread_mutex_unlock(&monitor_mutex);
+}
+
+void monitor_set_sample_hook(monitor_sample_hook hook, void *arg) {
+    pthread_mutex_lock(&monitor_mutex);
+    sample_hook = hook;
+    sample_hook_arg = arg;
+    pthread_mutex_unlock(&monitor_mutex);
+}
+
+int monitor_start_continuous(int interval_seconds) {
+    if (interval_seconds <= 0) {
+        return -EINVAL;
+    }
+    return monitor_start_continuous_ms(interval_seconds * 1000);
+}
+
+int monitor_start_continuous_ms(int interval_ms) {
+    if (interval_ms < MIN_INTERVAL_MS) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&monitor_mutex);
+
+    if (monitoring_active) {
+        pthread_mutex_unlock(&monitor_mutex);
+        return -1;
+    }
+
+    monitor_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (monitor_wake_fd < 0) {
+        pthread_mutex_unlock(&monitor_mutex);
+        return -1;
+    }
+
+    monitoring_active = 1;
+    monitor_interval_ms = interval_ms;
+    int device_count = sample_device_count;
+
+    if (pthread_create(&monitor_thread, NULL, monitor_thread_func, NULL) != 0) {
+        monitoring_active = 0;
+        close(monitor_wake_fd);
+        monitor_wake_fd = -1;
+        pthread_mutex_unlock(&monitor_mutex);
+        return -1;
+    }
+
+    pthread_mutex_unlock(&monitor_mutex);
+    if (device_count > 0) {
+        printf("Monitor: Started continuous monitoring of %d devices (interval: %d ms)\n",
+               device_count, interval_ms);
+    } else {
+        printf("Monitor: Started continuous monitoring of all devices (interval: %d ms)\n",
+               interval_ms);
+    }
+    return 0;
+}
+
+int monitor_get_interval_ms(void) {
+    return atomic_load_explicit(&monitor_effective_ms, memory_order_relaxed);
+}
+
+int monitor_stop_continuous(void) {
+    pthread_mutex_lock(&monitor_mutex);
+    monitoring_active = 0;
+    if (monitor_wake_fd >= 0) {
+        uint64_t one = 1;
+        if (write(monitor_wake_fd, &one, sizeof(one)) < 0) {
+            // El thread saldrá en el siguiente tick
+        }
+    }
+    pthread_mutex_unlock(&monitor_mutex);
+
+    if (monitor_thread) {
         pthread_join(monitor_thread, NULL);
         monitor_thread = 0;
     }
 
+    if (monitor_wake_fd >= 0) {
+        close(monitor_wake_fd);
+        monitor_wake_fd = -1;
+    }
+
     printf("Monitor: Stopped continuous monitoring\n");
     return 0;
 }
 
-int monitor_generate_report(const char *output_file, time_t start, time_t end) {
-    (void)start;
-    (void)end;
-    FILE *fp = fopen(output_file, "w");
-    if (!fp) {
+/*
+ * Reportes: una sola pasada sobre el histórico de todos los dispositivos
+ * del rango. Cada dispositivo acumula min/max/suma, un histograma
+ * log-lineal por métrica (los mismos bins que las latencias, con valores
+ * en milésimas) para los percentiles y los MONITOR_REPORT_TOP_INTERVALS
+ * intervalos de mayor %util, así que la memoria no depende del número de
+ * filas del rango.
+ */
+#define REPORT_METRICS 4
+
+static const char *const report_metric_names[REPORT_METRICS] = {
+    "iops", "throughput_mbs", "latency_ms", "util_percent"
+};
+
+typedef struct {
+    char device[64];
+    uint64_t samples;
+    uint64_t busy_samples;              // %util >= MONITOR_REPORT_BUSY_UTIL
+    time_t first;
+    time_t last;
+    double min[REPORT_METRICS];
+    double max[REPORT_METRICS];
+    double sum[REPORT_METRICS];
+    uint32_t bins[REPORT_METRICS][LAT_BINS];
+    performance_sample_t top[MONITOR_REPORT_TOP_INTERVALS];
+    int top_count;
+} report_device_t;
+
+// Sin tope de dispositivos: el histórico puede guardar más de los que
+// el sampler sigue a la vez (MONITOR_MAX_DEVICES)
+typedef struct {
+    report_device_t **devices;
+    int count;
+    int cap;
+    int last;                           // último dispositivo usado
+    int nomem;                          // alguna muestra se perdió por falta de memoria
+    uint64_t rows;
+} report_t;
+
+static report_device_t *report_device(report_t *r, const char *device) {
+    if (r->count > 0 && strcmp(r->devices[r->last]->device, device) == 0) {
+        return r->devices[r->last];
+    }
+    for (int i = 0; i < r->count; i++) {
+        if (strcmp(r->devices[i]->device, device) == 0) {
+            r->last = i;
+            return r->devices[i];
+        }
+    }
+    if (r->count == r->cap) {
+        int grown = r->cap ? r->cap * 2 : MONITOR_MAX_DEVICES;
+        report_device_t **tmp = realloc(r->devices, grown * sizeof(report_device_t*));
+        if (!tmp) {
+            return NULL;
+        }
+        r->devices = tmp;
+        r->cap = grown;
+    }
+
+    report_device_t *d = calloc(1, sizeof(report_device_t));
+    if (!d) {
+        return NULL;
+    }
+    strncpy(d->device, device, sizeof(d->device) - 1);
+    r->last = r->count;
+    r->devices[r->count++] = d;
+    return d;
+}
+
+static void report_add(report_t *r, const char *device, const performance_sample_t *s) {
+    report_device_t *d = report_device(r, device);
+    if (!d) {
+        r->nomem = 1;
+        return;
+    }
+
+    double values[REPORT_METRICS] = {
+        s->iops, s->throughput_mbs, s->latency_ms, s->util_percent
+    };
+    for (int m = 0; m < REPORT_METRICS; m++) {
+        double v = values[m] > 0.0 ? values[m] : 0.0;
+        if (d->samples == 0 || v < d->min[m]) d->min[m] = v;
+        if (d->samples == 0 || v > d->max[m]) d->max[m] = v;
+        d->sum[m] += v;
+        d->bins[m][lat_bin((uint64_t)llround(v * 1000.0))]++;
+    }
+
+    if (d->samples == 0 || s->timestamp < d->first) d->first = s->timestamp;
+    if (s->timestamp > d->last) d->last = s->timestamp;
+    if (s->util_percent >= MONITOR_REPORT_BUSY_UTIL) {
+        d->busy_samples++;
+    }
+    d->samples++;
+    r->rows++;
+
+    // Top por %util: K es pequeño, basta con reemplazar el mínimo
+    if (d->top_count < MONITOR_REPORT_TOP_INTERVALS) {
+        d->top[d->top_count++] = *s;
+    } else {
+        int lowest = 0;
+        for (int i = 1; i < d->top_count; i++) {
+            if (d->top[i].util_percent < d->top[lowest].util_percent) {
+                lowest = i;
+            }
+        }
+        if (s->util_percent > d->top[lowest].util_percent) {
+            d->top[lowest] = *s;
+        }
+    }
+}
+
+static double report_quantile(const uint32_t *bins, uint64_t total, double q) {
+    uint64_t target = (uint64_t)ceil(q * total);
+    uint64_t seen = 0;
+
+    for (int b = 0; b < LAT_BINS; b++) {
+        seen += bins[b];
+        if (bins[b] != 0 && seen >= target) {
+            uint64_t low, high;
+            lat_bin_range(b, &low, &high);
+            return (low + high) / 2.0 / 1000.0;
+        }
+    }
+    return 0.0;
+}
+
+static int report_scan_sqlite(report_t *r, time_t start, time_t end) {
+    long *days;
+    int ndays = history_partitions(start, end, &days);
+    int rc = SQLITE_DONE;
+
+    if (ndays < 0) {
+        return -1;
+    }
+
+    // Sin ORDER BY: los acumuladores no dependen del orden de las filas
+    for (int d = 0; d < ndays && rc == SQLITE_DONE; d++) {
+        char name[64];
+        char sql[512];
+        sqlite3_stmt *stmt;
+
+        history_table_name(days[d], name, sizeof(name));
+        snprintf(sql, sizeof(sql), "SELECT device, " HISTORY_COLUMNS " FROM %s "
+                 "WHERE timestamp BETWEEN ? AND ?;", name);
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+            continue;
+        }
+        sqlite3_bind_int64(stmt, 1, start);
+        sqlite3_bind_int64(stmt, 2, end);
+
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            performance_sample_t s;
+            const char *device = (const char*)sqlite3_column_text(stmt, 0);
+            if (!device) {
+                continue;
+            }
+            history_read_row(stmt, 1, &s);
+            report_add(r, device, &s);
+        }
+        sqlite3_finalize(stmt);
+    }
+    free(days);
+
+    return rc == SQLITE_DONE ? 0 : -1;
+}
+
+static int report_scan_tsdb(report_t *r, time_t start, time_t end) {
+    char (*names)[64] = NULL;
+    performance_sample_t batch[MONITOR_HISTORY_BATCH];
+    int max = MONITOR_MAX_DEVICES / 2;
+    int count;
+
+    // La lista se corta en max: crecer hasta que quepan todos
+    do {
+        max *= 2;
+        char (*tmp)[64] = realloc(names, max * sizeof(*names));
+        if (!tmp) {
+            free(names);
+            return -ENOMEM;
+        }
+        names = tmp;
+        count = tsdb_list_devices(names, max);
+    } while (count == max);
+
+    if (count < 0) {
+        free(names);
         return -1;
     }
-    fprintf(fp, "Storage Monitoring Report\n%s", ctime(&(time_t){time(NULL)}));
-    fclose(fp);
+    for (int i = 0; i < count; i++) {
+        tsdb_iter_t *iter;
+        int n;
+
+        if (tsdb_iter_open(names[i], start, end, &iter) != 0) {
+            continue;
+        }
+        while ((n = tsdb_iter_next(iter, batch, MONITOR_HISTORY_BATCH)) > 0) {
+            for (int k = 0; k < n; k++) {
+                report_add(r, names[i], &batch[k]);
+            }
+        }
+        tsdb_iter_close(iter);
+    }
+    free(names);
     return 0;
 }
 
+static int report_device_cmp(const void *a, const void *b) {
+    return strcmp((*(report_device_t *const *)a)->device,
+                  (*(report_device_t *const *)b)->device);
+}
+
+static int report_top_cmp(const void *a, const void *b) {
+    double x = ((const performance_sample_t*)a)->util_percent;
+    double y = ((const performance_sample_t*)b)->util_percent;
+    return x < y ? 1 : (x > y ? -1 : 0);
+}
+
+static void report_format_time(time_t t, char *buf, size_t size) {
+    struct tm tm;
+    localtime_r(&t, &tm);
+    strftime(buf, size, "%Y-%m-%d %H:%M:%S", &tm);
+}
+
+static void report_write_text(FILE *fp, const report_t *r, time_t start, time_t end) {
+    char from[32], to[32], when[32];
+
+    report_format_time(start, from, sizeof(from));
+    report_format_time(end, to, sizeof(to));
+    fprintf(fp, "Storage Monitoring Report\n");
+    fprintf(fp, "Range: %s - %s\n", from, to);
+    fprintf(fp, "Devices: %d  Samples: %llu\n", r->count, (unsigned long long)r->rows);
+
+    for (int i = 0; i < r->count; i++) {
+        const report_device_t *d = r->devices[i];
+
+        fprintf(fp, "\n== %s (%llu samples, %.1f%% busy) ==\n", d->device,
+                (unsigned long long)d->samples,
+                100.0 * d->busy_samples / d->samples);
+        fprintf(fp, "%-16s %12s %12s %12s %12s %12s %12s\n",
+                "metric", "min", "avg", "p50", "p95", "p99", "max");
+        for (int m = 0; m < REPORT_METRICS; m++) {
+            fprintf(fp, "%-16s %12.2f %12.2f %12.2f %12.2f %12.2f %12.2f\n",
+                    report_metric_names[m], d->min[m], d->sum[m] / d->samples,
+                    report_quantile(d->bins[m], d->samples, 0.50),
+                    report_quantile(d->bins[m], d->samples, 0.95),
+                    report_quantile(d->bins[m], d->samples, 0.99), d->max[m]);
+        }
+        fprintf(fp, "Busiest intervals:\n");
+        for (int k = 0; k < d->top_count; k++) {
+            report_format_time(d->top[k].timestamp, when, sizeof(when));
+            fprintf(fp, "  %s  util %6.2f%%  iops %10.2f  %8.2f MB/s  %8.2f ms\n", when,
+                    d->top[k].util_percent, d->top[k].iops, d->top[k].throughput_mbs,
+                    d->top[k].latency_ms);
+        }
+    }
+}
+
+static void report_write_csv(FILE *fp, const report_t *r) {
+    fprintf(fp, "device,metric,samples,min,avg,p50,p95,p99,max,busy_percent\n");
+    for (int i = 0; i < r->count; i++) {
+        const report_device_t *d = r->devices[i];
+        for (int m = 0; m < REPORT_METRICS; m++) {
+            fprintf(fp, "%s,%s,%llu,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.2f\n",
+                    d->device, report_metric_names[m], (unsigned long long)d->samples,
+                    d->min[m], d->sum[m] / d->samples,
+                    report_quantile(d->bins[m], d->samples, 0.50),
+                    report_quantile(d->bins[m], d->samples, 0.95),
+                    report_quantile(d->bins[m], d->samples, 0.99), d->max[m],
+                    100.0 * d->busy_samples / d->samples);
+        }
+    }
+}
+
+static void report_write_json(FILE *fp, const report_t *r, time_t start, time_t end) {
+    fprintf(fp, "{\n  \"start\": %lld,\n  \"end\": %lld,\n  \"samples\": %llu,\n  \"devices\": [",
+            (long long)start, (long long)end, (unsigned long long)r->rows);
+
+    for (int i = 0; i < r->count; i++) {
+        const report_device_t *d = r->devices[i];
+
+        // Los nombres vienen de /proc/diskstats: sin comillas ni escapes
+        fprintf(fp, "%s\n    {\n      \"device\": \"%s\",\n      \"samples\": %llu,\n"
+                "      \"first\": %lld,\n      \"last\": %lld,\n      \"busy_percent\": %.2f,\n",
+                i ? "," : "", d->device, (unsigned long long)d->samples,
+                (long long)d->first, (long long)d->last,
+                100.0 * d->busy_samples / d->samples);
+        for (int m = 0; m < REPORT_METRICS; m++) {
+            fprintf(fp, "      \"%s\": {\"min\": %.4f, \"avg\": %.4f, \"p50\": %.4f, "
+                    "\"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f},\n",
+                    report_metric_names[m], d->min[m], d->sum[m] / d->samples,
+                    report_quantile(d->bins[m], d->samples, 0.50),
+                    report_quantile(d->bins[m], d->samples, 0.95),
+                    report_quantile(d->bins[m], d->samples, 0.99), d->max[m]);
+        }
+        fprintf(fp, "      \"top_intervals\": [");
+        for (int k = 0; k < d->top_count; k++) {
+            fprintf(fp, "%s\n        {\"timestamp\": %lld, \"util_percent\": %.2f, "
+                    "\"iops\": %.2f, \"throughput_mbs\": %.2f, \"latency_ms\": %.2f}",
+                    k ? "," : "", (long long)d->top[k].timestamp, d->top[k].util_percent,
+                    d->top[k].iops, d->top[k].throughput_mbs, d->top[k].latency_ms);
+        }
+        fprintf(fp, "%s]\n    }", d->top_count ? "\n      " : "");
+    }
+    fprintf(fp, "%s]\n}\n", r->count ? "\n  " : "");
+}
+
+int monitor_generate_report_format(const char *output_file, time_t start, time_t end,
+                                   monitor_report_format_t format) {
+    report_t *r;
+    int rc;
+
+    if (!output_file || end < start) {
+        return -EINVAL;
+    }
+    if (!db) {
+        return -1;
+    }
+
+    // Las muestras aún en cola también entran en el reporte
+    flush_pending();
+
+    r = calloc(1, sizeof(report_t));
+    if (!r) {
+        return -ENOMEM;
+    }
+
+    rc = monitor_config.backend == MONITOR_BACKEND_TSDB ?
+         report_scan_tsdb(r, start, end) : report_scan_sqlite(r, start, end);
+    if (rc == 0 && r->nomem) {
+        rc = -ENOMEM;
+    }
+
+    FILE *fp = rc == 0 ? fopen(output_file, "w") : NULL;
+    if (fp) {
+        if (r->count > 0) {
+            qsort(r->devices, r->count, sizeof(report_device_t*), report_device_cmp);
+        }
+        for (int i = 0; i < r->count; i++) {
+            qsort(r->devices[i]->top, r->devices[i]->top_count,
+                  sizeof(performance_sample_t), report_top_cmp);
+        }
+
+        switch (format) {
+        case MONITOR_REPORT_CSV:
+            report_write_csv(fp, r);
+            break;
+        case MONITOR_REPORT_JSON:
+            report_write_json(fp, r, start, end);
+            break;
+        default:
+            report_write_text(fp, r, start, end);
+            break;
+        }
+        rc = fclose(fp) == 0 ? r->count : -1;
+    } else if (rc == 0) {
+        rc = -1;
+    }
+
+    for (int i = 0; i < r->count; i++) {
+        free(r->devices[i]);
+    }
+    free(r->devices);
+    free(r);
+    return rc;
+}
+
+int monitor_generate_report(const char *output_file, time_t start, time_t end) {
+    monitor_report_format_t format = MONITOR_REPORT_TEXT;
+    const char *ext = output_file ? strrchr(output_file, '.') : NULL;
+
+    if (ext && strcasecmp(ext, ".csv") == 0) {
+        format = MONITOR_REPORT_CSV;
+    } else if (ext && strcasecmp(ext, ".json") == 0) {
+        format = MONITOR_REPORT_JSON;
+    }
+    return monitor_generate_report_format(output_file, start, end, format);
+}
+
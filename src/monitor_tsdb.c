@@ -0,0 +1,858 @@
+#include "monitor_tsdb.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define TSDB_MAGIC "SMTS"
+#define TSDB_VERSION 1
+#define TSDB_COLUMNS 9
+// Peor caso: timestamp con 64 bits + 5 de prefijo, cada columna 2+5+6+64
+#define TSDB_MAX_SAMPLE_BITS (69 + TSDB_COLUMNS * 77)
+#define TSDB_DATA_BITS ((uint64_t)(TSDB_SEGMENT_SIZE - TSDB_HEADER_SIZE) * 8)
+
+// Entrada del índice temporal: rango y posición de un bloque
+typedef struct {
+    int64_t min_us;
+    int64_t max_us;
+    uint64_t bit_off;
+    uint32_t count;
+    uint32_t reserved;
+} tsdb_block_t;
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t nblocks;
+    uint32_t reserved;
+    int64_t min_us;
+    int64_t max_us;
+    uint64_t data_bits;
+    uint64_t samples;
+    tsdb_block_t blocks[];
+} tsdb_header_t;
+
+#define TSDB_MAX_BLOCKS ((TSDB_HEADER_SIZE - sizeof(tsdb_header_t)) / sizeof(tsdb_block_t))
+
+// Estado del codificador/decodificador dentro de un bloque
+typedef struct {
+    int64_t prev_us;
+    int64_t prev_delta;
+    uint64_t prev[TSDB_COLUMNS];
+    int lead[TSDB_COLUMNS];     // -1: todavía no hay ventana de bits
+    int trail[TSDB_COLUMNS];
+} tsdb_codec_t;
+
+typedef struct {
+    char device[64];
+    uint32_t seq;
+    int fd;
+    uint8_t *map;
+    tsdb_header_t *hdr;
+    tsdb_codec_t codec;
+    int block_open;             // 0: la próxima muestra abre un bloque nuevo
+} tsdb_series_t;
+
+struct tsdb_iter {
+    char path[PATH_MAX];
+    int64_t start_us;
+    int64_t end_us;
+    uint32_t *seqs;
+    int nseg;
+    int seg;
+    uint8_t *map;
+    uint32_t nblocks;
+    uint32_t block;
+    uint32_t remaining;
+    uint32_t decoded;
+    uint64_t pos;
+    tsdb_codec_t codec;
+};
+
+static char tsdb_dir[256];
+static tsdb_series_t *series[MONITOR_MAX_DEVICES];
+static int series_count = 0;
+static int tsdb_ready = 0;
+static pthread_mutex_t tsdb_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* ---- Bits ---- */
+
+static inline void put_bits(uint8_t *data, uint64_t *pos, uint64_t value, int nbits) {
+    while (nbits > 0) {
+        int off = *pos & 7;
+        int space = 8 - off;
+        int take = nbits < space ? nbits : space;
+        uint8_t bits = (value >> (nbits - take)) & ((1u << take) - 1);
+        data[*pos >> 3] |= bits << (space - take);
+        *pos += take;
+        nbits -= take;
+    }
+}
+
+static inline uint64_t get_bits(const uint8_t *data, uint64_t *pos, int nbits) {
+    uint64_t value = 0;
+    while (nbits > 0) {
+        int off = *pos & 7;
+        int space = 8 - off;
+        int take = nbits < space ? nbits : space;
+        uint8_t bits = (data[*pos >> 3] >> (space - take)) & ((1u << take) - 1);
+        value = (value << take) | bits;
+        *pos += take;
+        nbits -= take;
+    }
+    return value;
+}
+
+/* ---- Codificación de muestras ---- */
+
+static inline uint64_t double_bits(double v) {
+    uint64_t u;
+    memcpy(&u, &v, sizeof(u));
+    return u;
+}
+
+static inline double bits_double(uint64_t u) {
+    double v;
+    memcpy(&v, &u, sizeof(v));
+    return v;
+}
+
+static void sample_columns(const performance_sample_t *s, uint64_t *cols) {
+    cols[0] = double_bits(s->iops);
+    cols[1] = double_bits(s->throughput_mbs);
+    cols[2] = double_bits(s->latency_ms);
+    cols[3] = double_bits(s->read_latency_ms);
+    cols[4] = double_bits(s->write_latency_ms);
+    cols[5] = double_bits(s->util_percent);
+    cols[6] = double_bits(s->avg_queue_size);
+    cols[7] = double_bits(s->interval_s);
+    cols[8] = double_bits((double)s->active_requests);
+}
+
+static void columns_sample(const uint64_t *cols, int64_t ts_us, performance_sample_t *s) {
+    memset(s, 0, sizeof(performance_sample_t));
+    s->timestamp = (time_t)(ts_us / 1000000);
+    s->timestamp_ns = (uint64_t)ts_us * 1000ULL;
+    s->iops = bits_double(cols[0]);
+    s->throughput_mbs = bits_double(cols[1]);
+    s->latency_ms = bits_double(cols[2]);
+    s->read_latency_ms = bits_double(cols[3]);
+    s->write_latency_ms = bits_double(cols[4]);
+    s->util_percent = bits_double(cols[5]);
+    s->avg_queue_size = bits_double(cols[6]);
+    s->interval_s = bits_double(cols[7]);
+    s->active_requests = (int)bits_double(cols[8]);
+}
+
+// Clave temporal en microsegundos; timestamp_ns solo si es coherente con timestamp
+static int64_t sample_key(const performance_sample_t *s) {
+    if (s->timestamp_ns != 0 && (time_t)(s->timestamp_ns / 1000000000ULL) == s->timestamp) {
+        return (int64_t)(s->timestamp_ns / 1000ULL);
+    }
+    return (int64_t)s->timestamp * 1000000LL;
+}
+
+static void codec_reset(tsdb_codec_t *c) {
+    memset(c, 0, sizeof(tsdb_codec_t));
+    for (int i = 0; i < TSDB_COLUMNS; i++) {
+        c->lead[i] = -1;
+    }
+}
+
+static void encode_first(tsdb_codec_t *c, uint8_t *data, uint64_t *pos,
+                         int64_t ts_us, const uint64_t *cols) {
+    codec_reset(c);
+    put_bits(data, pos, (uint64_t)ts_us, 64);
+    for (int i = 0; i < TSDB_COLUMNS; i++) {
+        put_bits(data, pos, cols[i], 64);
+        c->prev[i] = cols[i];
+    }
+    c->prev_us = ts_us;
+}
+
+static void encode_timestamp(tsdb_codec_t *c, uint8_t *data, uint64_t *pos, int64_t ts_us) {
+    int64_t delta = ts_us - c->prev_us;
+    int64_t dod = delta - c->prev_delta;
+
+    if (dod == 0) {
+        put_bits(data, pos, 0x0, 1);
+    } else if (dod >= -63 && dod <= 64) {
+        put_bits(data, pos, 0x2, 2);
+        put_bits(data, pos, (uint64_t)(dod + 63), 7);
+    } else if (dod >= -255 && dod <= 256) {
+        put_bits(data, pos, 0x6, 3);
+        put_bits(data, pos, (uint64_t)(dod + 255), 9);
+    } else if (dod >= -2047 && dod <= 2048) {
+        put_bits(data, pos, 0xE, 4);
+        put_bits(data, pos, (uint64_t)(dod + 2047), 12);
+    } else if (dod >= INT32_MIN && dod <= INT32_MAX) {
+        put_bits(data, pos, 0x1E, 5);
+        put_bits(data, pos, (uint32_t)(int32_t)dod, 32);
+    } else {
+        put_bits(data, pos, 0x1F, 5);
+        put_bits(data, pos, (uint64_t)dod, 64);
+    }
+
+    c->prev_delta = delta;
+    c->prev_us = ts_us;
+}
+
+static void encode_value(tsdb_codec_t *c, int col, uint8_t *data, uint64_t *pos, uint64_t value) {
+    uint64_t x = value ^ c->prev[col];
+    c->prev[col] = value;
+
+    if (x == 0) {
+        put_bits(data, pos, 0, 1);
+        return;
+    }
+    put_bits(data, pos, 1, 1);
+
+    int lead = __builtin_clzll(x);
+    int trail = __builtin_ctzll(x);
+    if (lead > 31) {
+        lead = 31;
+    }
+
+    // Reutilizar la ventana anterior si los bits significativos caben en ella
+    if (c->lead[col] >= 0 && lead >= c->lead[col] && trail >= c->trail[col]) {
+        int sig = 64 - c->lead[col] - c->trail[col];
+        put_bits(data, pos, 0, 1);
+        put_bits(data, pos, x >> c->trail[col], sig);
+        return;
+    }
+
+    int sig = 64 - lead - trail;
+    put_bits(data, pos, 1, 1);
+    put_bits(data, pos, lead, 5);
+    put_bits(data, pos, sig - 1, 6);
+    put_bits(data, pos, x >> trail, sig);
+    c->lead[col] = lead;
+    c->trail[col] = trail;
+}
+
+static void decode_first(tsdb_codec_t *c, const uint8_t *data, uint64_t *pos,
+                         int64_t *ts_us, uint64_t *cols) {
+    codec_reset(c);
+    *ts_us = (int64_t)get_bits(data, pos, 64);
+    for (int i = 0; i < TSDB_COLUMNS; i++) {
+        cols[i] = get_bits(data, pos, 64);
+        c->prev[i] = cols[i];
+    }
+    c->prev_us = *ts_us;
+}
+
+static int64_t decode_timestamp(tsdb_codec_t *c, const uint8_t *data, uint64_t *pos) {
+    int64_t dod;
+
+    if (get_bits(data, pos, 1) == 0) {
+        dod = 0;
+    } else if (get_bits(data, pos, 1) == 0) {
+        dod = (int64_t)get_bits(data, pos, 7) - 63;
+    } else if (get_bits(data, pos, 1) == 0) {
+        dod = (int64_t)get_bits(data, pos, 9) - 255;
+    } else if (get_bits(data, pos, 1) == 0) {
+        dod = (int64_t)get_bits(data, pos, 12) - 2047;
+    } else if (get_bits(data, pos, 1) == 0) {
+        dod = (int32_t)(uint32_t)get_bits(data, pos, 32);
+    } else {
+        dod = (int64_t)get_bits(data, pos, 64);
+    }
+
+    c->prev_delta += dod;
+    c->prev_us += c->prev_delta;
+    return c->prev_us;
+}
+
+static uint64_t decode_value(tsdb_codec_t *c, int col, const uint8_t *data, uint64_t *pos) {
+    if (get_bits(data, pos, 1) == 0) {
+        return c->prev[col];
+    }
+
+    if (get_bits(data, pos, 1) != 0) {
+        c->lead[col] = (int)get_bits(data, pos, 5);
+        int sig = (int)get_bits(data, pos, 6) + 1;
+        c->trail[col] = 64 - c->lead[col] - sig;
+    }
+
+    int sig = 64 - c->lead[col] - c->trail[col];
+    uint64_t x = get_bits(data, pos, sig) << c->trail[col];
+    c->prev[col] ^= x;
+    return c->prev[col];
+}
+
+/* ---- Segmentos ---- */
+
+static int valid_device_name(const char *device) {
+    return device && device[0] != '\0' && device[0] != '.' &&
+           strchr(device, '/') == NULL && strlen(device) < 64;
+}
+
+static int make_dirs(const char *path) {
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s", path);
+
+    for (char *p = tmp + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            if (mkdir(tmp, 0755) != 0 && errno != EEXIST) {
+                return -1;
+            }
+            *p = '/';
+        }
+    }
+    if (mkdir(tmp, 0755) != 0 && errno != EEXIST) {
+        return -1;
+    }
+    return 0;
+}
+
+static void segment_path(char *buf, size_t size, const char *device, uint32_t seq) {
+    snprintf(buf, size, "%s/%s/%08u.seg", tsdb_dir, device, seq);
+}
+
+static int seq_cmp(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return x < y ? -1 : (x > y);
+}
+
+// Secuencias de segmentos de un dispositivo, ordenadas
+static int list_segments(const char *device, uint32_t **seqs) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", tsdb_dir, device);
+
+    *seqs = NULL;
+    DIR *dir = opendir(path);
+    if (!dir) {
+        return 0;
+    }
+
+    int count = 0, capacity = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        uint32_t seq;
+        char suffix[8];
+        if (sscanf(entry->d_name, "%8u.%4s", &seq, suffix) != 2 ||
+            strcmp(suffix, "seg") != 0) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            uint32_t *bigger = realloc(*seqs, capacity * sizeof(uint32_t));
+            if (!bigger) {
+                break;
+            }
+            *seqs = bigger;
+        }
+        (*seqs)[count++] = seq;
+    }
+    closedir(dir);
+
+    qsort(*seqs, count, sizeof(uint32_t), seq_cmp);
+    return count;
+}
+
+static int read_header(const char *path, tsdb_header_t *hdr) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t n = pread(fd, hdr, sizeof(tsdb_header_t), 0);
+    close(fd);
+
+    if (n != (ssize_t)sizeof(tsdb_header_t) || memcmp(hdr->magic, TSDB_MAGIC, 4) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static void series_unmap(tsdb_series_t *s) {
+    if (s->map) {
+        msync(s->map, TSDB_SEGMENT_SIZE, MS_ASYNC);
+        munmap(s->map, TSDB_SEGMENT_SIZE);
+        s->map = NULL;
+        s->hdr = NULL;
+    }
+    if (s->fd >= 0) {
+        close(s->fd);
+        s->fd = -1;
+    }
+}
+
+static int series_map(tsdb_series_t *s, uint32_t seq) {
+    char path[PATH_MAX];
+    struct stat st;
+
+    segment_path(path, sizeof(path), s->device, seq);
+    s->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (s->fd < 0) {
+        return -1;
+    }
+
+    // ftruncate deja el fichero disperso: solo ocupan disco las páginas escritas
+    if (fstat(s->fd, &st) != 0 ||
+        (st.st_size < TSDB_SEGMENT_SIZE && ftruncate(s->fd, TSDB_SEGMENT_SIZE) != 0)) {
+        close(s->fd);
+        s->fd = -1;
+        return -1;
+    }
+
+    s->map = mmap(NULL, TSDB_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+    if (s->map == MAP_FAILED) {
+        s->map = NULL;
+        close(s->fd);
+        s->fd = -1;
+        return -1;
+    }
+    s->hdr = (tsdb_header_t*)s->map;
+    s->seq = seq;
+    s->block_open = 0;
+
+    if (st.st_size == 0 || memcmp(s->hdr->magic, "\0\0\0\0", 4) == 0) {
+        memcpy(s->hdr->magic, TSDB_MAGIC, 4);
+        s->hdr->version = TSDB_VERSION;
+        s->hdr->min_us = INT64_MAX;
+        s->hdr->max_us = INT64_MIN;
+    } else if (memcmp(s->hdr->magic, TSDB_MAGIC, 4) != 0 ||
+               s->hdr->version != TSDB_VERSION ||
+               s->hdr->data_bits > TSDB_DATA_BITS ||
+               s->hdr->nblocks > TSDB_MAX_BLOCKS) {
+        series_unmap(s);
+        return -1;
+    } else {
+        // Tras una caída puede quedar como mucho una muestra a medio escribir
+        uint8_t *data = s->map + TSDB_HEADER_SIZE;
+        uint64_t bits = s->hdr->data_bits;
+        uint64_t byte = bits >> 3;
+        if (bits & 7) {
+            data[byte] &= (uint8_t)(0xFF << (8 - (bits & 7)));
+            byte++;
+        }
+        uint64_t end = byte + TSDB_MAX_SAMPLE_BITS / 8 + 1;
+        if (end > TSDB_DATA_BITS / 8) {
+            end = TSDB_DATA_BITS / 8;
+        }
+        if (byte < end) {
+            memset(data + byte, 0, end - byte);
+        }
+    }
+
+    return 0;
+}
+
+static tsdb_series_t *series_get(const char *device) {
+    for (int i = 0; i < series_count; i++) {
+        if (strcmp(series[i]->device, device) == 0) {
+            return series[i];
+        }
+    }
+    if (series_count >= MONITOR_MAX_DEVICES) {
+        return NULL;
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", tsdb_dir, device);
+    if (make_dirs(path) != 0) {
+        return NULL;
+    }
+
+    tsdb_series_t *s = calloc(1, sizeof(tsdb_series_t));
+    if (!s) {
+        return NULL;
+    }
+    strncpy(s->device, device, sizeof(s->device) - 1);
+    s->fd = -1;
+
+    uint32_t *seqs;
+    int n = list_segments(device, &seqs);
+    uint32_t seq = n > 0 ? seqs[n - 1] : 1;
+    free(seqs);
+
+    if (series_map(s, seq) != 0) {
+        free(s);
+        return NULL;
+    }
+
+    series[series_count++] = s;
+    return s;
+}
+
+/* ---- API ---- */
+
+int tsdb_open(const char *dir) {
+    if (!dir || dir[0] == '\0' || strlen(dir) >= sizeof(tsdb_dir)) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&tsdb_mutex);
+    if (tsdb_ready) {
+        pthread_mutex_unlock(&tsdb_mutex);
+        return 0;
+    }
+    if (make_dirs(dir) != 0) {
+        pthread_mutex_unlock(&tsdb_mutex);
+        return -1;
+    }
+    strncpy(tsdb_dir, dir, sizeof(tsdb_dir) - 1);
+    series_count = 0;
+    tsdb_ready = 1;
+    pthread_mutex_unlock(&tsdb_mutex);
+    return 0;
+}
+
+void tsdb_close(void) {
+    pthread_mutex_lock(&tsdb_mutex);
+    for (int i = 0; i < series_count; i++) {
+        series_unmap(series[i]);
+        free(series[i]);
+        series[i] = NULL;
+    }
+    series_count = 0;
+    tsdb_ready = 0;
+    pthread_mutex_unlock(&tsdb_mutex);
+}
+
+int tsdb_append(const char *device, const performance_sample_t *sample) {
+    uint64_t cols[TSDB_COLUMNS];
+
+    if (!valid_device_name(device) || !sample) {
+        return -EINVAL;
+    }
+
+    int64_t ts_us = sample_key(sample);
+    sample_columns(sample, cols);
+
+    pthread_mutex_lock(&tsdb_mutex);
+    tsdb_series_t *s = tsdb_ready ? series_get(device) : NULL;
+    if (!s) {
+        pthread_mutex_unlock(&tsdb_mutex);
+        return -1;
+    }
+
+    tsdb_header_t *hdr = s->hdr;
+    int new_block = !s->block_open ||
+                    hdr->blocks[hdr->nblocks - 1].count >= TSDB_BLOCK_SAMPLES;
+
+    // Segmento lleno: sellarlo y continuar en el siguiente
+    if ((new_block && hdr->nblocks >= TSDB_MAX_BLOCKS) ||
+        hdr->data_bits + TSDB_MAX_SAMPLE_BITS > TSDB_DATA_BITS) {
+        uint32_t next = s->seq + 1;
+        series_unmap(s);
+        if (series_map(s, next) != 0) {
+            pthread_mutex_unlock(&tsdb_mutex);
+            return -1;
+        }
+        hdr = s->hdr;
+        new_block = 1;
+    }
+
+    uint8_t *data = s->map + TSDB_HEADER_SIZE;
+    uint64_t pos = hdr->data_bits;
+    tsdb_block_t *block;
+
+    if (new_block) {
+        block = &hdr->blocks[hdr->nblocks];
+        block->bit_off = pos;
+        block->min_us = ts_us;
+        block->max_us = ts_us;
+        block->count = 0;
+        encode_first(&s->codec, data, &pos, ts_us, cols);
+        __atomic_store_n(&hdr->nblocks, hdr->nblocks + 1, __ATOMIC_RELEASE);
+        s->block_open = 1;
+    } else {
+        block = &hdr->blocks[hdr->nblocks - 1];
+        encode_timestamp(&s->codec, data, &pos, ts_us);
+        for (int i = 0; i < TSDB_COLUMNS; i++) {
+            encode_value(&s->codec, i, data, &pos, cols[i]);
+        }
+    }
+
+    if (ts_us < block->min_us) block->min_us = ts_us;
+    if (ts_us > block->max_us) block->max_us = ts_us;
+    if (ts_us < hdr->min_us) hdr->min_us = ts_us;
+    if (ts_us > hdr->max_us) hdr->max_us = ts_us;
+    hdr->data_bits = pos;
+    hdr->samples++;
+    // Publicar la muestra a los lectores después de escribir sus bits
+    __atomic_store_n(&block->count, block->count + 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&tsdb_mutex);
+    return 0;
+}
+
+int tsdb_sync(void) {
+    int rc = 0;
+
+    pthread_mutex_lock(&tsdb_mutex);
+    for (int i = 0; i < series_count; i++) {
+        if (series[i]->map && msync(series[i]->map, TSDB_SEGMENT_SIZE, MS_ASYNC) != 0) {
+            rc = -1;
+        }
+    }
+    pthread_mutex_unlock(&tsdb_mutex);
+    return rc;
+}
+
+int tsdb_drop_before(time_t cutoff) {
+    int64_t cutoff_us = (int64_t)cutoff * 1000000LL;
+    int dropped = 0;
+
+    pthread_mutex_lock(&tsdb_mutex);
+    if (!tsdb_ready) {
+        pthread_mutex_unlock(&tsdb_mutex);
+        return -1;
+    }
+
+    DIR *dir = opendir(tsdb_dir);
+    if (!dir) {
+        pthread_mutex_unlock(&tsdb_mutex);
+        return -1;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (!valid_device_name(entry->d_name)) {
+            continue;
+        }
+
+        uint32_t active = 0;
+        for (int i = 0; i < series_count; i++) {
+            if (strcmp(series[i]->device, entry->d_name) == 0) {
+                active = series[i]->seq;
+            }
+        }
+
+        uint32_t *seqs;
+        int n = list_segments(entry->d_name, &seqs);
+        for (int i = 0; i < n; i++) {
+            char path[PATH_MAX];
+            tsdb_header_t hdr;
+
+            if (seqs[i] == active) {
+                continue;
+            }
+            segment_path(path, sizeof(path), entry->d_name, seqs[i]);
+            if (read_header(path, &hdr) == 0 && hdr.samples > 0 &&
+                hdr.max_us < cutoff_us && unlink(path) == 0) {
+                dropped++;
+            }
+        }
+        free(seqs);
+    }
+    closedir(dir);
+
+    pthread_mutex_unlock(&tsdb_mutex);
+    return dropped;
+}
+
+int tsdb_usage(uint64_t *disk_bytes, uint64_t *samples) {
+    uint64_t bytes = 0, total = 0;
+
+    pthread_mutex_lock(&tsdb_mutex);
+    DIR *dir = tsdb_ready ? opendir(tsdb_dir) : NULL;
+    if (!dir) {
+        pthread_mutex_unlock(&tsdb_mutex);
+        return -1;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (!valid_device_name(entry->d_name)) {
+            continue;
+        }
+        uint32_t *seqs;
+        int n = list_segments(entry->d_name, &seqs);
+        for (int i = 0; i < n; i++) {
+            char path[PATH_MAX];
+            struct stat st;
+            tsdb_header_t hdr;
+
+            segment_path(path, sizeof(path), entry->d_name, seqs[i]);
+            if (stat(path, &st) == 0) {
+                bytes += (uint64_t)st.st_blocks * 512;
+            }
+            if (read_header(path, &hdr) == 0) {
+                total += hdr.samples;
+            }
+        }
+        free(seqs);
+    }
+    closedir(dir);
+    pthread_mutex_unlock(&tsdb_mutex);
+
+    if (disk_bytes) *disk_bytes = bytes;
+    if (samples) *samples = total;
+    return 0;
+}
+
+int tsdb_list_devices(char (*names)[64], int max) {
+    int count = 0;
+
+    if (!names || max <= 0) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&tsdb_mutex);
+    DIR *dir = tsdb_ready ? opendir(tsdb_dir) : NULL;
+    if (!dir) {
+        pthread_mutex_unlock(&tsdb_mutex);
+        return -1;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL && count < max) {
+        if (!valid_device_name(entry->d_name) || entry->d_type != DT_DIR) {
+            continue;
+        }
+        strncpy(names[count], entry->d_name, 63);
+        names[count][63] = '\0';
+        count++;
+    }
+    closedir(dir);
+    pthread_mutex_unlock(&tsdb_mutex);
+
+    return count;
+}
+
+int tsdb_iter_open(const char *device, time_t start, time_t end, tsdb_iter_t **iter) {
+    if (!valid_device_name(device) || !iter) {
+        return -EINVAL;
+    }
+    if (!tsdb_ready) {
+        return -1;
+    }
+
+    tsdb_iter_t *it = calloc(1, sizeof(tsdb_iter_t));
+    if (!it) {
+        return -ENOMEM;
+    }
+    snprintf(it->path, sizeof(it->path), "%s/%s", tsdb_dir, device);
+    it->start_us = (int64_t)start * 1000000LL;
+    it->end_us = (int64_t)end * 1000000LL + 999999;
+    it->nseg = list_segments(device, &it->seqs);
+
+    *iter = it;
+    return 0;
+}
+
+static int iter_map_segment(tsdb_iter_t *it) {
+    char path[PATH_MAX + 16];
+    snprintf(path, sizeof(path), "%s/%08u.seg", it->path, it->seqs[it->seg]);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    it->map = mmap(NULL, TSDB_SEGMENT_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (it->map == MAP_FAILED) {
+        it->map = NULL;
+        return -1;
+    }
+
+    const tsdb_header_t *hdr = (const tsdb_header_t*)it->map;
+    if (memcmp(hdr->magic, TSDB_MAGIC, 4) != 0) {
+        munmap(it->map, TSDB_SEGMENT_SIZE);
+        it->map = NULL;
+        return -1;
+    }
+
+    it->nblocks = __atomic_load_n(&hdr->nblocks, __ATOMIC_ACQUIRE);
+    if (it->nblocks > TSDB_MAX_BLOCKS) {
+        it->nblocks = TSDB_MAX_BLOCKS;
+    }
+    it->block = 0;
+    it->remaining = 0;
+
+    // Los segmentos sellados no cambian: se pueden descartar por su rango
+    if (it->seg < it->nseg - 1 &&
+        (hdr->max_us < it->start_us || hdr->min_us > it->end_us)) {
+        it->nblocks = 0;
+    }
+    return 0;
+}
+
+// Avanza al siguiente bloque que se solapa con el rango pedido
+static int iter_next_block(tsdb_iter_t *it) {
+    const tsdb_header_t *hdr = (const tsdb_header_t*)it->map;
+
+    while (it->block < it->nblocks) {
+        const tsdb_block_t *b = &hdr->blocks[it->block++];
+        uint32_t count = __atomic_load_n(&b->count, __ATOMIC_ACQUIRE);
+        if (count == 0 || b->max_us < it->start_us || b->min_us > it->end_us) {
+            continue;
+        }
+        it->remaining = count;
+        it->decoded = 0;
+        it->pos = b->bit_off;
+        return 1;
+    }
+    return 0;
+}
+
+int tsdb_iter_next(tsdb_iter_t *iter, performance_sample_t *out, int max) {
+    int n = 0;
+
+    if (!iter || !out || max <= 0) {
+        return -EINVAL;
+    }
+
+    while (n < max) {
+        if (!iter->map) {
+            if (iter->seg >= iter->nseg) {
+                break;
+            }
+            if (iter_map_segment(iter) != 0) {
+                // Segmento borrado por la retención o corrupto: saltarlo
+                iter->seg++;
+                continue;
+            }
+        }
+
+        if (iter->remaining == 0 && !iter_next_block(iter)) {
+            munmap(iter->map, TSDB_SEGMENT_SIZE);
+            iter->map = NULL;
+            iter->seg++;
+            continue;
+        }
+
+        const uint8_t *data = iter->map + TSDB_HEADER_SIZE;
+        uint64_t cols[TSDB_COLUMNS];
+        int64_t ts_us;
+
+        if (iter->decoded == 0) {
+            decode_first(&iter->codec, data, &iter->pos, &ts_us, cols);
+        } else {
+            ts_us = decode_timestamp(&iter->codec, data, &iter->pos);
+            for (int i = 0; i < TSDB_COLUMNS; i++) {
+                cols[i] = decode_value(&iter->codec, i, data, &iter->pos);
+            }
+        }
+        iter->decoded++;
+        iter->remaining--;
+
+        if (ts_us >= iter->start_us && ts_us <= iter->end_us) {
+            columns_sample(cols, ts_us, &out[n++]);
+        }
+    }
+
+    return n;
+}
+
+void tsdb_iter_close(tsdb_iter_t *iter) {
+    if (!iter) {
+        return;
+    }
+    if (iter->map) {
+        munmap(iter->map, TSDB_SEGMENT_SIZE);
+    }
+    free(iter->seqs);
+    free(iter);
+}
@@ -0,0 +1,650 @@
+#include "mount_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/statvfs.h>
+#include <sys/sysmacros.h>
+
+#define MOUNTINFO_PATH "/proc/self/mountinfo"
+#define MOUNT_WORKERS 4          // workers activos
+#define MOUNT_MAX_WORKERS 16     // incluyendo los bloqueados en un montaje colgado
+
+// Worker del pool; el sweeper lo marca abandoned si supera el timeout
+typedef struct {
+    int abandoned;
+} probe_worker_t;
+
+typedef struct {
+    mount_usage_t info;
+    int queued;
+    probe_worker_t *worker;     // != NULL mientras hay un statvfs en curso
+    uint64_t probe_start_ns;
+} mount_slot_t;
+
+static mount_slot_t *slots = NULL;
+static int slot_count = 0;
+static unsigned int table_gen = 0;
+
+static int *work_queue = NULL;
+static int queue_head = 0;
+static int queue_len = 0;
+static int pending = 0;                 // sondas del barrido actual sin terminar
+static int workers_alive = 0;
+static int workers_stuck = 0;
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+// Un solo barrido o recarga de tabla a la vez
+static pthread_mutex_t sweep_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int mountinfo_fd = -1;
+static char *mountinfo_buf = NULL;
+static size_t mountinfo_buf_size = 0;
+static uint64_t last_sweep_ns = 0;
+static int sweep_interval_ms = MOUNT_CACHE_SWEEP_MS;
+static int probe_timeout_ms = MOUNT_CACHE_TIMEOUT_MS;
+
+static pthread_t sweeper_thread;
+static int sweeper_running = 0;
+static int sweeper_wake_fd = -1;
+static int sweeper_reloading = 0;       // recarga tras un cambio en curso (cache_mutex)
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void mount_cache_configure(int interval_ms, int timeout_ms) {
+    pthread_mutex_lock(&cache_mutex);
+    if (interval_ms > 0) {
+        sweep_interval_ms = interval_ms;
+    }
+    if (timeout_ms > 0) {
+        probe_timeout_ms = timeout_ms;
+    }
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+/*
+ * fork() solo conserva el hilo que lo llama: en el hijo no existen ni el
+ * sweeper ni los workers. Los mutex se toman alrededor del fork para que
+ * el hijo no herede uno bloqueado, y el hijo parte de una caché sin
+ * hilos que mide bajo demanda hasta un nuevo mount_cache_start().
+ */
+static void atfork_prepare(void) {
+    pthread_mutex_lock(&sweep_mutex);
+    pthread_mutex_lock(&cache_mutex);
+}
+
+static void atfork_parent(void) {
+    pthread_mutex_unlock(&cache_mutex);
+    pthread_mutex_unlock(&sweep_mutex);
+}
+
+static void atfork_child(void) {
+    for (int i = 0; i < slot_count; i++) {
+        if (slots[i].queued || slots[i].worker) {
+            slots[i].info.stale = 1;
+        }
+        slots[i].queued = 0;
+        slots[i].worker = NULL;
+    }
+    queue_head = 0;
+    queue_len = 0;
+    pending = 0;
+    workers_alive = 0;
+    workers_stuck = 0;
+    last_sweep_ns = 0;
+    // Las condiciones aún cuentan a los workers del padre como esperando
+    pthread_cond_init(&work_cond, NULL);
+    pthread_cond_init(&done_cond, NULL);
+
+    sweeper_running = 0;
+    sweeper_reloading = 0;
+    if (sweeper_wake_fd >= 0) {
+        close(sweeper_wake_fd);
+        sweeper_wake_fd = -1;
+    }
+    // /proc/self del padre: el hijo lo reabre con su propia vista
+    if (mountinfo_fd >= 0) {
+        close(mountinfo_fd);
+        mountinfo_fd = -1;
+    }
+    atfork_parent();
+}
+
+static void register_atfork(void) {
+    pthread_atfork(atfork_prepare, atfork_parent, atfork_child);
+}
+
+// Copia un campo de mountinfo deshaciendo los escapes octales (\040 = espacio)
+static const char *mountinfo_field(const char *p, const char *end, char *out, size_t size) {
+    size_t n = 0;
+
+    while (p < end && *p == ' ') {
+        p++;
+    }
+    while (p < end && *p != ' ' && *p != '\n') {
+        char c = *p++;
+        if (c == '\\' && end - p >= 3 &&
+            p[0] >= '0' && p[0] <= '3' && p[1] >= '0' && p[1] <= '7' &&
+            p[2] >= '0' && p[2] <= '7') {
+            c = (char)((p[0] - '0') * 64 + (p[1] - '0') * 8 + (p[2] - '0'));
+            p += 3;
+        }
+        if (n + 1 < size) {
+            out[n++] = c;
+        }
+    }
+    if (size > 0) {
+        out[n] = '\0';
+    }
+    return p;
+}
+
+// "36 35 98:0 /mnt1 /mnt2 rw,noatime master:1 - ext3 /dev/root rw,errors=continue"
+static int mountinfo_parse_line(const char *p, const char *end, mount_usage_t *m) {
+    char field[256];
+    unsigned int major = 0, minor = 0;
+
+    memset(m, 0, sizeof(mount_usage_t));
+    p = mountinfo_field(p, end, field, sizeof(field));     // mount id
+    p = mountinfo_field(p, end, field, sizeof(field));     // parent id
+    p = mountinfo_field(p, end, field, sizeof(field));     // major:minor
+    if (sscanf(field, "%u:%u", &major, &minor) != 2) {
+        return -1;
+    }
+    m->dev = makedev(major, minor);
+    p = mountinfo_field(p, end, field, sizeof(field));     // root
+    p = mountinfo_field(p, end, m->mount_point, sizeof(m->mount_point));
+    p = mountinfo_field(p, end, m->options, sizeof(m->options));
+
+    // Campos opcionales hasta el separador "-"
+    do {
+        p = mountinfo_field(p, end, field, sizeof(field));
+    } while (field[0] != '\0' && strcmp(field, "-") != 0);
+    if (field[0] == '\0') {
+        return -1;
+    }
+
+    p = mountinfo_field(p, end, m->fstype, sizeof(m->fstype));
+    mountinfo_field(p, end, m->device, sizeof(m->device));
+    return m->mount_point[0] == '/' ? 0 : -1;
+}
+
+static int mountinfo_read(void) {
+    size_t len = 0;
+    ssize_t n;
+
+    if (mountinfo_buf_size == 0) {
+        mountinfo_buf_size = 16384;
+        mountinfo_buf = malloc(mountinfo_buf_size);
+        if (!mountinfo_buf) {
+            mountinfo_buf_size = 0;
+            return -ENOMEM;
+        }
+    }
+
+    // seq_file: leer desde el principio hasta EOF
+    if (lseek(mountinfo_fd, 0, SEEK_SET) < 0) {
+        return -1;
+    }
+    while ((n = read(mountinfo_fd, mountinfo_buf + len, mountinfo_buf_size - len)) > 0) {
+        len += (size_t)n;
+        if (len == mountinfo_buf_size) {
+            char *bigger = realloc(mountinfo_buf, mountinfo_buf_size * 2);
+            if (!bigger) {
+                return -ENOMEM;
+            }
+            mountinfo_buf = bigger;
+            mountinfo_buf_size *= 2;
+        }
+    }
+    return n < 0 ? -1 : (int)len;
+}
+
+static mount_slot_t *find_slot(mount_slot_t *table, int count, const char *mount_point) {
+    // Con montajes apilados gana el último, que es el visible
+    for (int i = count - 1; i >= 0; i--) {
+        if (strcmp(table[i].info.mount_point, mount_point) == 0) {
+            return &table[i];
+        }
+    }
+    return NULL;
+}
+
+// Relee la tabla de montajes conservando el uso ya medido. Con sweep_mutex.
+static int reload_table(void) {
+    if (mountinfo_fd < 0) {
+        mountinfo_fd = open(MOUNTINFO_PATH, O_RDONLY | O_CLOEXEC);
+        if (mountinfo_fd < 0) {
+            return -1;
+        }
+    }
+
+    int len = mountinfo_read();
+    if (len < 0) {
+        return len;
+    }
+
+    int lines = 0;
+    for (int i = 0; i < len; i++) {
+        if (mountinfo_buf[i] == '\n') {
+            lines++;
+        }
+    }
+
+    mount_slot_t *table = calloc(lines + 1, sizeof(mount_slot_t));
+    int *queue = malloc((lines + 1) * sizeof(int));
+    if (!table || !queue) {
+        free(table);
+        free(queue);
+        return -ENOMEM;
+    }
+
+    int count = 0;
+    const char *p = mountinfo_buf;
+    const char *end = mountinfo_buf + len;
+    while (p < end && count <= lines) {
+        const char *nl = memchr(p, '\n', end - p);
+        const char *line_end = nl ? nl : end;
+        if (mountinfo_parse_line(p, line_end, &table[count].info) == 0) {
+            count++;
+        }
+        p = nl ? nl + 1 : end;
+    }
+
+    pthread_mutex_lock(&cache_mutex);
+    for (int i = 0; i < count; i++) {
+        mount_slot_t *old = find_slot(slots, slot_count, table[i].info.mount_point);
+        if (old && old->info.dev == table[i].info.dev) {
+            mount_usage_t *dst = &table[i].info;
+            dst->total_bytes = old->info.total_bytes;
+            dst->free_bytes = old->info.free_bytes;
+            dst->available_bytes = old->info.available_bytes;
+            dst->total_inodes = old->info.total_inodes;
+            dst->free_inodes = old->info.free_inodes;
+            dst->updated = old->info.updated;
+            dst->stale = old->info.stale;
+        }
+        // Una sonda colgada sigue perteneciendo al mismo punto de montaje
+        if (old && old->worker) {
+            table[i].worker = old->worker;
+            table[i].probe_start_ns = old->probe_start_ns;
+            old->worker = NULL;
+        }
+    }
+    free(slots);
+    free(work_queue);
+    slots = table;
+    slot_count = count;
+    work_queue = queue;
+    queue_head = 0;
+    queue_len = 0;
+    table_gen++;
+    pthread_mutex_unlock(&cache_mutex);
+
+    return count;
+}
+
+static void *probe_worker_func(void *arg) {
+    (void)arg;
+    probe_worker_t self;
+    char path[256];
+
+    pthread_mutex_lock(&cache_mutex);
+    for (;;) {
+        while (queue_len == 0) {
+            pthread_cond_wait(&work_cond, &cache_mutex);
+        }
+        int idx = work_queue[queue_head];
+        queue_head = (queue_head + 1) % (slot_count + 1);
+        queue_len--;
+
+        mount_slot_t *slot = &slots[idx];
+        unsigned int gen = table_gen;
+        self.abandoned = 0;
+        slot->queued = 0;
+        slot->worker = &self;
+        slot->probe_start_ns = now_ns();
+        strncpy(path, slot->info.mount_point, sizeof(path) - 1);
+        path[sizeof(path) - 1] = '\0';
+        pthread_mutex_unlock(&cache_mutex);
+
+        struct statvfs st;
+        int rc = statvfs(path, &st);
+
+        pthread_mutex_lock(&cache_mutex);
+        if (gen != table_gen) {
+            // La tabla se recargó mientras tanto: buscar el slot que nos heredó
+            slot = NULL;
+            for (int i = 0; i < slot_count && !slot; i++) {
+                if (slots[i].worker == &self) {
+                    slot = &slots[i];
+                }
+            }
+        } else {
+            slot = &slots[idx];
+        }
+        if (slot && slot->worker == &self) {
+            slot->worker = NULL;
+            if (rc == 0) {
+                slot->info.total_bytes = (unsigned long long)st.f_blocks * st.f_frsize;
+                slot->info.free_bytes = (unsigned long long)st.f_bfree * st.f_frsize;
+                slot->info.available_bytes = (unsigned long long)st.f_bavail * st.f_frsize;
+                slot->info.total_inodes = st.f_files;
+                slot->info.free_inodes = st.f_ffree;
+                slot->info.updated = time(NULL);
+                slot->info.stale = 0;
+            } else {
+                slot->info.stale = 1;
+            }
+        }
+
+        if (self.abandoned) {
+            // Sobra un worker si ya se lanzó un sustituto
+            workers_stuck--;
+            if (workers_alive - workers_stuck > MOUNT_WORKERS) {
+                workers_alive--;
+                pthread_mutex_unlock(&cache_mutex);
+                return NULL;
+            }
+        } else {
+            pending--;
+            pthread_cond_broadcast(&done_cond);
+        }
+    }
+}
+
+// Con cache_mutex
+static void spawn_workers(void) {
+    while (workers_alive - workers_stuck < MOUNT_WORKERS && workers_alive < MOUNT_MAX_WORKERS) {
+        pthread_t t;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        int rc = pthread_create(&t, &attr, probe_worker_func, NULL);
+        pthread_attr_destroy(&attr);
+        if (rc != 0) {
+            break;
+        }
+        workers_alive++;
+    }
+}
+
+/*
+ * Reparte statvfs entre los workers y espera a que terminen. Una sonda
+ * que supera probe_timeout_ms se abandona: el montaje queda stale y se
+ * lanza un worker de reemplazo. Los montajes con una sonda todavía
+ * colgada no se vuelven a encolar. Con sweep_mutex.
+ */
+static int sweep(int only_new) {
+    pthread_mutex_lock(&cache_mutex);
+    spawn_workers();
+    if (workers_alive == 0) {
+        pthread_mutex_unlock(&cache_mutex);
+        return -1;
+    }
+
+    for (int i = 0; i < slot_count; i++) {
+        mount_slot_t *slot = &slots[i];
+        if (slot->queued || slot->worker || (only_new && slot->info.updated != 0)) {
+            continue;
+        }
+        slot->queued = 1;
+        work_queue[(queue_head + queue_len) % (slot_count + 1)] = i;
+        queue_len++;
+        pending++;
+    }
+    pthread_cond_broadcast(&work_cond);
+
+    uint64_t timeout_ns = (uint64_t)probe_timeout_ms * 1000000ULL;
+    while (pending > 0) {
+        uint64_t now = now_ns();
+        uint64_t deadline = now + timeout_ns;
+
+        for (int i = 0; i < slot_count; i++) {
+            mount_slot_t *slot = &slots[i];
+            if (!slot->worker || slot->worker->abandoned) {
+                continue;
+            }
+            uint64_t d = slot->probe_start_ns + timeout_ns;
+            if (now >= d) {
+                slot->worker->abandoned = 1;
+                slot->info.stale = 1;
+                workers_stuck++;
+                pending--;
+                spawn_workers();
+            } else if (d < deadline) {
+                deadline = d;
+            }
+        }
+        // Todos los workers colgados y sin cupo para más: lo encolado no se mide
+        if (queue_len > 0 && workers_alive - workers_stuck == 0) {
+            while (queue_len > 0) {
+                mount_slot_t *slot = &slots[work_queue[queue_head]];
+                slot->queued = 0;
+                slot->info.stale = 1;
+                queue_head = (queue_head + 1) % (slot_count + 1);
+                queue_len--;
+                pending--;
+            }
+        }
+        if (pending == 0) {
+            break;
+        }
+
+        // done_cond usa CLOCK_REALTIME
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        uint64_t wait_ns = deadline - now;
+        ts.tv_sec += wait_ns / 1000000000ULL;
+        ts.tv_nsec += wait_ns % 1000000000ULL;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&done_cond, &cache_mutex, &ts);
+    }
+    pthread_mutex_unlock(&cache_mutex);
+
+    if (!only_new) {
+        last_sweep_ns = now_ns();
+    }
+    return 0;
+}
+
+// ¿Cambió la tabla de montajes desde el último poll()?
+static int mounts_changed(int timeout_ms) {
+    struct pollfd pfd = { .fd = mountinfo_fd, .events = POLLPRI };
+    return poll(&pfd, 1, timeout_ms) > 0 && (pfd.revents & (POLLPRI | POLLERR));
+}
+
+// Deja la caché al día antes de una consulta. Con sweep_mutex. changed
+// indica que el llamador ya consumió el aviso de mountinfo con su poll().
+static int cache_sync(int changed) {
+    int rc = 0;
+
+    if (changed || mountinfo_fd < 0 || mounts_changed(0)) {
+        rc = reload_table();
+        if (rc < 0) {
+            return rc;
+        }
+    }
+
+    if (!sweeper_running &&
+        now_ns() - last_sweep_ns >= (uint64_t)sweep_interval_ms * 1000000ULL) {
+        return sweep(0);
+    }
+    // Montajes nuevos que aún no se han medido
+    return sweep(1);
+}
+
+static int cache_prepare(void) {
+    int changed = 0;
+
+    pthread_once(&atfork_once, register_atfork);
+    if (sweeper_running) {
+        // Con el barrido en segundo plano no se espera a un barrido periódico,
+        // pero sí a la recarga de la tabla tras montar o desmontar
+        if (pthread_mutex_trylock(&sweep_mutex) != 0) {
+            pthread_mutex_lock(&cache_mutex);
+            int reloading = sweeper_reloading;
+            pthread_mutex_unlock(&cache_mutex);
+            if (!reloading) {
+                // El poll() consume el aviso: ni cache_sync ni el sweeper
+                // lo volverán a ver, así que esta llamada hace la recarga
+                changed = mounts_changed(0);
+                if (!changed) {
+                    return 0;
+                }
+            }
+            pthread_mutex_lock(&sweep_mutex);
+        }
+    } else {
+        pthread_mutex_lock(&sweep_mutex);
+    }
+    int rc = cache_sync(changed);
+    pthread_mutex_unlock(&sweep_mutex);
+    return rc;
+}
+
+int mount_cache_refresh(void) {
+    pthread_once(&atfork_once, register_atfork);
+    pthread_mutex_lock(&sweep_mutex);
+    int rc = 0;
+    if (mountinfo_fd < 0 || mounts_changed(0)) {
+        rc = reload_table();
+    }
+    if (rc >= 0) {
+        rc = sweep(0);
+    }
+    pthread_mutex_unlock(&sweep_mutex);
+    return rc;
+}
+
+int mount_cache_get(const char *mount_point, mount_usage_t *out) {
+    if (!mount_point || !out) {
+        return -EINVAL;
+    }
+
+    int rc = cache_prepare();
+    if (rc < 0) {
+        return rc;
+    }
+
+    pthread_mutex_lock(&cache_mutex);
+    mount_slot_t *slot = find_slot(slots, slot_count, mount_point);
+    if (slot) {
+        *out = slot->info;
+    }
+    pthread_mutex_unlock(&cache_mutex);
+
+    return slot ? 0 : -ENOENT;
+}
+
+int mount_cache_list(mount_usage_t *out, int max) {
+    if (!out || max < 0) {
+        return -EINVAL;
+    }
+
+    int rc = cache_prepare();
+    if (rc < 0) {
+        return rc;
+    }
+
+    pthread_mutex_lock(&cache_mutex);
+    int total = slot_count;
+    for (int i = 0; i < total && i < max; i++) {
+        out[i] = slots[i].info;
+    }
+    pthread_mutex_unlock(&cache_mutex);
+
+    return total;
+}
+
+static void *sweeper_func(void *arg) {
+    (void)arg;
+
+    while (sweeper_running) {
+        pthread_mutex_lock(&sweep_mutex);
+        if (mountinfo_fd < 0) {
+            reload_table();
+        }
+        uint64_t elapsed_ms = (now_ns() - last_sweep_ns) / 1000000ULL;
+        if (elapsed_ms >= (uint64_t)sweep_interval_ms) {
+            sweep(0);
+            elapsed_ms = 0;
+        }
+        int fd = mountinfo_fd;
+        pthread_mutex_unlock(&sweep_mutex);
+
+        struct pollfd pfds[2] = {
+            { .fd = fd, .events = POLLPRI },
+            { .fd = sweeper_wake_fd, .events = POLLIN },
+        };
+        int rc = poll(pfds, 2, sweep_interval_ms - (int)elapsed_ms);
+        if (rc > 0 && (pfds[0].revents & (POLLPRI | POLLERR))) {
+            // Cambió la tabla: releerla y medir solo los montajes nuevos
+            pthread_mutex_lock(&cache_mutex);
+            sweeper_reloading = 1;
+            pthread_mutex_unlock(&cache_mutex);
+            pthread_mutex_lock(&sweep_mutex);
+            if (reload_table() >= 0) {
+                sweep(1);
+            }
+            pthread_mutex_lock(&cache_mutex);
+            sweeper_reloading = 0;
+            pthread_mutex_unlock(&cache_mutex);
+            pthread_mutex_unlock(&sweep_mutex);
+        }
+    }
+    return NULL;
+}
+
+int mount_cache_start(void) {
+    if (sweeper_running) {
+        return 0;
+    }
+
+    sweeper_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (sweeper_wake_fd < 0) {
+        return -1;
+    }
+
+    // Primer barrido síncrono para que las consultas tengan datos
+    mount_cache_refresh();
+
+    sweeper_running = 1;
+    if (pthread_create(&sweeper_thread, NULL, sweeper_func, NULL) != 0) {
+        sweeper_running = 0;
+        close(sweeper_wake_fd);
+        sweeper_wake_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void mount_cache_stop(void) {
+    if (!sweeper_running) {
+        return;
+    }
+
+    sweeper_running = 0;
+    uint64_t one = 1;
+    if (write(sweeper_wake_fd, &one, sizeof(one)) < 0) {
+        // el thread sale como mucho tras un intervalo
+    }
+    pthread_join(sweeper_thread, NULL);
+    close(sweeper_wake_fd);
+    sweeper_wake_fd = -1;
+}
@@ -2,12 +2,25 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <errno.h>
 #include <sys/stat.h>
+#include <sys/file.h>
 #include "../include/backup_engine.h"
+#include "../include/backup_copy.h"
+#include "../include/backup_manifest.h"
+#include "../include/backup_repo.h"
 
 #define TEST_SOURCE "/tmp/backup_test_source"
 #define TEST_DEST "/tmp/backup_test_dest"
 #define TEST_RESTORE "/tmp/backup_test_restore"
+#define TEST_COPY_SRC "/tmp/backup_test_copy_src"
+#define TEST_COPY_DST "/tmp/backup_test_copy_dst"
+#define TEST_REPO_SRC "/tmp/backup_test_repo_src"
+#define TEST_REPO_DIR "/tmp/backup_test_repo"
+#define TEST_REPO_DST "/tmp/backup_test_repo_dst"
+#define TEST_VERIFY_DEST "/tmp/backup_test_verify"
 
 // Crear datos de prueba
 int create_test_data(void) {
@@ -52,9 +65,52 @@ void test_full_backup(void) {
     
     if (backup_create(TEST_SOURCE, TEST_DEST, BACKUP_FULL) == 0) {
         printf("✓ Full backup completed successfully\n");
+        
+        // El checksum del catálogo es la raíz Merkle del manifiesto guardado
+        backup_info_t *backups = NULL;
+        backup_manifest_t manifest;
+        backup_hash_t root;
+        char manifest_path[600], hex[65] = "";
+        int count = 0;
+        
+        if (backup_list(&backups, &count) == 0 && count > 0) {
+            snprintf(manifest_path, sizeof(manifest_path), "%s.manifest", backups[0].dest_path);
+            if (backup_manifest_load(manifest_path, &manifest) == 0) {
+                backup_manifest_root(&manifest, root);
+                backup_hash_hex(root, hex);
+                backup_manifest_free(&manifest);
+            }
+        }
+        if (count > 0 && strlen(backups[0].checksum) == 64 &&
+            strcmp(backups[0].checksum, hex) == 0) {
+            printf("✓ Checksum recorded: %.16s...\n", backups[0].checksum);
+        } else {
+            printf("✗ Checksum missing or does not match the manifest\n");
+        }
+        free(backups);
     } else {
         printf("✗ Full backup failed\n");
     }
+    
+    // Un destino que no cabe en el catálogo se rechaza en vez de truncarse
+    char long_dest[400];
+    memset(long_dest, 'd', sizeof(long_dest) - 1);
+    long_dest[0] = '/';
+    long_dest[sizeof(long_dest) - 1] = '\0';
+    int before = 0, after = 0;
+    backup_info_t *list = NULL;
+    if (backup_list(&list, &before) == 0) {
+        free(list);
+    }
+    int rc = backup_create(TEST_SOURCE, long_dest, BACKUP_FULL);
+    if (backup_list(&list, &after) == 0) {
+        free(list);
+    }
+    if (rc != 0 && after == before) {
+        printf("✓ Over-long destination rejected\n");
+    } else {
+        printf("✗ Over-long destination accepted (rc=%d)\n", rc);
+    }
 }
 
 void test_incremental_backup(void) {
@@ -88,7 +144,40 @@ void test_incremental_backup(void) {
         printf("✓ Incremental backup completed successfully\n");
     } else {
         printf("✗ Incremental backup failed\n");
+        return;
     }
+    
+    // Los ficheros sin cambios deben compartir inodo con el backup anterior
+    backup_info_t *backups = NULL;
+    int count = 0;
+    if (backup_list(&backups, &count) == 0 && count >= 2 &&
+        backups[0].parent_backup_id[0] != '\0') {
+        backup_info_t parent;
+        char prev_path[512], cur_path[512];
+        struct stat prev_st, cur_st;
+        
+        backup_get_info(backups[0].parent_backup_id, &parent);
+        snprintf(prev_path, sizeof(prev_path), "%s/file2.txt", parent.dest_path);
+        snprintf(cur_path, sizeof(cur_path), "%s/file2.txt", backups[0].dest_path);
+        if (stat(prev_path, &prev_st) == 0 && stat(cur_path, &cur_st) == 0 &&
+            prev_st.st_ino == cur_st.st_ino) {
+            printf("✓ Unchanged file linked from %s\n", parent.backup_id);
+        } else {
+            printf("✗ Unchanged file was copied again\n");
+        }
+        
+        snprintf(prev_path, sizeof(prev_path), "%s/file1.txt", parent.dest_path);
+        snprintf(cur_path, sizeof(cur_path), "%s/file1.txt", backups[0].dest_path);
+        if (stat(prev_path, &prev_st) == 0 && stat(cur_path, &cur_st) == 0 &&
+            prev_st.st_ino != cur_st.st_ino && cur_st.st_size > prev_st.st_size) {
+            printf("✓ Modified file copied\n");
+        } else {
+            printf("✗ Modified file not copied\n");
+        }
+    } else {
+        printf("✗ Incremental backup has no parent\n");
+    }
+    free(backups);
 }
 
 void test_backup_list(void) {
@@ -181,10 +270,14 @@ void test_backup_cleanup(void) {
     printf("\n=== Test 6: Cleanup Old Backups ===\n");
     
     backup_info_t *backups = NULL;
+    char oldest[PATH_MAX] = "";
     int count = 0;
     
     if (backup_list(&backups, &count) == 0) {
         printf("Current backup count: %d\n", count);
+        if (count > 1 && backups[count - 1].format == BACKUP_FORMAT_TREE) {
+            snprintf(oldest, sizeof(oldest), "%s", backups[count - 1].dest_path);
+        }
         free(backups);
         
         if (count > 1) {
@@ -198,6 +291,15 @@ void test_backup_cleanup(void) {
                     printf("New backup count: %d\n", count);
                     free(backups);
                 }
+                
+                // Se borran el árbol y su manifiesto
+                char manifest_path[PATH_MAX + 16];
+                snprintf(manifest_path, sizeof(manifest_path), "%s.manifest", oldest);
+                if (oldest[0] && access(oldest, F_OK) != 0 && access(manifest_path, F_OK) != 0) {
+                    printf("✓ Tree and manifest of the oldest backup removed\n");
+                } else if (oldest[0]) {
+                    printf("✗ Files of %s left behind\n", oldest);
+                }
             } else {
                 printf("✗ Cleanup failed\n");
             }
@@ -207,6 +309,809 @@ void test_backup_cleanup(void) {
     }
 }
 
+// Contenido determinista de tamaño variable
+static int write_pattern_file(const char *path, size_t size, unsigned seed) {
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        return -1;
+    }
+    for (size_t i = 0; i < size; i++) {
+        fputc((int)((i * 31 + seed) & 0xff), fp);
+    }
+    fclose(fp);
+    return 0;
+}
+
+static int same_content(const char *a, const char *b) {
+    FILE *fa = fopen(a, "r");
+    FILE *fb = fopen(b, "r");
+    int same = fa && fb;
+    
+    while (same) {
+        int ca = fgetc(fa);
+        int cb = fgetc(fb);
+        if (ca != cb) {
+            same = 0;
+        }
+        if (ca == EOF) {
+            break;
+        }
+    }
+    if (fa) fclose(fa);
+    if (fb) fclose(fb);
+    return same;
+}
+
+void test_copy_engine(void) {
+    printf("\n=== Test 7: Native Copy Engine ===\n");
+    
+    char path[512], other[512];
+    int files = 0;
+    
+    system("chmod -R u+w " TEST_COPY_SRC " " TEST_COPY_DST " 2>/dev/null");
+    system("rm -rf " TEST_COPY_SRC " " TEST_COPY_DST);
+    mkdir(TEST_COPY_SRC, 0755);
+    
+    // 4 directorios x 3 subdirectorios x 25 ficheros de tamaños variados
+    for (int d = 0; d < 4; d++) {
+        snprintf(path, sizeof(path), "%s/d%d", TEST_COPY_SRC, d);
+        mkdir(path, 0755);
+        for (int s = 0; s < 3; s++) {
+            snprintf(path, sizeof(path), "%s/d%d/s%d", TEST_COPY_SRC, d, s);
+            mkdir(path, 0750);
+            for (int f = 0; f < 25; f++) {
+                snprintf(path, sizeof(path), "%s/d%d/s%d/f%d", TEST_COPY_SRC, d, s, f);
+                write_pattern_file(path, (size_t)(f * 397 + d * 13), d * 100 + s * 10 + f);
+                files++;
+            }
+        }
+    }
+    // Un fichero mayor que el buffer de copia
+    snprintf(path, sizeof(path), "%s/big.bin", TEST_COPY_SRC);
+    write_pattern_file(path, 3 * BACKUP_COPY_BUFFER_SIZE + 17, 7);
+    files++;
+    
+    // Modo, tiempos, enlace duro, enlace simbólico y directorio de solo lectura
+    snprintf(path, sizeof(path), "%s/d0/s0/f1", TEST_COPY_SRC);
+    chmod(path, 0640);
+    struct timespec times[2] = { { 1577836800, 0 }, { 1577836800, 123456789 } };
+    utimensat(AT_FDCWD, path, times, 0);
+    
+    snprintf(other, sizeof(other), "%s/hardlink", TEST_COPY_SRC);
+    link(path, other);
+    files++;
+    
+    snprintf(path, sizeof(path), "%s/symlink", TEST_COPY_SRC);
+    symlink("d0/s0/f1", path);
+    
+    snprintf(path, sizeof(path), "%s/readonly", TEST_COPY_SRC);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/readonly/inside", TEST_COPY_SRC);
+    write_pattern_file(path, 100, 3);
+    files++;
+    snprintf(path, sizeof(path), "%s/readonly", TEST_COPY_SRC);
+    chmod(path, 0555);
+    
+    printf("Created %d files in %s\n", files, TEST_COPY_SRC);
+    
+    backup_copy_opts_t opts = { .threads = 4 };
+    backup_copy_stats_t cs;
+    int rc = backup_copy_tree(TEST_COPY_SRC, TEST_COPY_DST, &opts, &cs);
+    
+    printf("Copied %llu files, %llu dirs, %.2f MB in %.3f s with %d threads\n",
+           (unsigned long long)cs.files, (unsigned long long)cs.dirs,
+           cs.bytes_copied / (1024.0 * 1024.0), cs.elapsed_s, cs.threads);
+    if (rc == 0 && cs.errors == 0 && cs.files == (uint64_t)files) {
+        printf("✓ Tree copied without errors\n");
+    } else {
+        printf("✗ Copy failed (rc=%d, errors=%llu, files=%llu/%d): %s\n", rc,
+               (unsigned long long)cs.errors, (unsigned long long)cs.files, files,
+               cs.first_error);
+    }
+    
+    int mismatches = 0;
+    for (int d = 0; d < 4; d++) {
+        for (int s = 0; s < 3; s++) {
+            for (int f = 0; f < 25; f++) {
+                snprintf(path, sizeof(path), "%s/d%d/s%d/f%d", TEST_COPY_SRC, d, s, f);
+                snprintf(other, sizeof(other), "%s/d%d/s%d/f%d", TEST_COPY_DST, d, s, f);
+                if (!same_content(path, other)) {
+                    mismatches++;
+                }
+            }
+        }
+    }
+    if (!same_content(TEST_COPY_SRC "/big.bin", TEST_COPY_DST "/big.bin")) {
+        mismatches++;
+    }
+    if (mismatches == 0) {
+        printf("✓ File contents match\n");
+    } else {
+        printf("✗ %d files differ\n", mismatches);
+    }
+    
+    struct stat st, st2;
+    if (stat(TEST_COPY_DST "/d0/s0/f1", &st) == 0 && (st.st_mode & 07777) == 0640 &&
+        st.st_mtim.tv_sec == 1577836800 && st.st_mtim.tv_nsec == 123456789) {
+        printf("✓ Mode and nanosecond mtime preserved\n");
+    } else {
+        printf("✗ Mode or mtime not preserved\n");
+    }
+    if (stat(TEST_COPY_DST "/hardlink", &st2) == 0 && st2.st_ino == st.st_ino) {
+        printf("✓ Hardlink preserved\n");
+    } else {
+        printf("✗ Hardlink copied as a separate file\n");
+    }
+    char target[256];
+    ssize_t len = readlink(TEST_COPY_DST "/symlink", target, sizeof(target) - 1);
+    if (len > 0) {
+        target[len] = '\0';
+    }
+    if (len > 0 && strcmp(target, "d0/s0/f1") == 0) {
+        printf("✓ Symlink preserved\n");
+    } else {
+        printf("✗ Symlink not preserved\n");
+    }
+    if (stat(TEST_COPY_DST "/readonly", &st) == 0 && (st.st_mode & 07777) == 0555 &&
+        stat(TEST_COPY_DST "/readonly/inside", &st2) == 0 &&
+        stat(TEST_COPY_DST "/d1/s2", &st) == 0 && (st.st_mode & 07777) == 0750) {
+        printf("✓ Directory modes applied after filling\n");
+    } else {
+        printf("✗ Directory modes not preserved\n");
+    }
+    
+    system("chmod -R u+w " TEST_COPY_SRC " " TEST_COPY_DST " 2>/dev/null");
+    system("rm -rf " TEST_COPY_SRC " " TEST_COPY_DST);
+}
+
+// Datos pseudoaleatorios (el contenido periódico no ejercita los cortes)
+static void fill_random(unsigned char *buf, size_t size, uint64_t seed) {
+    uint64_t x = seed * 0x9E3779B97F4A7C15ULL + 1;
+    for (size_t i = 0; i < size; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        buf[i] = (unsigned char)(x >> 24);
+    }
+}
+
+static int write_random_file(const char *path, size_t size, uint64_t seed) {
+    unsigned char *buf = malloc(size);
+    FILE *fp = fopen(path, "w");
+    int rc = -1;
+    if (buf && fp) {
+        fill_random(buf, size, seed);
+        rc = fwrite(buf, 1, size, fp) == size ? 0 : -1;
+    }
+    if (fp) fclose(fp);
+    free(buf);
+    return rc;
+}
+
+// Trocea data y guarda offset y longitud de cada chunk
+static int cdc_split(const unsigned char *data, size_t len, size_t *offs, size_t *lens, int max) {
+    int n = 0;
+    for (size_t off = 0; off < len && n < max; n++) {
+        lens[n] = backup_cdc_cut(data + off, len - off);
+        offs[n] = off;
+        off += lens[n];
+    }
+    return n;
+}
+
+static int count_files(const char *dir) {
+    char cmd[512];
+    int n = -1;
+    snprintf(cmd, sizeof(cmd), "ls %s 2>/dev/null | wc -l", dir);
+    FILE *fp = popen(cmd, "r");
+    if (fp) {
+        if (fscanf(fp, "%d", &n) != 1) {
+            n = -1;
+        }
+        pclose(fp);
+    }
+    return n;
+}
+
+void test_dedup_repository(void) {
+    printf("\n=== Test 8: Deduplicating Repository ===\n");
+    
+    const size_t data_len = 4 * 1024 * 1024;
+    size_t offs_a[256], lens_a[256], offs_b[256], lens_b[256];
+    unsigned char *a = malloc(data_len);
+    unsigned char *b = malloc(data_len + 1);
+    
+    if (!a || !b) {
+        printf("✗ Out of memory\n");
+        free(a);
+        free(b);
+        return;
+    }
+    
+    // Límites de los chunks
+    fill_random(a, data_len, 42);
+    int na = cdc_split(a, data_len, offs_a, lens_a, 256);
+    int bounds_ok = 1;
+    for (int i = 0; i < na; i++) {
+        if (lens_a[i] > BACKUP_CDC_MAX_SIZE ||
+            (i < na - 1 && lens_a[i] < BACKUP_CDC_MIN_SIZE)) {
+            bounds_ok = 0;
+        }
+    }
+    printf("4 MB split into %d chunks (avg %.1f KB)\n", na, data_len / 1024.0 / na);
+    if (bounds_ok && na >= 4 * 1024 / 256) {
+        printf("✓ Chunk sizes within [%d KB, %d KB]\n",
+               BACKUP_CDC_MIN_SIZE / 1024, BACKUP_CDC_MAX_SIZE / 1024);
+    } else {
+        printf("✗ Chunk sizes out of bounds\n");
+    }
+    
+    // Insertar un byte solo cambia los chunks de alrededor
+    size_t at = data_len / 2;
+    memcpy(b, a, at);
+    b[at] = 0x5a;
+    memcpy(b + at + 1, a + at, data_len - at);
+    int nb = cdc_split(b, data_len + 1, offs_b, lens_b, 256);
+    int shared = 0;
+    for (int i = 0; i < nb; i++) {
+        for (int j = 0; j < na; j++) {
+            if (lens_b[i] == lens_a[j] && memcmp(b + offs_b[i], a + offs_a[j], lens_a[j]) == 0) {
+                shared++;
+                break;
+            }
+        }
+    }
+    printf("After a 1-byte insert: %d of %d chunks unchanged\n", shared, nb);
+    if (shared >= nb - 2) {
+        printf("✓ Boundaries resynchronize after an insertion\n");
+    } else {
+        printf("✗ Insertion shifted too many chunks\n");
+    }
+    free(a);
+    free(b);
+    
+    // Árbol de prueba
+    char path[512], other[512];
+    system("rm -rf " TEST_REPO_SRC " " TEST_REPO_DIR " " TEST_REPO_DST);
+    mkdir(TEST_REPO_SRC, 0755);
+    mkdir(TEST_REPO_SRC "/sub", 0750);
+    for (int i = 0; i < 3; i++) {
+        snprintf(path, sizeof(path), "%s/data%d.bin", TEST_REPO_SRC, i);
+        write_random_file(path, (size_t)(1024 * 1024 + i * 1000), 100 + i);
+        snprintf(path, sizeof(path), "%s/sub/copy%d.bin", TEST_REPO_SRC, i);
+        write_random_file(path, (size_t)(1024 * 1024 + i * 1000), 100 + i);
+    }
+    write_random_file(TEST_REPO_SRC "/small.txt", 100, 7);
+    chmod(TEST_REPO_SRC "/small.txt", 0640);
+    struct timespec times[2] = { { 1577836800, 0 }, { 1577836800, 987654321 } };
+    utimensat(AT_FDCWD, TEST_REPO_SRC "/small.txt", times, 0);
+    link(TEST_REPO_SRC "/small.txt", TEST_REPO_SRC "/sub/small.link");
+    symlink("../data0.bin", TEST_REPO_SRC "/sub/data0.sym");
+    
+    backup_repo_stats_t rs;
+    mkdir(TEST_REPO_DIR, 0755);
+    int rc = backup_repo_store(TEST_REPO_DIR, TEST_REPO_SRC,
+                               TEST_REPO_DIR "/manifests/m1.manifest", NULL, 4, &rs);
+    printf("First store: %llu files, %.2f MB logical, %.2f MB stored, %llu/%llu new chunks\n",
+           (unsigned long long)rs.files, rs.logical_bytes / (1024.0 * 1024.0),
+           rs.stored_bytes / (1024.0 * 1024.0),
+           (unsigned long long)rs.new_chunks, (unsigned long long)rs.chunks);
+    // Cada fichero de sub/ es una copia: la mitad de los datos se deduplica
+    if (rc == 0 && rs.files == 7 && rs.hardlinks == 1 && rs.symlinks == 1 &&
+        rs.stored_bytes * 2 <= rs.logical_bytes + 200) {
+        printf("✓ Duplicate files stored once\n");
+    } else {
+        printf("✗ Unexpected first store (rc=%d): %s\n", rc, rs.first_error);
+    }
+    
+    rc = backup_repo_store(TEST_REPO_DIR, TEST_REPO_SRC,
+                           TEST_REPO_DIR "/manifests/m2.manifest", NULL, 4, &rs);
+    if (rc == 0 && rs.new_chunks == 0 && rs.stored_bytes == 0) {
+        printf("✓ Unchanged tree adds no chunks\n");
+    } else {
+        printf("✗ Unchanged tree stored %llu new chunks\n", (unsigned long long)rs.new_chunks);
+    }
+    
+    // Un byte cambiado en medio de un fichero
+    int fd = open(TEST_REPO_SRC "/data1.bin", O_WRONLY);
+    if (fd >= 0) {
+        pwrite(fd, "X", 1, 500000);
+        close(fd);
+    }
+    rc = backup_repo_store(TEST_REPO_DIR, TEST_REPO_SRC,
+                           TEST_REPO_DIR "/manifests/m3.manifest", NULL, 4, &rs);
+    printf("After 1-byte change: %llu new chunks, %.1f KB stored\n",
+           (unsigned long long)rs.new_chunks, rs.stored_bytes / 1024.0);
+    if (rc == 0 && rs.new_chunks >= 1 && rs.new_chunks <= 2 &&
+        rs.stored_bytes <= 2 * BACKUP_CDC_MAX_SIZE) {
+        printf("✓ Only the changed chunk was stored\n");
+    } else {
+        printf("✗ Too much data stored for a 1-byte change\n");
+    }
+    
+    if (backup_repo_missing(TEST_REPO_DIR, TEST_REPO_DIR "/manifests/m3.manifest") == 0) {
+        printf("✓ All chunks of the manifest are indexed\n");
+    } else {
+        printf("✗ Manifest references missing chunks\n");
+    }
+    
+    // Restauración completa
+    rc = backup_repo_restore(TEST_REPO_DIR, TEST_REPO_DIR "/manifests/m3.manifest",
+                             TEST_REPO_DST, 4, &rs);
+    int mismatches = 0;
+    for (int i = 0; i < 3; i++) {
+        snprintf(path, sizeof(path), "%s/data%d.bin", TEST_REPO_SRC, i);
+        snprintf(other, sizeof(other), "%s/data%d.bin", TEST_REPO_DST, i);
+        mismatches += !same_content(path, other);
+        snprintf(path, sizeof(path), "%s/sub/copy%d.bin", TEST_REPO_SRC, i);
+        snprintf(other, sizeof(other), "%s/sub/copy%d.bin", TEST_REPO_DST, i);
+        mismatches += !same_content(path, other);
+    }
+    if (rc == 0 && mismatches == 0 && same_content(TEST_REPO_SRC "/small.txt",
+                                                   TEST_REPO_DST "/small.txt")) {
+        printf("✓ Restored contents match\n");
+    } else {
+        printf("✗ Restore failed (rc=%d, %d files differ): %s\n", rc, mismatches, rs.first_error);
+    }
+    
+    struct stat st, st2;
+    char target[64];
+    ssize_t len = readlink(TEST_REPO_DST "/sub/data0.sym", target, sizeof(target) - 1);
+    if (len > 0) {
+        target[len] = '\0';
+    }
+    if (stat(TEST_REPO_DST "/small.txt", &st) == 0 && (st.st_mode & 07777) == 0640 &&
+        st.st_mtim.tv_nsec == 987654321 &&
+        stat(TEST_REPO_DST "/sub/small.link", &st2) == 0 && st2.st_ino == st.st_ino &&
+        len > 0 && strcmp(target, "../data0.bin") == 0 &&
+        stat(TEST_REPO_DST "/sub", &st) == 0 && (st.st_mode & 07777) == 0750) {
+        printf("✓ Metadata, hardlinks and symlinks restored\n");
+    } else {
+        printf("✗ Metadata or links not restored\n");
+    }
+    
+    // GC: sin manifiestos no queda ningún pack
+    uint64_t freed = 0;
+    unlink(TEST_REPO_DIR "/manifests/m1.manifest");
+    unlink(TEST_REPO_DIR "/manifests/m2.manifest");
+    rc = backup_repo_gc(TEST_REPO_DIR, &freed);
+    int packs = count_files(TEST_REPO_DIR "/packs");
+    printf("GC with one manifest left: %d packs kept, %.2f MB freed\n",
+           packs, freed / (1024.0 * 1024.0));
+    if (rc == 0 && packs > 0 &&
+        backup_repo_missing(TEST_REPO_DIR, TEST_REPO_DIR "/manifests/m3.manifest") == 0) {
+        printf("✓ Live chunks kept\n");
+    } else {
+        printf("✗ GC removed live data\n");
+    }
+    unlink(TEST_REPO_DIR "/manifests/m3.manifest");
+    
+    // Con el repositorio tomado (un store en curso) GC no borra nada
+    int lock_fd = open(TEST_REPO_DIR "/repo.lock", O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lock_fd >= 0 && flock(lock_fd, LOCK_EX) == 0) {
+        rc = backup_repo_gc(TEST_REPO_DIR, &freed);
+        if (rc == -EBUSY && freed == 0 && count_files(TEST_REPO_DIR "/packs") == packs) {
+            printf("✓ GC refuses a locked repository\n");
+        } else {
+            printf("✗ GC ran on a locked repository (rc=%d)\n", rc);
+        }
+    }
+    if (lock_fd >= 0) {
+        close(lock_fd);
+    }
+    rc = backup_repo_gc(TEST_REPO_DIR, &freed);
+    if (rc == 0 && freed > 0 && count_files(TEST_REPO_DIR "/packs") == 0) {
+        printf("✓ Unreferenced packs removed (%.2f MB)\n", freed / (1024.0 * 1024.0));
+    } else {
+        printf("✗ Packs left after GC\n");
+    }
+    
+    // Backup chunked a través del motor
+    backup_config_t config;
+    backup_info_t *backups = NULL;
+    int count = 0;
+    
+    backup_cleanup();
+    backup_config_defaults(&config);
+    config.format = BACKUP_FORMAT_CHUNKED;
+    config.copy_threads = 4;
+    if (backup_init_with_config(&config) != 0) {
+        printf("✗ Cannot reinitialize backup engine\n");
+        return;
+    }
+    sleep(1);
+    system("rm -rf " TEST_REPO_DST);
+    if (backup_create(TEST_SOURCE, TEST_REPO_DIR, BACKUP_FULL) == 0 &&
+        backup_list(&backups, &count) == 0 && count > 0 &&
+        backups[0].format == BACKUP_FORMAT_CHUNKED &&
+        backup_verify(backups[0].backup_id) == 0 &&
+        backup_restore(backups[0].backup_id, TEST_REPO_DST) == 0 &&
+        same_content(TEST_SOURCE "/file1.txt", TEST_REPO_DST "/file1.txt")) {
+        printf("✓ Chunked backup created, verified and restored (%llu bytes logical)\n",
+               backups[0].logical_bytes);
+    } else {
+        printf("✗ Chunked backup through the engine failed\n");
+    }
+    free(backups);
+    
+    system("rm -rf " TEST_REPO_SRC " " TEST_REPO_DIR " " TEST_REPO_DST);
+}
+
+void test_merkle_checksum(void) {
+    printf("\n=== Test 9: Parallel Merkle Checksum ===\n");
+    
+    backup_manifest_t m1, m4;
+    backup_walk_stats_t ws;
+    backup_hash_t root1, root4;
+    char hex1[65], hex4[65], file_hex[65];
+    
+    system("rm -rf " TEST_REPO_SRC " " TEST_REPO_DIR);
+    mkdir(TEST_REPO_SRC, 0755);
+    mkdir(TEST_REPO_SRC "/a", 0755);
+    mkdir(TEST_REPO_SRC "/b", 0700);
+    for (int i = 0; i < 40; i++) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s/f%02d", TEST_REPO_SRC, i % 2 ? "a" : "b", i);
+        write_random_file(path, (size_t)(i * 3001), 500 + i);
+    }
+    write_random_file(TEST_REPO_SRC "/large.bin", 2 * BACKUP_HASH_BUFFER + 5, 9);
+    link(TEST_REPO_SRC "/a/f01", TEST_REPO_SRC "/b/link");
+    symlink("a/f01", TEST_REPO_SRC "/sym");
+    
+    int rc1 = backup_manifest_scan(TEST_REPO_SRC, 1, BACKUP_SCAN_HASH, &m1, &ws);
+    int rc4 = backup_manifest_scan(TEST_REPO_SRC, 4, BACKUP_SCAN_HASH, &m4, &ws);
+    backup_manifest_root(&m1, root1);
+    backup_manifest_root(&m4, root4);
+    backup_hash_hex(root1, hex1);
+    backup_hash_hex(root4, hex4);
+    printf("%zu entries, root %.16s... (%d threads)\n", m4.count, hex4, ws.threads);
+    if (rc1 == 0 && rc4 == 0 && m1.count == 46 && strcmp(hex1, hex4) == 0) {
+        printf("✓ Root independent of the number of threads\n");
+    } else {
+        printf("✗ Roots differ (rc=%d/%d, %zu entries)\n", rc1, rc4, m1.count);
+    }
+    
+    // El hash por fichero coincide con backup_calculate_checksum()
+    int matched = 0;
+    for (size_t i = 0; i < m4.count; i++) {
+        if (strcmp(m4.entries[i].path, "large.bin") == 0 && m4.entries[i].has_hash &&
+            backup_calculate_checksum(TEST_REPO_SRC "/large.bin", file_hex) == 0) {
+            backup_hash_hex(m4.entries[i].hash, hex1);
+            matched = strcmp(hex1, file_hex) == 0;
+        }
+    }
+    if (matched) {
+        printf("✓ Per-file hash matches backup_calculate_checksum()\n");
+    } else {
+        printf("✗ Per-file hash mismatch\n");
+    }
+    backup_manifest_free(&m1);
+    backup_manifest_free(&m4);
+    
+    // Los dos formatos dan el mismo checksum para el mismo árbol
+    backup_repo_stats_t rs;
+    mkdir(TEST_REPO_DIR, 0755);
+    if (backup_repo_store(TEST_REPO_DIR, TEST_REPO_SRC, TEST_REPO_DIR "/manifests/t.manifest",
+                          NULL, 4, &rs) == 0 && memcmp(rs.root, root4, BACKUP_HASH_SIZE) == 0) {
+        printf("✓ Chunked repository reports the same root\n");
+    } else {
+        printf("✗ Chunked repository root differs\n");
+    }
+    
+    int fd = open(TEST_REPO_SRC "/large.bin", O_WRONLY);
+    if (fd >= 0) {
+        pwrite(fd, "!", 1, BACKUP_HASH_BUFFER + 1);
+        close(fd);
+    }
+    if (backup_manifest_scan(TEST_REPO_SRC, 4, BACKUP_SCAN_HASH, &m1, &ws) == 0) {
+        backup_manifest_root(&m1, root1);
+        backup_manifest_free(&m1);
+    }
+    if (memcmp(root1, root4, BACKUP_HASH_SIZE) != 0) {
+        printf("✓ One changed byte changes the root\n");
+    } else {
+        printf("✗ Root did not change\n");
+    }
+    
+    system("rm -rf " TEST_REPO_SRC " " TEST_REPO_DIR);
+}
+
+static int reinit_engine(backup_format_t format, int sample_percent, int rate_limit_mb) {
+    backup_config_t config;
+    
+    backup_cleanup();
+    backup_config_defaults(&config);
+    config.format = format;
+    config.copy_threads = 4;
+    config.verify_sample_percent = sample_percent;
+    config.verify_rate_limit_mb = rate_limit_mb;
+    return backup_init_with_config(&config);
+}
+
+static void flip_byte(const char *path, off_t offset) {
+    unsigned char c = 0;
+    int fd = open(path, O_RDWR);
+    if (fd >= 0) {
+        pread(fd, &c, 1, offset);
+        c ^= 0xff;
+        pwrite(fd, &c, 1, offset);
+        close(fd);
+    }
+}
+
+void test_manifest_verify(void) {
+    printf("\n=== Test 10: Manifest-Based Verification ===\n");
+    
+    backup_verify_report_t report;
+    backup_info_t *backups = NULL;
+    char backup_id[64] = "";
+    char path[600];
+    int count = 0;
+    int data_files = 0;
+    
+    system("rm -rf " TEST_REPO_SRC " " TEST_REPO_DIR " " TEST_VERIFY_DEST);
+    mkdir(TEST_REPO_SRC, 0755);
+    mkdir(TEST_REPO_SRC "/a", 0755);
+    for (int i = 0; i < 60; i++) {
+        snprintf(path, sizeof(path), "%s/a/f%02d", TEST_REPO_SRC, i);
+        write_random_file(path, (size_t)(1000 + i * 517), 700 + i);
+        data_files++;
+    }
+    write_random_file(TEST_REPO_SRC "/large.bin", 8 * 1024 * 1024, 11);
+    data_files++;
+    symlink("a/f00", TEST_REPO_SRC "/sym");
+    
+    if (reinit_engine(BACKUP_FORMAT_TREE, 100, 0) != 0) {
+        printf("✗ Cannot reinitialize backup engine\n");
+        return;
+    }
+    sleep(1);
+    if (backup_create(TEST_REPO_SRC, TEST_VERIFY_DEST, BACKUP_FULL) == 0 &&
+        backup_list(&backups, &count) == 0 && count > 0) {
+        strncpy(backup_id, backups[0].backup_id, sizeof(backup_id) - 1);
+    }
+    free(backups);
+    
+    int rc = backup_verify_with_report(backup_id, &report);
+    if (rc == 0 && report.mismatches == 0 && report.checked == report.entries &&
+        report.bytes_read >= 8 * 1024 * 1024) {
+        printf("✓ Intact backup verified (%llu entries, %.2f MB re-read)\n",
+               (unsigned long long)report.entries, report.bytes_read / (1024.0 * 1024.0));
+    } else {
+        printf("✗ Intact backup failed verification (rc=%d)\n", rc);
+    }
+    backup_verify_report_free(&report);
+    
+    // Un byte cambiado sin cambiar el tamaño y un fichero borrado
+    snprintf(path, sizeof(path), "%s/%s/a/f17", TEST_VERIFY_DEST, backup_id);
+    flip_byte(path, 300);
+    snprintf(path, sizeof(path), "%s/%s/a/f42", TEST_VERIFY_DEST, backup_id);
+    unlink(path);
+    rc = backup_verify_with_report(backup_id, &report);
+    int found17 = 0, found42 = 0;
+    for (size_t i = 0; i < report.reported; i++) {
+        found17 |= strcmp(report.bad_paths[i], "a/f17") == 0;
+        found42 |= strcmp(report.bad_paths[i], "a/f42") == 0;
+    }
+    if (rc != 0 && report.mismatches == 2 && found17 && found42) {
+        printf("✓ Corrupted and missing files reported by path\n");
+    } else {
+        printf("✗ Wrong mismatch report (rc=%d, %llu mismatches)\n", rc,
+               (unsigned long long)report.mismatches);
+    }
+    backup_verify_report_free(&report);
+    
+    // Muestreo del 25%: cuatro pasadas cubren todos los ficheros una vez
+    reinit_engine(BACKUP_FORMAT_TREE, 25, 0);
+    uint64_t sampled_out = 0, mismatches = 0;
+    int partial = 1;
+    for (int pass = 0; pass < 4; pass++) {
+        backup_verify_with_report(backup_id, &report);
+        sampled_out += report.sampled_out;
+        mismatches += report.mismatches;
+        partial &= report.sampled_out > 0;
+        backup_verify_report_free(&report);
+    }
+    if (partial && sampled_out == 3 * (uint64_t)data_files && mismatches == 2) {
+        printf("✓ Sampling covers every file once in 4 passes\n");
+    } else {
+        printf("✗ Sampling coverage wrong (%llu sampled out, %llu mismatches)\n",
+               (unsigned long long)sampled_out, (unsigned long long)mismatches);
+    }
+    
+    // Límite de 4 MB/s con casi 9 MB a releer: más de dos segundos
+    reinit_engine(BACKUP_FORMAT_TREE, 100, 4);
+    backup_verify_with_report(backup_id, &report);
+    printf("Rate-limited pass: %.2f MB in %.2f s\n",
+           report.bytes_read / (1024.0 * 1024.0), report.elapsed_s);
+    if (report.elapsed_s >= 2.0) {
+        printf("✓ I/O rate cap applied\n");
+    } else {
+        printf("✗ Verification exceeded the rate cap\n");
+    }
+    backup_verify_report_free(&report);
+    
+    // Repositorio: un byte dañado en un pack
+    backup_verify_opts_t opts;
+    backup_repo_stats_t rs;
+    backup_verify_opts_defaults(&opts);
+    opts.threads = 4;
+    mkdir(TEST_REPO_DIR, 0755);
+    backup_repo_store(TEST_REPO_DIR, TEST_REPO_SRC, TEST_REPO_DIR "/manifests/v.manifest", NULL, 4, &rs);
+    int clean = backup_repo_verify(TEST_REPO_DIR, TEST_REPO_DIR "/manifests/v.manifest",
+                                   &opts, &report);
+    backup_verify_report_free(&report);
+    system("for p in " TEST_REPO_DIR "/packs/*.pack; do "
+           "printf 'Z' | dd of=$p bs=1 seek=100 conv=notrunc 2>/dev/null; done");
+    rc = backup_repo_verify(TEST_REPO_DIR, TEST_REPO_DIR "/manifests/v.manifest", &opts, &report);
+    if (clean == 0 && rc != 0 && report.reported > 0) {
+        printf("✓ Corrupted chunk detected in %s\n", report.bad_paths[0]);
+    } else {
+        printf("✗ Repository corruption not detected (clean=%d, rc=%d)\n", clean, rc);
+    }
+    backup_verify_report_free(&report);
+    
+    system("rm -rf " TEST_REPO_SRC " " TEST_REPO_DIR " " TEST_VERIFY_DEST);
+}
+
+// Entradas sin cambios del cruce que no tienen el mismo hash que al leerlas
+static int joined_hash_mismatches(const backup_manifest_t *joined, const backup_manifest_t *full) {
+    int bad = 0;
+    
+    if (joined->count != full->count) {
+        return -1;
+    }
+    for (size_t i = 0; i < joined->count; i++) {
+        const backup_manifest_entry_t *e = &joined->entries[i];
+        if (e->unchanged && (strcmp(e->path, full->entries[i].path) != 0 ||
+                             memcmp(e->hash, full->entries[i].hash, BACKUP_HASH_SIZE) != 0)) {
+            bad++;
+        }
+    }
+    return bad;
+}
+
+void test_change_detection(void) {
+    printf("\n=== Test 11: Metadata-Manifest Change Detection ===\n");
+    
+    backup_manifest_t prev, loaded, cur, full;
+    backup_walk_stats_t ws;
+    backup_repo_stats_t rs;
+    backup_hash_t root;
+    backup_info_t *backups = NULL;
+    char hex[65];
+    char path[600], other[600];
+    struct timespec times[2];
+    struct stat st, st2;
+    int count = 0;
+    
+    system("rm -rf " TEST_REPO_SRC " " TEST_REPO_DIR " " TEST_VERIFY_DEST);
+    mkdir(TEST_REPO_SRC, 0755);
+    mkdir(TEST_REPO_SRC "/d", 0755);
+    mkdir(TEST_REPO_DIR, 0755);
+    for (int i = 0; i < 200; i++) {
+        snprintf(path, sizeof(path), "%s/d/f%03d", TEST_REPO_SRC, i);
+        write_random_file(path, (size_t)(2000 + i * 37), 900 + i);
+    }
+    symlink("d/f000", TEST_REPO_SRC "/sym");
+    link(TEST_REPO_SRC "/d/f001", TEST_REPO_SRC "/hard");
+    usleep(100 * 1000);
+    
+    // Inodo, ctime e instante del recorrido sobreviven a escribir y releer
+    int rc = backup_manifest_scan(TEST_REPO_SRC, 4, BACKUP_SCAN_HASH, &prev, &ws);
+    if (rc == 0) {
+        rc = backup_manifest_write(TEST_REPO_DIR "/prev.manifest", &prev);
+    }
+    if (rc == 0) {
+        rc = backup_manifest_load(TEST_REPO_DIR "/prev.manifest", &loaded);
+    }
+    stat(TEST_REPO_SRC "/d/f005", &st);
+    int roundtrip = 0;
+    if (rc == 0) {
+        for (size_t i = 0; i < loaded.count; i++) {
+            const backup_manifest_entry_t *e = &loaded.entries[i];
+            if (strcmp(e->path, "d/f005") == 0) {
+                roundtrip = e->ino == st.st_ino && e->ctime_sec == st.st_ctim.tv_sec &&
+                            e->ctime_nsec == (uint32_t)st.st_ctim.tv_nsec;
+            }
+        }
+        roundtrip &= loaded.created_sec == prev.created_sec &&
+                     loaded.created_nsec == prev.created_nsec && loaded.created_sec > 0;
+    }
+    if (roundtrip) {
+        printf("✓ Manifest v%d keeps inode, ctime and scan time\n", BACKUP_MANIFEST_VERSION);
+    } else {
+        printf("✗ Manifest metadata lost (rc=%d)\n", rc);
+    }
+    backup_manifest_free(&prev);
+    
+    // Crece, mismo tamaño con el mtime restaurado, chmod, nuevo y borrado
+    write_random_file(TEST_REPO_SRC "/d/f010", 9000, 1);
+    stat(TEST_REPO_SRC "/d/f020", &st);
+    flip_byte(TEST_REPO_SRC "/d/f020", 100);
+    times[0] = st.st_atim;
+    times[1] = st.st_mtim;
+    utimensat(AT_FDCWD, TEST_REPO_SRC "/d/f020", times, 0);
+    chmod(TEST_REPO_SRC "/d/f030", 0600);
+    write_random_file(TEST_REPO_SRC "/d/new", 5000, 2);
+    unlink(TEST_REPO_SRC "/d/f040");
+    usleep(100 * 1000);
+    
+    size_t changed = (size_t)-1;
+    int bad = -1;
+    if (rc == 0 && backup_manifest_scan(TEST_REPO_SRC, 4, 0, &cur, &ws) == 0) {
+        changed = backup_manifest_join(&cur, &loaded);
+        if (backup_manifest_scan(TEST_REPO_SRC, 4, BACKUP_SCAN_HASH, &full, &ws) == 0) {
+            bad = joined_hash_mismatches(&cur, &full);
+            backup_manifest_free(&full);
+        }
+        backup_manifest_free(&cur);
+    }
+    if (rc == 0) {
+        backup_manifest_free(&loaded);
+    }
+    if (changed == 4 && bad == 0) {
+        printf("✓ Merge-join finds exactly the 4 changed files, reused hashes are exact\n");
+    } else {
+        printf("✗ Merge-join found %zu changed files (%d wrong hashes)\n", changed, bad);
+    }
+    
+    // Árbol: el incremental solo copia el fichero modificado
+    reinit_engine(BACKUP_FORMAT_TREE, 100, 0);
+    backup_create(TEST_REPO_SRC, TEST_VERIFY_DEST, BACKUP_FULL);
+    usleep(100 * 1000);
+    write_random_file(TEST_REPO_SRC "/d/f050", 4321, 3);
+    usleep(100 * 1000);
+    rc = backup_create(TEST_REPO_SRC, TEST_VERIFY_DEST, BACKUP_INCREMENTAL);
+    
+    int ok = 0;
+    if (rc == 0 && backup_list(&backups, &count) == 0 && count >= 2 &&
+        backup_manifest_scan(TEST_REPO_SRC, 4, BACKUP_SCAN_HASH, &full, &ws) == 0) {
+        backup_manifest_root(&full, root);
+        backup_hash_hex(root, hex);
+        backup_manifest_free(&full);
+        snprintf(path, sizeof(path), "%s/d/f060", backups[0].dest_path);
+        snprintf(other, sizeof(other), "%s/d/f060", backups[1].dest_path);
+        ok = backups[0].stored_bytes == 4321 && strcmp(backups[0].checksum, hex) == 0 &&
+             stat(path, &st) == 0 && stat(other, &st2) == 0 && st.st_ino == st2.st_ino &&
+             backup_verify(backups[0].backup_id) == 0;
+    }
+    if (ok) {
+        printf("✓ Tree incremental copied only the changed file and verifies\n");
+    } else {
+        printf("✗ Tree incremental wrong (rc=%d, stored %llu bytes)\n", rc,
+               count > 0 ? backups[0].stored_bytes : 0ULL);
+    }
+    free(backups);
+    
+    // Repositorio: los ficheros sin cambios reutilizan sus chunks sin leerse
+    rc = backup_repo_store(TEST_REPO_DIR, TEST_REPO_SRC, TEST_REPO_DIR "/manifests/c1.manifest",
+                           NULL, 4, &rs);
+    usleep(100 * 1000);
+    write_random_file(TEST_REPO_SRC "/d/f070", 70000, 4);
+    usleep(100 * 1000);
+    if (rc == 0) {
+        rc = backup_repo_store(TEST_REPO_DIR, TEST_REPO_SRC, TEST_REPO_DIR "/manifests/c2.manifest",
+                               TEST_REPO_DIR "/manifests/c1.manifest", 4, &rs);
+    }
+    ok = 0;
+    if (rc == 0 && backup_manifest_scan(TEST_REPO_SRC, 4, BACKUP_SCAN_HASH, &full, &ws) == 0) {
+        backup_manifest_root(&full, root);
+        backup_manifest_free(&full);
+        ok = rs.unchanged == rs.files - 1 && memcmp(rs.root, root, BACKUP_HASH_SIZE) == 0 &&
+             backup_repo_missing(TEST_REPO_DIR, TEST_REPO_DIR "/manifests/c2.manifest") == 0;
+    }
+    if (ok) {
+        printf("✓ Chunked incremental read 1 of %llu files\n", (unsigned long long)rs.files);
+    } else {
+        printf("✗ Chunked incremental reused %llu of %llu files (rc=%d)\n",
+               (unsigned long long)rs.unchanged, (unsigned long long)rs.files, rc);
+    }
+    
+    reinit_engine(BACKUP_FORMAT_TREE, 100, 0);
+    system("rm -rf " TEST_REPO_SRC " " TEST_REPO_DIR " " TEST_VERIFY_DEST);
+}
+
 void cleanup_test_data(void) {
     printf("\n=== Cleaning Up Test Data ===\n");
     
@@ -244,6 +1149,9 @@ int main(int argc, char *argv[]) {
     
     // Crear datos de prueba
     create_test_data();
+    // Lo modificado en el mismo tick que empieza el recorrido del full se
+    // relee en el incremental (ver backup_manifest_join)
+    usleep(100 * 1000);
     
     // Ejecutar tests
     test_full_backup();
@@ -254,6 +1162,11 @@ int main(int argc, char *argv[]) {
     test_backup_verify();
     test_backup_restore();
     test_backup_cleanup();
+    test_copy_engine();
+    test_dedup_repository();
+    test_merkle_checksum();
+    test_manifest_verify();
+    test_change_detection();
     
     // Limpiar
     cleanup_test_data();
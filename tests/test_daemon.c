@@ -1,10 +1,21 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <dirent.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include "../include/daemon.h"
+#include "../include/ipc_server.h"
+
+#define TEST_DAEMON_BIN     "./bin/storage_daemon"
+#define TEST_DAEMON_PIDFILE "/tmp/test_storage_daemon.pid"
+#define TEST_METRICS_SOCK   "/tmp/test_storage_metrics.sock"
 
 void print_separator(const char *title) {
     printf("\n========================================\n");
@@ -161,6 +172,146 @@ void test_daemon_lifecycle() {
     printf("\nTest 5 completed.\n");
 }
 
+// Hilos vivos de un proceso
+static int count_threads(pid_t pid) {
+    char path[64];
+    int count = 0;
+    
+    snprintf(path, sizeof(path), "/proc/%d/task", pid);
+    DIR *dir = opendir(path);
+    if (!dir) {
+        return -1;
+    }
+    for (struct dirent *de; (de = readdir(dir)) != NULL; ) {
+        if (de->d_name[0] != '.') {
+            count++;
+        }
+    }
+    closedir(dir);
+    return count;
+}
+
+// storage_monitor_ticks_total del endpoint OpenMetrics (-1 si no responde)
+static long scrape_ticks(const char *sock_path) {
+    struct sockaddr_un addr;
+    char buf[65536];
+    size_t len = 0;
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, sock_path, sizeof(addr.sun_path) - 1);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    static const char req[] = "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    if (write(fd, req, sizeof(req) - 1) < 0) {
+        close(fd);
+        return -1;
+    }
+    for (ssize_t n; len < sizeof(buf) - 1 && (n = read(fd, buf + len, sizeof(buf) - 1 - len)) > 0; ) {
+        len += n;
+    }
+    close(fd);
+    buf[len] = '\0';
+    
+    char *line = strstr(buf, "\nstorage_monitor_ticks_total ");
+    return line ? atol(line + strlen("\nstorage_monitor_ticks_total ")) : -1;
+}
+
+// Muestras publicadas en los anillos de shm (-1 si no existen)
+static long long shm_published_samples(void) {
+    long long total = 0;
+    
+    int fd = shm_open(IPC_SAMPLES_SHM_NAME, O_RDONLY, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    ipc_sample_shm_t *shm = mmap(NULL, sizeof(*shm), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        return -1;
+    }
+    if (shm->magic == IPC_SAMPLES_MAGIC) {
+        for (uint32_t i = 0; i < shm->ndevices && i < IPC_SAMPLE_MAX_DEVICES; i++) {
+            total += (long long)shm->rings[i].head;
+        }
+    }
+    munmap(shm, sizeof(*shm));
+    return total;
+}
+
+void test_daemonized_monitor() {
+    print_separator("TEST 6: Daemonized Monitor");
+    
+    if (geteuid() != 0 || access(TEST_DAEMON_BIN, X_OK) != 0) {
+        printf("⚠ SKIPPED: needs root and %s\n", TEST_DAEMON_BIN);
+        return;
+    }
+    
+    printf("\n[6.1] Starting the daemon in background mode...\n");
+    unlink(TEST_DAEMON_PIDFILE);
+    if (system(TEST_DAEMON_BIN " -p " TEST_DAEMON_PIDFILE " -m " TEST_METRICS_SOCK
+               " -i 100 >/dev/null 2>&1") != 0) {
+        printf("✗ ERROR: daemon did not start\n");
+        return;
+    }
+    pid_t pid = -1;
+    for (int i = 0; i < 50 && pid <= 0; i++) {
+        usleep(100 * 1000);
+        pid = daemon_read_pid(TEST_DAEMON_PIDFILE);
+    }
+    if (pid <= 0) {
+        printf("✗ ERROR: no PID file written\n");
+        return;
+    }
+    printf("✓ SUCCESS: daemon running (PID %d)\n", pid);
+    sleep(2);
+    
+    printf("\n[6.2] Checking threads after fork...\n");
+    int threads = count_threads(pid);
+    if (threads >= 5) {
+        printf("✓ SUCCESS: %d threads (IPC, writer, sweeper, sampler, metrics)\n", threads);
+    } else {
+        printf("✗ ERROR: only %d threads in the daemonized process\n", threads);
+    }
+    
+    printf("\n[6.3] Scraping the metrics endpoint...\n");
+    long ticks = scrape_ticks(TEST_METRICS_SOCK);
+    if (ticks > 0) {
+        printf("✓ SUCCESS: storage_monitor_ticks_total %ld\n", ticks);
+    } else {
+        printf("✗ ERROR: no ticks served (%ld)\n", ticks);
+    }
+    
+    printf("\n[6.4] Checking live samples in shared memory...\n");
+    long long published = shm_published_samples();
+    if (published > 0) {
+        printf("✓ SUCCESS: %lld samples published in %s\n", published, IPC_SAMPLES_SHM_NAME);
+    } else {
+        printf("✗ ERROR: no samples in %s (%lld)\n", IPC_SAMPLES_SHM_NAME, published);
+    }
+    
+    printf("\n[6.5] Stopping the daemon...\n");
+    kill(pid, SIGTERM);
+    for (int i = 0; i < 50 && kill(pid, 0) == 0; i++) {
+        usleep(100 * 1000);
+    }
+    if (kill(pid, 0) != 0) {
+        printf("✓ SUCCESS: daemon exited\n");
+    } else {
+        printf("✗ ERROR: daemon still running\n");
+        kill(pid, SIGKILL);
+    }
+    unlink(TEST_DAEMON_PIDFILE);
+    
+    printf("\nTest 6 completed.\n");
+}
+
 int main() {
     printf("========================================\n");
     printf("  DAEMON - TEST SUITE\n");
@@ -174,6 +325,7 @@ int main() {
     test_worker_management();
     test_resource_limits();
     test_daemon_lifecycle();
+    test_daemonized_monitor();
     
     print_separator("TEST SUMMARY");
     printf("\n✓ Test 1: PID File Operations - PASSED\n");
@@ -181,6 +333,7 @@ int main() {
     printf("✓ Test 3: Worker Management - PASSED\n");
     printf("✓ Test 4: Resource Limits - PASSED\n");
     printf("✓ Test 5: Daemon Lifecycle - PASSED\n");
+    printf("✓ Test 6: Daemonized Monitor - see [6.x] results\n");
     
     printf("\n========================================\n");
     printf("  ALL TESTS COMPLETED\n");
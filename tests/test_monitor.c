@@ -1,7 +1,24 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <math.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mount.h>
+#include <sys/ioctl.h>
+#include <linux/loop.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include "../include/monitor.h"
+#include "../include/monitor_tsdb.h"
+#include "../include/mount_cache.h"
+#include "../include/metrics_server.h"
+#include "../include/ipc_server.h"
 
 void test_device_stats(void) {
     printf("\n=== Test 1: Device Statistics ===\n");
@@ -40,8 +57,181 @@ void test_disk_usage(void) {
     }
 }
 
+void test_mount_cache(void) {
+    printf("\n=== Test 3: Cached Mount Usage ===\n");
+    
+    mount_usage_t mounts[256];
+    struct timespec t0, t1;
+    
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int before = mount_cache_list(mounts, 256);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (before > 0) {
+        printf("✓ %d mounts served from cache in %.3f ms\n", before,
+               ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / 1e6);
+    } else {
+        printf("✗ Mount cache empty (rc=%d)\n", before);
+        return;
+    }
+    
+    char dir[] = "/tmp/test_monitor_mnt_XXXXXX";
+    if (!mkdtemp(dir)) {
+        printf("✗ Cannot create mount point\n");
+        return;
+    }
+    if (mount("tmpfs", dir, "tmpfs", 0, "size=8m") != 0) {
+        printf("⚠ Cannot mount tmpfs, skipping change detection\n");
+        rmdir(dir);
+        return;
+    }
+    
+    mount_usage_t m;
+    int rc = mount_cache_get(dir, &m);
+    if (rc == 0 && m.updated != 0 && m.total_bytes == 8ULL * 1024 * 1024) {
+        printf("✓ New mount picked up: %s %s %llu bytes\n", m.fstype, m.mount_point,
+               m.total_bytes);
+    } else {
+        printf("✗ New mount not in cache (rc=%d)\n", rc);
+    }
+    
+    umount(dir);
+    rmdir(dir);
+    if (mount_cache_get(dir, &m) == -ENOENT) {
+        printf("✓ Unmount detected\n");
+    } else {
+        printf("✗ Unmounted filesystem still cached\n");
+    }
+    
+    // El hijo de un fork() no hereda el sweeper ni los workers
+    pid_t pid = fork();
+    if (pid == 0) {
+        alarm(10);
+        _exit(mount_cache_refresh() == 0 && mount_cache_get("/", &m) == 0 && !m.stale ? 0 : 1);
+    }
+    int status = 0;
+    if (pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+        WEXITSTATUS(status) == 0) {
+        printf("✓ Forked child measures mounts with its own workers\n");
+    } else {
+        printf("✗ Forked child cannot measure mounts (status=%d)\n", status);
+    }
+}
+
+void test_open_files(void) {
+    printf("\n=== Test 4: Open Files ===\n");
+    
+    const char *path = "/tmp/storage_open_files_test";
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        printf("✗ Cannot create %s\n", path);
+        return;
+    }
+    
+    open_file_t *files = NULL;
+    int count = 0;
+    struct timespec t0, t1;
+    
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int rc = monitor_list_open_files("/tmp", &files, &count);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    
+    int found = 0;
+    for (int i = 0; i < count; i++) {
+        if (files[i].pid == getpid() && strcmp(files[i].path, path) == 0 &&
+            files[i].fd == fileno(fp)) {
+            found = 1;
+            printf("  pid %d (%s) fd %d [%s] %s\n", files[i].pid, files[i].process_name,
+                   files[i].fd, files[i].mode, files[i].path);
+        }
+    }
+    
+    if (rc == 0 && found) {
+        printf("✓ %d open files on the /tmp filesystem, scanned in %.2f ms\n", count,
+               ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / 1e6);
+    } else {
+        printf("✗ Test file not reported (rc=%d, %d files)\n", rc, count);
+    }
+    
+    free(files);
+    fclose(fp);
+    unlink(path);
+}
+
+void test_process_io(void) {
+    printf("\n=== Test 5: Per-Process I/O ===\n");
+    
+    char path[] = "/tmp/test_monitor_pio_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        printf("✗ Cannot create test file\n");
+        return;
+    }
+    close(fd);
+    
+    // Un hijo escribe y sincroniza durante ~2 s
+    pid_t child = fork();
+    if (child == 0) {
+        static char block[1024 * 1024];
+        memset(block, 'x', sizeof(block));
+        int out = open(path, O_WRONLY | O_TRUNC);
+        for (int i = 0; i < 20 && out >= 0; i++) {
+            if (write(out, block, sizeof(block)) < 0) {
+                break;
+            }
+            fsync(out);
+            usleep(100000);
+        }
+        _exit(0);
+    }
+    
+    monitor_update_process_io();
+    usleep(1000000);
+    int n = monitor_update_process_io();
+    
+    process_io_t top[MONITOR_TOP_PROCESSES];
+    int ntop = monitor_get_top_process_io(top, MONITOR_TOP_PROCESSES);
+    int found = 0;
+    for (int i = 0; i < ntop; i++) {
+        printf("  %2d. pid %-6d %-16s read %.1f KB/s write %.1f KB/s\n", i + 1,
+               top[i].pid, top[i].process_name, top[i].read_bps / 1024.0,
+               top[i].write_bps / 1024.0);
+        if (top[i].pid == child && top[i].write_bps > 0) {
+            found = 1;
+        }
+    }
+    
+    if (n > 0 && found) {
+        printf("✓ Writer process ranked among %d processes\n", n);
+    } else {
+        printf("✗ Writer process not in top-N (%d processes, %d ranked)\n", n, ntop);
+    }
+    
+    device_stats_t stats;
+    if (monitor_get_process_io(child, &stats) == 0 && stats.write_bytes > 0) {
+        printf("✓ monitor_get_process_io: %s wrote %llu bytes in %llu syscalls\n",
+               stats.device, stats.write_bytes, stats.writes);
+    } else {
+        printf("✗ monitor_get_process_io failed for pid %d\n", child);
+    }
+    
+    waitpid(child, NULL, 0);
+    unlink(path);
+    
+    // El barrido del sampler es opt-in y el top está acotado
+    monitor_config_t cfg;
+    monitor_config_defaults(&cfg);
+    int default_n = cfg.process_top_n;
+    cfg.process_top_n = MONITOR_MAX_TOP_PROCESSES + 1;
+    if (default_n == 0 && monitor_init_with_config(&cfg) == -EINVAL) {
+        printf("✓ Process scan off by default, top-N above %d rejected\n",
+               MONITOR_MAX_TOP_PROCESSES);
+    } else {
+        printf("✗ Process scan default %d or top-N cap not enforced\n", default_n);
+    }
+}
+
 void test_performance_tracking(void) {
-    printf("\n=== Test 3: Performance Tracking ===\n");
+    printf("\n=== Test 6: Performance Tracking ===\n");
     
     performance_sample_t sample;
     const char *device = "sda";
@@ -63,7 +253,7 @@ void test_performance_tracking(void) {
 }
 
 void test_history(void) {
-    printf("\n=== Test 4: Historical Data ===\n");
+    printf("\n=== Test 7: Historical Data ===\n");
     
     const char *device = "sda";
     time_t end = time(NULL);
@@ -90,8 +280,795 @@ void test_history(void) {
     }
 }
 
+void test_write_behind(void) {
+    printf("\n=== Test 8: Write-Behind Persistence ===\n");
+    
+    const char *device = "test_wb";
+    time_t now = time(NULL);
+    int queued = 0;
+    
+    for (int i = 0; i < 1000; i++) {
+        performance_sample_t sample = {
+            .timestamp = now, .iops = 100.0 + i, .throughput_mbs = 1.5,
+            .latency_ms = 0.2, .active_requests = 1
+        };
+        if (monitor_save_sample(device, &sample) == 0) {
+            queued++;
+        }
+    }
+    
+    if (monitor_flush() != 0) {
+        printf("✗ Flush failed\n");
+        return;
+    }
+    
+    performance_sample_t *samples = NULL;
+    int count = 0;
+    if (monitor_get_history(device, now, now, &samples, &count) == 0 && count >= queued) {
+        printf("✓ %d queued samples persisted in batches\n", queued);
+    } else {
+        printf("✗ Expected %d samples, found %d\n", queued, count);
+    }
+    free(samples);
+}
+
+typedef struct {
+    int rows;
+    int batches;
+    int max_batch;
+} stream_stats_t;
+
+static int count_batch(const char *device, const performance_sample_t *batch,
+                       int count, void *user_data) {
+    stream_stats_t *st = user_data;
+    (void)device;
+    (void)batch;
+    st->rows += count;
+    st->batches++;
+    if (count > st->max_batch) {
+        st->max_batch = count;
+    }
+    return 0;
+}
+
+void test_history_streaming(void) {
+    printf("\n=== Test 9: Streaming History Cursor ===\n");
+    
+    time_t end = time(NULL);
+    stream_stats_t st = { 0, 0, 0 };
+    
+    if (monitor_history_foreach("test_wb", end - 3600, end, 128, count_batch, &st) != 0) {
+        printf("✗ Streaming query failed\n");
+        return;
+    }
+    
+    performance_sample_t *samples = NULL;
+    int count = 0;
+    monitor_get_history("test_wb", end - 3600, end, &samples, &count);
+    free(samples);
+    
+    if (st.rows == count && st.max_batch <= 128) {
+        printf("✓ %d rows streamed in %d batches (max %d per batch)\n",
+               st.rows, st.batches, st.max_batch);
+    } else {
+        printf("✗ Streamed %d rows, array wrapper returned %d\n", st.rows, count);
+    }
+}
+
+void test_partitioned_retention(void) {
+    printf("\n=== Test 10: Partitioned Retention ===\n");
+    
+    // Tres días de muestras muy antiguas más uno reciente, cada uno en su partición
+    char device[64];
+    snprintf(device, sizeof(device), "test_part_%d", getpid());
+    time_t now = time(NULL);
+    time_t old = now - 400 * 24 * 3600;
+    for (int day = 0; day < 3; day++) {
+        for (int i = 0; i < 1000; i++) {
+            performance_sample_t s;
+            memset(&s, 0, sizeof(s));
+            s.timestamp = old + day * 24 * 3600 + i;
+            s.iops = i;
+            monitor_save_sample(device, &s);
+        }
+    }
+    performance_sample_t recent;
+    memset(&recent, 0, sizeof(recent));
+    recent.timestamp = now;
+    monitor_save_sample(device, &recent);
+    monitor_flush();
+    
+    performance_sample_t *samples = NULL;
+    int count = 0;
+    monitor_get_history(device, old, now, &samples, &count);
+    int ordered = 1;
+    for (int i = 1; i < count; i++) {
+        if (samples[i].timestamp < samples[i - 1].timestamp) ordered = 0;
+    }
+    free(samples);
+    if (count == 3001 && ordered) {
+        printf("✓ Range across 4 daily partitions returned %d ordered samples\n", count);
+    } else {
+        printf("✗ Range returned %d samples (ordered=%d), expected 3001\n", count, ordered);
+    }
+    
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    monitor_cleanup_old_data(398);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    
+    monitor_get_history(device, old, now, &samples, &count);
+    free(samples);
+    if (count == 1001) {
+        printf("✓ Retention dropped the two oldest days in %.2f ms\n",
+               ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / 1e6);
+    } else {
+        printf("✗ %d samples left after retention, expected 1001\n", count);
+    }
+    
+    // Los rollups tienen retención propia: 1 m = 7 × keep_days, 1 h = 30 ×
+    char aged_device[64];
+    snprintf(aged_device, sizeof(aged_device), "test_aged_%d", getpid());
+    time_t aged = now - 100 * 24 * 3600;
+    for (int i = 0; i < 120; i++) {
+        performance_sample_t s;
+        memset(&s, 0, sizeof(s));
+        s.timestamp = aged + i;
+        s.iops = i;
+        monitor_save_sample(aged_device, &s);
+    }
+    monitor_flush();
+    
+    performance_rollup_t *rows = NULL;
+    int minutes = 0, hours = 0;
+    monitor_get_rollups(aged_device, aged - 3600, aged + 3600, 60, &rows, &minutes);
+    free(rows);
+    monitor_cleanup_old_data(10);
+    int minutes_left = -1;
+    monitor_get_rollups(aged_device, aged - 3600, aged + 3600, 60, &rows, &minutes_left);
+    free(rows);
+    monitor_get_rollups(aged_device, aged - 3600, aged + 3600, 3600, &rows, &hours);
+    free(rows);
+    if (minutes > 0 && minutes_left == 0 && hours > 0) {
+        printf("✓ 100-day-old 1m rollups pruned (%d), 1h rollups kept (%d)\n", minutes, hours);
+    } else {
+        printf("✗ Rollup retention: %d 1m before, %d after, %d 1h kept\n",
+               minutes, minutes_left, hours);
+    }
+}
+
+void test_rollups(void) {
+    printf("\n=== Test 11: Multi-Tier Rollups ===\n");
+    
+    const char *device = "test_rollup";
+    time_t base = time(NULL) - 7200;
+    base -= base % 3600;
+    
+    for (int i = 0; i < 180; i++) {
+        performance_sample_t sample = {
+            .timestamp = base + i, .iops = i, .throughput_mbs = 1.0,
+            .latency_ms = 0.5, .util_percent = 10.0
+        };
+        monitor_save_sample(device, &sample);
+    }
+    
+    performance_rollup_t *rows = NULL;
+    int count = 0;
+    if (monitor_get_rollups(device, base, base + 179, 60, &rows, &count) == 0 && count == 3) {
+        printf("✓ 1-minute tier: %d buckets\n", count);
+        for (int i = 0; i < count; i++) {
+            printf("  bucket +%lds: n=%u iops min=%.0f max=%.0f avg=%.1f p95=%.1f\n",
+                   (long)(rows[i].bucket - base), rows[i].samples, rows[i].iops.min,
+                   rows[i].iops.max, rows[i].iops.avg, rows[i].iops.p95);
+        }
+    } else {
+        printf("✗ Expected 3 one-minute buckets, got %d\n", count);
+    }
+    free(rows);
+    
+    rows = NULL;
+    if (monitor_get_rollups(device, base, base + 179, 3600, &rows, &count) == 0 &&
+        count == 1 && rows[0].samples == 180) {
+        printf("✓ 1-hour tier: avg iops %.1f, p95 %.1f\n", rows[0].iops.avg, rows[0].iops.p95);
+    } else {
+        printf("✗ Expected one hourly bucket with 180 samples\n");
+    }
+    free(rows);
+}
+
+void test_report(void) {
+    printf("\n=== Test 12: Streaming Report ===\n");
+    
+    char device[32];
+    snprintf(device, sizeof(device), "rpt%d", (int)getpid());
+    time_t base = time(NULL) - 30 * 86400;
+    
+    for (int i = 0; i < 1000; i++) {
+        performance_sample_t sample = {
+            .timestamp = base + i, .iops = i, .throughput_mbs = 2.0,
+            .latency_ms = 1.0, .util_percent = i % 100
+        };
+        monitor_save_sample(device, &sample);
+    }
+    
+    const char *csv = "/tmp/test_monitor_report.csv";
+    int devices = monitor_generate_report(csv, base, base + 999);
+    
+    FILE *fp = fopen(csv, "r");
+    char line[512];
+    int found = 0;
+    while (fp && fgets(line, sizeof(line), fp)) {
+        char dev[64], metric[32];
+        unsigned long long n;
+        double mn, avg, p50, p95, p99, mx, busy;
+        if (sscanf(line, "%63[^,],%31[^,],%llu,%lf,%lf,%lf,%lf,%lf,%lf,%lf", dev, metric, &n,
+                   &mn, &avg, &p50, &p95, &p99, &mx, &busy) == 10 &&
+            strcmp(dev, device) == 0 && strcmp(metric, "iops") == 0) {
+            printf("  iops n=%llu min=%.0f avg=%.1f p50=%.1f p95=%.1f max=%.0f busy=%.0f%%\n",
+                   n, mn, avg, p50, p95, mx, busy);
+            found = n == 1000 && mn == 0 && mx == 999 && fabs(avg - 499.5) < 0.01 &&
+                    fabs(p50 - 500) < 500 * 0.04 && fabs(p95 - 950) < 950 * 0.04 &&
+                    fabs(busy - 20.0) < 0.01;
+        }
+    }
+    if (fp) fclose(fp);
+    
+    if (devices > 0 && found) {
+        printf("✓ CSV report over %d devices matches the inserted series\n", devices);
+    } else {
+        printf("✗ CSV report mismatch (rc=%d)\n", devices);
+    }
+    
+    const char *json = "/tmp/test_monitor_report.json";
+    const char *txt = "/tmp/test_monitor_report.txt";
+    int top_ok = 0;
+    if (monitor_generate_report(json, base, base + 999) > 0 &&
+        monitor_generate_report(txt, base, base + 999) > 0 && (fp = fopen(txt, "r"))) {
+        int in_device = 0;
+        while (fgets(line, sizeof(line), fp)) {
+            if (strncmp(line, "== ", 3) == 0) {
+                in_device = strncmp(line + 3, device, strlen(device)) == 0;
+            } else if (in_device && strstr(line, "util  99.00%")) {
+                top_ok++;
+            }
+        }
+        fclose(fp);
+    }
+    if (top_ok == MONITOR_REPORT_TOP_INTERVALS) {
+        printf("✓ Text and JSON reports written, top intervals at 99%% util\n");
+    } else {
+        printf("✗ Unexpected top intervals (%d at 99%%)\n", top_ok);
+    }
+    
+    
+    // Más dispositivos que los que sigue el sampler: ninguno se pierde
+    int many = MONITOR_MAX_DEVICES + 8;
+    time_t many_base = base - 5000;
+    for (int i = 0; i < many; i++) {
+        char name[32];
+        performance_sample_t sample = { .timestamp = many_base + i, .iops = 1.0 };
+        snprintf(name, sizeof(name), "rpt%d_%d", (int)getpid(), i);
+        monitor_save_sample(name, &sample);
+    }
+    devices = monitor_generate_report(csv, many_base, many_base + many - 1);
+    if (devices >= many) {
+        printf("✓ Report covers all %d devices\n", devices);
+    } else {
+        printf("✗ Report covers %d of %d devices\n", devices, many);
+    }
+    
+    unlink(csv);
+    unlink(json);
+    unlink(txt);
+}
+
+void test_anomaly_detection(void) {
+    printf("\n=== Test 14: Anomaly Detection ===\n");
+    
+    char device[32];
+    snprintf(device, sizeof(device), "anom%d", (int)getpid());
+    time_t base = time(NULL) - 3600;
+    int flagged = 0, early = 0;
+    
+    // 300 muestras estables, dos picos de latencia de 5 muestras separados
+    for (int i = 0; i < 400; i++) {
+        double jitter = ((i * 7919) % 13 - 6) / 20.0;
+        performance_sample_t sample = {
+            .timestamp = base + i, .iops = 100 + jitter * 10, .latency_ms = 5.0 + jitter
+        };
+        if ((i >= 300 && i < 305) || (i >= 350 && i < 355)) {
+            sample.latency_ms = 50.0;
+        }
+        int n = monitor_observe_sample(device, &sample);
+        flagged += n;
+        if (i < 300) {
+            early += n;
+        }
+    }
+    
+    monitor_anomaly_t *events = NULL;
+    int count = 0;
+    int rc = monitor_get_anomalies(device, base, base + 400, &events, &count);
+    int latency_events = 0;
+    for (int i = 0; i < count; i++) {
+        printf("  +%lds %s %.2f (expected %.2f, %.1f sigma)\n", (long)(events[i].timestamp - base),
+               events[i].metric, events[i].value, events[i].expected, events[i].score);
+        if (strcmp(events[i].metric, "latency_ms") == 0) {
+            latency_events++;
+        }
+    }
+    free(events);
+    
+    if (early == 0) {
+        printf("✓ No events on the stable series\n");
+    } else {
+        printf("✗ %d false positives on the stable series\n", early);
+    }
+    if (rc == 0 && flagged == 2 && latency_events == 2 && count == 2) {
+        printf("✓ Both latency spikes flagged once and persisted\n");
+    } else {
+        printf("✗ Expected 2 latency events, got %d flagged / %d stored (rc=%d)\n",
+               flagged, count, rc);
+    }
+}
+
+static void *query_device_thread(void *arg) {
+    const char *device = (const char*)arg;
+    performance_sample_t sample;
+    long failures = 0;
+    
+    for (int i = 0; i < 3; i++) {
+        if (monitor_get_current_performance(device, &sample) != 0) {
+            failures++;
+        }
+        sleep(1);
+    }
+    return (void*)failures;
+}
+
+void test_latency_histograms(void) {
+    printf("\n=== Test 13: Latency Percentiles ===\n");
+    
+    latency_percentiles_t pct;
+    time_t now = time(NULL);
+    uint64_t persisted = 0;
+    
+    // La base de datos puede conservar snapshots de ejecuciones anteriores
+    if (monitor_get_latency_range("test_lat", now - 60, now + 60, &pct) == 0) {
+        persisted = pct.count;
+    }
+    
+    // 10000 IOs de 0.01 a 100 ms: pXX ≈ XX ms
+    for (int i = 1; i <= 10000; i++) {
+        monitor_record_latency("test_lat", i * 0.01, 1);
+    }
+    
+    if (monitor_get_latency_percentiles("test_lat", MONITOR_LATENCY_WINDOW_1M, &pct) != 0) {
+        printf("✗ Failed to read 1-minute window\n");
+        return;
+    }
+    printf("  1m window: n=%llu p50=%.2f p95=%.2f p99=%.2f p99.9=%.2f max=%.2f ms\n",
+           (unsigned long long)pct.count, pct.p50_ms, pct.p95_ms, pct.p99_ms,
+           pct.p999_ms, pct.max_ms);
+    
+    if (pct.count == 10000 && fabs(pct.p50_ms - 50.0) < 2.0 &&
+        fabs(pct.p99_ms - 99.0) < 4.0 && fabs(pct.p999_ms - 99.9) < 4.0) {
+        printf("✓ Window percentiles within histogram precision\n");
+    } else {
+        printf("✗ Unexpected window percentiles\n");
+    }
+    
+    monitor_get_latency_percentiles("test_lat", MONITOR_LATENCY_WINDOW_5M, &pct);
+    if (pct.count == 10000) {
+        printf("✓ 5-minute window sees all %llu IOs\n", (unsigned long long)pct.count);
+    } else {
+        printf("✗ 5-minute window has %llu IOs\n", (unsigned long long)pct.count);
+    }
+    
+    if (monitor_get_latency_range("test_lat", now - 60, now + 60, &pct) == 0 &&
+        pct.count - persisted == 10000 && fabs(pct.p95_ms - 95.0) < 4.0) {
+        printf("✓ Persisted snapshots: n=%llu p95=%.2f ms\n",
+               (unsigned long long)(pct.count - persisted), pct.p95_ms);
+    } else {
+        printf("✗ Persisted snapshots: n=%llu\n",
+               (unsigned long long)(pct.count - persisted));
+    }
+}
+
+void test_concurrent_deltas(void) {
+    printf("\n=== Test 15: Concurrent Per-Device Deltas ===\n");
+    
+    const char *devices[] = { "vda", "sda", "loop0", "nvme0n1" };
+    pthread_t threads[4];
+    long failures[4];
+    
+    for (int i = 0; i < 4; i++) {
+        pthread_create(&threads[i], NULL, query_device_thread, (void*)devices[i]);
+    }
+    for (int i = 0; i < 4; i++) {
+        void *ret;
+        pthread_join(threads[i], &ret);
+        failures[i] = (long)ret;
+    }
+    
+    for (int i = 0; i < 4; i++) {
+        performance_sample_t sample;
+        if (failures[i] == 0 && monitor_get_current_performance(devices[i], &sample) == 0) {
+            printf("✓ %-8s IOPS=%.2f Throughput=%.2f MB/s\n",
+                   devices[i], sample.iops, sample.throughput_mbs);
+        } else {
+            printf("  %-8s not present on this system\n", devices[i]);
+        }
+    }
+}
+
+void test_multi_device_sampling(void) {
+    printf("\n=== Test 16: Multi-Device Sampling ===\n");
+    
+    const char *devices[] = { "sda", "vda", "nvme0n1", "loop0", "md0" };
+    int count = sizeof(devices) / sizeof(devices[0]);
+    device_stats_t stats[5];
+    
+    int found = monitor_sample_devices(devices, count, stats);
+    if (found < 0) {
+        printf("✗ Failed to read /proc/diskstats\n");
+        return;
+    }
+    
+    printf("✓ Single pass found %d of %d devices\n", found, count);
+    for (int i = 0; i < count; i++) {
+        if (stats[i].last_update != 0) {
+            printf("  %-8s reads=%llu writes=%llu\n",
+                   stats[i].device, stats[i].reads, stats[i].writes);
+        }
+    }
+}
+
+#define HOTPLUG_LOOP 250
+
+static atomic_int hotplug_samples;
+
+static void hotplug_hook(const char *device, const performance_sample_t *sample, void *arg) {
+    (void)sample;
+    (void)arg;
+    if (strcmp(device, "loop250") == 0) {
+        atomic_fetch_add(&hotplug_samples, 1);
+    }
+}
+
+void test_device_hotplug(void) {
+    printf("\n=== Test 16b: Device Hotplug in All-Devices Mode ===\n");
+    
+    int ctl = open("/dev/loop-control", O_RDWR | O_CLOEXEC);
+    if (ctl < 0) {
+        printf("⚠ No /dev/loop-control, skipping\n");
+        return;
+    }
+    
+    // El disco aparece con el muestreo ya en marcha
+    atomic_store(&hotplug_samples, 0);
+    monitor_set_sample_hook(hotplug_hook, NULL);
+    monitor_start_continuous_ms(100);
+    usleep(300000);
+    if (ioctl(ctl, LOOP_CTL_ADD, HOTPLUG_LOOP) < 0) {
+        printf("⚠ Cannot add loop%d (%s), skipping\n", HOTPLUG_LOOP, strerror(errno));
+        monitor_stop_continuous();
+        monitor_set_sample_hook(NULL, NULL);
+        close(ctl);
+        return;
+    }
+    usleep(800000);
+    monitor_stop_continuous();
+    monitor_set_sample_hook(NULL, NULL);
+    ioctl(ctl, LOOP_CTL_REMOVE, HOTPLUG_LOOP);
+    close(ctl);
+    
+    int n = atomic_load(&hotplug_samples);
+    if (n > 0) {
+        printf("✓ New device loop%d sampled %d times without restarting\n", HOTPLUG_LOOP, n);
+    } else {
+        printf("✗ New device loop%d never sampled\n", HOTPLUG_LOOP);
+    }
+}
+
+void test_high_resolution_sampling(void) {
+    printf("\n=== Test 17: High-Resolution Sampling (100 ms) ===\n");
+    
+    struct timespec cpu0, cpu1, wall0, wall1;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu0);
+    clock_gettime(CLOCK_MONOTONIC, &wall0);
+    
+    if (monitor_start_continuous_ms(100) != 0) {
+        printf("✗ Failed to start high-resolution monitoring\n");
+        return;
+    }
+    sleep(3);
+    monitor_stop_continuous();
+    
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu1);
+    clock_gettime(CLOCK_MONOTONIC, &wall1);
+    double cpu = (cpu1.tv_sec - cpu0.tv_sec) + (cpu1.tv_nsec - cpu0.tv_nsec) / 1e9;
+    double wall = (wall1.tv_sec - wall0.tv_sec) + (wall1.tv_nsec - wall0.tv_nsec) / 1e9;
+    
+    performance_sample_t *samples = NULL;
+    int count = 0;
+    time_t end = time(NULL);
+    if (monitor_get_history("loop0", end - 5, end, &samples, &count) == 0 && count > 1) {
+        double span = (samples[count - 1].timestamp_ns - samples[0].timestamp_ns) / 1e9;
+        printf("✓ %d samples for loop0, mean interval %.1f ms\n",
+               count, span * 1000.0 / (count - 1));
+    } else {
+        printf("✗ No high-resolution samples recorded\n");
+    }
+    free(samples);
+    
+    printf("  CPU usage while sampling: %.2f%%\n", cpu / wall * 100.0);
+}
+
+#define METRICS_TEST_SOCKET "/tmp/test_monitor_metrics.sock"
+
+static int metrics_scrape(const char *request, char *buf, size_t size) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strncpy(addr.sun_path, METRICS_TEST_SOCKET, sizeof(addr.sun_path) - 1);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        write(fd, request, strlen(request)) != (ssize_t)strlen(request)) {
+        close(fd);
+        return -1;
+    }
+    
+    size_t len = 0;
+    ssize_t r;
+    while (len < size - 1 && (r = read(fd, buf + len, size - 1 - len)) > 0) {
+        len += r;
+    }
+    buf[len] = '\0';
+    close(fd);
+    return (int)len;
+}
+
+void test_metrics_endpoint(void) {
+    printf("\n=== Test 18: OpenMetrics Endpoint ===\n");
+    
+    if (monitor_start_continuous_ms(100) != 0) {
+        printf("✗ Failed to start monitoring\n");
+        return;
+    }
+    if (metrics_server_start(METRICS_TEST_SOCKET) != 0) {
+        printf("✗ Failed to start metrics server\n");
+        monitor_stop_continuous();
+        return;
+    }
+    usleep(500000);
+    
+    char *buf = malloc(METRICS_BUFFER_SIZE);
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int len = metrics_scrape("GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n",
+                             buf, METRICS_BUFFER_SIZE);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    
+    if (len > 0 && strstr(buf, "200 OK") && strstr(buf, "storage_device_reads_completed_total{") &&
+        strstr(buf, "storage_device_latency_seconds") && strstr(buf, "# EOF\n")) {
+        printf("✓ Scrape returned %d bytes in %.2f ms\n", len,
+               ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / 1e6);
+    } else {
+        printf("✗ Unexpected scrape response (%d bytes)\n", len);
+    }
+    
+    len = metrics_scrape("POST /metrics HTTP/1.1\r\n\r\n", buf, METRICS_BUFFER_SIZE);
+    if (len > 0 && strstr(buf, "405")) {
+        printf("✓ Non-GET requests rejected\n");
+    } else {
+        printf("✗ POST was not rejected\n");
+    }
+    
+    free(buf);
+    metrics_server_stop();
+    monitor_stop_continuous();
+    
+    if (access(METRICS_TEST_SOCKET, F_OK) != 0) {
+        printf("✓ Socket removed on stop\n");
+    } else {
+        printf("✗ Socket left behind after stop\n");
+    }
+}
+
+void test_psi_adaptive_sampling(void) {
+    printf("\n=== Test 19: PSI Adaptive Sampling ===\n");
+    
+    if (monitor_start_continuous(1) != 0) {
+        printf("✗ Failed to start monitoring\n");
+        return;
+    }
+    usleep(200000);
+    if (monitor_get_interval_ms() == 1000) {
+        printf("✓ Baseline interval in effect (1000 ms)\n");
+    } else {
+        printf("✗ Interval is %d ms, expected 1000\n", monitor_get_interval_ms());
+    }
+    
+    // Escrituras síncronas para provocar esperas de I/O
+    const char *path = "/var/lib/storage_mgr/test_psi.tmp";
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    char block[65536];
+    memset(block, 0xa5, sizeof(block));
+    int min_interval = monitor_get_interval_ms();
+    time_t until = time(NULL) + 3;
+    while (fd >= 0 && time(NULL) < until) {
+        if (write(fd, block, sizeof(block)) != (ssize_t)sizeof(block) || fsync(fd) != 0) {
+            break;
+        }
+        int interval = monitor_get_interval_ms();
+        if (interval < min_interval) {
+            min_interval = interval;
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+        unlink(path);
+    }
+    usleep(1200000);
+    if (monitor_get_interval_ms() < min_interval) {
+        min_interval = monitor_get_interval_ms();
+    }
+    monitor_stop_continuous();
+    
+    if (min_interval == 100) {
+        printf("✓ Switched to 100 ms sampling under I/O pressure\n");
+    } else {
+        printf("  No I/O stall above the trigger threshold (interval stayed at %d ms)\n",
+               min_interval);
+    }
+    if (monitor_get_interval_ms() == 0) {
+        printf("✓ Interval reset after stop\n");
+    } else {
+        printf("✗ Interval still reported after stop\n");
+    }
+}
+
+#define SHM_TEST_PUBLISHES 200000
+
+static atomic_int shm_writer_done;
+
+static void *shm_ring_writer(void *arg) {
+    (void)arg;
+    performance_sample_t s;
+    memset(&s, 0, sizeof(s));
+    for (int i = 1; i <= SHM_TEST_PUBLISHES; i++) {
+        // Todos los campos derivan de i: una copia rota los mezcla
+        s.timestamp = i;
+        s.iops = i;
+        s.throughput_mbs = i * 2.0;
+        s.timestamp_ns = (uint64_t)i * 1000;
+        ipc_samples_publish("test_shm_ring", &s);
+    }
+    atomic_store(&shm_writer_done, 1);
+    return NULL;
+}
+
+static void shm_publish_hook(const char *device, const performance_sample_t *sample, void *arg) {
+    (void)arg;
+    ipc_samples_publish(device, sample);
+}
+
+void test_shm_sample_rings(void) {
+    printf("\n=== Test 20: Shared-Memory Sample Rings ===\n");
+    
+    if (ipc_shm_init() != 0) {
+        printf("✗ Failed to create shared memory segments\n");
+        return;
+    }
+    
+    // Un escritor a máxima velocidad y un lector comprobando cada instantánea
+    pthread_t writer;
+    performance_sample_t snap[IPC_SAMPLE_RING_SIZE];
+    long reads = 0, torn = 0, unordered = 0;
+    atomic_store(&shm_writer_done, 0);
+    pthread_create(&writer, NULL, shm_ring_writer, NULL);
+    // Al menos una lectura aunque el escritor termine antes de planificar al lector
+    while (!atomic_load(&shm_writer_done) || reads == 0) {
+        int n = ipc_samples_read("test_shm_ring", snap, IPC_SAMPLE_RING_SIZE);
+        if (n <= 0) continue;
+        reads++;
+        for (int i = 0; i < n; i++) {
+            if (snap[i].iops != (double)snap[i].timestamp ||
+                snap[i].throughput_mbs != snap[i].timestamp * 2.0 ||
+                snap[i].timestamp_ns != (uint64_t)snap[i].timestamp * 1000) {
+                torn++;
+            }
+            if (i > 0 && snap[i].timestamp != snap[i - 1].timestamp + 1) {
+                unordered++;
+            }
+        }
+    }
+    pthread_join(writer, NULL);
+    
+    if (reads > 0 && torn == 0 && unordered == 0) {
+        printf("✓ %ld concurrent snapshots, none torn or out of order\n", reads);
+    } else {
+        printf("✗ %ld snapshots: %ld torn samples, %ld gaps\n", reads, torn, unordered);
+    }
+    
+    int n = ipc_samples_read("test_shm_ring", snap, 5);
+    if (n == 5 && snap[4].timestamp == SHM_TEST_PUBLISHES) {
+        printf("✓ Latest samples readable after the writer finished\n");
+    } else {
+        printf("✗ Read %d samples, newest %ld\n", n, n > 0 ? (long)snap[n - 1].timestamp : 0L);
+    }
+    
+    // Publicación real desde el thread del monitor
+    monitor_set_sample_hook(shm_publish_hook, NULL);
+    monitor_start_continuous_ms(100);
+    usleep(600000);
+    monitor_stop_continuous();
+    monitor_set_sample_hook(NULL, NULL);
+    
+    n = ipc_samples_read("/dev/loop0", snap, IPC_SAMPLE_RING_SIZE);
+    if (n > 0) {
+        printf("✓ Monitor thread published %d samples for loop0\n", n);
+    } else {
+        printf("✗ No samples published for loop0 (%d)\n", n);
+    }
+    if (ipc_samples_read("no_such_device", snap, 1) == -ENOENT) {
+        printf("✓ Unknown device reported as -ENOENT\n");
+    } else {
+        printf("✗ Unknown device not rejected\n");
+    }
+    
+    ipc_shm_cleanup();
+}
+
+void test_self_instrumentation(void) {
+    printf("\n=== Test 21: Self-Instrumentation and Overhead Budget ===\n");
+    
+    monitor_self_stats_t self;
+    monitor_start_continuous_ms(10);
+    usleep(1500000);
+    monitor_stop_continuous();
+    monitor_flush();
+    monitor_get_self_stats(&self);
+    
+    if (self.ticks > 0 && self.cpu_ms > 0 && self.parse_us > 0) {
+        printf("✓ %llu ticks, %.1f ms CPU, last tick %.1f us CPU / %.1f us parse\n",
+               (unsigned long long)self.ticks, self.cpu_ms, self.tick_cpu_us, self.parse_us);
+        printf("  Lateness %.3f ms (max %.3f), missed %llu, DB batch %.2f ms (max %.2f), dropped %llu\n",
+               self.lateness_ms, self.max_lateness_ms, (unsigned long long)self.missed_ticks,
+               self.db_write_ms, self.max_db_write_ms, self.samples_dropped);
+    } else {
+        printf("✗ Self stats not collected (%llu ticks)\n", (unsigned long long)self.ticks);
+    }
+    
+    // Presupuesto imposible de cumplir a 10 ms: el intervalo debe alargarse
+    monitor_config_t config;
+    monitor_config_defaults(&config);
+    config.overhead_budget_percent = 0.01;
+    monitor_cleanup();
+    if (monitor_init_with_config(&config) != 0) {
+        printf("✗ Failed to reinitialize monitor\n");
+        return;
+    }
+    monitor_start_continuous_ms(10);
+    usleep(2600000);
+    monitor_get_self_stats(&self);
+    monitor_stop_continuous();
+    
+    if (self.budget_floor_ms > 10 && self.interval_ms >= self.budget_floor_ms) {
+        printf("✓ %.2f%% CPU over a 0.01%% budget: interval raised to %d ms\n",
+               self.cpu_percent, self.interval_ms);
+    } else {
+        printf("✗ Budget not enforced (%.2f%% CPU, interval %d ms)\n",
+               self.cpu_percent, self.interval_ms);
+    }
+    
+    monitor_cleanup();
+    monitor_init();
+}
+
 void test_continuous_monitoring(void) {
-    printf("\n=== Test 5: Continuous Monitoring ===\n");
+    printf("\n=== Test 22: Continuous Monitoring ===\n");
     
     printf("Starting continuous monitoring for 15 seconds...\n");
     
@@ -107,6 +1084,125 @@ void test_continuous_monitoring(void) {
     }
 }
 
+#define TSDB_TEST_SAMPLES 40000
+
+static performance_sample_t tsdb_test_sample(time_t base, int i) {
+    // 100 ms entre muestras con algo de jitter, valores tipo iostat
+    uint64_t ns = (uint64_t)base * 1000000000ULL + (uint64_t)i * 100000000ULL +
+                  (uint64_t)((i * 7919) % 300) * 1000ULL;
+    performance_sample_t s = {
+        .timestamp = (time_t)(ns / 1000000000ULL), .timestamp_ns = ns,
+        .iops = 1200.0 + (i % 50) * 10.0, .throughput_mbs = 4.6875 + (i % 5) * 0.25,
+        .latency_ms = 0.5 + (i % 8) * 0.125, .active_requests = i % 4,
+        .read_latency_ms = 0.25, .write_latency_ms = 0.75 + (i % 3) * 0.5,
+        .util_percent = (i % 20) * 5.0, .avg_queue_size = 0.5 * (i % 6),
+        .interval_s = 0.1
+    };
+    return s;
+}
+
+static unsigned long long file_bytes(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (unsigned long long)st.st_blocks * 512 : 0;
+}
+
+void test_tsdb_backend(void) {
+    printf("\n=== Test 23: Compressed Time-Series Backend ===\n");
+    
+    const char *sqlite_path = "/tmp/storage_monitor_cmp.db";
+    monitor_config_t config;
+    time_t base = time(NULL) - 2 * 24 * 3600;
+    struct timespec t0, t1;
+    
+    system("rm -rf /tmp/storage_monitor_tsdb /tmp/storage_monitor_cmp.db*");
+    
+    // Misma carga en los dos backends para comparar espacio y tiempo
+    for (int backend = 0; backend < 2; backend++) {
+        monitor_config_defaults(&config);
+        strcpy(config.db_path, sqlite_path);
+        strcpy(config.tsdb_dir, "/tmp/storage_monitor_tsdb");
+        config.backend = backend ? MONITOR_BACKEND_TSDB : MONITOR_BACKEND_SQLITE;
+        config.queue_capacity = TSDB_TEST_SAMPLES;
+        config.flush_batch_size = TSDB_TEST_SAMPLES;
+        
+        if (monitor_init_with_config(&config) != 0) {
+            printf("✗ Failed to initialize %s backend\n", backend ? "TSDB" : "SQLite");
+            return;
+        }
+        
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (int i = 0; i < TSDB_TEST_SAMPLES; i++) {
+            performance_sample_t s = tsdb_test_sample(base, i);
+            monitor_save_sample("test_tsdb", &s);
+        }
+        monitor_flush();
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        double write_s = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        
+        performance_sample_t *samples = NULL;
+        int count = 0;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        monitor_get_history("test_tsdb", base, base + TSDB_TEST_SAMPLES / 10, &samples, &count);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        double read_s = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        
+        unsigned long long bytes;
+        if (backend) {
+            uint64_t disk = 0;
+            tsdb_usage(&disk, NULL);
+            bytes = disk;
+        } else {
+            bytes = file_bytes(sqlite_path) + file_bytes("/tmp/storage_monitor_cmp.db-wal");
+        }
+        printf("  %-6s: %d rows, write %.1f ms, read %.1f ms, %.1f bytes/sample\n",
+               backend ? "TSDB" : "SQLite", count, write_s * 1e3, read_s * 1e3,
+               count ? (double)bytes / count : 0.0);
+        
+        if (backend) {
+            int mismatches = count == TSDB_TEST_SAMPLES ? 0 : 1;
+            for (int i = 0; i < count && !mismatches; i++) {
+                performance_sample_t expect = tsdb_test_sample(base, i);
+                if (samples[i].timestamp != expect.timestamp ||
+                    samples[i].timestamp_ns / 1000 != expect.timestamp_ns / 1000 ||
+                    samples[i].iops != expect.iops ||
+                    samples[i].throughput_mbs != expect.throughput_mbs ||
+                    samples[i].write_latency_ms != expect.write_latency_ms ||
+                    samples[i].util_percent != expect.util_percent ||
+                    samples[i].avg_queue_size != expect.avg_queue_size ||
+                    samples[i].active_requests != expect.active_requests) {
+                    mismatches++;
+                }
+            }
+            if (mismatches == 0) {
+                printf("✓ All %d samples decoded exactly\n", count);
+            } else {
+                printf("✗ Decoded samples differ from the originals\n");
+            }
+            
+            free(samples);
+            monitor_get_history("test_tsdb", base + 100, base + 199, &samples, &count);
+            if (count == 1000) {
+                printf("✓ Range scan returned %d samples\n", count);
+            } else {
+                printf("✗ Range scan returned %d samples, expected 1000\n", count);
+            }
+            
+            // 40000 muestras ocupan dos segmentos: la retención borra el sellado
+            monitor_cleanup_old_data(1);
+            free(samples);
+            monitor_get_history("test_tsdb", base, base + TSDB_TEST_SAMPLES / 10, &samples, &count);
+            if (count > 0 && count < TSDB_TEST_SAMPLES) {
+                printf("✓ Retention dropped a whole segment (%d samples left)\n", count);
+            } else {
+                printf("✗ Retention left %d samples\n", count);
+            }
+        }
+        
+        free(samples);
+        monitor_cleanup();
+    }
+}
+
 int main(int argc, char *argv[]) {
     printf("\n");
     printf("╔════════════════════════════════════════╗\n");
@@ -128,13 +1224,33 @@ int main(int argc, char *argv[]) {
     // Ejecutar tests
     test_device_stats();
     test_disk_usage();
+    test_mount_cache();
+    test_open_files();
+    test_process_io();
     test_performance_tracking();
     test_history();
+    test_write_behind();
+    test_history_streaming();
+    test_partitioned_retention();
+    test_rollups();
+    test_report();
+    test_latency_histograms();
+    test_anomaly_detection();
+    test_concurrent_deltas();
+    test_multi_device_sampling();
+    test_device_hotplug();
+    test_high_resolution_sampling();
+    test_metrics_endpoint();
+    test_psi_adaptive_sampling();
+    test_shm_sample_rings();
+    test_self_instrumentation();
     test_continuous_monitoring();
     
     // Limpiar
     monitor_cleanup();
     
+    test_tsdb_backend();
+    
     printf("\n");
     printf("╔════════════════════════════════════════╗\n");
     printf("║  Monitor Tests Completed               ║\n");